@@ -0,0 +1,47 @@
+/**
+ * @file	clock.h
+ * @brief	Prototypes: System clock (PLL) configuration,
+ * 						clock constants for the drivers
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+
+/*
+ * The one clock configuration: every driver derives its prescalers and
+ * baud rate divisors from these, so changing them here is enough.
+ */
+#define HSI_HZ			16000000UL
+#define PLL_M			8				// VCO input = HSI / M = 2 MHz
+#define PLL_N			100				// VCO output = 200 MHz
+#define PLL_P			2				// SYSCLK = VCO / P
+#define PLL_Q			4				// 48 MHz domain, unused (no USB/SDIO)
+#define APB1_DIV		2				// APB1 may not exceed 50 MHz
+#define APB2_DIV		1
+#define FLASH_WS		3				// 90 < HCLK <= 100 MHz at 2.7-3.6 V
+
+#define SYSCLK_HZ		(HSI_HZ / PLL_M * PLL_N / PLL_P)
+#define HCLK_HZ			SYSCLK_HZ		// No AHB prescaling
+#define PCLK1_HZ		(HCLK_HZ / APB1_DIV)
+#define PCLK2_HZ		(HCLK_HZ / APB2_DIV)
+
+// Timers on a divided APB run at twice its clock
+#define TIM_APB1_HZ		((APB1_DIV == 1) ? PCLK1_HZ : (2 * PCLK1_HZ))
+#define TIM_APB2_HZ		((APB2_DIV == 1) ? PCLK2_HZ : (2 * PCLK2_HZ))
+
+// USART BRR for 16x oversampling, rounded to the nearest
+#define USART_BRR(pclk, baud)	(((pclk) + ((baud) / 2)) / (baud))
+
+#if (SYSCLK_HZ > 100000000UL) || (PCLK1_HZ > 50000000UL) || (PCLK2_HZ > 100000000UL)
+#error "Clock configuration exceeds the STM32F411 limits"
+#endif
+
+void Clock_Init(void);
+
+#endif // CLOCK_H
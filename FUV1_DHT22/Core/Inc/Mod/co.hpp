@@ -0,0 +1,258 @@
+/**
+ * @file	co.hpp
+ * @brief	C++20 coroutines for the drivers, alongside the protothreads
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The C++ flavour of Mod/pt.h, for code built as C++20 (GCC 10 or later,
+ * exceptions off). A co::task is a coroutine its caller steps, as it would
+ * a protothread, and it waits with co_await instead of the PT_ macros:
+ *
+ *	co::task blink(void) {
+ *		for (;;) {
+ *			GPIOB->ODR ^= 1;
+ *			co_await co::delay_ms(500);
+ *		}
+ *	}
+ *
+ *	co::task t = blink();
+ *	while (PT_SCHEDULE(t.step())) { ... }
+ *
+ * Its locals live in the coroutine frame, so unlike a protothread's they
+ * survive a wait, and it may wait anywhere, inside a switch included.
+ *
+ * It can wait on:
+ * 	- co::delay_us()/co::delay_ms(), on the TIM2 clock
+ * 	- co::until(), a condition checked at every step
+ * 	- co::yield(), the next step
+ * 	- another co::task, stepped to its end
+ * 	- co::protothread(), one of the drivers' protothreads (LCD_ClearPT(),
+ * 	  AT_CommandPT()...) stepped to its end
+ * step() returns the protothread codes, so both kinds share one loop, and
+ * until() is the deadline of the delay it waits on, for sleeping through.
+ *
+ * Frames come from a static pool of CO_FRAMES slots of CO_FRAME_BYTES, not
+ * the heap; a task whose frame does not fit is not valid() and is done at
+ * once.
+ */
+
+#ifndef CO_HPP
+#define CO_HPP
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+#include "Mod/pt.h"
+}
+
+#ifndef CO_FRAMES
+#define CO_FRAMES			8				// Tasks alive at once
+#endif
+#ifndef CO_FRAME_BYTES
+#define CO_FRAME_BYTES		256				// Largest frame (locals, awaiters, bookkeeping)
+#endif
+
+namespace co {
+
+namespace detail {
+
+// Frames without the heap: a slot per task alive
+struct pool {
+	alignas(std::max_align_t) static inline uint8_t slots[CO_FRAMES][CO_FRAME_BYTES];
+	static inline bool used[CO_FRAMES];
+
+	static void* take(std::size_t n) noexcept {
+		if (n > CO_FRAME_BYTES) {
+			return nullptr;
+		}
+		for (unsigned int i = 0; i < CO_FRAMES; i++) {
+			if (!used[i]) {
+				used[i] = true;
+				return slots[i];
+			}
+		}
+		return nullptr;
+	}
+
+	static void give(void* p) noexcept {
+		used[(static_cast<uint8_t*>(p) - &slots[0][0]) / CO_FRAME_BYTES] = false;
+	}
+};
+
+} // namespace detail
+
+
+class task {
+public:
+	struct promise_type {
+		uint64_t until = 0;					// (us) Deadline of the delay waited on
+		const uint64_t* wake = nullptr;		// ... or of a protothread's, if it is one
+		const task* child = nullptr;		// ... or of the task waited on
+		bool (*ready)(void* ctx) = nullptr;	// What it waits on is there; NULL: nothing but until
+		void* ready_ctx = nullptr;
+		bool yielded = false;
+
+		promise_type() noexcept {}			// GCC 12 skips the initializers above without it
+
+		task get_return_object() noexcept {
+			return task(handle::from_promise(*this));
+		}
+		static task get_return_object_on_allocation_failure() noexcept {
+			return task();
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept {}
+
+		static void* operator new(std::size_t n) noexcept { return detail::pool::take(n); }
+		static void operator delete(void* p) noexcept { detail::pool::give(p); }
+	};
+
+	using handle = std::coroutine_handle<promise_type>;
+
+	task() noexcept = default;
+	task(task&& other) noexcept : h(other.h) { other.h = nullptr; }
+	task& operator=(task&& other) noexcept {
+		if (this != &other) {
+			if (h) {
+				h.destroy();
+			}
+			h = other.h;
+			other.h = nullptr;
+		}
+		return *this;
+	}
+	task(const task&) = delete;
+	task& operator=(const task&) = delete;
+	~task() {
+		if (h) {
+			h.destroy();
+		}
+	}
+
+	bool valid() const { return static_cast<bool>(h); }
+	bool done() const { return !h || h.done(); }
+
+	int step() {
+		// Resume once, if what it waits on is there; PT_ codes, as a protothread returns
+		if (done()) {
+			return PT_ENDED;
+		}
+
+		promise_type& p = h.promise();
+		if ((p.wake == nullptr) && (now_us() < p.until)) {
+			return PT_WAITING;
+		}
+		if ((p.ready != nullptr) && !p.ready(p.ready_ctx)) {
+			return PT_WAITING;
+		}
+		p.until = 0;
+		p.wake = nullptr;
+		p.child = nullptr;
+		p.ready = nullptr;
+		p.yielded = false;
+		h.resume();
+		if (h.done()) {
+			return PT_ENDED;
+		}
+		return p.yielded ? PT_YIELDED : PT_WAITING;
+	}
+
+	uint64_t until() const {
+		// (us) When it next has something to do if it waits on a delay, else 0
+		if (done()) {
+			return 0;
+		}
+		const promise_type& p = h.promise();
+		if (p.child != nullptr) {
+			return p.child->until();
+		}
+		return (p.wake != nullptr) ? *p.wake : p.until;
+	}
+
+	// co_await on a task steps it to its end
+	struct awaiter {
+		task* t;
+
+		bool await_ready() noexcept { return t->step() == PT_ENDED; }
+		void await_suspend(handle h) noexcept {
+			h.promise().child = t;
+			h.promise().ready = [](void* ctx) { return static_cast<task*>(ctx)->step() == PT_ENDED; };
+			h.promise().ready_ctx = t;
+		}
+		void await_resume() noexcept {}
+	};
+
+	awaiter operator co_await() & noexcept { return awaiter{ this }; }
+	awaiter operator co_await() && noexcept { return awaiter{ this }; }
+
+private:
+	explicit task(handle h) noexcept : h(h) {}
+
+	handle h = nullptr;
+};
+
+
+struct delay_us {
+	uint64_t us;
+
+	explicit delay_us(uint64_t us) noexcept : us(us) {}
+	bool await_ready() const noexcept { return us == 0; }
+	void await_suspend(task::handle h) const noexcept { h.promise().until = now_us() + us; }
+	void await_resume() const noexcept {}
+};
+
+
+inline delay_us delay_ms(uint32_t ms) noexcept {
+	return delay_us(static_cast<uint64_t>(ms) * 1000);
+}
+
+
+struct yield {
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(task::handle h) const noexcept { h.promise().yielded = true; }
+	void await_resume() const noexcept {}
+};
+
+
+template <typename F>
+struct until {
+	F cond;								// bool(), checked at every step
+
+	explicit until(F cond) noexcept : cond(cond) {}
+	bool await_ready() { return cond(); }
+	void await_suspend(task::handle h) noexcept {
+		h.promise().ready = [](void* ctx) -> bool { return static_cast<until*>(ctx)->cond(); };
+		h.promise().ready_ctx = this;
+	}
+	void await_resume() noexcept {}
+};
+
+
+template <typename F>
+struct protothread {
+	F thread;							// int(pt_t*): a protothread with its arguments bound
+	pt_t pt;
+
+	explicit protothread(F thread) noexcept : thread(thread) { PT_INIT(&pt); }
+	bool await_ready() { return !PT_SCHEDULE(thread(&pt)); }
+	void await_suspend(task::handle h) noexcept {
+		h.promise().wake = &pt.until;
+		h.promise().ready = [](void* ctx) -> bool {
+			protothread* self = static_cast<protothread*>(ctx);
+			return !PT_SCHEDULE(self->thread(&self->pt));
+		};
+		h.promise().ready_ctx = this;
+	}
+	void await_resume() noexcept {}
+};
+
+} // namespace co
+
+#endif // CO_HPP
@@ -15,11 +15,14 @@
 
 #include "stm32f4xx.h"                  // Device header
 #include <stdint.h>
+#include <stdbool.h>
+#include "Mod/pt.h"
 
 void dht22_PinA8_Init(void);
 void dht22_start(void);
 int Check_Response(void);
 uint8_t DHT22_Read (void);
-void Get_DHT_Data(float * TEMP, float *RH);
+bool Get_DHT_Data(float * TEMP, float *RH);
+int DHT22_MeasurePT(pt_t* pt, float* temp, float* rh, bool* ok);
 
 #endif /* DHT22_H */
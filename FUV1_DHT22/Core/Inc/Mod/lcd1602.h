@@ -16,6 +16,7 @@
 #include "stm32f4xx.h"                  // Device header
 #include <stdint.h>
 #include <stdbool.h>
+#include "Mod/pt.h"
 
 extern uint8_t displayfunction;
 extern uint8_t displaycontrol;
@@ -24,7 +25,9 @@ extern uint8_t backlightval;
 extern uint8_t numlines;
 
 void LCD_Init(void);
+int LCD_InitPT(pt_t* pt);
 void LCD_Begin(uint8_t cols, uint8_t lines, uint8_t dotsize);
+int LCD_BeginPT(pt_t* pt, uint8_t cols, uint8_t lines, uint8_t dotsize);
 void LCD_SendCommand(uint8_t command);
 void LCD_Send(uint8_t value, uint8_t mode);
 void LCD_Write4Bits(uint8_t value);
@@ -34,6 +37,7 @@ void LCD_Display(void);
 void LCD_Home(void);
 void LCD_SetCursor(uint8_t col, uint8_t row);
 void LCD_Clear(void);
+int LCD_ClearPT(pt_t* pt);
 void LCD_SendString(const char *str, uint8_t row, uint8_t col, bool clear);
 void LCD_ClearRow(uint8_t row);
 
@@ -0,0 +1,72 @@
+/**
+ * @file	prof.h
+ * @brief	Prototypes: DWT cycle counter profiling zones
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * PROF_ZONE(zone) at the top of a block times it, in core cycles, until the
+ * block is left by any path. A zone that ends elsewhere, such as in the
+ * interrupt that completes what the block started, is timed with
+ * PROF_OPEN()/PROF_CLOSE() on a static prof_scope_t instead. Each zone keeps
+ * a count, the min and max, and a histogram with one bucket per power of
+ * two. Send 'p' on USART2 to have
+ * the table printed (see Prof_Poll()), 'r' to clear it.
+ *
+ * Only Debug builds (DEBUG defined) profile; otherwise the zones and the
+ * table compile to nothing.
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+
+typedef enum {
+	PROF_LOOP = 0,						// Main loop work, sleep excluded
+	PROF_LM35,							// LM35_GetVal()
+	PROF_MQ2,							// MQ2_GetPPM()
+	PROF_DHT22,							// Get_DHT_Data()
+	PROF_LCD_STRING,					// LCD_SendString()
+	PROF_I2C_WRITE,						// I2C_Write()
+	PROF_ESP_SEND,						// usart1_tx_start() to DMA transfer complete
+	PROF_ZONES
+} prof_zone_t;
+
+#define PROF_BUCKETS	24				// Bucket n: 2^n to 2^(n+1)-1 cycles; the last takes the rest
+
+#ifdef DEBUG
+
+typedef struct {
+	uint8_t zone;
+	uint32_t start;						// DWT->CYCCNT on entry
+} prof_scope_t;
+
+void Prof_Leave(prof_scope_t* scope);
+void Prof_Dump(void);
+void Prof_Reset(void);
+void Prof_Poll(void);
+
+// One per block; recorded when the block is left
+#define PROF_ZONE(zone)		prof_scope_t prof_scope __attribute__((cleanup(Prof_Leave))) = \
+								{ (zone), DWT->CYCCNT }
+
+// Across functions or into an interrupt; one transfer in flight per scope
+#define PROF_OPEN(scope, z)	do { (scope).zone = (z); (scope).start = DWT->CYCCNT; } while (0)
+#define PROF_CLOSE(scope)	Prof_Leave(&(scope))
+
+#else
+
+#define PROF_ZONE(zone)		do {} while (0)
+#define PROF_OPEN(scope, z)	do {} while (0)
+#define PROF_CLOSE(scope)	do {} while (0)
+#define Prof_Dump()			do {} while (0)
+#define Prof_Reset()		do {} while (0)
+#define Prof_Poll()			do {} while (0)
+
+#endif // DEBUG
+
+#endif // PROF_H
@@ -0,0 +1,35 @@
+/**
+ * @file	sampler.h
+ * @brief	Prototypes: Timer 3 (TIM3) fixed-rate sampling,
+ * 						timestamped sample queue
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SAMPLER_QUEUE		64			// Samples in flight; a power of two
+#define SAMPLER_VALUES		2			// Values per sample (DHT22: temperature, humidity)
+#define SAMPLER_PERIOD_MIN	1			// (ms) Fastest rate: the tick reads the ADC in the interrupt
+#define SAMPLER_PERIOD_MAX	32767		// (ms) Slowest rate TIM3 can count to
+
+typedef struct {
+	uint64_t t_us;						// now_us() when the sample was taken; for the tick, the TIM3 update
+	int32_t value[SAMPLER_VALUES];		// Sensor units, set by the producer
+} sample_t;
+
+// Called from the TIM3 interrupt every period, with the time of the update that raised it
+typedef void (*sampler_tick_t)(uint64_t t_us);
+
+void Sampler_Init(uint32_t period_ms, sampler_tick_t tick);
+bool Sampler_Push(const sample_t* s);
+bool Sampler_Pop(sample_t* s);
+uint32_t Sampler_Dropped(void);
+
+#endif // SAMPLER_H
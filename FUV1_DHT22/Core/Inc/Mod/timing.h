@@ -1,8 +1,8 @@
 /**
  * @file	timing.h
  * @brief	Prototypes: Independent Watchdog (IWDG),
- * 						System tick timer (SysTick),
- * 						Timer 2 (TIM2) libary
+ * 						Timer 2 (TIM2) microsecond clock,
+ * 						Sleep/Stop mode libary
  *
  * @author	Nathaniel Renz C. Domingo <ncdomingo1@up.edu.ph>
  * @date	9 June 2024
@@ -17,16 +17,47 @@
 
 #include "stm32f4xx.h"                  // Device header
 #include <stdint.h>
+#include <stdbool.h>
 
+/*
+ * Waits on time go through delay_until()/idle_until(), and waits on a
+ * hardware flag through SPIN_WHILE(), so each has one place to hook.
+ * An off-target build (simulated register file, virtual clock, see Host/)
+ * defines SPIN_SYNC() to bring its peripheral models up to date with what
+ * was written, and SPIN_HOOK() to also let time pass; on the target both
+ * are empty.
+ */
+#ifndef SPIN_SYNC
+#define SPIN_SYNC()			do {} while (0)
+#endif
+#ifndef SPIN_HOOK
+#define SPIN_HOOK()			do {} while (0)
+#endif
+#define SPIN_WHILE(cond)	do { SPIN_SYNC(); while (cond) { SPIN_HOOK(); } } while (0)
 
-extern volatile int millis;
+/*
+ * The F411's flash is a single bank: while a sector is erased (see
+ * flashlog.c) every fetch from it stalls, code and constants alike. The
+ * interrupt handlers that must keep running meanwhile, and everything they
+ * call, are marked RAMFUNC; the startup code copies .RamFunc into RAM with
+ * .data. They keep clear of libgcc (64-bit division) and of const tables.
+ */
+#ifndef RAMFUNC
+#define RAMFUNC				__attribute__((section(".RamFunc")))
+#endif
 
 void IWDG_Init(void);
 void IWDG_Refresh(void);
-void SysTick_Init(void);
 void TIM2_Init(void);
+uint64_t now_us(void);
+uint32_t now_ms(void);				// Wraps after ~49.7 days; compare by difference
+void delay_until(uint64_t deadline_us);
+void idle_until(uint64_t deadline_us);
 void delayuS(uint32_t us);
 void delaymS(uint32_t ms);
+void Stop_Init(void);
+void stop_until(uint64_t deadline_us);
+void Duty_Read(uint32_t* run_ms, uint32_t* sleep_ms);
 
 #endif // TIMING_H
 
@@ -15,14 +15,38 @@
 #define USART1_H
 
 #include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
 #include <stdbool.h>
+#include "Mod/pt.h"
+
+// Value for a ThingSpeak field in hundredths, e.g. 2315 is sent as 23.15
+typedef struct {
+	uint8_t field;
+	int32_t centi;
+} ts_field_t;
+
+// Rounds a float reading to hundredths for ts_field_t
+#define TS_CENTI(x)		((int32_t)((x) * 100.0f + (((x) < 0) ? -0.5f : 0.5f)))
+
+// Or'ed into a ThingSpeak_AddSample() field: the value is in hundredths
+#define TS_FIELD_CENTI	0x80
 
 void usart1_Init(void);
 int usart1_tx_send(int c);
-void sendESP_NoResponse(const char* s);
-bool sendESP(const char* s, const char* response);
+bool usart1_tx_start(const void* buf, uint16_t len);
+bool usart1_tx_busy(void);
+bool usart1_rx_read(uint8_t* c);
 void WiFi_Init(void);
-void sendThingSpeak(int val, int field);
+int WiFi_InitPT(pt_t* pt);
+bool sendThingSpeak(int val, int field);
+bool sendThingSpeakFields(const ts_field_t* fields, uint8_t count);
+bool ThingSpeak_Busy(void);
+uint32_t ThingSpeak_Completed(void);
+void ThingSpeak_Poll(void);
+void ThingSpeak_PollFor(uint32_t ms);
+bool ThingSpeak_AddSample(int val, int field);
+uint16_t ThingSpeak_Pending(void);
+bool ThingSpeak_BulkUpload(void);
 
 #endif // USART1_H
 
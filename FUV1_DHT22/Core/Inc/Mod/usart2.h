@@ -15,9 +15,12 @@
 #define USART2_H
 
 #include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
 
 void usart2_Init(void);
 int usart2_tx_send(int c);
+bool usart2_rx_read(uint8_t* c);
 void serialPrint(const char* s);
 
 #endif // USART2_H
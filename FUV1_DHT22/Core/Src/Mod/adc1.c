@@ -12,10 +12,13 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *	- Inputs:
- * 		- ADC Analog @ PA1 (Channel 1)
+ * 		- ADC Analog @ PA1 (Channel 1); the channels are set by ADC_SENSOR_CH
+ * 		- VREFINT (Channel 17) and the temperature sensor (Channel 18)
+ *	- TIM5 CC1 triggers each conversion (ADC_RATE_MIN..ADC_RATE_MAX)
+ *	- DMA2 Stream 0, Channel 0 (ADC1), circular
  *
  * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
  * 	 		This allows register names to be used without regard to the exact
@@ -23,60 +26,315 @@
  */
 
 #include "Mod/adc1.h"
+#include "Mod/clock.h"
+#include "Mod/prof.h"
 #include <Mod/timing.h>
-#include <math.h>				// For pow()
+#include <Mod/pt.h>
+
+/*
+ * TIM5 starts one conversion per period, so the sample spacing is set by
+ * the timer rather than by whoever reads the result, and DMA fills adc_buf
+ * round and round. Each half is a block of ADC_BLOCK conversions; the
+ * half-transfer and transfer-complete interrupts hand the block just
+ * filled to ADC_Block() while DMA fills the other half, so the processing
+ * cost is per block, not per sample. ADC_Block() sums the block (a boxcar
+ * filter) and decimates it by 2^ADC_OSR_BITS: summing 4^n samples and
+ * dropping n bits gives n bits more than the hardware (the noise dithers
+ * the input). The getters only read the last block's result; thresholds
+ * are applied to it by the caller.
+ *
+ * A block that DMA has already started to overwrite by the time it is
+ * processed is counted as an overrun.
+ *
+ * ADC_BlockTime() is when the last block's first scan was triggered, for
+ * the age of the data a caller acts on. TIM5 and TIM2 (now_us()) count
+ * from the same clock, so the blocks fall on a grid from the time TIM5 was
+ * started; ADC_Block() takes the newest block complete on the grid, or the
+ * one before it if that is the half it was handed.
+ *
+ * Each trigger converts the whole regular sequence: the sensor channels,
+ * then VREFINT and the temperature sensor, so DMA interleaves them and a
+ * block holds ADC_BLOCK scans. VREFINT against its factory calibration
+ * (taken at VDDA = 3.3 V) gives the actual VDDA, and the readings are
+ * scaled by it rather than assuming 3.3 V, so a supply droop while the
+ * ESP8266 transmits does not show up as a change at the sensor.
+ */
+
+#define ADC_DIV		4					// ADCCLK = PCLK2 / 4 = 25 MHz
+#define ADC_BLOCK	(1U << (2 * ADC_OSR_BITS))	// Conversions per block: 4^ADC_OSR_BITS
+#define ADC_VREF_MV	3300				// (mV) ADC supply/reference
+#define ADC_TIM_HZ	1000000				// TIM5 count rate; ARR spans 1 Hz at 32 bits
+#define ADC_EXTSEL_TIM5_CC1	10			// CR2 EXTSEL code for the TIM5 CC1 event
+#define ADC_CH_VREFINT	17
+#define ADC_CH_TEMP		18
+#define ADC_SMP_480		7				// SMPRx code: 480 cycles, >= 10 us for VREFINT/temperature
+
+// Factory calibration (RM0383/datasheet), taken at VDDA = 3.3 V, 12 bits
+#define ADC_VREFINT_CAL	(*(const uint16_t*)0x1FFF7A2A)
+#define ADC_TS_CAL1		(*(const uint16_t*)0x1FFF7A2C)	// At 30 Celsius
+#define ADC_TS_CAL2		(*(const uint16_t*)0x1FFF7A2E)	// At 110 Celsius
+
+#if (PCLK2_HZ / ADC_DIV) > 36000000UL
+#error "ADCCLK above 36 MHz; raise ADC_DIV"
+#endif
+
+// Regular sequence, one scan per trigger
+static const uint8_t adc_seq[] = { ADC_SENSOR_CH, ADC_CH_VREFINT, ADC_CH_TEMP };
+
+#define ADC_SCAN		(sizeof(adc_seq))
+#define ADC_SLOT_VREFINT	(ADC_SCAN - 2)
+#define ADC_SLOT_TEMP	(ADC_SCAN - 1)
+
+_Static_assert(ADC_SCAN <= 5, "a scan must fit in 1 / ADC_RATE_MAX; drop sensor channels");
+_Static_assert(LM35_SLOT < ADC_SENSORS, "LM35_SLOT is past the end of ADC_SENSOR_CH");
+
+static uint16_t adc_buf[2 * ADC_BLOCK * ADC_SCAN];	// Two halves, written by DMA2 Stream 0
+static volatile uint16_t adc_value[ADC_SCAN];	// Last block per slot, ADC_BITS wide
+static volatile uint32_t adc_vdda_mv = ADC_VREF_MV;	// From VREFINT, the last block
+static uint32_t adc_vrefint_cal;		// ADC_VREFINT_CAL, in RAM for ADC_Block()
+static volatile uint32_t adc_blocks = 0;	// Blocks decimated so far
+static volatile uint32_t adc_overruns = 0;	// Blocks overwritten before they were processed
+static volatile uint64_t adc_block_us = 0;	// now_us() at the first trigger of the last block
+static uint64_t adc_next_us;			// First trigger of the next block to complete
+static uint32_t adc_grid;				// Blocks complete on the grid so far
+static uint32_t adc_period_us;			// Between triggers
+
+static void ADC_Timer(uint32_t rate_hz);
+
+
+void ADC_Init(uint32_t rate_hz) {
+	// Scan adc_seq rate_hz times a second, clamped to ADC_RATE_MIN..ADC_RATE_MAX
+	if (rate_hz < ADC_RATE_MIN) {
+		rate_hz = ADC_RATE_MIN;
+	}
+	if (rate_hz > ADC_RATE_MAX) {
+		rate_hz = ADC_RATE_MAX;
+	}
 
-void ADC_Init(void) {
 	// Enable clocks
 	RCC->APB2ENR |= (1 << 8);			// Enable ADC1 clock
 	RCC->AHB1ENR |= (1 << 0);			// Enable GPIOA clock
 
-	// Configure GPIOA pin PA1 for ADC
-	GPIOA->MODER &= ~(3 << 2);			// Clear mode bits
-	GPIOA->MODER |= (3 << 2);			// Analog Mode
+	// Sensor channels 0..7 are PA0..PA7: analog mode
+	for (uint32_t i = 0; i < ADC_SLOT_VREFINT; i++) {
+		if (adc_seq[i] < 8) {
+			GPIOA->MODER |= (3UL << (2 * adc_seq[i]));
+		}
+	}
 
 	// ADC Configuration
-	ADC->CCR &= ~(3 << 16);				// Prescaler = 2
+	ADC->CCR = (ADC->CCR & ~ADC_CCR_ADCPRE) | (((ADC_DIV / 2) - 1) << ADC_CCR_ADCPRE_Pos);
+	ADC->CCR |= ADC_CCR_TSVREFE;		// Wake VREFINT and the temperature sensor
+	adc_vrefint_cal = ADC_VREFINT_CAL;	// System memory stalls with the flash during an erase
 	ADC1->CR1 &= ~(3 << 24);			// 12-bit resolution conversion
 	ADC1->CR1 |= (1 << 8);				// Enable scan mode
-	ADC1->CR1 |= (1 << 5);				// Generate interrupt when the EOC bit is set
+	ADC1->CR1 &= ~(1 << 5);				// No EOC interrupt; DMA takes each result
 
-	// 15 cycles sampling time for Channel 1
-	ADC1->SMPR2 &= ~(1 << 5);
-	ADC1->SMPR2 &= ~(1 << 4);
-	ADC1->SMPR2 |= (1 << 3);
+	// 480 cycles sampling time for every channel in the scan (~19.7 us a conversion)
+	for (uint32_t i = 0; i < ADC_SCAN; i++) {
+		if (adc_seq[i] < 10) {
+			ADC1->SMPR2 |= (ADC_SMP_480 << (3 * adc_seq[i]));
+		} else {
+			ADC1->SMPR1 |= (ADC_SMP_480 << (3 * (adc_seq[i] - 10)));
+		}
+	}
 
 	ADC1->CR2 &= ~(1 << 10);			// EOC bit is set at the end of each sequence of regular conversions
 	ADC1->CR2 &= ~(1 << 11);			// Right allignment for data
 
-	// 1 conversion in the regular channel conversion sequence
-	ADC1->SQR1 &= ~(1 << 23);
-	ADC1->SQR1 &= ~(1 << 22);
-	ADC1->SQR1 &= ~(1 << 21);
-	ADC1->SQR1 &= ~(1 << 20);
+	// ADC_SCAN conversions in the regular sequence, in adc_seq order (SQ1..SQ5 are in SQR3)
+	ADC1->SQR1 = (ADC_SCAN - 1) << ADC_SQR1_L_Pos;
+	ADC1->SQR2 = 0;
+	ADC1->SQR3 = 0;
+	for (uint32_t i = 0; i < ADC_SCAN; i++) {
+		ADC1->SQR3 |= (uint32_t)adc_seq[i] << (5 * i);
+	}
+	ADC1->CR2 &= ~(1 << 1);				// One scan per trigger
 
-	ADC1->SQR3 |= (1 << 0);				// Assign channel 1 as the 1st in the sequence to be converted
-	ADC1->CR2 |= (1 << 1);				// Continuous conversion mode
+	// Trigger on the rising edge of TIM5 CC1
+	ADC1->CR2 = (ADC1->CR2 & ~(ADC_CR2_EXTSEL | ADC_CR2_EXTEN))
+			| (ADC_EXTSEL_TIM5_CC1 << ADC_CR2_EXTSEL_Pos) | ADC_CR2_EXTEN_0;
+
+	// DMA2 Stream 0 (channel 0 is ADC1): half-words into adc_buf, circular
+	RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+	DMA2_Stream0->CR = 0;
+	SPIN_WHILE(DMA2_Stream0->CR & DMA_SxCR_EN);
+	DMA2->LIFCR = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0
+			| DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;		// Clear stale flags
+	DMA2_Stream0->PAR = (uint32_t)&ADC1->DR;
+	DMA2_Stream0->M0AR = (uint32_t)adc_buf;
+	DMA2_Stream0->NDTR = 2 * ADC_BLOCK * ADC_SCAN;
+	DMA2_Stream0->CR = (0U << DMA_SxCR_CHSEL_Pos)		// Channel 0: ADC1
+			| DMA_SxCR_PL_1								// High priority
+			| DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0		// 16-bit both sides
+			| DMA_SxCR_MINC | DMA_SxCR_CIRC
+			| DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+	DMA2_Stream0->CR |= DMA_SxCR_EN;
+	NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+	ADC1->CR2 |= ADC_CR2_DMA | ADC_CR2_DDS;	// A DMA request per conversion, without end
+
+	// Power the ADC up once; TIM5 starts each conversion from here on
+	ADC1->CR2 |= (1 << 0); 				// Enable the ADC
+	delaymS(1); 						// Required to ensure adc stable
+	ADC_Timer(rate_hz);
+}
+
+
+static void ADC_Timer(uint32_t rate_hz) {
+	// TIM5 in PWM mode 1: OC1REF rises at every update, one CC1 event a period
+	RCC->APB1ENR |= RCC_APB1ENR_TIM5EN;
+
+	TIM5->CR1 &= ~TIM_CR1_CEN;
+	TIM5->PSC = (TIM_APB1_HZ / ADC_TIM_HZ) - 1;
+	TIM5->ARR = (ADC_TIM_HZ / rate_hz) - 1;
+	TIM5->CCR1 = (TIM5->ARR + 1) / 2;
+	TIM5->CCMR1 = (TIM5->CCMR1 & ~(TIM_CCMR1_OC1M | TIM_CCMR1_CC1S)) | (6U << TIM_CCMR1_OC1M_Pos);
+	TIM5->CCER |= TIM_CCER_CC1E;					// The ADC sees the event only with CC1 enabled; PA0 stays GPIO
+	TIM5->CNT = 0;
+	TIM5->EGR = TIM_EGR_UG;							// Load PSC now rather than at the first overflow
+
+	// TIM5 counts in microseconds; the first trigger is at CCR1
+	adc_period_us = TIM5->ARR + 1;
+	adc_grid = 0;
+	adc_next_us = now_us() + TIM5->CCR1;
+	TIM5->CR1 |= TIM_CR1_CEN;
 }
 
 
-float LM35_GetVal(void) {
-	ADC1->CR2 |= (1 << 0); 					// Enable the ADC
-	delaymS(1); 							// Required to ensure adc stable
-	ADC1->CR2 |= (1 << 30); 				// Start ADC conversion
-	while (!((ADC1->SR) & (1 << 1))); 		// Wait for the end of conversion
-	uint16_t adc_val = ADC1->DR;			// Store ADC value
+RAMFUNC static void ADC_Stamp(bool second) {
+	// When the block in the given half began; see ADC_BlockTime()
+	uint32_t block_us = ADC_BLOCK * adc_period_us;
+	uint64_t now = now_us();
+
+	// Complete once its last scan has been triggered
+	while (now >= adc_next_us + block_us - adc_period_us) {
+		adc_next_us += block_us;
+		adc_grid++;
+	}
+	// The newest, number adc_grid - 1, went into the first half if even
+	bool newest_second = ((adc_grid - 1) & 1) != 0;
+	adc_block_us = adc_next_us - ((newest_second == second) ? 1 : 2) * (uint64_t)block_us;
+}
+
+
+RAMFUNC static void ADC_Block(const uint16_t* block, bool second) {
+	// Processing stage: filter and decimate one block (4^n scans, n extra bits)
+	uint32_t sum[ADC_SCAN] = { 0 };
+
+	for (uint32_t i = 0; i < ADC_BLOCK; i++) {
+		for (uint32_t j = 0; j < ADC_SCAN; j++) {
+			sum[j] += *block++;
+		}
+	}
+
+	// DMA should still be in the other half; if not, this block was being overwritten
+	if ((DMA2_Stream0->NDTR > (ADC_BLOCK * ADC_SCAN)) != second) {
+		adc_overruns++;
+	}
+	for (uint32_t j = 0; j < ADC_SCAN; j++) {
+		adc_value[j] = sum[j] >> ADC_OSR_BITS;
+	}
+
+	// VDDA = 3.3 V × VREFINT_CAL / VREFINT, kept within the part's 1.7..3.6 V
+	uint32_t vref = adc_value[ADC_SLOT_VREFINT];
+	uint32_t vdda = vref ? ((ADC_VREF_MV * (adc_vrefint_cal << ADC_OSR_BITS)) + (vref / 2)) / vref
+			: ADC_VREF_MV;
+
+	adc_vdda_mv = (vdda < 1700) ? 1700 : ((vdda > 3600) ? 3600 : vdda);
+	ADC_Stamp(second);
+	adc_blocks++;
+}
+
+
+RAMFUNC void DMA2_Stream0_IRQHandler(void) {
+	uint32_t lisr = DMA2->LISR;
+
+	if ((lisr & DMA_LISR_HTIF0) && (lisr & DMA_LISR_TCIF0)) {
+		adc_overruns++;								// Both halves done: one was never processed in time
+	}
+	if (lisr & DMA_LISR_HTIF0) {
+		DMA2->LIFCR = DMA_LIFCR_CHTIF0;
+		ADC_Block(&adc_buf[0], false);				// DMA is now filling the second half
+	}
+	if (lisr & DMA_LISR_TCIF0) {
+		DMA2->LIFCR = DMA_LIFCR_CTCIF0;
+		ADC_Block(&adc_buf[ADC_BLOCK * ADC_SCAN], true);
+	}
+	if (lisr & DMA_LISR_TEIF0) {
+		DMA2->LIFCR = DMA_LIFCR_CTEIF0;
+	}
+}
+
+
+void ADC_Stats(uint32_t* blocks, uint32_t* overruns) {
+	*blocks = adc_blocks;
+	*overruns = adc_overruns;
+}
+
+
+RAMFUNC uint16_t ADC_Read(int slot) {
+	// The last block of ADC_SENSOR_CH[slot], ADC_BITS wide; 0 until the first block is in
+	if ((slot < 0) || (slot >= (int)ADC_SLOT_VREFINT)) {
+		return 0;
+	}
+	return adc_value[slot];
+}
+
+
+RAMFUNC uint64_t ADC_BlockTime(void) {
+	// now_us() when the last block's first scan was triggered; 0 until the first block is in
+	return adc_block_us;
+}
+
+
+RAMFUNC uint32_t ADC_VddaMV(void) {
+	// (mV) Supply/reference measured through VREFINT
+	return adc_vdda_mv;
+}
+
+
+int32_t ADC_ChipTemp(void) {
+	// (0.01 Celsius) Die temperature, on the line through the two factory points
+	int32_t ts = (int32_t)((adc_value[ADC_SLOT_TEMP] * adc_vdda_mv) / ADC_VREF_MV);	// As at 3.3 V
+	int32_t cal1 = (int32_t)ADC_TS_CAL1 << ADC_OSR_BITS;
+	int32_t cal2 = (int32_t)ADC_TS_CAL2 << ADC_OSR_BITS;
+
+	if (cal2 == cal1) {
+		return 0;
+	}
+	return 3000 + (8000 * (ts - cal1)) / (cal2 - cal1);
+}
+
+
+RAMFUNC int32_t LM35_GetVal(void) {
+	PROF_ZONE(PROF_LM35);
+
+	uint32_t adc_val = ADC_Read(LM35_SLOT);	// Oversampled, ADC_BITS wide
 
 	/*
 	 * 	As per LM35 datasheet,
 	 * 	  	       	V = 10 mv/°C × T
 	 *
-	 *	For a 12-bit ADC and an ADC power supply of 3.3V,
-	 *	   	adc_value = (V_in × (2^12)) / 3.3
-	 *	   	adc_value = ((0.01 × T) × (2^12)) / 3.3
-	 *	   	       	T = (adc_value * 3.3) / ((2^12) × 0.01)
+	 *	For an n-bit (oversampled) ADC and an ADC supply of VDDA mV,
+	 *	   	adc_value = (V_in × (2^n)) / VDDA
+	 *	   	    100 T = adc_value × (VDDA × 10) / (2^n)		(0.01 Celsius)
+	 *
+	 *	VDDA × 10 is the scale in Q(n): one multiply and a rounding shift,
+	 *	no float or pow(). VDDA comes from VREFINT (3300 mV if it were ideal).
 	 */
 
-	float temperature = ((adc_val * 3.3) / pow(2, 12)) * 100;
-	return temperature; 	// Read the value contained at the data register
+	return (int32_t)((adc_val * (ADC_VddaMV() * 10UL) + (1UL << (ADC_BITS - 1))) >> ADC_BITS);
+}
+
+
+int ADC_ReadPT(pt_t* pt, int slot, uint16_t* raw) {
+	// Wait for the next block as a protothread; one caller at a time
+	static uint32_t seen;
+
+	PT_BEGIN(pt);
+	seen = adc_blocks;
+	PT_WAIT_UNTIL(pt, adc_blocks != seen);
+	*raw = ADC_Read(slot);
+	PT_END(pt);
 }
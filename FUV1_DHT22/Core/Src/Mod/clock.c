@@ -0,0 +1,70 @@
+/**
+ * @file	clock.c
+ * @brief	Library code: System clock (PLL) configuration
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * System configuration/build:
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
+ *
+ * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
+ * 	 		This allows register names to be used without regard to the exact
+ * 	 		addresses.
+ */
+
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+
+
+static uint32_t Clock_APBBits(uint32_t div) {
+	// PPREx field: 0xx = /1, 100 = /2, 101 = /4, 110 = /8, 111 = /16
+	uint32_t bits = 0;
+
+	while (div > 1) {
+		div >>= 1;
+		bits = (bits == 0) ? 4 : (bits + 1);
+	}
+	return bits;
+}
+
+void Clock_Init(void) {
+	/*
+	 * Run SYSCLK from the PLL at SYSCLK_HZ. Also called after Stop mode,
+	 * which leaves the core on the HSI with the PLL off.
+	 */
+	if ((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL) {
+		return;
+	}
+
+	// 100 MHz needs regulator scale 1
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR |= PWR_CR_VOS;
+
+	// Wait states before the clock goes up; prefetch and the ART caches hide them
+	FLASH->ACR = FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN | (FLASH_WS << FLASH_ACR_LATENCY_Pos);
+	SPIN_WHILE((FLASH->ACR & FLASH_ACR_LATENCY) != (FLASH_WS << FLASH_ACR_LATENCY_Pos));
+
+	// PLL from the HSI (PLLSRC = 0)
+	RCC->CR &= ~RCC_CR_PLLON;
+	SPIN_WHILE(RCC->CR & RCC_CR_PLLRDY);
+	RCC->PLLCFGR = (PLL_M << RCC_PLLCFGR_PLLM_Pos)
+			| (PLL_N << RCC_PLLCFGR_PLLN_Pos)
+			| (((PLL_P / 2) - 1) << RCC_PLLCFGR_PLLP_Pos)
+			| (PLL_Q << RCC_PLLCFGR_PLLQ_Pos);
+	RCC->CR |= RCC_CR_PLLON;
+	SPIN_WHILE((RCC->CR & RCC_CR_PLLRDY) == 0);
+	SPIN_WHILE((PWR->CSR & PWR_CSR_VOSRDY) == 0);
+
+	// Bus prescalers, then the switch
+	RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2))
+			| (Clock_APBBits(APB1_DIV) << RCC_CFGR_PPRE1_Pos)
+			| (Clock_APBBits(APB2_DIV) << RCC_CFGR_PPRE2_Pos);
+	RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+	SPIN_WHILE((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+
+	SystemCoreClock = HCLK_HZ;
+}
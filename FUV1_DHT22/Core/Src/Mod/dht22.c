@@ -12,8 +12,8 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *	- DHT22 Pins (Bidirectional):
  * 		- data feed in & out @ PB8
  *
@@ -24,26 +24,38 @@
 
 #include "Mod/dht22.h"
 #include "Mod/timing.h"
+#include "Mod/pt.h"
+#include "Mod/prof.h"
+
+#define DHT22_GAP_US	2000000		// Datasheet: at least 2 s between readings
 
 void dht22_PinA8_Init(void){
 	// Enable GPIOA clock
 	RCC->AHB1ENR |= (1 << 0);
 }
 
-void dht22_start(void){
+static void dht22_hold_low(void){
 	/*Set PA8 as output*/
 	GPIOA->MODER |= (1 << 16);
 	GPIOA->MODER &= ~(1 << 17);
 
 	/*Set the pin low*/
 	GPIOA->BSRR = (1 << 24);
+}
+
+static void dht22_release(void){
+	/*Set the pin to input*/
+	GPIOA->MODER &= ~(3 << 16);
+}
+
+void dht22_start(void){
+	dht22_hold_low();
 
 	/*Wait for 18ms*/
 
 	delaymS(18);
 
-	/*Set the pin to input*/
-	GPIOA->MODER &= ~(3 << 16);
+	dht22_release();
 }
 
 int Check_Response(void){
@@ -61,7 +73,7 @@ int Check_Response(void){
 			response = 0;
 		}
 	}
-	while ((GPIOA->IDR & GPIO_IDR_ID8)==GPIO_IDR_ID8);   // wait for the pin to go low
+	SPIN_WHILE((GPIOA->IDR & GPIO_IDR_ID8)==GPIO_IDR_ID8);   // wait for the pin to go low
 	return response;
 }
 
@@ -69,19 +81,21 @@ uint8_t DHT22_Read (void){
 	uint8_t i,j;
 	for (j=0;j<8;j++)
 	{
-		while ((GPIOA->IDR & GPIO_IDR_ID8)!=GPIO_IDR_ID8);   // wait for the pin to go high
+		SPIN_WHILE((GPIOA->IDR & GPIO_IDR_ID8)!=GPIO_IDR_ID8);   // wait for the pin to go high
 		delayuS (40);   // wait for 40 us
 		if ((GPIOA->IDR & GPIO_IDR_ID8)!=GPIO_IDR_ID8)   // if the pin is low
 		{
 			i&= ~(1<<(7-j));   // write 0
 		}
 		else i|= (1<<(7-j));  // if the pin is high, write 1
-		while ((GPIOA->IDR & GPIO_IDR_ID8)==GPIO_IDR_ID8);  // wait for the pin to go low
+		SPIN_WHILE((GPIOA->IDR & GPIO_IDR_ID8)==GPIO_IDR_ID8);  // wait for the pin to go low
 	}
 	return i;
 }
 
-void Get_DHT_Data(float * TEMP, float *RH){
+bool Get_DHT_Data(float * TEMP, float *RH){
+    PROF_ZONE(PROF_DHT22);
+
     uint8_t Rh_byte1 = DHT22_Read ();
     uint8_t Rh_byte2 = DHT22_Read ();
 
@@ -99,5 +113,34 @@ void Get_DHT_Data(float * TEMP, float *RH){
         }
 
         *RH = (float)((Rh_byte1<<8)|Rh_byte2)/10;
+        return true;
     }
+    return false;
+}
+
+int DHT22_MeasurePT(pt_t* pt, float* temp, float* rh, bool* ok){
+	/*
+	 * A whole reading as a protothread: it yields through the 18 ms start
+	 * signal. The reply that follows is ~5 ms of microsecond-timed pulses,
+	 * which is read in one go. Start signals are kept DHT22_GAP_US apart:
+	 * a reading started late, then one on time, would otherwise come
+	 * sooner than the sensor answers.
+	 */
+	static uint64_t released_us;
+	static bool released = false;
+
+	PT_BEGIN(pt);
+	*ok = false;
+
+	PT_WAIT_UNTIL(pt, !released || (now_us() - released_us >= DHT22_GAP_US));
+	dht22_hold_low();
+	PT_DELAY_MS(pt, 18);
+	dht22_release();
+	released_us = now_us();
+	released = true;
+
+	if (Check_Response() == 1) {
+		*ok = Get_DHT_Data(temp, rh);
+	}
+	PT_END(pt);
 }
@@ -0,0 +1,417 @@
+/**
+ * @file	esp_at.c
+ * @brief	Library code: ESP8266 AT command engine
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Commands are queued with AT_Submit()/AT_SubmitData() and run one at a
+ * time. AT_Poll() drains the USART1 receive ring buffer, completes the
+ * active command when its expected response, an error or its timeout is
+ * seen, and then starts the next one. The main loop only has to call
+ * AT_Poll() often enough; nothing here blocks except AT_Command().
+ *
+ * Every command also gets a deadline when it is queued: the time by which
+ * it would have completed if everything ahead of it ran to its timeout.
+ * A command still waiting to be sent past it (the TX DMA never freed up,
+ * for instance) completes with AT_TIMEOUT, so no caller waits forever.
+ *
+ * Commands are sent by USART1's TX DMA straight out of their queue slot
+ * (or out of the caller's buffer for AT_SubmitData()); AT_SubmitFormat()
+ * formats into the slot itself, so no intermediate copy is made.
+ *
+ * Responses are recognised by a streaming matcher that tracks every
+ * terminator at once (see at_patterns[]), so each received byte costs a
+ * constant amount of work instead of a strstr() over the whole response.
+ *
+ * Data the ESP receives on a link arrives as "+IPD,<link>,<len>:" followed
+ * by len raw bytes. Those bytes may be binary (MQTT), so they are handed
+ * to the data handler as they come in and never reach the line assembly
+ * or the response matcher.
+ *
+ * NOTE: 	Completion callbacks run from AT_Poll(), never from an interrupt,
+ * 			and may submit or flush commands.
+ */
+
+#include "Mod/esp_at.h"
+#include "Mod/usart1.h"
+#include "Mod/timing.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#define AT_QUEUE_LEN	8			// Commands that can be waiting at once
+#define AT_CMD_MAX		96			// Longest command copied by AT_Submit()
+#define AT_RESP_MAX		512			// Response kept for the active command
+#define AT_LINE_MAX		64			// Longest line passed to the URC handler
+
+typedef struct {
+	char cmd[AT_CMD_MAX];			// Copied command text (AT_Submit)
+	const char* data;				// Caller-owned payload (AT_SubmitData)
+	uint16_t len;
+	at_expect_t expect;
+	uint32_t timeout_ms;
+	uint32_t deadline;				// now_ms() by which it must have completed
+	at_callback_t cb;
+	void* ctx;
+} at_cmd_t;
+
+/*
+ * Response terminators, matched in parallel with one KMP automaton each.
+ * fail[] is the KMP failure function of the pattern (length of the longest
+ * proper prefix of text[0..i] that is also a suffix of it), written out
+ * next to it so that the whole table stays in flash. None of the current
+ * patterns overlaps itself, so it is all zeroes. A table whose length
+ * differs from its pattern's fails to compile (negative array size), and
+ * Host/Test/bench_at_match.c checks the values against the text.
+ *
+ * "OK" also matches the tail of "SEND OK"; it only completes a command that
+ * expects AT_EXPECT_OK. The error patterns complete any command.
+ */
+typedef struct {
+	const char* text;
+	uint8_t len;
+	const uint8_t* fail;
+	at_status_t status;				// Outcome when this pattern fires
+	int8_t expect;					// at_expect_t it satisfies, -1 for errors
+} at_pattern_t;
+
+#define AT_PATTERN(s, f, st, ex)	{ (s), sizeof(s) - 1 \
+		+ 0 * sizeof(char[(sizeof(f) == sizeof(s) - 1) ? 1 : -1]), (f), (st), (ex) }
+
+static const uint8_t fail_ok[]      = { 0, 0, 0, 0 };
+static const uint8_t fail_prompt[]  = { 0 };
+static const uint8_t fail_send_ok[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t fail_error[]   = { 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t fail_fail[]    = { 0, 0, 0, 0, 0, 0 };
+static const uint8_t fail_busy[]    = { 0, 0, 0, 0, 0 };
+
+static const at_pattern_t at_patterns[] = {
+	AT_PATTERN("OK\r\n",		fail_ok,		AT_OK,		AT_EXPECT_OK),
+	AT_PATTERN(">",			fail_prompt,	AT_OK,		AT_EXPECT_PROMPT),
+	AT_PATTERN("SEND OK\r\n",	fail_send_ok,	AT_OK,		AT_EXPECT_SEND_OK),
+	AT_PATTERN("ERROR\r\n",	fail_error,		AT_ERROR,	-1),
+	AT_PATTERN("FAIL\r\n",	fail_fail,		AT_FAIL,	-1),
+	AT_PATTERN("busy ",		fail_busy,		AT_BUSY,	-1),
+};
+
+#define AT_NUM_PATTERNS		(sizeof(at_patterns) / sizeof(at_patterns[0]))
+
+static uint8_t match_pos[AT_NUM_PATTERNS];	// Characters matched so far
+
+static at_cmd_t queue[AT_QUEUE_LEN];
+static uint8_t q_head = 0;
+static uint8_t q_count = 0;
+
+static bool active = false;			// queue[q_head] has been sent
+static uint32_t started;			// now_ms() when the active command was sent
+
+static char resp[AT_RESP_MAX];
+static uint16_t resp_len = 0;
+static char line[AT_LINE_MAX];
+static uint16_t line_len = 0;
+
+static at_urc_handler_t urc_handler = NULL;
+static at_data_handler_t data_handler = NULL;
+static uint16_t ipd_left = 0;		// +IPD payload bytes still to come
+static uint8_t ipd_link;
+
+
+static void AT_StartNext(void);
+
+
+void AT_Init(at_urc_handler_t urc) {
+	urc_handler = urc;
+	q_head = 0;
+	q_count = 0;
+	active = false;
+	resp_len = 0;
+	line_len = 0;
+	ipd_left = 0;
+}
+
+
+void AT_SetDataHandler(at_data_handler_t handler) {
+	data_handler = handler;
+}
+
+
+static at_cmd_t* AT_Push(at_expect_t expect, uint32_t timeout_ms,
+		at_callback_t cb, void* ctx) {
+	if (q_count >= AT_QUEUE_LEN) {
+		return NULL;
+	}
+
+	at_cmd_t* cmd = &queue[(q_head + q_count) % AT_QUEUE_LEN];
+	uint32_t start = now_ms();
+
+	// Starts at the latest when the command ahead of it times out
+	if (q_count > 0) {
+		uint32_t prev = queue[(q_head + q_count - 1) % AT_QUEUE_LEN].deadline;
+		if ((int32_t)(prev - start) > 0) {
+			start = prev;
+		}
+	}
+
+	cmd->data = NULL;
+	cmd->len = 0;
+	cmd->expect = expect;
+	cmd->timeout_ms = timeout_ms;
+	cmd->deadline = start + timeout_ms;
+	cmd->cb = cb;
+	cmd->ctx = ctx;
+	q_count++;
+	return cmd;
+}
+
+
+bool AT_Submit(const char* cmd, at_expect_t expect, uint32_t timeout_ms,
+		at_callback_t cb, void* ctx) {
+	uint16_t len = strlen(cmd);
+	if (len >= AT_CMD_MAX) {
+		return false;
+	}
+
+	at_cmd_t* slot = AT_Push(expect, timeout_ms, cb, ctx);
+	if (slot == NULL) {
+		return false;
+	}
+
+	memcpy(slot->cmd, cmd, len + 1);
+	slot->len = len;
+	return true;
+}
+
+
+bool AT_SubmitFormat(at_expect_t expect, uint32_t timeout_ms,
+		at_callback_t cb, void* ctx, const char* fmt, ...) {
+	if (q_count >= AT_QUEUE_LEN) {
+		return false;
+	}
+
+	// Format into the slot before it is committed to the queue
+	at_cmd_t* slot = &queue[(q_head + q_count) % AT_QUEUE_LEN];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(slot->cmd, AT_CMD_MAX, fmt, args);
+	va_end(args);
+
+	if ((len <= 0) || (len >= AT_CMD_MAX)) {
+		return false;
+	}
+
+	AT_Push(expect, timeout_ms, cb, ctx);
+	slot->len = len;
+	return true;
+}
+
+
+bool AT_SubmitData(const char* data, uint16_t len, at_expect_t expect,
+		uint32_t timeout_ms, at_callback_t cb, void* ctx) {
+	// data is not copied and must stay valid until the callback has run
+	at_cmd_t* slot = AT_Push(expect, timeout_ms, cb, ctx);
+	if (slot == NULL) {
+		return false;
+	}
+
+	slot->data = data;
+	slot->len = len;
+	return true;
+}
+
+
+void AT_Flush(void) {
+	// Drop everything that has not been sent yet; the active command runs on
+	at_callback_t cb[AT_QUEUE_LEN];
+	void* ctx[AT_QUEUE_LEN];
+	uint8_t keep = active ? 1 : 0;
+	uint8_t n = 0;
+
+	// Taken off the queue first, as the callbacks may submit again
+	for (uint8_t i = keep; i < q_count; i++) {
+		at_cmd_t* cmd = &queue[(q_head + i) % AT_QUEUE_LEN];
+		cb[n] = cmd->cb;
+		ctx[n++] = cmd->ctx;
+	}
+	q_count = keep;
+
+	for (uint8_t i = 0; i < n; i++) {
+		if (cb[i] != NULL) {
+			cb[i](AT_ABORTED, "", ctx[i]);
+		}
+	}
+}
+
+
+bool AT_Busy(void) {
+	return active || (q_count > 0);
+}
+
+
+static void AT_Complete(at_status_t status) {
+	at_cmd_t* cmd = &queue[q_head];
+	at_callback_t cb = cmd->cb;
+	void* ctx = cmd->ctx;
+
+	q_head = (q_head + 1) % AT_QUEUE_LEN;
+	q_count--;
+	active = false;
+
+	if (cb != NULL) {
+		cb(status, resp, ctx);
+	}
+}
+
+
+static void AT_StartNext(void) {
+	if (active || (q_count == 0) || usart1_tx_busy()) {
+		return;
+	}
+
+	at_cmd_t* cmd = &queue[q_head];
+	const char* p = (cmd->data != NULL) ? cmd->data : cmd->cmd;
+
+	resp_len = 0;
+	resp[0] = '\0';
+	memset(match_pos, 0, sizeof(match_pos));
+	active = true;
+
+	usart1_tx_start(p, cmd->len);
+	started = now_ms();
+}
+
+
+static at_status_t AT_Match(char c, at_expect_t expect) {
+	// Advance every pattern by one byte and report the outcome, if any
+	at_status_t status = AT_PENDING;
+
+	for (unsigned int i = 0; i < AT_NUM_PATTERNS; i++) {
+		const at_pattern_t* p = &at_patterns[i];
+		uint8_t pos = match_pos[i];
+
+		while ((pos > 0) && (p->text[pos] != c)) {
+			pos = p->fail[pos - 1];
+		}
+		if (p->text[pos] == c) {
+			pos++;
+		}
+		if (pos == p->len) {
+			pos = p->fail[pos - 1];
+			if ((p->expect < 0) || (p->expect == (int8_t)expect)) {
+				status = p->status;
+			}
+		}
+		match_pos[i] = pos;
+	}
+	return status;
+}
+
+
+static void AT_Receive(char c) {
+	if (ipd_left > 0) {
+		ipd_left--;
+		if (data_handler != NULL) {
+			data_handler(ipd_link, (uint8_t)c);
+		}
+		return;
+	}
+
+	// Line assembly for the URC handler, independent of any active command
+	if (line_len < (AT_LINE_MAX - 1)) {
+		line[line_len++] = c;
+	}
+	if ((c == ':') && (strncmp(line, "+IPD,", 5) == 0)) {
+		unsigned int link, len;
+
+		line[line_len] = '\0';
+		if (sscanf(line, "+IPD,%u,%u:", &link, &len) == 2) {
+			ipd_link = link;
+			ipd_left = len;
+		}
+		line_len = 0;
+		return;
+	}
+	if (c == '\n') {
+		line[line_len] = '\0';
+		if ((urc_handler != NULL) && (line_len > 2)) {
+			urc_handler(line);
+		}
+		line_len = 0;
+	}
+
+	if (!active) {
+		return;
+	}
+
+	// Keep the start of the response for the callback; matching is streamed
+	if (resp_len < (AT_RESP_MAX - 1)) {
+		resp[resp_len++] = c;
+		resp[resp_len] = '\0';
+	}
+
+	at_status_t status = AT_Match(c, queue[q_head].expect);
+	if (status != AT_PENDING) {
+		AT_Complete(status);
+	}
+}
+
+
+void AT_Poll(void) {
+	uint8_t c;
+
+	// Commands never sent in time; those behind them expire no earlier
+	while (!active && (q_count > 0) && ((int32_t)(now_ms() - queue[q_head].deadline) >= 0)) {
+		resp_len = 0;
+		resp[0] = '\0';
+		AT_Complete(AT_TIMEOUT);
+	}
+
+	AT_StartNext();
+
+	while (usart1_rx_read(&c)) {
+		AT_Receive(c);
+		AT_StartNext();
+	}
+
+	if (active && ((uint32_t)(now_ms() - started) >= queue[q_head].timeout_ms)) {
+		AT_Complete(AT_TIMEOUT);
+		AT_StartNext();
+	}
+}
+
+
+static void AT_OnCommand(at_status_t status, const char* response, void* ctx) {
+	*(volatile at_status_t*)ctx = status;
+}
+
+
+at_status_t AT_Command(const char* cmd, at_expect_t expect, uint32_t timeout_ms) {
+	// Blocking helper for start-up code; waits behind any queued commands
+	volatile at_status_t status = AT_PENDING;
+
+	if (!AT_Submit(cmd, expect, timeout_ms, AT_OnCommand, (void*)&status)) {
+		return AT_ERROR;
+	}
+
+	while (status == AT_PENDING) {
+		AT_Poll();
+		idle_until(now_us() + 1000);	// Until the next byte or millisecond
+	}
+	return status;
+}
+
+
+int AT_CommandPT(pt_t* pt, const char* cmd, at_expect_t expect, uint32_t timeout_ms,
+		volatile at_status_t* status) {
+	// AT_Command() as a protothread; cmd is copied on the first call
+	PT_BEGIN(pt);
+	*status = AT_PENDING;
+	if (!AT_Submit(cmd, expect, timeout_ms, AT_OnCommand, (void*)status)) {
+		*status = AT_ERROR;
+		PT_EXIT(pt);
+	}
+	PT_WAIT_UNTIL(pt, (AT_Poll(), *status != AT_PENDING));
+	PT_END(pt);
+}
@@ -12,8 +12,8 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *
  * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
  * 	 		This allows register names to be used without regard to the exact
@@ -23,6 +23,8 @@
 #include "Mod/lcd1602.h"
 #include "Mod/i2c1.h"
 #include "Mod/timing.h"
+#include "Mod/pt.h"
+#include "Mod/prof.h"
 
 
 // LCD1602 commands and flags
@@ -77,11 +79,29 @@ uint8_t backlightval = LCD_BACKLIGHT;
 uint8_t numlines;
 
 void LCD_Init(void) {
+    pt_t pt;
+    PT_BLOCK(&pt, LCD_InitPT(&pt));
+}
+
+int LCD_InitPT(pt_t* pt) {
+    // LCD_Init() as a protothread, so start-up can go on around it
+    static pt_t begin_pt;
+
+    PT_BEGIN(pt);
     displayfunction = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
-    LCD_Begin(COLS, ROWS, 0);
+    PT_SPAWN(pt, &begin_pt, LCD_BeginPT(&begin_pt, COLS, ROWS, 0));
+    PT_END(pt);
 }
 
 void LCD_Begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
+    pt_t pt;
+    PT_BLOCK(&pt, LCD_BeginPT(&pt, cols, lines, dotsize));
+}
+
+int LCD_BeginPT(pt_t* pt, uint8_t cols, uint8_t lines, uint8_t dotsize) {
+    // LCD_Begin() as a protothread: yields through the power-up waits
+    PT_BEGIN(pt);
+
     if (lines > 1) {
         displayfunction |= LCD_2LINE;
     }
@@ -91,18 +111,18 @@ void LCD_Begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
         displayfunction |= LCD_5x10DOTS;
     }
 
-    delaymS(50);
+    PT_DELAY_MS(pt, 50);
     LCD_ExpanderWrite(backlightval);
-    delaymS(1000);
+    PT_DELAY_MS(pt, 1000);
 
     LCD_Write4Bits(0x03 << 4);
-    delayuS(4500);
+    PT_DELAY_US(pt, 4500);
 
     LCD_Write4Bits(0x03 << 4);
-    delayuS(4500);
+    PT_DELAY_US(pt, 4500);
 
     LCD_Write4Bits(0x03 << 4);
-    delayuS(150);
+    PT_DELAY_US(pt, 150);
 
     LCD_Write4Bits(0x02 << 4);
 
@@ -111,12 +131,16 @@ void LCD_Begin(uint8_t cols, uint8_t lines, uint8_t dotsize) {
     displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
     LCD_Display();
 
-    LCD_Clear();
+    LCD_SendCommand(LCD_CLEARDISPLAY);
+    PT_DELAY_US(pt, 2000);
 
     displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
     LCD_SendCommand(LCD_ENTRYMODESET | displaymode);
 
-    LCD_Home();
+    LCD_SendCommand(LCD_RETURNHOME);
+    PT_DELAY_US(pt, 2000);
+
+    PT_END(pt);
 }
 
 void LCD_SendCommand(uint8_t command) {
@@ -165,11 +189,20 @@ void LCD_SetCursor(uint8_t col, uint8_t row) {
 }
 
 void LCD_Clear(void) {
+    pt_t pt;
+    PT_BLOCK(&pt, LCD_ClearPT(&pt));
+}
+
+int LCD_ClearPT(pt_t* pt) {
+    PT_BEGIN(pt);
     LCD_SendCommand(LCD_CLEARDISPLAY);
-    delayuS(2000);
+    PT_DELAY_US(pt, 2000);
+    PT_END(pt);
 }
 
 void LCD_SendString(const char *str, uint8_t row, uint8_t col, bool clear) {
+	PROF_ZONE(PROF_LCD_STRING);
+
 	if (clear) {
 		LCD_ClearRow(row);
 	}
@@ -9,8 +9,8 @@
  * @section Configuration
  * System configuration/build:
  * 		- Clock source:
- * 				- HSI (~16 MHz)
- * 				- No AHB & APB1/2 prescaling
+ * 				- PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 				- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *		- Inputs:
  * 				- USART Input @ PA10 (USART1_RX)
  * 				- USART Input @ PA3 (USART2_RX)
@@ -34,6 +34,7 @@
  *					- PASS
  *					- WRITE_API
  *					- READ_API
+ *					- CHANNEL_ID
  *				- ./main.c
  *					- THRESHOLD
  *					- FIELD_NUM
@@ -51,159 +52,316 @@
 #include "stm32f4xx.h" 			// Header for the specific device family
 #include <stm32f411xe.h>
 
+#include <Mod/clock.h>
 #include <Mod/timing.h>
 #include <Mod/usart1.h>
+#include <Mod/esp_at.h>
 #include <Mod/usart2.h>
+#include <Mod/flashlog.h>
 #include <Mod/i2c1.h>
 #include <Mod/lcd1602.h>
-#include <Mod/adc1.h>
 #include <Mod/dht22.h>
+#include <Mod/sched.h>
+#include <Mod/prof.h>
+#include <Mod/monitor.h>
+#include <Mod/sampler.h>
 
 #include <stdio.h>				// For sprintf()
 
-#define SEND_INTERVAL 	70000 	// 32 seconds interval for sending to cloud
+#define SEND_INTERVAL 	50000 	// (ms) Interval for sending both fields to cloud
+#define READ_INTERVAL	2000	// (ms) The DHT22 needs at least 2 s between reads
+#define DISPLAY_INTERVAL 1000	// (ms) LCD refresh
+#define WATCHDOG_INTERVAL 1000	// (ms) IWDG kick, if every job has checked in
+#define JOB_SLACK		2000	// (ms) Lateness a job may have before the monitor holds the IWDG kick
+#define IDLE_MAX		1000	// (ms) Longest sleep between jobs
+#define IDLE_BUSY		10		// (ms) Longest sleep while the ESP8266 is busy
+#define IDLE_STEP		1		// (ms) Longest sleep while a reading or the LCD bring-up is in progress
+//#define BATTERY_STOP			// Stop mode between jobs; see stop_until()
 #define THRESHOLD 		60		// (Celsius) System will trigger alarm if this value is reached
 #define RH_FIELD_NUM 	2		// ThingSpeak Field number for the specific sensor
 #define TEMP_FIELD_NUM 	3		// ThingSpeak Field number for the specific sensor
+#define BOOT_STAGES		6		// Boot timeline entries
 
 
 /************************** Function Prototypes *******************************/
 
 void Buzzer_Init(void);
-void TIM3_Init(void);
-int TIM3_GetTick(void);
+void Boot_Mark(const char* stage);
+void Boot_Report(void);
+void Boot_Step(void);
+void Watchdog_Job(void* ctx);
+void Read_Job(void* ctx);
+void Read_Step(void);
+void Sample_Drain(void);
+void Display_Job(void* ctx);
+void Upload_Job(void* ctx);
+
+float temp, hum;
+bool have_data = false;
+uint32_t alarm_worst_us = 0;			// Worst time from a reading's start to its buzzer write
+uint32_t alarm_age_us = 0;				// Worst age of the data read, at the buzzer write
+
+pt_t read_pt;
+bool reading = false;					// read_pt is in progress
+uint64_t read_us;						// When the reading in progress started
+uint64_t prev_read_us = 0;				// When the one before it started; 0: none yet
+
+sched_timer_t watchdog_job, read_job, display_job, upload_job;
+int read_mon, display_mon, upload_mon;		// Deadline monitor ids
+uint32_t uploads_seen = 0;				// ThingSpeak_Completed() at the last upload check-in
+
+pt_t lcd_pt, wifi_pt;					// Start-up, run from the loop
+bool lcd_ready = false;
+bool wifi_ready = false;
+struct {
+	const char* stage;
+	uint32_t us;						// now_us() when it was reached
+} boot_log[BOOT_STAGES];
+int boot_count = 0;
 
 /************************* Main Function **************************************/
 
 int main(void) {
+	Clock_Init();						// 100 MHz before any peripheral is set up
+	bool wdog_reset = Monitor_Init();	// Reads the reset flags
 	IWDG_Init();
 	TIM2_Init();
-	TIM3_Init();
+	Boot_Mark("clock");
+
+	// Sensing first: the first reading starts on the first pass of the loop
+	Buzzer_Init();
+	Boot_Mark("alarm live");
+
+	usart1_Init();
+	usart2_Init();
+	if (wdog_reset) {
+		Monitor_Report();				// What starved the loop last time
+	}
+	FlashLog_Init();					// Samples not uploaded before a reset
 	I2C_Init();
-	LCD_Init();
 
+	// The LCD and the WiFi join come up from the loop, in Boot_Step()
+	PT_INIT(&lcd_pt);
+	PT_INIT(&wifi_pt);
 
-	LCD_SendString("Initializing", 0, 2, true);
-	LCD_SendString("System", 1, 5, true);
+	// Each job runs at its own rate
+	Sched_Init(&watchdog_job, Watchdog_Job, NULL);
+	Sched_Init(&read_job, Read_Job, NULL);
+	Sched_Init(&display_job, Display_Job, NULL);
+	Sched_Init(&upload_job, Upload_Job, NULL);
 
-	IWDG_Refresh();
+	Sched_Start(&watchdog_job, 0, WATCHDOG_INTERVAL);
+	Sched_Start(&read_job, 0, READ_INTERVAL);
+	Sched_Start(&display_job, 0, DISPLAY_INTERVAL);
+	Sched_Start(&upload_job, SEND_INTERVAL, SEND_INTERVAL);
 
-	Buzzer_Init();
-	ADC_Init();
-	SysTick_Init();
-	usart1_Init();
-	usart2_Init();
+	// Each job must check in within its period plus some slack
+	read_mon = Monitor_Register("read", 0, READ_INTERVAL + JOB_SLACK);
+	display_mon = Monitor_Register("display", 0, DISPLAY_INTERVAL + JOB_SLACK);
+	upload_mon = Monitor_Register("upload", SEND_INTERVAL, SEND_INTERVAL + JOB_SLACK);
 
-	delaymS(1500);
-	IWDG_Refresh();
+#ifdef BATTERY_STOP
+	Stop_Init();
+#endif
 
+	/* Loop forever */
+	while (1) {
+		bool busy;
+		{
+			PROF_ZONE(PROF_LOOP);
+			Sched_Run();
+			Read_Step();
+			Sample_Drain();
+			Boot_Step();
+			ThingSpeak_Poll();			// Service the ESP8266 between jobs
+			busy = ThingSpeak_Busy() || AT_Busy() || !wifi_ready;
+		}
+		Prof_Poll();					// Debug builds: profile table on request
+
+		// Sleep until the next job; ESP8266 data and other interrupts wake it early
+		uint32_t idle = (reading || !lcd_ready) ? IDLE_STEP : (busy ? IDLE_BUSY : IDLE_MAX);
+#ifdef BATTERY_STOP
+		Sched_Idle(idle, !busy && !reading && lcd_ready);	// Stopping would drop ESP8266 data
+#else
+		Sched_Idle(idle, false);
+#endif
+	}
+}
 
-	LCD_SendString("Connecting", 0, 3, true);
-	LCD_SendString("WIFI", 1, 6, true);
+/******************************* Boot Sequence ********************************/
 
-	WiFi_Init();
+void Boot_Mark(const char* stage) {
+	// Timestamp a start-up stage for Boot_Report()
+	if (boot_count < BOOT_STAGES) {
+		boot_log[boot_count].stage = stage;
+		boot_log[boot_count].us = (uint32_t)now_us();
+		boot_count++;
+	}
+}
 
-	LCD_ClearRow(1);
-	LCD_SendString("Success!", 0, 4, true);
-	delaymS(1500);
+void Boot_Report(void) {
+	char line[60];
 
+	serialPrint("boot timeline (from TIM2 start):\r\n");
+	for (int i = 0; i < boot_count; i++) {
+		sprintf(line, "  %10lu us  %s\r\n", boot_log[i].us, boot_log[i].stage);
+		serialPrint(line);
+	}
+}
 
+void Boot_Step(void) {
+	// Carry the LCD bring-up and the WiFi join on side by side
+	if (!lcd_ready && !PT_SCHEDULE(LCD_InitPT(&lcd_pt))) {
+		lcd_ready = true;
+		Boot_Mark("LCD ready");
+		if (!wifi_ready) {
+			LCD_SendString("Connecting", 0, 3, true);
+			LCD_SendString("WIFI", 1, 6, true);
+		}
+	}
 
-	float temp, hum;
-	bool send_temp = true;
-	bool send_rh = false;
+	if (!wifi_ready && !PT_SCHEDULE(WiFi_InitPT(&wifi_pt))) {
+		wifi_ready = true;
+		Boot_Mark("WiFi ready");
+		if (lcd_ready) {
+			LCD_ClearRow(1);
+			LCD_SendString("Success!", 0, 4, true);
+		}
+		Boot_Report();
+	}
+}
 
-	LCD_ClearRow(0);
-	IWDG_Refresh();
+/****************************** Scheduled Jobs ********************************/
+
+void Watchdog_Job(void* ctx) {
+	Monitor_Kick();
+}
+
+void Read_Job(void* ctx) {
+	// Start a reading; Read_Step() carries it on between the other work
+	if (!reading) {
+		PT_INIT(&read_pt);
+		prev_read_us = read_us;
+		read_us = now_us();
+		reading = true;
+	}
+}
+
+void Read_Step(void) {
+	// Finish the reading, act on the alarm and queue it, stamped with its start
+	static float new_temp, new_hum;
+	static bool ok;
+
+	if (!reading || PT_SCHEDULE(DHT22_MeasurePT(&read_pt, &new_temp, &new_hum, &ok))) {
+		return;
+	}
+	reading = false;
+	Monitor_CheckIn(read_mon);			// A failed reading still means the loop got here
+	if (!ok) {
+		return;
+	}
 
-	int state = 0;
-	int send_interval = 0;
+	if (new_temp >= 40)
+		GPIOB->ODR |= (1<<1); // Buzzer turns ON
+	else if (new_hum <= 30)
+		GPIOB->ODR |= (1<<1); // Buzzer turns ON
+	else
+		GPIOB->ODR &= ~(1<<1); // Buzzer is OFF
+
+	// Record the worst response latency: from the reading's start to the buzzer write, and
+	// from the previous reading's start, as the DHT22 answers with what it measured after that one
+	uint64_t now = now_us();
+	uint32_t latency_us = (uint32_t)(now - read_us);
+	uint32_t age_us = (uint32_t)(now - prev_read_us);
+	if (latency_us > alarm_worst_us) {
+		alarm_worst_us = latency_us;
+	}
+	if ((prev_read_us != 0) && (age_us > alarm_age_us)) {
+		alarm_age_us = age_us;
+	}
+
+	sample_t s = { .t_us = read_us, .value = { TS_CENTI(new_temp), TS_CENTI(new_hum) } };
+	Sampler_Push(&s);
+}
 
-	char sendbuff[100];
-	char timebuff[60];
-	int start = 0;
-	int end = 0;
+void Sample_Drain(void) {
+	// Take the queued readings; the newest is displayed and uploaded
+	sample_t s;
+
+	while (Sampler_Pop(&s)) {
+		if (!have_data) {
+			Boot_Mark("first sample");
+		}
+		temp = s.value[0] / 100.0f;
+		hum = s.value[1] / 100.0f;
+		have_data = true;
+	}
+}
 
+void Display_Job(void* ctx) {
 	char tempbuff[50];
 	char humbuff[50];
-	millis = 0;
-	int last_send_time = 0;
-	int time_send_interval = 0;
-	/* Loop forever */
-	while (1) {
-		sprintf(sendbuff, "state: %d\r\nmillis: %d\r\nsend_interval: %d\r\n", state, millis - last_send_time, send_interval);
-		serialPrint(sendbuff);
-		dht22_start();
-		if(Check_Response() == 1) {
-			Get_DHT_Data(&temp, &hum);
-
-			// Display the data to LCD
-			LCD_ClearRow(0);
-			LCD_SendString("R. Temp:", 0, 0, false);
-			sprintf(tempbuff, "%.2f", temp);
-			LCD_SendString(tempbuff, 0, 9, false);
 
-			LCD_ClearRow(1);
-			LCD_SendString("Hum:", 1, 4, false);
-			sprintf(humbuff, "%.2f", hum);
-			LCD_SendString(humbuff, 1, 9, false);
-
-			if (temp >= 40)
-				GPIOB->ODR |= (1<<1); // Buzzer turns ON
-			else if (hum <= 30)
-				GPIOB->ODR |= (1<<1); // Buzzer turns ON
-			else
-				GPIOB->ODR &= ~(1<<1); // Buzzer is OFF
-		}
+	Monitor_CheckIn(display_mon);
 
-		if (state == 0) {
-			send_interval = 100000;
-		}
-		else if (state == 1) {
-			send_interval = 50000 - time_send_interval;
-		}
-		else if (state == 2) {
-			send_interval = 50000;
-		}
+	if (!have_data || !lcd_ready || !wifi_ready) {
+		return;							// Nothing yet, or start-up messages still showing
+	}
 
-		// Send data to ThingSpeak server every 15 seconds
-		if ((millis - last_send_time) >= send_interval) {
-			LCD_Clear();
-			if (send_temp) {
-				LCD_SendString("Sending Temp.", 0, 0, true);
-
-				start = TIM3_GetTick();
-				sendThingSpeak(temp, TEMP_FIELD_NUM);
-				end = TIM3_GetTick();
-
-				last_send_time = millis;
-				send_temp = false;
-				send_rh = true;
-				LCD_SendString("Success!", 1, 0, true);
-				state = 1;
-			} else if (send_rh) {
-				LCD_SendString("Sending R.H.", 0, 0, true);
-
-				start = TIM3_GetTick();
-				sendThingSpeak(hum, RH_FIELD_NUM);
-				end = TIM3_GetTick();
-
-				last_send_time = millis;
-				send_temp = true;
-				send_rh = false;
-				LCD_SendString("Success!", 1, 0, true);
-				state = 2;
-			}
-
-			time_send_interval = end - start;
-			sprintf(timebuff, "%d \r\n", time_send_interval);
-			serialPrint(timebuff);
-			TIM3->CNT = 0;
+	// Display the data to LCD
+	LCD_ClearRow(0);
+	LCD_SendString("R. Temp:", 0, 0, false);
+	sprintf(tempbuff, "%.2f", temp);
+	LCD_SendString(tempbuff, 0, 9, false);
 
-		}
-		IWDG_Refresh();
-		delaymS(1000);
+	LCD_ClearRow(1);
+	LCD_SendString("Hum:", 1, 4, false);
+	sprintf(humbuff, "%.2f", hum);
+	LCD_SendString(humbuff, 1, 9, false);
+}
+
+void Upload_Job(void* ctx) {
+	char report[100];
+	uint32_t run_ms, sleep_ms;
+
+	// Only once the previous upload has completed, so a stuck one starves the monitor
+	if (!ThingSpeak_Busy() || (ThingSpeak_Completed() != uploads_seen)) {
+		uploads_seen = ThingSpeak_Completed();
+		Monitor_CheckIn(upload_mon);
+	}
+
+	// Buffer the latest reading whatever the link does; both fields share its time, so one entry
+	if (have_data) {
+		ThingSpeak_AddSample(TS_CENTI(temp), TEMP_FIELD_NUM | TS_FIELD_CENTI);
+		ThingSpeak_AddSample(TS_CENTI(hum), RH_FIELD_NUM | TS_FIELD_CENTI);
 	}
+
+	if (!wifi_ready || ThingSpeak_Busy()) {
+		return;							// Not joined yet, or last upload still running; samples stay buffered
+	}
+
+	// transmit to Thingspeak; the upload runs in the background
+	if (lcd_ready) {
+		LCD_Clear();
+		LCD_SendString("Sending data", 0, 0, true);
+	}
+	ThingSpeak_BulkUpload();
+
+	sprintf(report, "alarm latency (worst): %lu us from the data, %lu us from the reading\r\n",
+			alarm_age_us, alarm_worst_us);
+	serialPrint(report);
+	sprintf(report, "samples: every %u ms, %lu dropped\r\n", READ_INTERVAL, Sampler_Dropped());
+	serialPrint(report);
+	sprintf(report, "job jitter (worst): read %lu us, display %lu us, upload %lu us\r\n",
+			Sched_Jitter(&read_job), Sched_Jitter(&display_job), Sched_Jitter(&upload_job));
+	serialPrint(report);
+
+	Duty_Read(&run_ms, &sleep_ms);
+	sprintf(report, "duty cycle: run %lu ms, sleep %lu ms (%lu%% awake)\r\n", run_ms, sleep_ms,
+			(uint32_t)((uint64_t)run_ms * 100 / ((run_ms + sleep_ms) ? (run_ms + sleep_ms) : 1)));
+	serialPrint(report);
+
+	Monitor_Report();
 }
 
 /************************** Buzzer Initialization *****************************/
@@ -218,19 +376,4 @@ void Buzzer_Init(void) {
 	GPIOB->OTYPER &= ~(1 << 1);			// Push-pull output
 }
 
-void TIM3_Init(void) {
-    // Enable TIM3 clock
-    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
-
-    // Configure TIM3: count up, no prescaler, update on overflow
-    TIM3->PSC = 16000 - 1;  // Prescaler to get 1 ms tick (assuming 16 MHz clock)
-    TIM3->ARR = 0xFFFFFFFF; // Max auto-reload value
-    TIM3->CNT = 0;          // Clear counter
-    TIM3->CR1 |= TIM_CR1_CEN; // Enable the timer
-}
-
-int TIM3_GetTick(void) {
-    return TIM3->CNT;
-}
-
 
@@ -0,0 +1,57 @@
+/**
+ * @file	esp_at.h
+ * @brief	Prototypes: ESP8266 AT command engine
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef ESP_AT_H
+#define ESP_AT_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
+#include "Mod/pt.h"
+
+typedef enum {
+	AT_EXPECT_OK = 0,					// "OK"
+	AT_EXPECT_PROMPT,					// ">" (CIPSEND data prompt)
+	AT_EXPECT_SEND_OK,					// "SEND OK" (CIPSEND data accepted)
+} at_expect_t;
+
+typedef enum {
+	AT_OK = 0,							// Expected response received
+	AT_ERROR,							// ESP answered "ERROR"
+	AT_FAIL,							// ESP answered "FAIL" / "SEND FAIL"
+	AT_BUSY,							// ESP answered "busy p..." / "busy s..."
+	AT_TIMEOUT,							// No answer within the command's timeout
+	AT_ABORTED,							// Dropped by AT_Flush() before it was sent
+	AT_PENDING,							// Still queued or in flight
+} at_status_t;
+
+// Called once the command completes; response is only valid during the call
+typedef void (*at_callback_t)(at_status_t status, const char* response, void* ctx);
+
+// Called for every complete line received from the ESP (responses and URCs)
+typedef void (*at_urc_handler_t)(const char* line);
+
+// Called for every byte of data received on a link (the payload of "+IPD")
+typedef void (*at_data_handler_t)(uint8_t link, uint8_t c);
+
+void AT_Init(at_urc_handler_t urc);
+void AT_SetDataHandler(at_data_handler_t handler);
+bool AT_Submit(const char* cmd, at_expect_t expect, uint32_t timeout_ms,
+		at_callback_t cb, void* ctx);
+bool AT_SubmitFormat(at_expect_t expect, uint32_t timeout_ms,
+		at_callback_t cb, void* ctx, const char* fmt, ...);
+bool AT_SubmitData(const char* data, uint16_t len, at_expect_t expect,
+		uint32_t timeout_ms, at_callback_t cb, void* ctx);
+void AT_Flush(void);
+bool AT_Busy(void);
+void AT_Poll(void);
+at_status_t AT_Command(const char* cmd, at_expect_t expect, uint32_t timeout_ms);
+int AT_CommandPT(pt_t* pt, const char* cmd, at_expect_t expect, uint32_t timeout_ms,
+		volatile at_status_t* status);
+
+#endif // ESP_AT_H
@@ -0,0 +1,25 @@
+/**
+ * @file	monitor.h
+ * @brief	Prototypes: Deadline monitor in front of the watchdog (IWDG)
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MONITOR_MAX		4				// Activities that can be registered
+#define MONITOR_NAME	12				// Name length kept across resets, with the NUL
+
+bool Monitor_Init(void);
+int Monitor_Register(const char* name, uint32_t delay_ms, uint32_t budget_ms);
+void Monitor_CheckIn(int id);
+void Monitor_Kick(void);
+void Monitor_Report(void);
+
+#endif // MONITOR_H
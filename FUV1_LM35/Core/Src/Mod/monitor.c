@@ -0,0 +1,171 @@
+/**
+ * @file	monitor.c
+ * @brief	Library code: Deadline monitor in front of the watchdog (IWDG)
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Each periodic activity registers a budget: the longest it may go between
+ * two Monitor_CheckIn() calls. Monitor_Kick() is the only path to
+ * IWDG_Refresh(), and only refreshes while every activity is within its
+ * budget, so one starved activity is enough for the IWDG to reset the
+ * board. Before anything is registered it refreshes unconditionally, which
+ * covers the blocking start-up.
+ *
+ * Overruns, the longest gap seen and the activity that was overdue when the
+ * IWDG was last left to run out are kept in .noinit RAM (see the linker
+ * scripts), which the startup code does not clear, so they are still there
+ * after the watchdog reset to be printed.
+ */
+
+#include "Mod/monitor.h"
+#include "Mod/timing.h"
+#include "Mod/usart2.h"
+#include <string.h>
+#include <stdio.h>
+
+#define MONITOR_MAGIC	0x4D4F4E31UL	// "MON1": the .noinit log holds data
+
+typedef struct {
+	char name[MONITOR_NAME];
+	uint32_t budget;					// (ms)
+	uint32_t overruns;					// Check-ins later than the budget
+	uint32_t worst_ms;					// Longest gap between two check-ins
+} monitor_stat_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t resets;					// Watchdog resets since power-up
+	int32_t starved;					// Activity overdue at the last refused kick, -1 if none
+	uint32_t starved_ms;				// How far past its budget it was then
+	int32_t last_id;					// Last activity to check in
+	monitor_stat_t stat[MONITOR_MAX];
+} monitor_log_t;
+
+static monitor_log_t monitor_log __attribute__((section(".noinit")));
+
+static struct {
+	uint32_t due;						// now_ms() by which the next check-in is needed
+	uint32_t last;						// now_ms() of the last check-in
+	bool started;						// Checked in at least once
+} act[MONITOR_MAX];
+static int act_count = 0;
+static bool iwdg_reset = false;
+
+
+bool Monitor_Init(void) {
+	// Call early, before anything else reads or clears the reset flags
+	iwdg_reset = (RCC->CSR & RCC_CSR_IWDGRSTF) != 0;
+	RCC->CSR |= RCC_CSR_RMVF;
+
+	if (monitor_log.magic != MONITOR_MAGIC) {
+		memset(&monitor_log, 0, sizeof(monitor_log));	// Power-up: RAM holds garbage
+		monitor_log.magic = MONITOR_MAGIC;
+		monitor_log.starved = -1;
+		monitor_log.last_id = -1;
+	}
+	if (iwdg_reset) {
+		monitor_log.resets++;
+	}
+	return iwdg_reset;
+}
+
+
+int Monitor_Register(const char* name, uint32_t delay_ms, uint32_t budget_ms) {
+	/*
+	 * Returns the activity's id for Monitor_CheckIn(), or -1 if the table
+	 * is full. The first check-in is due delay_ms + budget_ms from now.
+	 * Ids follow registration order, so the kept statistics line up after
+	 * a reset; a different name in the slot starts them over.
+	 */
+	if (act_count >= MONITOR_MAX) {
+		return -1;
+	}
+
+	int id = act_count++;
+	monitor_stat_t* s = &monitor_log.stat[id];
+
+	if (strncmp(s->name, name, MONITOR_NAME - 1) != 0) {
+		memset(s, 0, sizeof(*s));
+		strncpy(s->name, name, MONITOR_NAME - 1);
+	}
+	s->budget = budget_ms;
+
+	act[id].due = now_ms() + delay_ms + budget_ms;
+	act[id].started = false;
+	return id;
+}
+
+
+void Monitor_CheckIn(int id) {
+	if ((id < 0) || (id >= act_count)) {
+		return;
+	}
+
+	uint32_t now = now_ms();
+	monitor_stat_t* s = &monitor_log.stat[id];
+
+	if ((int32_t)(now - act[id].due) > 0) {
+		s->overruns++;
+	}
+	if (act[id].started && ((now - act[id].last) > s->worst_ms)) {
+		s->worst_ms = now - act[id].last;
+	}
+	act[id].last = now;
+	act[id].due = now + s->budget;
+	act[id].started = true;
+	monitor_log.last_id = id;
+}
+
+
+void Monitor_Kick(void) {
+	// Refresh the IWDG, unless an activity is past its budget
+	uint32_t now = now_ms();
+
+	for (int i = 0; i < act_count; i++) {
+		int32_t over = (int32_t)(now - act[i].due);
+
+		if (over > 0) {
+			monitor_log.starved = i;
+			monitor_log.starved_ms = over;
+			return;
+		}
+	}
+	if (act_count > 0) {
+		monitor_log.starved = -1;		// Start-up kicks leave the last run's record alone
+	}
+	IWDG_Refresh();
+}
+
+
+void Monitor_Report(void) {
+	char line[100];
+	int count = act_count;
+	const monitor_log_t* l = &monitor_log;
+	bool boot = iwdg_reset && (act_count == 0);
+
+	if (count == 0) {
+		// Nothing registered yet (start-up): report what the last run left
+		for (count = MONITOR_MAX; (count > 0) && (l->stat[count - 1].name[0] == 0); count--);
+	}
+
+	sprintf(line, "monitor: %lu watchdog resets%s\r\n", l->resets,
+			boot ? ", the last one just now" : "");
+	serialPrint(line);
+	if (boot && (l->starved >= 0) && (l->starved < MONITOR_MAX)) {
+		sprintf(line, "  starved: %s, %lu ms over budget\r\n",
+				l->stat[l->starved].name, l->starved_ms);
+		serialPrint(line);
+	}
+	if (boot && (l->last_id >= 0) && (l->last_id < MONITOR_MAX)) {
+		sprintf(line, "  last check-in: %s\r\n", l->stat[l->last_id].name);
+		serialPrint(line);
+	}
+	for (int i = 0; i < count; i++) {
+		sprintf(line, "  %s: %lu overruns, worst gap %lu of %lu ms\r\n", l->stat[i].name,
+				l->stat[i].overruns, l->stat[i].worst_ms, l->stat[i].budget);
+		serialPrint(line);
+	}
+}
@@ -0,0 +1,441 @@
+/**
+ * @file	mqtt.c
+ * @brief	Library code: MQTT 3.1.1 client over the ESP8266
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * A single MQTT session is kept open on one ESP TCP link (AT+CIPSTART) and
+ * packets are written to it with AT+CIPSEND, through the AT command engine.
+ * Packets from the broker arrive through the engine's +IPD data handler,
+ * which must forward to MQTT_OnData(); link URCs must be forwarded to
+ * MQTT_OnLine().
+ *
+ * One publish is in flight at a time. The session is opened by the first
+ * publish and kept alive with PINGREQ; a QoS 1 publish is resent (DUP) if
+ * its PUBACK does not arrive in time. "SEND OK" only means the ESP took a
+ * packet, so a QoS 0 publish is followed by a PINGREQ: the broker answers
+ * packets in order, and its PINGRESP shows the PUBLISH got there. Without
+ * one in time the session is dropped, as for a lost PUBACK. When the session breaks, the publish
+ * in flight fails and the next one opens a new session, so retrying is
+ * left to the caller.
+ *
+ * Only what a publisher needs is implemented: no subscriptions, QoS 2 or
+ * retained messages, and no will.
+ */
+
+#include "Mod/mqtt.h"
+#include "Mod/esp_at.h"
+#include "Mod/timing.h"
+#include <string.h>
+
+#define MQTT_TX_MAX			192			// Largest CONNECT/PUBLISH packet
+#define MQTT_CONNECT_TIMEOUT 15000		// (ms) From CIPSTART to CONNACK
+#define MQTT_ACK_TIMEOUT	5000		// (ms) Wait for a PUBACK (QoS 0: PINGRESP) before resending
+#define MQTT_RETRIES		3			// QoS 1 sends before the session is dropped
+
+#define MQTT_CONNECT		0x10
+#define MQTT_CONNACK		0x2
+#define MQTT_PUBLISH		0x30
+#define MQTT_PUBACK			0x4
+#define MQTT_PINGRESP		0xD
+#define MQTT_DUP			0x08
+
+typedef enum {
+	MQTT_DOWN,
+	MQTT_CONNECTING,					// CONNECT queued or waiting for CONNACK
+	MQTT_UP,
+} mqtt_state_t;
+
+enum {
+	MQTT_STEP_MUX,
+	MQTT_STEP_START,
+	MQTT_STEP_SEND,
+	MQTT_STEP_CONNECT,
+	MQTT_STEP_PUBLISH,
+	MQTT_STEP_PING,
+};
+
+enum {
+	MQTT_RX_HEADER,
+	MQTT_RX_LENGTH,
+	MQTT_RX_BODY,
+};
+
+static const uint8_t pingreq[] = { 0xC0, 0x00 };
+
+static const mqtt_config_t* cfg = NULL;
+static mqtt_state_t state = MQTT_DOWN;
+static bool mux_enabled = false;			// AT+CIPMUX=1 already accepted
+static uint32_t connect_at;					// now_ms() when the session was started
+static uint32_t last_tx;					// now_ms() of the last packet sent
+static uint32_t last_rx;					// now_ms() of the last byte received
+static uint32_t bytes_sent = 0;				// MQTT packet bytes, AT commands excluded
+static uint32_t pings_sent;					// PINGREQs this session
+static uint32_t pings_answered;				// PINGRESPs this session
+
+// Packet being sent; read by the USART1 TX DMA, so only one at a time
+static uint8_t tx[MQTT_TX_MAX];
+
+// The publish in flight
+static bool pub_active = false;
+static bool pub_sent = false;				// PUBLISH went out; QoS 1 waits for PUBACK
+static const char* pub_topic;
+static const char* pub_payload;
+static uint16_t pub_len;
+static uint8_t pub_qos;
+static uint16_t pub_id = 0;
+static uint8_t pub_tries;
+static uint32_t pub_at;						// now_ms() when the PUBLISH went out
+static uint32_t pub_ping;					// QoS 0: the PINGREQ whose answer confirms it
+static mqtt_callback_t pub_cb;
+static void* pub_ctx;
+
+// Incoming packet; only the start of its body is kept
+static uint8_t rx_state = MQTT_RX_HEADER;
+static uint8_t rx_type;
+static uint32_t rx_left;
+static uint8_t rx_shift;
+static uint8_t rx_body[4];
+static uint8_t rx_pos;
+
+
+static void MQTT_OnReply(at_status_t status, const char* response, void* ctx);
+
+
+void MQTT_Init(const mqtt_config_t* config) {
+	cfg = config;
+	state = MQTT_DOWN;
+	pub_active = false;
+}
+
+
+static void MQTT_Finish(bool ok) {
+	mqtt_callback_t cb = pub_cb;
+
+	pub_active = false;
+	if (cb != NULL) {
+		cb(ok, pub_ctx);
+	}
+}
+
+
+static void MQTT_Drop(void) {
+	// Close the session; the publish in flight, if any, fails
+	state = MQTT_DOWN;
+	AT_Flush();
+	AT_SubmitFormat(AT_EXPECT_OK, 1000, NULL, NULL, "AT+CIPCLOSE=%d\r\n", cfg->link);
+
+	if (pub_active) {
+		MQTT_Finish(false);
+	}
+}
+
+
+static void MQTT_Send(const uint8_t* pkt, uint16_t len, int step) {
+	AT_SubmitFormat(AT_EXPECT_PROMPT, 2000, MQTT_OnReply, (void*)(uintptr_t)MQTT_STEP_SEND,
+			"AT+CIPSEND=%d,%u\r\n", cfg->link, len);
+	AT_SubmitData((const char*)pkt, len, AT_EXPECT_SEND_OK, 5000,
+			MQTT_OnReply, (void*)(uintptr_t)step);
+
+	bytes_sent += len;
+	last_tx = now_ms();
+	if (step == MQTT_STEP_PING) {
+		pings_sent++;
+	}
+}
+
+
+static uint16_t MQTT_PutLength(uint8_t* p, uint32_t len) {
+	// Remaining Length: 7 bits per byte, least significant first
+	uint16_t n = 0;
+
+	do {
+		uint8_t b = len & 0x7F;
+		len >>= 7;
+		p[n++] = b | ((len > 0) ? 0x80 : 0);
+	} while (len > 0);
+	return n;
+}
+
+
+static uint16_t MQTT_PutString(uint8_t* p, const char* s) {
+	uint16_t len = strlen(s);
+
+	p[0] = len >> 8;
+	p[1] = len & 0xFF;
+	memcpy(p + 2, s, len);
+	return len + 2;
+}
+
+
+static void MQTT_SendPublish(bool dup) {
+	uint32_t rem = 2 + strlen(pub_topic) + ((pub_qos > 0) ? 2 : 0) + pub_len;
+	uint16_t n = 0;
+
+	if (rem + 5 > sizeof(tx)) {
+		MQTT_Finish(false);					// Does not fit; nothing was sent
+		return;
+	}
+
+	tx[n++] = MQTT_PUBLISH | (pub_qos << 1) | (dup ? MQTT_DUP : 0);
+	n += MQTT_PutLength(tx + n, rem);
+	n += MQTT_PutString(tx + n, pub_topic);
+	if (pub_qos > 0) {
+		tx[n++] = pub_id >> 8;
+		tx[n++] = pub_id & 0xFF;
+	}
+	memcpy(tx + n, pub_payload, pub_len);
+	n += pub_len;
+
+	pub_sent = false;
+	MQTT_Send(tx, n, MQTT_STEP_PUBLISH);
+}
+
+
+static bool MQTT_Connect(void) {
+	uint32_t rem = 10 + 2 + strlen(cfg->client_id);
+	uint8_t flags = 0x02;					// Clean session
+	uint16_t n = 0;
+
+	if (cfg->user != NULL) {
+		rem += 2 + strlen(cfg->user);
+		flags |= 0x80;
+	}
+	if (cfg->pass != NULL) {
+		rem += 2 + strlen(cfg->pass);
+		flags |= 0x40;
+	}
+	if (rem + 5 > sizeof(tx)) {
+		return false;
+	}
+
+	tx[n++] = MQTT_CONNECT;
+	n += MQTT_PutLength(tx + n, rem);
+	n += MQTT_PutString(tx + n, "MQTT");
+	tx[n++] = 4;							// Protocol level: 3.1.1
+	tx[n++] = flags;
+	tx[n++] = cfg->keepalive >> 8;
+	tx[n++] = cfg->keepalive & 0xFF;
+	n += MQTT_PutString(tx + n, cfg->client_id);
+	if (cfg->user != NULL) {
+		n += MQTT_PutString(tx + n, cfg->user);
+	}
+	if (cfg->pass != NULL) {
+		n += MQTT_PutString(tx + n, cfg->pass);
+	}
+
+	state = MQTT_CONNECTING;
+	connect_at = now_ms();
+	last_rx = now_ms();
+	rx_state = MQTT_RX_HEADER;
+	pings_sent = 0;
+	pings_answered = 0;
+
+	if (!mux_enabled) {
+		AT_Submit("AT+CIPMUX=1\r\n", AT_EXPECT_OK, 1000,
+				MQTT_OnReply, (void*)(uintptr_t)MQTT_STEP_MUX);
+	}
+	AT_SubmitFormat(AT_EXPECT_OK, 10000, MQTT_OnReply, (void*)(uintptr_t)MQTT_STEP_START,
+			"AT+CIPSTART=%d,\"TCP\",\"%s\",%u\r\n", cfg->link, cfg->host, cfg->port);
+	MQTT_Send(tx, n, MQTT_STEP_CONNECT);
+	return true;
+}
+
+
+static void MQTT_OnReply(at_status_t status, const char* response, void* ctx) {
+	int step = (int)(uintptr_t)ctx;
+
+	if (status == AT_ABORTED) {
+		return;								// Flushed by MQTT_Drop() already
+	}
+	if (status != AT_OK) {
+		MQTT_Drop();
+		return;
+	}
+
+	switch (step) {
+	case MQTT_STEP_MUX:
+		mux_enabled = true;
+		break;
+	case MQTT_STEP_PUBLISH:
+		pub_sent = true;
+		pub_at = now_ms();
+		if (pub_qos == 0) {
+			MQTT_Send(pingreq, sizeof(pingreq), MQTT_STEP_PING);
+			pub_ping = pings_sent;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+bool MQTT_Publish(const char* topic, const char* payload, uint16_t len, uint8_t qos,
+		mqtt_callback_t cb, void* ctx) {
+	// topic and payload are not copied and must stay valid until cb has run
+	if ((cfg == NULL) || pub_active || (qos > 1)) {
+		return false;
+	}
+
+	pub_active = true;
+	pub_topic = topic;
+	pub_payload = payload;
+	pub_len = len;
+	pub_qos = qos;
+	pub_tries = 0;
+	pub_cb = cb;
+	pub_ctx = ctx;
+	if (qos > 0) {
+		pub_id = (pub_id % 0xFFFF) + 1;		// Packet identifiers are never 0
+	}
+
+	if (state == MQTT_UP) {
+		MQTT_SendPublish(false);
+	} else if ((state == MQTT_DOWN) && !MQTT_Connect()) {
+		pub_active = false;					// Credentials too long for tx
+		return false;
+	}
+	return true;
+}
+
+
+bool MQTT_Busy(void) {
+	return pub_active;
+}
+
+
+bool MQTT_Connected(void) {
+	return state == MQTT_UP;
+}
+
+
+uint32_t MQTT_BytesSent(void) {
+	return bytes_sent;
+}
+
+
+static void MQTT_Packet(void) {
+	rx_state = MQTT_RX_HEADER;
+
+	switch (rx_type) {
+	case MQTT_CONNACK:
+		if (state != MQTT_CONNECTING) {
+			break;
+		}
+		if ((rx_pos < 2) || (rx_body[1] != 0)) {
+			MQTT_Drop();					// Refused (bad credentials, client ID...)
+			break;
+		}
+		state = MQTT_UP;
+		if (pub_active) {
+			MQTT_SendPublish(false);
+		}
+		break;
+	case MQTT_PUBACK:
+		if (pub_active && pub_sent && (pub_qos > 0) && (rx_pos >= 2)
+				&& (((rx_body[0] << 8) | rx_body[1]) == pub_id)) {
+			MQTT_Finish(true);
+		}
+		break;
+	case MQTT_PINGRESP:
+		// Answers come in order, so an earlier keep-alive PINGREQ's does not count
+		pings_answered++;
+		if (pub_active && pub_sent && (pub_qos == 0) && (pings_answered >= pub_ping)) {
+			MQTT_Finish(true);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+void MQTT_OnData(uint8_t link, uint8_t c) {
+	// Packet framing: type byte, Remaining Length, then the body
+	if ((cfg == NULL) || (link != cfg->link)) {
+		return;
+	}
+	last_rx = now_ms();
+
+	switch (rx_state) {
+	case MQTT_RX_HEADER:
+		rx_type = c >> 4;
+		rx_left = 0;
+		rx_shift = 0;
+		rx_pos = 0;
+		rx_state = MQTT_RX_LENGTH;
+		break;
+	case MQTT_RX_LENGTH:
+		rx_left |= (uint32_t)(c & 0x7F) << rx_shift;
+		rx_shift += 7;
+		if (!(c & 0x80)) {
+			if (rx_left == 0) {
+				MQTT_Packet();
+			} else {
+				rx_state = MQTT_RX_BODY;
+			}
+		}
+		break;
+	case MQTT_RX_BODY:
+		if (rx_pos < sizeof(rx_body)) {
+			rx_body[rx_pos++] = c;
+		}
+		if (--rx_left == 0) {
+			MQTT_Packet();
+		}
+		break;
+	}
+}
+
+
+void MQTT_OnLine(const char* line) {
+	// "<link>,CLOSED" or a lost AP ends the session
+	if ((cfg == NULL) || (state == MQTT_DOWN)) {
+		return;
+	}
+
+	bool closed = (line[0] == ('0' + cfg->link)) && (strncmp(line + 1, ",CLOSED", 7) == 0);
+	if (closed || (strstr(line, "WIFI DISCONNECT") != NULL)) {
+		state = MQTT_DOWN;
+		if (pub_active) {
+			MQTT_Finish(false);
+		}
+	}
+}
+
+
+void MQTT_Poll(void) {
+	// Timeouts and keep-alive; call it along with AT_Poll()
+	if ((cfg == NULL) || (state == MQTT_DOWN)) {
+		return;
+	}
+
+	uint32_t now = now_ms();
+
+	if (state == MQTT_CONNECTING) {
+		if ((uint32_t)(now - connect_at) >= MQTT_CONNECT_TIMEOUT) {
+			MQTT_Drop();
+		}
+		return;
+	}
+
+	if (pub_active && pub_sent && ((uint32_t)(now - pub_at) >= MQTT_ACK_TIMEOUT)) {
+		if ((pub_qos > 0) && (++pub_tries < MQTT_RETRIES)) {
+			MQTT_SendPublish(true);
+		} else {
+			MQTT_Drop();
+		}
+		return;
+	}
+
+	// The broker drops a client silent for 1.5 keep-alive periods; mirror that
+	if ((uint32_t)(now - last_rx) >= (cfg->keepalive * 1500UL)) {
+		MQTT_Drop();
+	} else if (((uint32_t)(now - last_tx) >= (cfg->keepalive * 500UL)) && !AT_Busy()) {
+		MQTT_Send(pingreq, sizeof(pingreq), MQTT_STEP_PING);
+	}
+}
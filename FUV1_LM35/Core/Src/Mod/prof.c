@@ -0,0 +1,117 @@
+/**
+ * @file	prof.c
+ * @brief	Library code: DWT cycle counter profiling zones
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * System configuration/build:
+ * 	- DWT->CYCCNT running (enabled by TIM2_Init())
+ * 	- Debug build only (DEBUG defined)
+ *
+ * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
+ * 	 		This allows register names to be used without regard to the exact
+ * 	 		addresses.
+ */
+
+#include "Mod/prof.h"
+
+#ifdef DEBUG
+
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include "Mod/usart2.h"
+#include <stdio.h>
+
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint32_t hist[PROF_BUCKETS];
+} prof_stat_t;
+
+static const char* const prof_names[PROF_ZONES] = {
+	"loop", "LM35_GetVal", "MQ2_GetPPM", "Get_DHT_Data",
+	"LCD_SendString", "I2C_Write", "esp send",
+};
+
+static prof_stat_t prof_table[PROF_ZONES];
+
+
+RAMFUNC void Prof_Leave(prof_scope_t* scope) {
+	/*
+	 * Zones may also close in an interrupt (the alarm reads the LM35 in
+	 * TIM3's), so a zone around thread code counts the interrupts it took.
+	 */
+	uint32_t cycles = DWT->CYCCNT - scope->start;
+	prof_stat_t* s = &prof_table[scope->zone];
+	uint32_t bucket = (cycles == 0) ? 0 : (31 - __CLZ(cycles));
+
+	if (bucket >= PROF_BUCKETS) {
+		bucket = PROF_BUCKETS - 1;
+	}
+	if ((s->count == 0) || (cycles < s->min)) {
+		s->min = cycles;
+	}
+	if (cycles > s->max) {
+		s->max = cycles;
+	}
+	s->count++;
+	s->total += cycles;
+	s->hist[bucket]++;
+}
+
+
+void Prof_Dump(void) {
+	// Zones that ran, in cycles (HCLK_HZ / 1000000 per microsecond)
+	char line[80];
+
+	serialPrint("profile (cycles):\r\n");
+	for (int z = 0; z < PROF_ZONES; z++) {
+		prof_stat_t s = prof_table[z];			// Copy; an interrupt may update it
+
+		if (s.count == 0) {
+			continue;
+		}
+		sprintf(line, "%s: n %lu, min %lu, avg %lu, max %lu (%lu us)\r\n", prof_names[z],
+				s.count, s.min, (uint32_t)(s.total / s.count), s.max, s.max / (HCLK_HZ / 1000000));
+		serialPrint(line);
+
+		for (int b = 0; b < PROF_BUCKETS; b++) {
+			if (s.hist[b]) {
+				sprintf(line, "  >= 2^%d: %lu\r\n", b, s.hist[b]);
+				serialPrint(line);
+			}
+		}
+	}
+}
+
+
+void Prof_Reset(void) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	for (int z = 0; z < PROF_ZONES; z++) {
+		prof_table[z] = (prof_stat_t){ 0 };
+	}
+	__set_PRIMASK(primask);
+}
+
+
+void Prof_Poll(void) {
+	// Debug console commands on USART2: 'p' prints the table, 'r' clears it
+	uint8_t c;
+
+	while (usart2_rx_read(&c)) {
+		if (c == 'p') {
+			Prof_Dump();
+		} else if (c == 'r') {
+			Prof_Reset();
+		}
+	}
+}
+
+#endif // DEBUG
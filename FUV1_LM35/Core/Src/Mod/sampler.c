@@ -0,0 +1,131 @@
+/**
+ * @file	sampler.c
+ * @brief	Library code: Timer 3 (TIM3) fixed-rate sampling,
+ * 						  timestamped sample queue
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * System configuration/build:
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
+ * 	- TIM3 counts at SAMPLER_TICK_HZ; one update interrupt per period
+ *
+ * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
+ * 	 		This allows register names to be used without regard to the exact
+ * 	 		addresses.
+ */
+
+/*
+ * The queue has one producer (the tick, or a single thread) and one
+ * consumer (the main loop), so it needs no lock: the producer only writes
+ * q_head and the consumer only writes q_tail. Both count up freely and are
+ * masked on use; a full queue drops the new sample and counts it.
+ *
+ * The tick is timed at the TIM3 update, not at the handler's entry, which
+ * masked sections and other handlers can hold back. TIM3 and TIM2 (now_us())
+ * count from the same clock, so the updates fall on a grid from the time
+ * TIM3 was started; the handler takes the last grid point it has passed.
+ */
+
+#include "Mod/sampler.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+
+#define SAMPLER_TICK_HZ		2000		// TIM3 count rate; fits its 16-bit prescaler and ARR
+#define SAMPLER_MASK		(SAMPLER_QUEUE - 1)
+
+static sample_t queue[SAMPLER_QUEUE];
+static volatile uint32_t q_head = 0;	// Written by the producer only
+static volatile uint32_t q_tail = 0;	// Written by the consumer only
+static volatile uint32_t dropped = 0;
+static sampler_tick_t on_tick = 0;
+static uint64_t next_us;				// When the next update is due
+static uint32_t period_us;
+
+
+void Sampler_Init(uint32_t period_ms, sampler_tick_t tick) {
+	// Call tick every period_ms from TIM3, clamped to the supported range
+	if (period_ms < SAMPLER_PERIOD_MIN) {
+		period_ms = SAMPLER_PERIOD_MIN;
+	}
+	if (period_ms > SAMPLER_PERIOD_MAX) {
+		period_ms = SAMPLER_PERIOD_MAX;
+	}
+	on_tick = tick;
+
+	RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+
+	TIM3->CR1 &= ~TIM_CR1_CEN;
+	TIM3->PSC = (TIM_APB1_HZ / SAMPLER_TICK_HZ) - 1;
+	TIM3->ARR = (period_ms * (SAMPLER_TICK_HZ / 1000)) - 1;
+	TIM3->CNT = 0;
+	TIM3->EGR = TIM_EGR_UG;							// Load PSC now rather than at the first overflow
+	TIM3->SR = ~TIM_SR_UIF;
+
+	TIM3->DIER |= TIM_DIER_UIE;
+	NVIC_EnableIRQ(TIM3_IRQn);
+	period_us = period_ms * 1000;
+	next_us = now_us() + period_us;					// The first update is a period after CEN
+	TIM3->CR1 |= TIM_CR1_CEN;
+}
+
+
+RAMFUNC void TIM3_IRQHandler(void) {
+	if (TIM3->SR & TIM_SR_UIF) {
+		TIM3->SR = ~TIM_SR_UIF;
+
+		uint64_t now = now_us();
+		if (now < next_us) {
+			return;									// Raised again by the update this handler took last time
+		}
+
+		// The latest update; any before it were missed while the handler was held back
+		uint64_t t_us = next_us;
+		while (now - t_us >= period_us) {
+			t_us += period_us;
+		}
+		next_us = t_us + period_us;
+
+		if (on_tick) {
+			on_tick(t_us);
+		}
+	}
+}
+
+
+RAMFUNC bool Sampler_Push(const sample_t* s) {
+	// Producer side; false (and counted) if the consumer has fallen behind
+	uint32_t head = q_head;
+
+	if ((head - q_tail) >= SAMPLER_QUEUE) {
+		dropped++;
+		return false;
+	}
+	queue[head & SAMPLER_MASK] = *s;
+	__DMB();										// Sample in place before it is published
+	q_head = head + 1;
+	return true;
+}
+
+
+bool Sampler_Pop(sample_t* s) {
+	// Consumer side; oldest sample first
+	uint32_t tail = q_tail;
+
+	if (tail == q_head) {
+		return false;
+	}
+	__DMB();
+	*s = queue[tail & SAMPLER_MASK];
+	__DMB();										// Copied out before the slot is handed back
+	q_tail = tail + 1;
+	return true;
+}
+
+
+uint32_t Sampler_Dropped(void) {
+	return dropped;
+}
@@ -0,0 +1,231 @@
+/**
+ * @file	sched.c
+ * @brief	Library code: Timer wheel scheduler for periodic jobs
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Timers hang off a hashed wheel of SCHED_SLOTS slots, one per millisecond
+ * of now_ms(); a timer sits in slot (due % SCHED_SLOTS) however far away
+ * its due time is. Starting or stopping a timer is a list insert/unlink,
+ * and each tick only looks at the one slot it hashes to.
+ *
+ * The wheel is turned by Sched_Run() from the main loop, catching up on the
+ * ticks that went by since the last call, so jobs run in thread context and
+ * may use the blocking drivers. A periodic job is rescheduled from its due
+ * time rather than from when it ran, so it keeps its rate however long the
+ * other jobs take; periods that were missed entirely are skipped and counted
+ * as overruns.
+ */
+
+#include "Mod/sched.h"
+#include "Mod/timing.h"
+#include <stddef.h>
+
+#define SCHED_SLOTS		64				// Wheel size (ticks); a power of two
+#define SCHED_MASK		(SCHED_SLOTS - 1)
+
+enum {
+	SCHED_IDLE,
+	SCHED_ARMED,						// In a wheel slot
+	SCHED_READY,						// Expired, in the ready list
+};
+
+static sched_timer_t* wheel[SCHED_SLOTS];
+static sched_timer_t* ready_head = NULL;
+static sched_timer_t* ready_tail = NULL;
+static uint32_t wheel_tick;				// Last tick whose slot was expired
+static bool running = false;
+
+
+static void Sched_Link(sched_timer_t* t) {
+	sched_timer_t** slot = &wheel[t->due & SCHED_MASK];
+
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot) {
+		(*slot)->prev = t;
+	}
+	*slot = t;
+	t->state = SCHED_ARMED;
+}
+
+
+static void Sched_Unlink(sched_timer_t* t) {
+	if (t->prev) {
+		t->prev->next = t->next;
+	} else {
+		wheel[t->due & SCHED_MASK] = t->next;
+	}
+	if (t->next) {
+		t->next->prev = t->prev;
+	}
+	t->next = NULL;
+	t->prev = NULL;
+}
+
+
+static void Sched_Dispatch(void) {
+	while (ready_head) {
+		sched_timer_t* t = ready_head;
+		ready_head = t->ready_next;
+
+		if (t->state != SCHED_READY) {
+			continue;					// Stopped or restarted since it expired
+		}
+		t->state = SCHED_IDLE;
+
+		// Jitter: how long after its due tick (a millisecond edge) the job started
+		uint64_t us = now_us();
+		uint32_t late = ((uint32_t)(us / 1000) - t->due) * 1000 + (uint32_t)(us % 1000);
+		if (late > t->jitter_us) {
+			t->jitter_us = late;
+		}
+
+		// Rearm before running, so the job may stop or restart itself
+		if (t->period) {
+			uint32_t now = now_ms();
+
+			t->due += t->period;
+			while ((int32_t)(t->due - now) <= 0) {
+				t->due += t->period;
+				t->overruns++;
+			}
+			Sched_Link(t);
+		}
+
+		t->job(t->ctx);
+	}
+	ready_tail = NULL;
+}
+
+
+void Sched_Init(sched_timer_t* t, sched_job_t job, void* ctx) {
+	t->next = NULL;
+	t->prev = NULL;
+	t->ready_next = NULL;
+	t->job = job;
+	t->ctx = ctx;
+	t->due = 0;
+	t->period = 0;
+	t->jitter_us = 0;
+	t->overruns = 0;
+	t->state = SCHED_IDLE;
+}
+
+
+void Sched_Start(sched_timer_t* t, uint32_t delay_ms, uint32_t period_ms) {
+	// Expire after delay_ms, then every period_ms (0: only once)
+	if (!running) {
+		wheel_tick = now_ms();
+		running = true;
+	}
+	if (t->state == SCHED_ARMED) {
+		Sched_Unlink(t);
+	}
+	if (delay_ms == 0) {
+		delay_ms = 1;					// The current tick may already be expired
+	}
+
+	t->due = now_ms() + delay_ms;
+	t->period = period_ms;
+	Sched_Link(t);
+}
+
+
+void Sched_Stop(sched_timer_t* t) {
+	if (t->state == SCHED_ARMED) {
+		Sched_Unlink(t);
+	}
+	t->state = SCHED_IDLE;
+}
+
+
+bool Sched_Active(const sched_timer_t* t) {
+	return t->state != SCHED_IDLE;
+}
+
+
+void Sched_Run(void) {
+	// Expire every tick up to now and run the jobs that came due
+	if (!running) {
+		return;
+	}
+
+	uint32_t now = now_ms();
+
+	// One full turn visits every slot, so a longer gap needs no more
+	if ((uint32_t)(now - wheel_tick) > SCHED_SLOTS) {
+		wheel_tick = now - SCHED_SLOTS;
+	}
+
+	while (wheel_tick != now) {
+		wheel_tick++;
+
+		sched_timer_t* t = wheel[wheel_tick & SCHED_MASK];
+		while (t) {
+			sched_timer_t* next = t->next;
+
+			if ((int32_t)(t->due - wheel_tick) <= 0) {
+				Sched_Unlink(t);
+				t->state = SCHED_READY;
+				t->ready_next = NULL;
+				if (ready_tail) {
+					ready_tail->ready_next = t;
+				} else {
+					ready_head = t;
+				}
+				ready_tail = t;
+			}
+			t = next;
+		}
+
+		Sched_Dispatch();
+	}
+}
+
+
+void Sched_Idle(uint32_t max_ms, bool deep) {
+	/*
+	 * Sleep until the next job is due, but no longer than max_ms; any
+	 * interrupt wakes the core earlier. Finding the next due time walks
+	 * every timer, which is fine with the loop about to sleep anyway.
+	 * deep selects Stop mode (see stop_until()) over Sleep.
+	 */
+	uint64_t us = now_us();
+	uint32_t now = (uint32_t)(us / 1000);
+	uint32_t wait = max_ms;
+
+	for (int i = 0; running && (i < SCHED_SLOTS); i++) {
+		for (sched_timer_t* t = wheel[i]; t; t = t->next) {
+			int32_t left = (int32_t)(t->due - now);
+
+			if (left <= 0) {
+				return;					// Already due; Sched_Run() first
+			}
+			if ((uint32_t)left < wait) {
+				wait = left;
+			}
+		}
+	}
+
+	uint64_t deadline = (us / 1000 + wait) * 1000;
+	if (deep) {
+		stop_until(deadline);
+	} else {
+		idle_until(deadline);
+	}
+}
+
+
+uint32_t Sched_Jitter(const sched_timer_t* t) {
+	// (us) Worst time a run started after it was due
+	return t->jitter_us;
+}
+
+
+uint32_t Sched_Overruns(const sched_timer_t* t) {
+	return t->overruns;
+}
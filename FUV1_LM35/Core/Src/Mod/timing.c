@@ -1,8 +1,7 @@
 /**
  * @file	timing.c
  * @brief	Library code: Independent Watchdog (IWDG),
- * 						  System tick timer (SysTick),
- * 						  Timer 2 (TIM2)
+ * 						  Timer 2 (TIM2) microsecond clock
  *
  * @author	Nathaniel Renz C. Domingo <ncdomingo1@up.edu.ph>
  * @date	9 June 2024
@@ -14,8 +13,8 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *
  * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
  * 	 		This allows register names to be used without regard to the exact
@@ -23,15 +22,24 @@
  */
 
 #include "Mod/timing.h"
+#include "Mod/clock.h"
 
 
-volatile uint32_t millis = 0;
+#define SLEEP_MIN_US	50								// Shorter waits spin rather than sleep
+#define RTC_WUT_DIV		16								// RTC wakeup timer clock: LSI / 16
+
+static volatile uint32_t us_high = 0;			// Upper word of the microsecond clock
+
+static uint64_t run_cycles = 0;					// DWT cycles spent awake since Duty_Read()
+static uint32_t awake_from = 0;					// DWT->CYCCNT when the core last woke
+static uint64_t duty_from = 0;					// now_us() of the last Duty_Read()
+static uint32_t lsi_hz = 0;						// Measured LSI frequency; 0 until Stop_Init()
 
 void IWDG_Init(void) {
     // Enable the LSI clock
     RCC->CSR |= (1 << 0);
 
-    while ((RCC->CSR & (1 << 1)) == 0);			// Wait for LSI to be ready
+    SPIN_WHILE((RCC->CSR & (1 << 1)) == 0);			// Wait for LSI to be ready
     IWDG->KR = 0x5555;							// Enable write access to IWDG_PR and IWDG_RLR registers
     IWDG->PR = 0x5;								// Prescaler of 1/128; 16.384s timeout period
     IWDG->RLR = 0xFFF; 							// Set the reload value to 4095
@@ -44,37 +52,254 @@ void IWDG_Refresh(void) {
     IWDG->KR = 0xAAAA;							// Reload the IWDG counter
 }
 
-void SysTick_Init(void) {
-    SysTick_Config(16000000 / 1000);        	// Configure SysTick to trigger every 1 millisecond
-}
-
-void SysTick_Handler(void) {
-    millis++;
-}
-
 void TIM2_Init(void) {
+	/*
+	 * TIM2 is a 32-bit timer: it free-runs at 1 MHz over the full range and
+	 * is never reset, so every driver shares one time base. Each overflow
+	 * (~71.6 minutes) bumps us_high to extend it to 64 bits.
+	 */
     // Enable TIM2 clock
     RCC->APB1ENR |= (1 << 0);
 
     // Configure TIM2 for 1 microsecond tick
-    TIM2->PSC = (16000000 / 1000000) - 1;  				// Prescaler value
-    TIM2->ARR = 0xFFFF;  								// Set auto-reload register to maximum value
-    TIM2->EGR |= (1 << 0); 								// Reset timer counter registers
+    TIM2->PSC = (TIM_APB1_HZ / 1000000) - 1;  				// Prescaler value
+    TIM2->ARR = 0xFFFFFFFF;  							// Count over the full 32 bits
+    TIM2->EGR |= (1 << 0); 								// Load the prescaler
+    TIM2->SR &= ~TIM_SR_UIF;							// Don't count that update as an overflow
     TIM2->CNT = 0;										// Clear the counter
+    us_high = 0;
+
+    TIM2->DIER |= TIM_DIER_UIE;							// Interrupt on overflow
+    NVIC_SetPriority(TIM2_IRQn, 0);						// Keep counting through longer interrupt handlers
+    NVIC_EnableIRQ(TIM2_IRQn);
     TIM2->CR1 |= (1 << 0);  							// Enable TIM2
+
+    // DWT cycle counter, for the time spent awake
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
-void delayuS(uint32_t us) {
-	TIM2->EGR |= (1 << 0); 								// Reset timer counter registers
-    TIM2->CNT = 0;										// Clear the counter
-    TIM2->CR1 |= (1 << 0);								// Enable timer
+RAMFUNC void TIM2_IRQHandler(void) {
+	// Flags are cleared by writing 0 to them alone, so no other event is lost
+	if (TIM2->SR & TIM_SR_UIF) {
+		TIM2->SR = ~TIM_SR_UIF;
+		us_high++;
+	}
+	if (TIM2->SR & TIM_SR_CC1IF) {
+		TIM2->SR = ~TIM_SR_CC1IF;						// idle_until() deadline; waking was the point
+	}
+}
+
+RAMFUNC uint64_t now_us(void) {
+	/*
+	 * With interrupts masked, us_high cannot change under us, and a pending
+	 * flag means the wrap is not in us_high yet, whether the caller masked
+	 * them or is a handler of equal priority. CNT is read again after the
+	 * flag so that it is past the wrap; the next one is ~71.6 minutes away.
+	 */
+	uint32_t primask = __get_PRIMASK();
+	uint32_t high, low;
+
+	__disable_irq();
+	high = us_high;
+	low = TIM2->CNT;
+	if (TIM2->SR & TIM_SR_UIF) {
+		high++;
+		low = TIM2->CNT;
+	}
+	__set_PRIMASK(primask);
+
+	return ((uint64_t)high << 32) | low;
+}
+
+uint32_t now_ms(void) {
+	return (uint32_t)(now_us() / 1000);
+}
+
+static void Core_Sleep(bool deep) {
+	// Called with interrupts masked; returns once one is pending
+	run_cycles += DWT->CYCCNT - awake_from;
+	if (deep) {
+		SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+	}
+	__DSB();
+	__WFI();
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+	awake_from = DWT->CYCCNT;
+}
+
+void idle_until(uint64_t deadline_us) {
+	// Sleep until the deadline or the first interrupt, whichever comes first
+	uint32_t primask = __get_PRIMASK();
+
+	if (SCB->ICSR & SCB_ICSR_VECTACTIVE_Msk) {
+		return;											// In a handler, WFI could miss its own wakeup
+	}
 
-    // Wait for the specified number of microseconds
-    while (TIM2->CNT < us);
+	__disable_irq();
+	if (now_us() + SLEEP_MIN_US <= deadline_us) {
+		TIM2->CCR1 = (uint32_t)deadline_us;				// Compare on the low word; early is harmless
+		TIM2->SR = ~TIM_SR_CC1IF;
+		TIM2->DIER |= TIM_DIER_CC1IE;
+		Core_Sleep(false);
+		TIM2->DIER &= ~TIM_DIER_CC1IE;
+	}
+	__set_PRIMASK(primask);
+}
+
+void delay_until(uint64_t deadline_us) {
+	// Sleep through the wait; interrupts in between are served as usual
+	uint64_t now;
+
+	while ((now = now_us()) < deadline_us) {
+		if (deadline_us - now >= SLEEP_MIN_US) {
+			idle_until(deadline_us);
+		} else {
+			SPIN_HOOK();
+		}
+	}
+}
+
+void delayuS(uint32_t us) {
+	delay_until(now_us() + us);
 }
 
 void delaymS(uint32_t ms) {
-    for (uint32_t i = 0; i < ms; i++) {
-        delayuS(1000);
-    }
+	delay_until(now_us() + (uint64_t)ms * 1000);
+}
+
+/******************************** Stop mode ***********************************/
+
+static void RTC_Unlock(void) {
+	RTC->WPR = 0xCA;
+	RTC->WPR = 0x53;
+}
+
+static void RTC_Wakeup(uint32_t ticks) {
+	// Start the wakeup timer for ticks of LSI / RTC_WUT_DIV
+	RTC_Unlock();
+	RTC->CR &= ~RTC_CR_WUTE;
+	SPIN_WHILE((RTC->ISR & RTC_ISR_WUTWF) == 0);			// Wait until WUTR may be written
+	RTC->WUTR = ticks - 1;
+	RTC->ISR = ~(RTC_ISR_WUTF | RTC_ISR_INIT);
+	RTC->CR |= RTC_CR_WUTIE | RTC_CR_WUTE;
+	RTC->WPR = 0xFF;
+}
+
+static void RTC_WakeupEnd(void) {
+	// One wakeup per stop_until(); the timer would otherwise reload
+	RTC_Unlock();
+	RTC->CR &= ~RTC_CR_WUTE;
+	RTC->WPR = 0xFF;
+	RTC->ISR = ~(RTC_ISR_WUTF | RTC_ISR_INIT);
+	EXTI->PR = EXTI_PR_PR22;
+}
+
+void Stop_Init(void) {
+	/*
+	 * The RTC wakeup timer ends Stop mode, since TIM2 does not run there.
+	 * It counts the LSI, which is only roughly 32 kHz, so its rate is
+	 * measured against TIM2 first.
+	 */
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR |= PWR_CR_DBP;								// Backup domain (RTC) write access
+
+	RCC->CSR |= RCC_CSR_LSION;
+	SPIN_WHILE((RCC->CSR & RCC_CSR_LSIRDY) == 0);
+	if ((RCC->BDCR & RCC_BDCR_RTCSEL) != RCC_BDCR_RTCSEL_1) {
+		RCC->BDCR |= RCC_BDCR_BDRST;					// RTCSEL only changes after a backup domain reset
+		RCC->BDCR &= ~RCC_BDCR_BDRST;
+		RCC->BDCR |= RCC_BDCR_RTCSEL_1;					// RTC clock = LSI
+	}
+	RCC->BDCR |= RCC_BDCR_RTCEN;
+
+	RTC_Unlock();
+	RTC->CR &= ~RTC_CR_WUCKSEL;							// Wakeup clock = RTC / 16
+	RTC->WPR = 0xFF;
+
+	// Time 256 wakeup ticks (~128 ms) before the interrupt is routed
+	RTC_Wakeup(256);
+	uint64_t start = now_us();
+	SPIN_WHILE((RTC->ISR & RTC_ISR_WUTF) == 0);
+	lsi_hz = (uint32_t)(256ULL * RTC_WUT_DIV * 1000000 / (now_us() - start));
+	RTC_WakeupEnd();
+
+	EXTI->IMR |= EXTI_IMR_MR22;							// EXTI line 22 = RTC wakeup
+	EXTI->RTSR |= EXTI_RTSR_TR22;
+	NVIC_EnableIRQ(RTC_WKUP_IRQn);
+}
+
+void RTC_WKUP_IRQHandler(void) {
+	RTC_WakeupEnd();
+}
+
+void stop_until(uint64_t deadline_us) {
+	/*
+	 * Stop mode until the deadline. Everything clocked from the HSI stops,
+	 * TIM2 included, and only EXTI lines wake the core: UART traffic in the
+	 * meantime is lost. On waking, TIM2 is moved on by the time slept.
+	 */
+	uint64_t now = now_us();
+	uint32_t primask = __get_PRIMASK();
+
+	if ((lsi_hz == 0) || (deadline_us <= now)) {
+		return;
+	}
+
+	uint64_t ticks = (deadline_us - now) * lsi_hz / (RTC_WUT_DIV * 1000000ULL);
+	if (ticks < 2) {
+		idle_until(deadline_us);						// Too short to be worth it
+		return;
+	}
+	if (ticks > 0x10000) {
+		ticks = 0x10000;
+	}
+
+	__disable_irq();
+	RTC_Wakeup((uint32_t)ticks);
+	PWR->CR &= ~PWR_CR_PDDS;							// Stop, not Standby
+	PWR->CR |= PWR_CR_LPDS;								// Low-power regulator while stopped
+	Core_Sleep(true);
+	Clock_Init();										// Stop mode left the core on the HSI
+
+	if (EXTI->PR & EXTI_PR_PR22) {
+		uint32_t slept = (uint32_t)(ticks * RTC_WUT_DIV * 1000000 / lsi_hz);
+		uint32_t cnt = TIM2->CNT;
+
+		TIM2->CNT = cnt + slept;
+		if (cnt + slept < cnt) {
+			us_high++;									// Skipped past an overflow
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+/******************************** Duty cycle **********************************/
+
+void Duty_Read(uint32_t* run_ms, uint32_t* sleep_ms) {
+	/*
+	 * Time awake, counted in DWT cycles, and asleep since the last call.
+	 * CYCCNT wraps after 2^32 cycles, so an awake stretch longer than that
+	 * (~43 s at 100 MHz) is undercounted.
+	 */
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	uint64_t now = now_us();
+	uint32_t cycles = DWT->CYCCNT;
+	run_cycles += cycles - awake_from;
+	awake_from = cycles;
+
+	uint64_t run = run_cycles / (HCLK_HZ / 1000000);
+	uint64_t total = now - duty_from;
+	run_cycles = 0;
+	duty_from = now;
+	__set_PRIMASK(primask);
+
+	if (run > total) {
+		run = total;
+	}
+	*run_ms = (uint32_t)(run / 1000);
+	*sleep_ms = (uint32_t)((total - run) / 1000);
 }
@@ -13,12 +13,15 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
+ *	- USART1 oversamples by 8; BRR is computed from the APB2 clock
  *	- Inputs:
  * 		- USART Input @ PA10 (USART1_RX)
  * 	- Outputs:
  *		- USART Output @ PA9 (USART1_TX)
+ *	- DMA:
+ *		- DMA2 Stream 7, Channel 4 (USART1_TX)
  *
  * NOTE: 	This project uses the CMSIS standard for ARM-based microcontrollers;
  * 	 		This allows register names to be used without regard to the exact
@@ -34,17 +37,232 @@
 
 #include "Mod/usart1.h"
 #include "Mod/usart2.h"
+#include "Mod/clock.h"
+#include "Mod/prof.h"
+#include "Mod/monitor.h"
 #include "Mod/timing.h"
+#include "Mod/esp_at.h"
+#include "Mod/flashlog.h"
+#include "Mod/mqtt.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 
-#define BUFFER_SIZE 1024
+#define RX_RING_SIZE    1024                // Must be a power of two
 
-/* TODO: Adjust these values as necessary */
+#define ESP_BAUD        115200              // ESP8266 power-on baud rate
+#define BAUD_MAX_ERROR  15                  // (per mille) Worst baud error accepted
+
+/* TODO: Adjust these values as necessary (or define them in the project's preprocessor settings) */
+#ifndef SSID
 #define SSID            "DOMINGO WIFI"
+#endif
+#ifndef PASS
 #define PASS            "Nathanie!0801"
+#endif
+#ifndef WRITE_API
 #define WRITE_API       "ADNJT35T06EVYT9T"  // Write API Key for ThingSpeak server
+#endif
+#ifndef READ_API
 #define READ_API        "YMI86E59HUTZAMK4"  // Read API Key for ThingSpeak server
+#endif
+#ifndef CHANNEL_ID
+#define CHANNEL_ID      "0000000"           // ThingSpeak channel ID (bulk updates)
+#endif
+#define CHANNEL_UNSET   "0000000"           // CHANNEL_ID as shipped
+
+/*
+ * Uploads go over HTTP to TS_HOST by default. Define TS_USE_MQTT (here or
+ * in the project's preprocessor settings) to publish to an MQTT broker
+ * instead, using the credentials of a ThingSpeak MQTT device. ThingSpeak's
+ * broker only takes QoS 0; a local broker can be given QoS 1.
+ */
+//#define TS_USE_MQTT
+#define TS_MQTT_HOST    "mqtt3.thingspeak.com"
+#define TS_MQTT_PORT    1883
+#define TS_MQTT_CLIENT  "000000000000000000000000"  // MQTT device Client ID
+#define TS_MQTT_USER    "000000000000000000000000"  // MQTT device Username
+#define TS_MQTT_PASS    "000000000000000000000000"  // MQTT device Password
+#define TS_MQTT_TOPIC   "channels/" CHANNEL_ID "/publish"
+#define TS_MQTT_QOS     0
+#define TS_MQTT_KEEPALIVE 60                // (s)
+
+#define TS_HOST         "api.thingspeak.com"
+#define TS_LINK_ID      0                   // CIPMUX link used for ThingSpeak
+#define RETRY_DELAY     5000                // (ms) Back-off after a failed attempt
+#define TS_MAX_ATTEMPTS 5                   // Upload attempts before giving up
+#define TS_BULK_MAX     128                 // Samples per bulk update
+#define TS_RING_MAX     256                 // Samples buffered in RAM
+#define TS_DRAIN_DELAY  15000               // (ms) Between bulk updates draining a backlog
+#define TS_CHUNK_SIZE   512                 // Bytes per CIPSEND (ESP limit is 2048)
+#define TS_VALUE_MAX    8                   // A sample's value as text: "-327.68"
+#define TS_REPLY_TIMEOUT 10000              // (ms) From the last chunk's SEND OK to the answer
+
+/*
+ * Receive ring buffer, filled by USART1_IRQHandler() and drained by the
+ * AT command engine. Bytes the ESP sends while the firmware is busy
+ * elsewhere are kept here instead of being overwritten in USART1->DR.
+ */
+static volatile uint8_t rx_ring[RX_RING_SIZE];
+static volatile uint16_t rx_head = 0;       // Written by the ISR only
+static volatile uint16_t rx_tail = 0;       // Written by usart1_rx_read() only
+static volatile uint32_t rx_dropped = 0;    // Bytes lost to a full ring
+
+static volatile bool tx_busy = false;       // DMA transfer to USART1 in progress
+#ifdef DEBUG
+static prof_scope_t tx_prof;				// PROF_ESP_SEND, closed by DMA2_Stream7_IRQHandler()
+#endif
+
+// Faster baud rates tried with AT+UART_CUR, fastest first
+static const uint32_t esp_bauds[] = { 921600, 460800 };
+static uint32_t baud = ESP_BAUD;
+
+static bool wifi_joined = false;            // ESP reports being on the access point
+
+/*
+ * ThingSpeak connection state. The TCP link is opened once and kept alive
+ * across uploads; it is only re-opened after the ESP reports it closed
+ * (the "<id>,CLOSED" URC) or a send on it fails.
+ */
+#ifndef TS_USE_MQTT
+static bool mux_enabled = false;            // AT+CIPMUX=1 already accepted
+static bool link_open = false;              // TCP link to TS_HOST is up
+#else
+static const mqtt_config_t ts_mqtt = {
+	TS_MQTT_HOST, TS_MQTT_PORT, TS_MQTT_CLIENT, TS_MQTT_USER, TS_MQTT_PASS,
+	TS_MQTT_KEEPALIVE, TS_LINK_ID,
+};
+#endif
+
+/*
+ * Upload in flight. The request is built directly in ts_request, which the
+ * USART1 TX DMA reads from, so it must stay untouched until the upload
+ * completes.
+ *
+ * Uploads are a background state machine: AT replies advance it from
+ * ThingSpeak_OnReply(), and a failed attempt waits out RETRY_DELAY in
+ * TS_BACKOFF, resumed by ThingSpeak_Poll(), instead of blocking the caller.
+ * A backlog left by an outage is drained one bulk update at a time, spaced
+ * by TS_DRAIN_DELAY in TS_DRAINING.
+ */
+typedef enum {
+	TS_IDLE,
+	TS_RUNNING,                             // AT commands queued or in flight
+	TS_BACKOFF,                             // Waiting to retry a failed attempt
+	TS_DRAINING,                            // Waiting to send more of the backlog
+} ts_state_t;
+
+enum {
+	TS_STEP_MUX,
+	TS_STEP_START,
+	TS_STEP_SEND,
+	TS_STEP_DATA,
+};
+
+static char ts_request[TS_CHUNK_SIZE];      // Request, or current chunk of a bulk request
+static uint16_t ts_request_len = 0;
+static ts_state_t ts_state = TS_IDLE;
+static uint8_t ts_attempts = 0;
+static uint32_t ts_wait_from;               // now_ms() when TS_BACKOFF/TS_DRAINING began
+#ifndef TS_USE_MQTT
+static bool ts_reused = false;              // Upload started on a kept-alive link
+#endif
+static bool ts_retried = false;
+
+/*
+ * The server's answer, parsed from the "+IPD" data as it comes in (the
+ * AT engine hands it to ThingSpeak_OnData() byte by byte). SEND OK only
+ * means the ESP sent the request; an upload is delivered once the answer
+ * is a 2xx, and for GET /update an entry id other than "0" (ThingSpeak's
+ * answer to a rejected or rate-limited update).
+ */
+#ifndef TS_USE_MQTT
+typedef enum {
+	TS_RX_STATUS,                           // Waiting for "HTTP/1.1 <code> ..."
+	TS_RX_HEADERS,
+	TS_RX_BODY,                             // Content-Length bytes
+	TS_RX_CHUNK_SIZE,                       // Transfer-Encoding: chunked
+	TS_RX_CHUNK,
+} ts_rx_t;
+
+static bool ts_awaiting = false;            // Request out, answer not yet in
+static bool ts_sent = false;               // ... and its last chunk's SEND OK is in
+static uint32_t ts_sent_at;                 // now_ms() at that SEND OK
+static ts_rx_t ts_rx = TS_RX_STATUS;
+static uint16_t ts_status = 0;
+static uint16_t ts_body_left = 0;
+static bool ts_chunked = false;
+static char ts_line[40];                    // Header line, or the start of the body
+static uint8_t ts_line_len = 0;
+#endif
+
+/*
+ * Samples waiting for a bulk upload are buffered in ts_ring, oldest first.
+ * Once a bulk upload has failed for good, or the ring overflows, they go
+ * to the flash log (Mod/flashlog.c) instead, so an outage or a reset in
+ * the middle of one does not lose them; flash is only written during
+ * outages, which spares its erase cycles. The log always holds older
+ * samples than the ring and is drained first when the link is back.
+ *
+ * Each bulk update copies its samples into ts_samples, and the request
+ * body is encoded from there into ts_request one chunk at a time, so the
+ * JSON never exists as a whole in RAM.
+ */
+static flashlog_rec_t ts_ring[TS_RING_MAX];
+static uint16_t ts_first = 0;
+static uint16_t ts_count = 0;
+static bool ts_offline = false;             // Last bulk upload failed; log new samples
+static uint32_t ts_completed = 0;           // Uploads delivered or given up on
+
+static flashlog_rec_t ts_samples[TS_BULK_MAX];
+static bool ts_bulk = false;                // Upload in flight is a bulk update
+static bool ts_from_log = false;            // That bulk update drains the flash log
+static uint16_t ts_batch = 0;               // Samples covered by that bulk update
+static uint16_t ts_batch_ring = 0;          // Of those, still at the front of ts_ring
+static int ts_segment = -1;                 // Next segment to encode (-1: headers),
+                                            // or next sample to publish over MQTT
+#ifdef TS_USE_MQTT
+static uint16_t ts_group = 0;               // Samples in the message in flight
+#endif
+
+
+static uint32_t usart1_Clock(void) {
+	// USART1 runs from APB2
+	return PCLK2_HZ;
+}
+
+
+static uint32_t usart1_BRR(uint32_t rate) {
+	/*
+	 * With OVER8, rate = f_ck / (8 * USARTDIV), so f_ck / rate is USARTDIV
+	 * in eighths: the mantissa goes in BRR[15:4] and the eighths in
+	 * BRR[2:0].
+	 */
+	uint32_t div8 = (usart1_Clock() + (rate / 2)) / rate;
+	return ((div8 >> 3) << 4) | (div8 & 0x07);
+}
+
+
+static uint32_t usart1_BaudError(uint32_t rate) {
+	// Difference between the rate asked for and what BRR gives, in per mille
+	uint32_t brr = usart1_BRR(rate);
+	uint32_t actual = usart1_Clock() / (((brr >> 4) << 3) | (brr & 0x07));
+	uint32_t diff = (actual > rate) ? (actual - rate) : (rate - actual);
+	return (diff * 1000) / rate;
+}
+
+
+static void usart1_SetBaud(uint32_t rate) {
+	// Let the last byte leave at the old rate before switching
+	SPIN_WHILE(tx_busy);
+	SPIN_WHILE(!(USART1->SR & USART_SR_TC));
+
+	USART1->CR1 &= ~USART_CR1_UE;
+	USART1->BRR = usart1_BRR(rate);
+	USART1->CR1 |= USART_CR1_UE;
+	baud = rate;
+}
 
 
 void usart1_Init(void) {
@@ -59,158 +277,907 @@ void usart1_Init(void) {
     GPIOA->AFR[1] |= (0x00000770); // USART1_TX = AF07 @ PA9, USART1_RX = AF07 @ PA10
 
     // Configure the baud rate
-    USART1->BRR &= ~(0x0000FFFF);
-    USART1->BRR |= (0x0000008B);
+    USART1->CR1 |= USART_CR1_OVER8; // oversample by 8, for the faster rates
+    USART1->BRR = usart1_BRR(ESP_BAUD);
+    baud = ESP_BAUD;
 
     // Now enable the USART peripheral
     USART1->CR1 |= (0x1UL << (2U)) // enable receive
         | (0x1UL << (3U)) // enable transmit
+        | (0x1UL << (5U)) // enable RXNE interrupt
         | (0x1UL << (13U)); // enable usart
+
+    NVIC_EnableIRQ(USART1_IRQn);
+
+    // Transmit through DMA2 Stream 7 (channel 4 is USART1_TX)
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+    DMA2_Stream7->CR = 0;
+    SPIN_WHILE(DMA2_Stream7->CR & DMA_SxCR_EN);
+    DMA2_Stream7->PAR = (uint32_t)&USART1->DR;
+    USART1->CR3 |= USART_CR3_DMAT;
+    NVIC_EnableIRQ(DMA2_Stream7_IRQn);
+}
+
+
+RAMFUNC void USART1_IRQHandler(void) {
+	uint32_t sr = USART1->SR;
+
+	// RXNE, or ORE (which also needs the SR-then-DR read to clear)
+	if (sr & ((0x1UL << (5U)) | (0x1UL << (3U)))) {
+		uint8_t c = USART1->DR;
+		uint16_t next = (rx_head + 1) & (RX_RING_SIZE - 1);
+
+		if (next != rx_tail) {
+			rx_ring[rx_head] = c;
+			rx_head = next;
+		} else {
+			rx_dropped++;
+		}
+	}
+}
+
+
+bool usart1_rx_read(uint8_t* c) {
+	if (rx_tail == rx_head) {
+		return false;
+	}
+
+	*c = rx_ring[rx_tail];
+	rx_tail = (rx_tail + 1) & (RX_RING_SIZE - 1);
+	return true;
 }
 
 
 int usart1_tx_send(int c) {
-    while (!(USART1->SR & (0x1UL << (7U)))) {}; // wait until we are able to transmit
+    SPIN_WHILE(tx_busy); // let a DMA transfer finish first
+    SPIN_WHILE(!(USART1->SR & (0x1UL << (7U)))); // wait until we are able to transmit
     USART1->DR = c; // transmit the character
     return c;
 }
 
 
-void sendESP_NoResponse(const char* s) {
-    while (*s){
-    	usart1_tx_send(*s++);
-    }
+bool usart1_tx_start(const void* buf, uint16_t len) {
+	/*
+	 * Start sending len bytes from buf and return at once. buf is read by
+	 * the DMA directly, so it must stay untouched until usart1_tx_busy()
+	 * reports the transfer finished.
+	 */
+	if (tx_busy || (len == 0)) {
+		return false;
+	}
+
+	tx_busy = true;
+	PROF_OPEN(tx_prof, PROF_ESP_SEND);			// Submit to the last byte handed to USART1
+
+	DMA2->HIFCR = DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7
+			| DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7;		// Clear stale flags
+	DMA2_Stream7->M0AR = (uint32_t)buf;
+	DMA2_Stream7->NDTR = len;
+	DMA2_Stream7->CR = (4U << DMA_SxCR_CHSEL_Pos)		// Channel 4: USART1_TX
+			| DMA_SxCR_MINC								// Walk through buf
+			| DMA_SxCR_DIR_0							// Memory to peripheral
+			| DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+	USART1->SR &= ~USART_SR_TC;
+	DMA2_Stream7->CR |= DMA_SxCR_EN;
+	return true;
+}
+
+
+bool usart1_tx_busy(void) {
+	return tx_busy;
 }
 
 
-bool sendESP(const char* s, const char* response) {
-    while (*s){
-    	usart1_tx_send(*s++);
-    }
+RAMFUNC void DMA2_Stream7_IRQHandler(void) {
+	uint32_t hisr = DMA2->HISR;
 
-    int max_size = BUFFER_SIZE;
-	char buffer[max_size];
-	memset(buffer, 0, max_size); // Clear the buffer before receiving new data
-	int i = 0;
-	char c;
+	if (hisr & (DMA_HISR_TCIF7 | DMA_HISR_TEIF7)) {
+		DMA2->HIFCR = DMA_HIFCR_CTCIF7 | DMA_HIFCR_CTEIF7;
+		PROF_CLOSE(tx_prof);
+		tx_busy = false;
+	}
+}
 
-	while (i < (max_size - 1)) {
-		while (!(USART1->SR & (1 << 5)));
 
-		c = USART1->DR;
-		buffer[i++] = c;
-		buffer[i] = '\0';
+static uint32_t ESP_RoundTrip(void) {
+	// Time AT+GMR (a few hundred bytes of version text) at the current rate
+	uint64_t start = now_us();
 
-		// Check for the keyword "OK" in the received data
-		if (strstr(buffer, response) != NULL) {
-			serialPrint("RESPONSE RECEIVED!!\r\n"); // echo the command to serial monitor
-			break;
+	if (AT_Command("AT+GMR\r\n", AT_EXPECT_OK, 1000) != AT_OK) {
+		return 0;
+	}
+	return (uint32_t)(now_us() - start);
+}
+
+
+static bool ESP_Verify(void) {
+	// A few tries: the first may meet bytes garbled by the switch
+	for (int i = 0; i < 3; i++) {
+		uint8_t c;
+
+		delaymS(20);
+		while (usart1_rx_read(&c)) {};
+		if (AT_Command("AT\r\n", AT_EXPECT_OK, 200) == AT_OK) {
+			return true;
 		}
 	}
+	return false;
+}
 
-	buffer[i] = '\0';
-	// transmit the response to the serial monitor
-	serialPrint(buffer);
-	serialPrint("\r\n");
-	return true;
+
+static void ESP_UpgradeBaud(void) {
+	/*
+	 * Move the ESP to the fastest rate this clock can generate closely
+	 * enough. AT+UART_CUR is not saved, so a power cycle brings both back
+	 * to ESP_BAUD; a watchdog reset of the MCU alone leaves the ESP at the
+	 * new rate, where ESP_FindBaud() looks for it.
+	 */
+	char data[64];
+	uint32_t before = ESP_RoundTrip();
+
+	for (unsigned int i = 0; i < sizeof(esp_bauds) / sizeof(esp_bauds[0]); i++) {
+		uint32_t rate = esp_bauds[i];
+
+		if (usart1_BaudError(rate) > BAUD_MAX_ERROR) {
+			continue;						// Too far off at this clock
+		}
+
+		sprintf(data, "AT+UART_CUR=%lu,8,1,0,0\r\n", rate);
+		if (AT_Command(data, AT_EXPECT_OK, 1000) != AT_OK) {
+			break;							// Firmware without AT+UART_CUR
+		}
+
+		usart1_SetBaud(rate);
+		if (ESP_Verify()) {
+			sprintf(data, "ESP8266 at %lu baud: AT+GMR %lu us, was %lu us at %lu\r\n",
+					rate, ESP_RoundTrip(), before, (uint32_t)ESP_BAUD);
+			serialPrint(data);
+			return;
+		}
+
+		// No answer at the new rate; ask it to go back, in case only our side misheard
+		sprintf(data, "AT+UART_CUR=%lu,8,1,0,0\r\n", (uint32_t)ESP_BAUD);
+		AT_Command(data, AT_EXPECT_OK, 200);
+		usart1_SetBaud(ESP_BAUD);
+		if (!ESP_Verify()) {
+			serialPrint("ESP8266 lost after a baud change.\r\n");
+			return;
+		}
+	}
+
+	sprintf(data, "ESP8266 stays at %lu baud.\r\n", baud);
+	serialPrint(data);
+}
+
+
+static bool ESP_FindBaud(void) {
+	// No answer at ESP_BAUD: try the rates ESP_UpgradeBaud() may have left it at
+	char data[40];
+
+	for (unsigned int i = 0; i < sizeof(esp_bauds) / sizeof(esp_bauds[0]); i++) {
+		uint32_t rate = esp_bauds[i];
+
+		if (usart1_BaudError(rate) > BAUD_MAX_ERROR) {
+			continue;
+		}
+		usart1_SetBaud(rate);
+		if (ESP_Verify()) {
+			sprintf(data, "ESP8266 found at %lu baud.\r\n", rate);
+			serialPrint(data);
+			return true;
+		}
+	}
+	usart1_SetBaud(ESP_BAUD);
+	return ESP_Verify();					// Also clears what the other rates left in its line
+}
+
+
+#ifndef TS_USE_MQTT
+static void ThingSpeak_OnData(uint8_t link, uint8_t c);
+
+
+static bool ESP_LinkEvent(const char* line, const char* event) {
+	// line is exactly "<TS_LINK_ID>,<event>": "0,CONNECT" but not "0,CONNECT FAIL"
+	char want[24];
+
+	snprintf(want, sizeof(want), "%d,%s\r\n", TS_LINK_ID, event);
+	return strcmp(line, want) == 0;
+}
+#endif
+
+
+static void ESP_TrackLink(const char* line) {
+	// Follow the state of the ThingSpeak link from the responses/URCs seen
+	if ((strncmp(line, "+CWJAP:\"", 8) == 0) || (strstr(line, "WIFI GOT IP") != NULL)) {
+		wifi_joined = true;
+	} else if (strstr(line, "WIFI DISCONNECT") != NULL) {
+		wifi_joined = false;
+	}
+
+#ifdef TS_USE_MQTT
+	MQTT_OnLine(line);
+#else
+	if (ESP_LinkEvent(line, "CLOSED") || strstr(line, "WIFI DISCONNECT") != NULL) {
+		link_open = false;
+	} else if (ESP_LinkEvent(line, "CONNECT") || strstr(line, "ALREADY CONNECTED") != NULL) {
+		link_open = true;
+	}
+#endif
 }
 
 
 void WiFi_Init(void) {
+	pt_t pt;
+	PT_BLOCK(&pt, WiFi_InitPT(&pt));
+}
+
 
-	char data[200];
+int WiFi_InitPT(pt_t* pt) {
+	// Join the access point as a protothread, yielding while the ESP works
+	static pt_t at_pt;
+	static volatile at_status_t status;
+	static char data[200];
+
+	PT_BEGIN(pt);
+
+	AT_Init(ESP_TrackLink);
+#ifdef TS_USE_MQTT
+	AT_SetDataHandler(MQTT_OnData);
+	MQTT_Init(&ts_mqtt);
+#else
+	AT_SetDataHandler(ThingSpeak_OnData);
+	if (strcmp(CHANNEL_ID, CHANNEL_UNSET) == 0) {
+		serialPrint("CHANNEL_ID is not set; ThingSpeak will refuse bulk updates.\r\n");
+	}
+#endif
 
 	while (true) {
 		serialPrint("Attempting WiFi Initialization...\r\n");
 
-		if (!sendESP("AT\r\n", "OK")) {
-			delaymS(5000);
+		PT_SPAWN(pt, &at_pt, AT_CommandPT(&at_pt, "AT\r\n", AT_EXPECT_OK, 1000, &status));
+		if ((status != AT_OK) && (baud == ESP_BAUD) && ESP_FindBaud()) {
+			status = AT_OK;					// At a faster rate from before a reset, or just late
+		}
+		if (status != AT_OK) {
+			PT_DELAY_MS(pt, RETRY_DELAY);
 			serialPrint("AT command failed. Retrying...\r\n");
 			continue;
 		}
 
-		IWDG_Refresh();
-		delaymS(1000);
+		Monitor_Kick();
+
+		if (baud == ESP_BAUD) {
+			ESP_UpgradeBaud();				// Blocks for a few hundred ms
+		}
 
-		if (!sendESP("AT+CWMODE=1\r\n", "OK")) {
-			delaymS(5000);
+		PT_SPAWN(pt, &at_pt, AT_CommandPT(&at_pt, "AT+CWMODE=1\r\n", AT_EXPECT_OK, 1000, &status));
+		if (status != AT_OK) {
+			PT_DELAY_MS(pt, RETRY_DELAY);
 			serialPrint("CWMODE command failed. Retrying...\r\n");
 			continue;
 		}
 
-		IWDG_Refresh();
-		delaymS(1000);
+		Monitor_Kick();
+
+		// With auto-connect the ESP rejoins its stored AP at power-up; if so, keep that
+		PT_SPAWN(pt, &at_pt, AT_CommandPT(&at_pt, "AT+CWJAP?\r\n", AT_EXPECT_OK, 1000, &status));
+		if (wifi_joined) {
+			serialPrint("WiFi already joined (auto-connect).\r\n");
+			break;
+		}
 
 		sprintf(data, "AT+CWJAP=\"%s\",\"%s\"\r\n", SSID, PASS);
-		if (!sendESP(data, "OK")) {
-			delaymS(5000);
+		PT_SPAWN(pt, &at_pt, AT_CommandPT(&at_pt, data, AT_EXPECT_OK, 15000, &status));
+		if (status != AT_OK) {
+			PT_DELAY_MS(pt, RETRY_DELAY);
 			serialPrint("CWJAP command failed. Retrying...\r\n");
 			continue;
 		}
 
+		// Rejoin by itself from the next power-up on
+		PT_SPAWN(pt, &at_pt, AT_CommandPT(&at_pt, "AT+CWAUTOCONN=1\r\n", AT_EXPECT_OK, 1000, &status));
+
 		// If all commands succeeded
-		IWDG_Refresh();
+		Monitor_Kick();
 		serialPrint("WiFi Initialization Success!\r\n");
 		break;
 	}
+
+	PT_END(pt);
 }
 
 
-void sendThingSpeak(int val, int field) {
-    char data[200];
-    char cipsend_cmd[100];
+static void ThingSpeak_Queue(void);
+static void ThingSpeak_Spill(uint16_t n);
+
+
+static void ThingSpeak_Consume(uint16_t n) {
+	// The first n samples of the bulk update in flight have been delivered
+	if (n == 0) {
+		return;
+	}
+
+	if (ts_from_log) {
+		FlashLog_Ack(ts_samples[n - 1].seq);
+	} else {
+		// Samples spilled to the log meanwhile have left the ring already
+		uint16_t spilled = ts_batch - ts_batch_ring;
+		uint16_t k = (n > spilled) ? (n - spilled) : 0;
+		ts_first = (ts_first + k) % TS_RING_MAX;
+		ts_count -= k;
+		ts_batch_ring -= k;
+	}
+}
 
-    memset(data, 0, sizeof(data));
-    memset(cipsend_cmd, 0, sizeof(cipsend_cmd));
 
-    sprintf(data, "GET /update?api_key=%s&field%d=%d\r\n\r\n", WRITE_API, field, val);
-    sprintf(cipsend_cmd, "AT+CIPSEND=0,%d\r\n", strlen(data) + 1);
+static void ThingSpeak_Failed(void) {
+	if (++ts_attempts < TS_MAX_ATTEMPTS) {
+		serialPrint("Data Transmission failed. Retrying...\r\n");
+		ts_state = TS_BACKOFF;
+		ts_wait_from = now_ms();
+	} else {
+		// Buffered samples are kept for the next bulk upload
+		serialPrint("Data Transmission failed.\r\n");
+		ts_state = TS_IDLE;
+		ts_completed++;
 
-    IWDG_Refresh();
+		if (ts_bulk) {
+#ifdef TS_USE_MQTT
+			ThingSpeak_Consume(ts_segment);
+#endif
+			ts_offline = true;
+			ThingSpeak_Spill(ts_count);
+		}
+	}
+}
 
-    while (true) {
-        serialPrint("Attempting Data Transmission to ThingSpeak...\r\n");
 
-        if (!sendESP("AT+CIPMUX=1\r\n", "OK")) {
-            delaymS(5000);
-            serialPrint("CIPMUX command failed. Retrying...\r\n");
-            continue;
-        }
+static void ThingSpeak_Done(void) {
+	if (ts_bulk) {
+		ThingSpeak_Consume(ts_batch);
+		ts_offline = false;
+	}
+	serialPrint("Data Transmission Success!\r\n");
+	ts_state = TS_IDLE;
+	ts_completed++;
 
-        IWDG_Refresh();
-        delaymS(1000);
+	if (ts_bulk && (FlashLog_Pending() > 0)) {
+		ts_state = TS_DRAINING;
+		ts_wait_from = now_ms();
+	}
+}
 
-        if (!sendESP("AT+CIPSTART=0,\"TCP\",\"api.thingspeak.com\",80\r\n", "OK")) {
-            delaymS(5000);
-            serialPrint("CIPSTART command failed. Retrying...\r\n");
-            continue;
-        }
 
-        IWDG_Refresh();
-        delaymS(1000);
+static const char* ThingSpeak_Value(const flashlog_rec_t* s, char* buf) {
+	// The sample's value as sent: TS_FIELD_CENTI ones with two decimals
+	int v = s->value;
 
-        if (!sendESP(cipsend_cmd, ">")) {
-        	delaymS(5000);
-            serialPrint("CIPSEND command failed. Retrying...\r\n");
-            continue;
-        }
+	if (s->field & TS_FIELD_CENTI) {
+		unsigned int mag = (v < 0) ? -v : v;
+		sprintf(buf, "%s%u.%02u", (v < 0) ? "-" : "", mag / 100, mag % 100);
+	} else {
+		sprintf(buf, "%d", v);
+	}
+	return buf;
+}
 
-        IWDG_Refresh();
-        delaymS(1000);
 
-        sendESP_NoResponse(data);
+static bool ThingSpeak_Joins(uint16_t i) {
+	/*
+	 * ts_samples[i] goes into the same update as the sample before it: taken
+	 * at the same time, in a field that update does not have yet. Readings
+	 * of several fields (the DHT22's) are then one ThingSpeak entry.
+	 */
+	if ((i == 0) || (ts_samples[i - 1].time != ts_samples[i].time)) {
+		return false;
+	}
+	for (uint16_t j = i; (j > 0) && (ts_samples[j - 1].time == ts_samples[i].time); j--) {
+		if (((ts_samples[j - 1].field ^ ts_samples[i].field) & ~TS_FIELD_CENTI) == 0) {
+			return false;
+		}
+	}
+	return true;
+}
 
-        IWDG_Refresh();
-        delaymS(3000);
 
-        if (!sendESP("AT+CIPCLOSE=0\r\n", "OK")) {
-            delaymS(5000);
-            serialPrint("CIPCLOSE command failed. Retrying...\r\n");
-            continue;
-        }
+static void ThingSpeak_Spill(uint16_t n) {
+	// Move the n oldest buffered samples to the flash log
+	for (; (n > 0) && (ts_count > 0); n--) {
+		flashlog_rec_t* s = &ts_ring[ts_first];
+		FlashLog_Append(s->time, s->value, s->field);
+		ts_first = (ts_first + 1) % TS_RING_MAX;
+		ts_count--;
+
+		// Only if a bulk update outlives the ring; it may then be sent twice
+		if (ts_batch_ring > 0) {
+			ts_batch_ring--;
+		}
+	}
+}
+
+
+#ifndef TS_USE_MQTT
+static void ThingSpeak_QueueChunk(void);
+
+
+static void ThingSpeak_Abort(bool stale) {
+	// The upload in flight failed on the link; stale: it may have been dropped unseen
+	ts_awaiting = false;
+	AT_Flush();
+
+	// A link the ESP still holds would answer the next CIPSTART with
+	// ALREADY CONNECTED and carry the next request into the same fault
+	if (link_open) {
+		AT_SubmitFormat(AT_EXPECT_OK, 1000, NULL, NULL, "AT+CIPCLOSE=%d\r\n", TS_LINK_ID);
+	}
+	link_open = false;
+
+	// The server may have dropped an idle link without us seeing the
+	// URC; reconnect straight away once in that case.
+	if (stale && ts_reused && !ts_retried) {
+		serialPrint("ThingSpeak link stale. Reconnecting...\r\n");
+		ts_retried = true;
+		ThingSpeak_Queue();
+		return;
+	}
+
+	ThingSpeak_Failed();
+}
+
+
+static void ThingSpeak_OnResponse(void) {
+	// A whole answer is in: ts_status, and the start of the body in ts_line
+	bool entry = ts_bulk || (strcmp(ts_line, "0") != 0);
+	char msg[48];
+
+	ts_rx = TS_RX_STATUS;
+	if (!ts_awaiting) {
+		return;							// Not for an upload of ours (one given up on)
+	}
+	ts_awaiting = false;
+
+	if ((ts_status >= 200) && (ts_status <= 299) && entry) {
+		ThingSpeak_Done();
+		return;
+	}
+
+	sprintf(msg, "ThingSpeak answered %u \"%.8s\".\r\n", (unsigned int)ts_status, ts_line);
+	serialPrint(msg);
+	ThingSpeak_Failed();
+}
+
+
+static void ThingSpeak_OnData(uint8_t link, uint8_t c) {
+	// Bytes the server sent on the link: the status line, headers and body
+	if (link != TS_LINK_ID) {
+		return;
+	}
+
+	if (ts_rx == TS_RX_BODY) {
+		if (ts_line_len < (sizeof(ts_line) - 1)) {
+			ts_line[ts_line_len++] = c;
+			ts_line[ts_line_len] = '\0';
+		}
+		if (--ts_body_left == 0) {
+			ThingSpeak_OnResponse();
+		}
+		return;
+	}
+
+	// Everything else is taken a line at a time
+	if (c != '\n') {
+		if ((c != '\r') && (ts_line_len < (sizeof(ts_line) - 1))) {
+			ts_line[ts_line_len++] = c;
+		}
+		return;
+	}
+	ts_line[ts_line_len] = '\0';
+	ts_line_len = 0;
+
+	switch (ts_rx) {
+	case TS_RX_STATUS: {
+		unsigned int code;
+		if (sscanf(ts_line, "HTTP/1.%*u %u", &code) == 1) {
+			ts_status = code;
+			ts_body_left = 0;
+			ts_chunked = false;
+			ts_rx = TS_RX_HEADERS;
+		}
+		break;
+	}
+	case TS_RX_HEADERS:
+		if (strncmp(ts_line, "Content-Length:", 15) == 0) {
+			ts_body_left = atoi(ts_line + 15);
+		} else if (strcmp(ts_line, "Transfer-Encoding: chunked") == 0) {
+			ts_chunked = true;
+		} else if (ts_line[0] == '\0') {
+			if (ts_chunked) {
+				ts_rx = TS_RX_CHUNK_SIZE;
+			} else if (ts_body_left > 0) {
+				ts_rx = TS_RX_BODY;
+			} else {
+				ThingSpeak_OnResponse();
+			}
+		}
+		break;
+	case TS_RX_CHUNK_SIZE:
+		if (strtoul(ts_line, NULL, 16) > 0) {
+			ts_rx = TS_RX_CHUNK;
+		} else {
+			ThingSpeak_OnResponse();	// Empty body
+		}
+		break;
+	case TS_RX_CHUNK:
+		ThingSpeak_OnResponse();		// The first chunk is all that is looked at
+		break;
+	default:
+		break;
+	}
+}
+
+
+static void ThingSpeak_OnReply(at_status_t status, const char* response, void* ctx) {
+	int step = (int)(uintptr_t)ctx;
+
+	if (status == AT_ABORTED) {
+		return;							// Flushed below after an earlier step failed
+	}
+	if (status != AT_OK) {
+		if ((step == TS_STEP_START) && link_open) {
+			return;						// ALREADY CONNECTED; carry on sending
+		}
+		ThingSpeak_Abort(step >= TS_STEP_SEND);
+		return;
+	}
+
+	switch (step) {
+	case TS_STEP_MUX:
+		mux_enabled = true;
+		break;
+	case TS_STEP_START:
+		link_open = true;
+		break;
+	case TS_STEP_DATA:
+		if (!ts_awaiting) {
+			ThingSpeak_QueueChunk();		// More of the bulk request to send
+		} else {
+			ts_sent = true;					// The answer decides (ThingSpeak_OnResponse()); time it from here
+			ts_sent_at = now_ms();
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+
+static int ThingSpeak_BulkSegment(char* dst, size_t cap, int seg) {
+	/*
+	 * Segment 0 opens the JSON body, segments 1..ts_batch are the samples
+	 * and the last one closes it. A sample opens an update object unless it
+	 * joins the one before (ThingSpeak_Joins()); delta_t is the offset in
+	 * seconds from the previous update, from the samples' FlashLog_Now()
+	 * times, which carry on across resets.
+	 */
+	if (seg == 0) {
+		return snprintf(dst, cap, "{\"write_api_key\":\"%s\",\"updates\":[", WRITE_API);
+	}
+	if (seg > ts_batch) {
+		return snprintf(dst, cap, "}]}");
+	}
+
+	const flashlog_rec_t* cur = &ts_samples[seg - 1];
+	const flashlog_rec_t* prev = (seg == 1) ? cur : &ts_samples[seg - 2];
+	unsigned long delta = (cur->time < prev->time) ? 0 : (cur->time - prev->time);
+	char value[TS_VALUE_MAX];
+
+	if (ThingSpeak_Joins(seg - 1)) {
+		return snprintf(dst, cap, ",\"field%d\":%s", cur->field & ~TS_FIELD_CENTI, ThingSpeak_Value(cur, value));
+	}
+	return snprintf(dst, cap, "%s{\"delta_t\":%lu,\"field%d\":%s", (seg == 1) ? "" : "},",
+			delta, cur->field & ~TS_FIELD_CENTI, ThingSpeak_Value(cur, value));
+}
+
+
+static uint16_t ThingSpeak_FillChunk(void) {
+	// Encode as many whole segments as fit into ts_request
+	uint16_t len = 0;
+
+	if (ts_segment < 0) {
+		unsigned int body = 0;
+		for (int seg = 0; seg <= ts_batch + 1; seg++) {
+			body += ThingSpeak_BulkSegment(NULL, 0, seg);
+		}
+
+		len = snprintf(ts_request, sizeof(ts_request),
+				"POST /channels/%s/bulk_update.json HTTP/1.1\r\n"
+				"Host: %s\r\n"
+				"Connection: keep-alive\r\n"
+				"Content-Type: application/json\r\n"
+				"Content-Length: %u\r\n\r\n", CHANNEL_ID, TS_HOST, body);
+		ts_segment = 0;
+	}
+
+	while (ts_segment <= ts_batch + 1) {
+		int n = ThingSpeak_BulkSegment(ts_request + len, sizeof(ts_request) - len, ts_segment);
+		if ((size_t)(len + n) >= sizeof(ts_request)) {
+			break;						// Did not fit; goes first in the next chunk
+		}
+		len += n;
+		ts_segment++;
+	}
+	return len;
+}
+
+
+static void ThingSpeak_QueueChunk(void) {
+	if (ts_bulk) {
+		ts_request_len = ThingSpeak_FillChunk();
+	}
+
+	// The last chunk of the request: the upload completes with the answer
+	ts_awaiting = !ts_bulk || (ts_segment > ts_batch + 1);
+	if (ts_awaiting) {
+		ts_sent = false;				// CIPMUX/CIPSTART may still be ahead of it in the queue
+		ts_rx = TS_RX_STATUS;
+		ts_line_len = 0;
+	}
+
+	AT_SubmitFormat(AT_EXPECT_PROMPT, 2000, ThingSpeak_OnReply, (void*)(uintptr_t)TS_STEP_SEND,
+			"AT+CIPSEND=%d,%u\r\n", TS_LINK_ID, ts_request_len);
+	AT_SubmitData(ts_request, ts_request_len, AT_EXPECT_SEND_OK, 5000,
+			ThingSpeak_OnReply, (void*)(uintptr_t)TS_STEP_DATA);
+}
+
+
+static void ThingSpeak_Queue(void) {
+	ts_reused = link_open;
+	ts_segment = -1;					// A bulk request always restarts from the top
+
+	if (!link_open) {
+		if (!mux_enabled) {
+			AT_Submit("AT+CIPMUX=1\r\n", AT_EXPECT_OK, 1000,
+					ThingSpeak_OnReply, (void*)(uintptr_t)TS_STEP_MUX);
+		}
+
+		AT_SubmitFormat(AT_EXPECT_OK, 10000, ThingSpeak_OnReply, (void*)(uintptr_t)TS_STEP_START,
+				"AT+CIPSTART=%d,\"TCP\",\"%s\",80\r\n", TS_LINK_ID, TS_HOST);
+	}
+
+	ThingSpeak_QueueChunk();
+}
+#else
+
+
+static void ThingSpeak_OnPublished(bool ok, void* ctx) {
+	if (!ok) {
+		ThingSpeak_Failed();
+		return;
+	}
+
+	if (ts_bulk && ((ts_segment += ts_group) < ts_batch)) {
+		ThingSpeak_Queue();					// Next update of the bulk update
+		return;
+	}
+	ThingSpeak_Done();
+}
+
+
+static void ThingSpeak_Queue(void) {
+	// Over MQTT a bulk update is one message per update; a retry resumes
+	if (ts_bulk) {
+		ts_request_len = 0;
+		ts_group = 0;
+		do {
+			const flashlog_rec_t* s = &ts_samples[ts_segment + ts_group];
+			char value[TS_VALUE_MAX];
+			ts_request_len += snprintf(ts_request + ts_request_len, sizeof(ts_request) - ts_request_len,
+					"%sfield%d=%s", (ts_group == 0) ? "" : "&", s->field & ~TS_FIELD_CENTI,
+					ThingSpeak_Value(s, value));
+			ts_group++;
+		} while ((ts_segment + ts_group < ts_batch) && ThingSpeak_Joins(ts_segment + ts_group));
+	}
+
+	if (!MQTT_Publish(TS_MQTT_TOPIC, ts_request, ts_request_len, TS_MQTT_QOS,
+			ThingSpeak_OnPublished, NULL)) {
+		ThingSpeak_Failed();
+	}
+}
+#endif
+
+
+static void ThingSpeak_Start(bool bulk) {
+	ts_state = TS_RUNNING;
+	ts_bulk = bulk;
+	ts_segment = 0;
+	ts_attempts = 0;
+	ts_retried = false;
+	ThingSpeak_Queue();
+}
+
+
+static bool ThingSpeak_StartBulk(void) {
+	// Next bulk update: the oldest samples, from the flash log first
+	ts_from_log = (FlashLog_Pending() > 0);
+	ts_batch_ring = 0;
+
+	if (ts_from_log) {
+		ts_batch = FlashLog_Read(ts_samples, TS_BULK_MAX);
+	} else {
+		ts_batch = (ts_count < TS_BULK_MAX) ? ts_count : TS_BULK_MAX;
+		for (uint16_t i = 0; i < ts_batch; i++) {
+			ts_samples[i] = ts_ring[(ts_first + i) % TS_RING_MAX];
+		}
+		ts_batch_ring = ts_batch;
+	}
+
+	// A full batch may end inside an update; that update goes whole in the next one
+	if (ts_batch == TS_BULK_MAX) {
+		uint16_t n = ts_batch;
+		while ((n > 0) && (ts_samples[n - 1].time == ts_samples[ts_batch - 1].time)) {
+			n--;
+		}
+		if (n > 0) {
+			ts_batch = n;
+			ts_batch_ring = ts_from_log ? 0 : n;
+		}
+	}
+
+	if (ts_batch == 0) {
+		ts_state = TS_IDLE;
+		return false;
+	}
+
+	ThingSpeak_Start(true);
+	return true;
+}
+
+
+bool ThingSpeak_Busy(void) {
+	return ts_state != TS_IDLE;
+}
+
+
+uint32_t ThingSpeak_Completed(void) {
+	// Counts the upload state machine's returns to idle, whatever the outcome
+	return ts_completed;
+}
+
+
+void ThingSpeak_Poll(void) {
+	// Background networking task; call it as often as the main loop can
+	AT_Poll();
+#ifdef TS_USE_MQTT
+	MQTT_Poll();
+#endif
+	FlashLog_Poll();
+
+#ifndef TS_USE_MQTT
+	if (ts_awaiting && ts_sent && ((uint32_t)(now_ms() - ts_sent_at) >= TS_REPLY_TIMEOUT)) {
+		serialPrint("No answer from ThingSpeak.\r\n");
+		ThingSpeak_Abort(true);
+	}
+#endif
+
+	if ((ts_state == TS_DRAINING) && ((uint32_t)(now_ms() - ts_wait_from) >= TS_DRAIN_DELAY)) {
+		ThingSpeak_StartBulk();
+	}
+
+	if ((ts_state == TS_BACKOFF) && ((uint32_t)(now_ms() - ts_wait_from) >= RETRY_DELAY)) {
+		ts_state = TS_RUNNING;
+		ts_retried = false;
+		ThingSpeak_Queue();
+	}
+}
+
+
+void ThingSpeak_PollFor(uint32_t ms) {
+	// Run the networking task instead of idling in delaymS()
+	uint32_t start = now_ms();
+	while ((uint32_t)(now_ms() - start) < ms) {
+		ThingSpeak_Poll();
+		idle_until(now_us() + 1000);	// Until the next byte or millisecond
+	}
+}
+
+
+bool sendThingSpeak(int val, int field) {
+	// Queue the upload and return; ThingSpeak_Poll() carries it out
+	if (ThingSpeak_Busy()) {
+		return false;
+	}
+
+#ifdef TS_USE_MQTT
+    ts_request_len = snprintf(ts_request, sizeof(ts_request), "field%d=%d", field, val);
+#else
+    // HTTP/1.1 so the server keeps the connection open for the next upload
+    ts_request_len = snprintf(ts_request, sizeof(ts_request),
+    		"GET /update?api_key=%s&field%d=%d HTTP/1.1\r\n"
+    		"Host: %s\r\n"
+    		"Connection: keep-alive\r\n\r\n", WRITE_API, field, val, TS_HOST);
+#endif
+
+    serialPrint("Attempting Data Transmission to ThingSpeak...\r\n");
+
+    ThingSpeak_Start(false);
+    return true;
+}
+
+
+bool sendThingSpeakFields(const ts_field_t* fields, uint8_t count) {
+	// Like sendThingSpeak(), but several fields share one request
+	if (ThingSpeak_Busy() || (count == 0)) {
+		return false;
+	}
+
+#ifdef TS_USE_MQTT
+	int len = 0;						// The MQTT payload is only the fields
+#else
+	int len = snprintf(ts_request, sizeof(ts_request), "GET /update?api_key=%s", WRITE_API);
+#endif
+
+	for (uint8_t i = 0; (i < count) && ((size_t)len < sizeof(ts_request)); i++) {
+		int32_t v = fields[i].centi;
+		unsigned long mag = (v < 0) ? -(unsigned long)v : (unsigned long)v;
+
+		len += snprintf(ts_request + len, sizeof(ts_request) - len, "%sfield%d=%s%lu.%02lu",
+				(len > 0) ? "&" : "", fields[i].field, (v < 0) ? "-" : "", mag / 100, mag % 100);
+	}
+
+	if ((size_t)len >= sizeof(ts_request)) {
+		return false;
+	}
+
+#ifndef TS_USE_MQTT
+
+	len += snprintf(ts_request + len, sizeof(ts_request) - len, " HTTP/1.1\r\n"
+			"Host: %s\r\n"
+			"Connection: keep-alive\r\n\r\n", TS_HOST);
+
+	if ((size_t)len >= sizeof(ts_request)) {
+		return false;
+	}
+#endif
+	ts_request_len = len;
+
+	serialPrint("Attempting Data Transmission to ThingSpeak...\r\n");
+
+	ThingSpeak_Start(false);
+	return true;
+}
+
+
+bool ThingSpeak_AddSample(int val, int field) {
+	// Buffer a timestamped sample for the next ThingSpeak_BulkUpload()
+	if (ts_offline) {
+		return FlashLog_Append(FlashLog_Now(), val, field);
+	}
+	if (ts_count >= TS_RING_MAX) {
+		ThingSpeak_Spill(1);
+	}
+
+	flashlog_rec_t* s = &ts_ring[(ts_first + ts_count) % TS_RING_MAX];
+	s->time = FlashLog_Now();
+	s->value = val;
+	s->field = field;
+	ts_count++;
+	return true;
+}
+
+
+uint16_t ThingSpeak_Pending(void) {
+	return ts_count + FlashLog_Pending();
+}
+
+
+bool ThingSpeak_BulkUpload(void) {
+	// Upload the buffered samples, up to TS_BULK_MAX per bulk_update.json POST
+	if (ThingSpeak_Busy() || (ThingSpeak_Pending() == 0)) {
+		return false;
+	}
+
+	serialPrint("Attempting Bulk Transmission to ThingSpeak...\r\n");
 
-        IWDG_Refresh();
-        serialPrint("Data Transmission Success!\r\n");
-        break;
-    }
+	return ThingSpeak_StartBulk();		// Samples added meanwhile wait for the next one
 }
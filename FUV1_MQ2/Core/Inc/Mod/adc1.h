@@ -14,8 +14,39 @@
 #define ADC1_H
 
 #include "stm32f4xx.h"                  // Device header
+#include "Mod/pt.h"
 
-int MQ2_GetVal(void);
-void ADC_Init(void);
+#define ADC_OSR_BITS	4				// Bits gained by oversampling (4^4 conversions a block)
+#define ADC_BITS		(12 + ADC_OSR_BITS)	// Width of ADC_Read()
+#define ADC_RATE_MIN	1				// (Hz) Slowest TIM5-triggered conversion rate
+#define ADC_RATE_MAX	10000			// (Hz) Fastest; a scan of up to 5 conversions (~20 us each) fits
+
+#ifndef ADC_SENSOR_CH
+#define ADC_SENSOR_CH	1				// Sensor channels (0..7 = PA0..PA7) in scan order; 1, 4 for an LM35 and an MQ2
+#endif
+
+#define ADC_SENSORS		(sizeof((uint8_t[]){ ADC_SENSOR_CH }))	// Entries in ADC_SENSOR_CH
+
+#ifndef MQ2_SLOT
+#define MQ2_SLOT		0				// Position of the MQ2 in ADC_SENSOR_CH
+#endif
+
+typedef enum {
+	MQ2_SMOKE,
+	MQ2_LPG,
+	MQ2_CO,
+	MQ2_GASES
+} mq2_gas_t;
+
+uint32_t MQ2_Ratio(void);
+uint32_t MQ2_GetPPM(mq2_gas_t gas);
+void MQ2_Track(uint32_t alarm_ppm);
+void ADC_Init(uint32_t rate_hz);
+uint16_t ADC_Read(int slot);
+uint64_t ADC_BlockTime(void);
+uint32_t ADC_VddaMV(void);
+int32_t ADC_ChipTemp(void);
+void ADC_Stats(uint32_t* blocks, uint32_t* overruns);
+int ADC_ReadPT(pt_t* pt, int slot, uint16_t* raw);
 
 #endif // ADC1_H
@@ -0,0 +1,36 @@
+/**
+ * @file	flashlog.h
+ * @brief	Prototypes: Flash-backed sample log
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef FLASHLOG_H
+#define FLASHLOG_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
+
+// One log slot, exactly as stored in flash
+typedef struct {
+	uint32_t seq;						// Write order, across resets
+	uint32_t time;						// (s) FlashLog_Now() of the sample (acked seq for an ack)
+	int16_t value;
+	uint8_t field;						// ThingSpeak field (with flags), FLASHLOG_ACK for an ack
+	uint8_t check;						// Written last; validates the whole slot
+} flashlog_rec_t;
+
+#define FLASHLOG_ACK	0xFE			// field of a record marking samples uploaded
+
+void FlashLog_Init(void);
+bool FlashLog_Append(uint32_t time, int value, uint8_t field);
+uint16_t FlashLog_Read(flashlog_rec_t* out, uint16_t max);
+void FlashLog_Ack(uint32_t seq);
+uint32_t FlashLog_Now(void);
+uint32_t FlashLog_Pending(void);
+uint32_t FlashLog_Dropped(void);
+void FlashLog_Poll(void);
+
+#endif // FLASHLOG_H
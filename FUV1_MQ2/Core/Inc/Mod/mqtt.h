@@ -0,0 +1,40 @@
+/**
+ * @file	mqtt.h
+ * @brief	Prototypes: MQTT 3.1.1 client over the ESP8266
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef MQTT_H
+#define MQTT_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
+
+// Broker and session settings; the strings must stay valid while in use
+typedef struct {
+	const char* host;
+	uint16_t port;
+	const char* client_id;
+	const char* user;					// NULL if the broker needs none
+	const char* pass;					// NULL if the broker needs none
+	uint16_t keepalive;					// (s)
+	uint8_t link;						// ESP CIPMUX link to use
+} mqtt_config_t;
+
+// Called once a publish is delivered (QoS 0: a PINGRESP after it, QoS 1: PUBACK) or given up
+typedef void (*mqtt_callback_t)(bool ok, void* ctx);
+
+void MQTT_Init(const mqtt_config_t* config);
+bool MQTT_Publish(const char* topic, const char* payload, uint16_t len, uint8_t qos,
+		mqtt_callback_t cb, void* ctx);
+bool MQTT_Busy(void);
+bool MQTT_Connected(void);
+void MQTT_Poll(void);
+void MQTT_OnLine(const char* line);
+void MQTT_OnData(uint8_t link, uint8_t c);
+uint32_t MQTT_BytesSent(void);
+
+#endif // MQTT_H
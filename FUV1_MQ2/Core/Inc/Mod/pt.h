@@ -0,0 +1,81 @@
+/**
+ * @file	pt.h
+ * @brief	Protothreads: stackless coroutines for the drivers
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * A protothread is a function taking a pt_t* and returning PT_WAITING or
+ * PT_YIELDED until it is done (PT_EXITED/PT_ENDED). Each call resumes it
+ * where it last waited, so one loop can step several of them in turn:
+ *
+ *	while (PT_SCHEDULE(LCD_BeginPT(&lcd_pt, 16, 2, 0))) { ... }
+ *
+ * The resume point is kept as a line number and jumped to with a switch,
+ * after Adam Dunkels' protothreads. Hence:
+ * 	- local variables do not survive a wait; keep such state static or in
+ * 	  the caller
+ * 	- a thread may not wait inside a switch of its own, nor twice on one line
+ */
+
+#ifndef PT_H
+#define PT_H
+
+#include "Mod/timing.h"
+#include <stdint.h>
+
+typedef struct {
+	uint16_t lc;						// Resume point (line), 0 to start over
+	uint64_t until;						// (us) Deadline of PT_DELAY_US()/PT_DELAY_MS()
+} pt_t;
+
+#define PT_WAITING		0
+#define PT_YIELDED		1
+#define PT_EXITED		2
+#define PT_ENDED		3
+
+#define PT_POLL_US		1000			// Sleep cap of PT_BLOCK() for a condition wait
+
+#define PT_FALLTHROUGH			__attribute__((fallthrough))	// Into the resume point
+
+#define PT_INIT(pt)				do { (pt)->lc = 0; (pt)->until = 0; } while (0)
+
+#define PT_BEGIN(pt)			{ uint8_t pt_yielded = 1; (void)pt_yielded; \
+								switch ((pt)->lc) { case 0:
+
+#define PT_END(pt)				} (pt)->lc = 0; return PT_ENDED; }
+
+#define PT_WAIT_UNTIL(pt, cond)	do { (pt)->lc = __LINE__; PT_FALLTHROUGH; case __LINE__: \
+								if (!(cond)) { return PT_WAITING; } } while (0)
+
+#define PT_WAIT_WHILE(pt, cond)	PT_WAIT_UNTIL((pt), !(cond))
+
+#define PT_YIELD(pt)			do { pt_yielded = 0; (pt)->lc = __LINE__; PT_FALLTHROUGH; case __LINE__: \
+								if (pt_yielded == 0) { return PT_YIELDED; } } while (0)
+
+#define PT_EXIT(pt)				do { (pt)->lc = 0; return PT_EXITED; } while (0)
+
+// Still running: call it again
+#define PT_SCHEDULE(f)			((f) < PT_EXITED)
+
+// Started and not yet done
+#define PT_RUNNING(pt)			((pt)->lc != 0)
+
+// Run a child thread to completion, waiting on it
+#define PT_SPAWN(pt, child, thread) do { PT_INIT((child)); \
+								PT_WAIT_WHILE((pt), PT_SCHEDULE(thread)); } while (0)
+
+#define PT_DELAY_US(pt, us)		do { (pt)->until = now_us() + (us); \
+								PT_WAIT_UNTIL((pt), now_us() >= (pt)->until); } while (0)
+
+#define PT_DELAY_MS(pt, ms)		PT_DELAY_US((pt), (uint64_t)(ms) * 1000)
+
+// Run a thread to completion from blocking code, sleeping through its waits
+#define PT_BLOCK(pt, thread)	do { PT_INIT((pt)); while (PT_SCHEDULE(thread)) { \
+								uint64_t pt_now = now_us(); \
+								idle_until(((pt)->until > pt_now) ? (pt)->until : pt_now + PT_POLL_US); \
+								} } while (0)
+
+#endif // PT_H
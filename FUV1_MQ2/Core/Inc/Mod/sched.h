@@ -0,0 +1,42 @@
+/**
+ * @file	sched.h
+ * @brief	Prototypes: Timer wheel scheduler for periodic jobs
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "stm32f4xx.h"                  // Device header
+#include <stdint.h>
+#include <stdbool.h>
+
+// Called from Sched_Run() when the timer expires
+typedef void (*sched_job_t)(void* ctx);
+
+// One software timer; owned by the caller, must stay valid while started
+typedef struct sched_timer {
+	struct sched_timer* next;			// Wheel slot links
+	struct sched_timer* prev;
+	struct sched_timer* ready_next;		// Expired, waiting to run
+	sched_job_t job;
+	void* ctx;
+	uint32_t due;						// (ms) now_ms() to expire at
+	uint32_t period;					// (ms) 0 for a one-shot
+	uint32_t jitter_us;					// Worst start delay behind the due time
+	uint32_t overruns;					// Periods skipped because the loop was late
+	uint8_t state;
+} sched_timer_t;
+
+void Sched_Init(sched_timer_t* t, sched_job_t job, void* ctx);
+void Sched_Start(sched_timer_t* t, uint32_t delay_ms, uint32_t period_ms);
+void Sched_Stop(sched_timer_t* t);
+bool Sched_Active(const sched_timer_t* t);
+void Sched_Run(void);
+void Sched_Idle(uint32_t max_ms, bool deep);
+uint32_t Sched_Jitter(const sched_timer_t* t);
+uint32_t Sched_Overruns(const sched_timer_t* t);
+
+#endif // SCHED_H
@@ -0,0 +1,416 @@
+/**
+ * @file	flashlog.c
+ * @brief	Library code: Flash-backed sample log
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * System configuration/build:
+ * 	- Flash sectors 1-3 (0x08004000-0x0800FFFF, 3 x 16 KB) are reserved as
+ * 	  the LOG region in STM32F411RETX_FLASH.ld; the program starts after it
+ *	- Flash programmed 32 bits at a time (2.7 V - 3.6 V supply)
+ *
+ * Samples are appended to the three sectors as a ring of 12-byte slots, so
+ * every sector is erased equally often. Each slot carries a sequence number
+ * that orders it across resets, and an upload is recorded by appending an
+ * ack record rather than rewriting anything, so a slot is programmed once
+ * per erase.
+ *
+ * An append only programs the slot at the head: three words, no search.
+ * The sector the head enters next is erased ahead of time by
+ * FlashLog_Poll(). The F411 has a single flash bank, so the CPU stalls on
+ * any fetch from flash while an erase runs: 250-500 ms for a 16 KB sector
+ * (1-2 s for the larger ones). The main loop waits it out, but the sampling
+ * interrupt must not: FlashLog_Init() moves the vector table to RAM, and
+ * the handlers that run through an erase are RAMFUNC (see Mod/timing.h),
+ * so the alarm keeps to its period.
+ *
+ * Power loss:
+ * 	- Mid-append: the check byte is in the last word programmed, so a torn
+ * 	  slot fails its check. It is ignored and the head moves past it.
+ * 	- Mid-erase: the sector's marker word is cleared before the erase and
+ * 	  only rewritten after it, so a half-erased sector is erased again
+ * 	  before use.
+ *
+ * When the log is full, the oldest sector is erased with any samples it
+ * still holds; those are counted by FlashLog_Dropped().
+ *
+ * Samples are stamped with FlashLog_Now(), a clock in seconds that carries
+ * on across resets, so the gaps between them are real ones whichever side
+ * of a reset they were taken on. FlashLog_Poll() keeps it, to the millisecond, in
+ * RTC backup registers, which a watchdog reset leaves alone; a power cut clears that,
+ * and the clock then resumes from the newest sample in the log. The time
+ * the node was off (or hung, up to the watchdog timeout) is not counted.
+ */
+
+#include "Mod/flashlog.h"
+#include "Mod/timing.h"
+#include <stddef.h>
+
+#define LOG_SECTOR_FIRST	1				// Flash sector at the start of the LOG region
+#define LOG_SECTORS			3
+#define LOG_SECTOR_SIZE		0x4000			// Sectors 1-3 are 16 KB each
+#define LOG_PER_SECTOR		(LOG_SECTOR_SIZE / sizeof(flashlog_rec_t))
+#define LOG_SLOTS			(LOG_SECTORS * LOG_PER_SECTOR)
+#define LOG_ERASE_MARGIN	64				// Free slots left when the next sector is erased
+#define LOG_MAGIC			0x474F4C46		// "FLOG", last word of a usable sector
+
+#define LOG_KEY1			0x45670123
+#define LOG_KEY2			0xCDEF89AB
+#define LOG_SR_ERRORS		(FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | FLASH_SR_WRPERR)
+#define LOG_VECTORS			(16 + SPI5_IRQn + 1)	// Core exceptions, then the F411's IRQs
+#define LOG_CLOCK			(RTC->BKP0R)			// FlashLog_Now(), through a watchdog reset
+#define LOG_CLOCK_MS		(RTC->BKP1R)			// (ms) and past that second
+
+extern const uint8_t _slog[];				// Start of the LOG region (linker script)
+extern const uint32_t g_pfnVectors[];		// Vector table in flash (startup file)
+
+// VTOR needs the table aligned to its size, rounded up to a power of two
+static uint32_t ram_vectors[LOG_VECTORS] __attribute__((aligned(512)));
+
+_Static_assert(sizeof(ram_vectors) <= 512, "align ram_vectors to the next power of two");
+
+static bool ready = false;					// FlashLog_Init() has run
+static uint16_t head = 0;					// Next slot to program
+static uint16_t tail = 0;					// Oldest slot that may hold an unacked sample
+static uint32_t next_seq = 1;
+static uint32_t acked = 0;					// Samples up to this seq are uploaded
+static uint32_t pending = 0;
+static uint32_t dropped = 0;
+static int8_t writing = -1;					// Sector the head is writing into
+static int8_t erased = -1;					// Sector erased and ready for the head
+static int8_t erasing = -1;					// Sector erase in progress
+static uint64_t clock_base = 0;				// (ms) FlashLog_Now() when TIM2 started
+
+
+static const flashlog_rec_t* Log_Slot(uint16_t slot) {
+	// Sectors do not hold a whole number of slots; the spare bytes hold LOG_MAGIC
+	return (const flashlog_rec_t*)(_slog + (slot / LOG_PER_SECTOR) * LOG_SECTOR_SIZE
+			+ (slot % LOG_PER_SECTOR) * sizeof(flashlog_rec_t));
+}
+
+
+static volatile uint32_t* Log_Magic(uint8_t sector) {
+	return (volatile uint32_t*)(_slog + (sector + 1) * LOG_SECTOR_SIZE - 4);
+}
+
+
+static uint8_t Log_Check(const flashlog_rec_t* r) {
+	// CRC-8 (polynomial 0x07) over everything but the check byte itself
+	const uint8_t* p = (const uint8_t*)r;
+	uint8_t crc = 0;
+
+	for (unsigned int i = 0; i < offsetof(flashlog_rec_t, check); i++) {
+		crc ^= p[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+		}
+	}
+	return crc;
+}
+
+
+static bool Log_Blank(const flashlog_rec_t* r) {
+	const uint32_t* w = (const uint32_t*)r;
+	return (w[0] == 0xFFFFFFFF) && (w[1] == 0xFFFFFFFF) && (w[2] == 0xFFFFFFFF);
+}
+
+
+static bool Log_Valid(const flashlog_rec_t* r) {
+	return !Log_Blank(r) && (r->check == Log_Check(r));
+}
+
+
+static bool Log_IsSample(const flashlog_rec_t* r) {
+	return Log_Valid(r) && (r->field != FLASHLOG_ACK);
+}
+
+
+static bool Log_SectorReady(uint8_t sector) {
+	// Erased, marked, and nothing written since
+	if (*Log_Magic(sector) != LOG_MAGIC) {
+		return false;
+	}
+	for (uint16_t i = 0; i < LOG_PER_SECTOR; i++) {
+		if (!Log_Blank(Log_Slot(sector * LOG_PER_SECTOR + i))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+static void Log_Unlock(void) {
+	if (FLASH->CR & FLASH_CR_LOCK) {
+		FLASH->KEYR = LOG_KEY1;
+		FLASH->KEYR = LOG_KEY2;
+	}
+}
+
+
+static void Log_RamVectors(void) {
+	// Take interrupts through a copy in RAM, so an erase does not hold them back
+	uint32_t primask = __get_PRIMASK();
+
+	if (SCB->VTOR == (uint32_t)ram_vectors) {
+		return;
+	}
+	for (unsigned int i = 0; i < LOG_VECTORS; i++) {
+		ram_vectors[i] = g_pfnVectors[i];
+	}
+	__disable_irq();
+	SCB->VTOR = (uint32_t)ram_vectors;
+	__DSB();
+	__set_PRIMASK(primask);
+}
+
+
+static bool Log_Program(volatile uint32_t* dst, const uint32_t* src, uint8_t words) {
+	Log_Unlock();
+	FLASH->SR = LOG_SR_ERRORS;				// Clear stale error flags
+	FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+
+	for (uint8_t i = 0; i < words; i++) {
+		dst[i] = src[i];
+		SPIN_WHILE(FLASH->SR & FLASH_SR_BSY);		// ~16 us per word
+	}
+
+	FLASH->CR &= ~FLASH_CR_PG;
+	FLASH->CR |= FLASH_CR_LOCK;
+	return !(FLASH->SR & LOG_SR_ERRORS);
+}
+
+
+static void Log_FlushCache(void) {
+	// The ART data cache may still hold what the sector contained before
+	if (FLASH->ACR & FLASH_ACR_DCEN) {
+		FLASH->ACR &= ~FLASH_ACR_DCEN;
+		FLASH->ACR |= FLASH_ACR_DCRST;
+		FLASH->ACR &= ~FLASH_ACR_DCRST;
+		FLASH->ACR |= FLASH_ACR_DCEN;
+	}
+}
+
+
+static void Log_StartErase(uint8_t sector) {
+	// Samples still waiting in the sector are lost; move the tail past them
+	for (uint16_t i = 0; i < LOG_PER_SECTOR; i++) {
+		const flashlog_rec_t* r = Log_Slot(sector * LOG_PER_SECTOR + i);
+		if (Log_IsSample(r) && (r->seq > acked)) {
+			pending--;
+			dropped++;
+		}
+	}
+	if ((tail / LOG_PER_SECTOR) == sector) {
+		tail = ((sector + 1) % LOG_SECTORS) * LOG_PER_SECTOR;
+	}
+
+	// Clear the marker first, so an interrupted erase is redone
+	const uint32_t zero = 0;
+	Log_Program(Log_Magic(sector), &zero, 1);
+
+	Log_Unlock();
+	FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SNB)) | FLASH_CR_PSIZE_1
+			| FLASH_CR_SER | ((LOG_SECTOR_FIRST + sector) << FLASH_CR_SNB_Pos);
+	FLASH->CR |= FLASH_CR_STRT;
+	erasing = sector;
+}
+
+
+static void Log_FinishErase(void) {
+	SPIN_WHILE(FLASH->SR & FLASH_SR_BSY);
+	FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+	Log_FlushCache();
+
+	const uint32_t magic = LOG_MAGIC;
+	if (Log_Program(Log_Magic(erasing), &magic, 1)) {
+		erased = erasing;
+	}
+	erasing = -1;
+}
+
+
+static bool Log_Write(uint32_t time, int value, uint8_t field) {
+	if (erasing >= 0) {
+		Log_FinishErase();
+	}
+
+	int8_t sector = head / LOG_PER_SECTOR;
+	if (sector != writing) {
+		if (sector != erased) {
+			return false;					// FlashLog_Poll() has not erased it yet
+		}
+		writing = sector;
+		erased = -1;
+	}
+
+	flashlog_rec_t r = { next_seq, time, value, field, 0 };
+	r.check = Log_Check(&r);
+
+	volatile uint32_t* dst = (volatile uint32_t*)Log_Slot(head);
+	head = (head + 1) % LOG_SLOTS;			// A failed slot is not retried
+	if (!Log_Program(dst, (const uint32_t*)&r, sizeof(r) / 4)) {
+		return false;
+	}
+	next_seq++;
+	return true;
+}
+
+
+void FlashLog_Init(void) {
+	int max_slot = -1;
+	uint32_t max_seq = 0;
+	uint32_t max_time = 0;
+
+	// Find the newest record, the newest sample time and the last upload acked
+	for (uint16_t slot = 0; slot < LOG_SLOTS; slot++) {
+		const flashlog_rec_t* r = Log_Slot(slot);
+		if ((*Log_Magic(slot / LOG_PER_SECTOR) != LOG_MAGIC) || !Log_Valid(r)) {
+			continue;
+		}
+		if (r->seq > max_seq) {
+			max_seq = r->seq;
+			max_slot = slot;
+		}
+		if ((r->field == FLASHLOG_ACK) && (r->time > acked)) {
+			acked = r->time;
+		} else if ((r->field != FLASHLOG_ACK) && (r->time > max_time)) {
+			max_time = r->time;
+		}
+	}
+	next_seq = max_seq + 1;
+
+	// The clock resumes from the backup register, or after a power cut the log
+	RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+	PWR->CR |= PWR_CR_DBP;							// Backup domain write access
+	if ((LOG_CLOCK > max_time) && (LOG_CLOCK_MS < 1000)) {
+		clock_base = (uint64_t)LOG_CLOCK * 1000 + LOG_CLOCK_MS;
+	} else {
+		clock_base = (uint64_t)max_time * 1000;
+	}
+
+	// Resume after the newest record, past any slot torn by a reset
+	writing = -1;
+	head = 0;
+	if (max_slot >= 0) {
+		writing = max_slot / LOG_PER_SECTOR;
+		head = (max_slot + 1) % LOG_SLOTS;
+		while (((int8_t)(head / LOG_PER_SECTOR) == writing) && !Log_Blank(Log_Slot(head))) {
+			head = (head + 1) % LOG_SLOTS;
+		}
+	}
+
+	// Count what is left to upload, oldest first
+	pending = 0;
+	tail = head;
+	for (uint16_t i = 1; i <= LOG_SLOTS; i++) {
+		uint16_t slot = (head + i) % LOG_SLOTS;
+		const flashlog_rec_t* r = Log_Slot(slot);
+		if ((*Log_Magic(slot / LOG_PER_SECTOR) == LOG_MAGIC) && Log_IsSample(r) && (r->seq > acked)) {
+			if (pending == 0) {
+				tail = slot;
+			}
+			pending++;
+		}
+	}
+
+	int8_t sector = head / LOG_PER_SECTOR;
+	uint8_t next = (sector != writing) ? sector : (sector + 1) % LOG_SECTORS;
+	erased = Log_SectorReady(next) ? next : -1;
+	erasing = -1;
+	Log_RamVectors();
+	ready = true;
+}
+
+
+bool FlashLog_Append(uint32_t time, int value, uint8_t field) {
+	// Store a sample until FlashLog_Ack() covers it
+	if (!ready || !Log_Write(time, value, field)) {
+		dropped++;
+		return false;
+	}
+	pending++;
+	return true;
+}
+
+
+uint16_t FlashLog_Read(flashlog_rec_t* out, uint16_t max) {
+	// Copy out up to max of the oldest samples not acked yet, oldest first
+	uint16_t n = 0;
+
+	for (uint16_t slot = tail; (slot != head) && (n < max); slot = (slot + 1) % LOG_SLOTS) {
+		const flashlog_rec_t* r = Log_Slot(slot);
+		if (Log_IsSample(r) && (r->seq > acked)) {
+			out[n++] = *r;
+		}
+	}
+	return n;
+}
+
+
+void FlashLog_Ack(uint32_t seq) {
+	// Every sample up to seq has been uploaded
+	for (; tail != head; tail = (tail + 1) % LOG_SLOTS) {
+		const flashlog_rec_t* r = Log_Slot(tail);
+		if (!Log_IsSample(r) || (r->seq <= acked)) {
+			continue;
+		}
+		if (r->seq > seq) {
+			break;
+		}
+		pending--;
+	}
+	acked = seq;
+
+	// If this cannot be written, the samples are sent again after a reset
+	Log_Write(seq, 0, FLASHLOG_ACK);
+}
+
+
+uint32_t FlashLog_Now(void) {
+	// (s) Sample time for FlashLog_Append(), counted across resets
+	return (uint32_t)((clock_base + now_us() / 1000) / 1000);
+}
+
+
+uint32_t FlashLog_Pending(void) {
+	return pending;
+}
+
+
+uint32_t FlashLog_Dropped(void) {
+	return dropped;
+}
+
+
+void FlashLog_Poll(void) {
+	// Erase the sector the head needs next; call from the main loop
+	if (!ready) {
+		return;
+	}
+	uint64_t clock = clock_base + now_us() / 1000;
+	LOG_CLOCK_MS = (uint32_t)(clock % 1000);
+	LOG_CLOCK = (uint32_t)(clock / 1000);
+	if (erasing >= 0) {
+		if (!(FLASH->SR & FLASH_SR_BSY)) {
+			Log_FinishErase();
+		}
+		return;
+	}
+
+	int8_t sector = head / LOG_PER_SECTOR;
+	int8_t target;
+	if (sector != writing) {
+		target = sector;					// Head is already waiting on it
+	} else if ((LOG_PER_SECTOR - (head % LOG_PER_SECTOR)) <= LOG_ERASE_MARGIN) {
+		target = (sector + 1) % LOG_SECTORS;
+	} else {
+		return;
+	}
+
+	if (target != erased) {
+		Log_StartErase(target);
+	}
+}
@@ -12,8 +12,8 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *	- I2C Pins (Bidirectional):
  * 		- SCL @ PB8 (I2C1_SCL)
  * 		- SDA @ PB9 (I2C1_SDA)
@@ -25,6 +25,11 @@
 
 
 #include "Mod/i2c1.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include "Mod/prof.h"
+
+#define PCLK1_MHZ	(PCLK1_HZ / 1000000)
 
 
 void I2C_Init(void) {
@@ -53,35 +58,37 @@ void I2C_Init(void) {
      *  From the datasheet,
      *      t_w(SCLH) = 4 us           SCL clock high time
      *      t_r(SCL) = 1000 ns          SDA and SCL rise time
-     *      T_PCLK1 = 1/16 MHz
+     *      T_PCLK1 = 1/PCLK1_MHZ (1/50 MHz)
      *
      *  Therefore,
      *      CCR = (t_r(SCL) + t_w(SCLH)) / T_PCLK1
-     *      CCR = 80
+     *      CCR = 5 * PCLK1_MHZ = 250
      *
      *      TRISE = (t_r(SCL) / T_PCLK1) + 1
-     *      TRISE = 17
+     *      TRISE = PCLK1_MHZ + 1 = 51
      */
 
     I2C1->CR1 |= (1 << 15);                	   // Software reset I2C1
     I2C1->CR1 &= ~(1 << 15);               	   // Clear reset
 
     I2C1->CR1 &= ~(1 << 0);                    // Disable I2C1
-    I2C1->CR2 = 16;                            // Set PCLK1 frequency (16 MHz)
-    I2C1->CCR = 80;                            // Set CCR value (Standard mode, 100 kHz)
-    I2C1->TRISE = 17;                          // Set TRISE value
+    I2C1->CR2 = PCLK1_MHZ;                     // Set PCLK1 frequency (MHz)
+    I2C1->CCR = 5 * PCLK1_MHZ;                 // Set CCR value (Standard mode, 100 kHz)
+    I2C1->TRISE = PCLK1_MHZ + 1;               // Set TRISE value
     I2C1->CR1 |= (1 << 0);                     // Enable I2C1
 }
 
 void I2C_Write(uint8_t addr, uint8_t data) {
-    while (I2C1->SR2 & (1 << 1)){;}  			// Wait until the I2C bus is not busy
+    PROF_ZONE(PROF_I2C_WRITE);
+
+    SPIN_WHILE(I2C1->SR2 & (1 << 1));			// Wait until the I2C bus is not busy
     I2C1->CR1 |= (1 << 8);         				// Generate a START condition
-    while (!(I2C1->SR1 & (1 << 0))){;} 			// Wait for START condition
+    SPIN_WHILE(!(I2C1->SR1 & (1 << 0)));			// Wait for START condition
     I2C1->DR = addr << 1;          				// Send the slave address with write bit
-    while (!(I2C1->SR1 & (1 << 1))){;} 			// Wait for address to be sent
+    SPIN_WHILE(!(I2C1->SR1 & (1 << 1)));			// Wait for address to be sent
     (void)I2C1->SR2;               				// Clear ADDR flag
-    while (!(I2C1->SR1 & (1 << 7))){;} 			// Wait for data register to be empty
+    SPIN_WHILE(!(I2C1->SR1 & (1 << 7)));			// Wait for data register to be empty
     I2C1->DR = data;               				// Send the data byte
-    while (!(I2C1->SR1 & (1 << 2))){;} 			// Wait for data transfer to finish
+    SPIN_WHILE(!(I2C1->SR1 & (1 << 2)));			// Wait for data transfer to finish
     I2C1->CR1 |= (1 << 9);         				// Generate a STOP condition
 }
@@ -13,8 +13,8 @@
 
 /*
  * System configuration/build:
- * 	- Clock source == HSI (~16 MHz)
- * 		- No AHB & APB1/2 prescaling
+ * 	- Clock source == PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 		- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *	- Inputs:
  * 		- USART Input @ PA3 (USART2_RX)
  * 	- Outputs:
@@ -27,6 +27,8 @@
 
 
 #include "Mod/usart2.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
 
 
 void usart2_Init(void) {
@@ -42,7 +44,7 @@ void usart2_Init(void) {
 
     // Configure the baud rate
     USART2->BRR &= ~(0x0000FFFF);
-    USART2->BRR |= (0x0000008B);
+    USART2->BRR |= USART_BRR(PCLK1_HZ, 115200); // 115200 baud from APB1
 
     // Now enable the USART peripheral
     USART2->CR1 |= (0x1UL << (2U)) // enable receive
@@ -52,12 +54,21 @@ void usart2_Init(void) {
 
 
 int usart2_tx_send(int c) {
-    while (!(USART2->SR & (0x1UL << (7U)))) {}; // wait until we are able to transmit
+    SPIN_WHILE(!(USART2->SR & (0x1UL << (7U)))); // wait until we are able to transmit
     USART2->DR = c; // transmit the character
     return c;
 }
 
 
+bool usart2_rx_read(uint8_t* c) {
+    if (!(USART2->SR & (0x1UL << (5U)))) { // nothing received
+        return false;
+    }
+    *c = USART2->DR; // also clears an overrun
+    return true;
+}
+
+
 void serialPrint(const char* s) {
     while (*s) {
     	usart2_tx_send(*s++);
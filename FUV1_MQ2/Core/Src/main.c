@@ -9,10 +9,10 @@
  * @section Configuration
  * System configuration/build:
  * 		- Clock source:
- * 				- HSI (~16 MHz)
- * 				- No AHB & APB1/2 prescaling
+ * 				- PLL from the HSI (100 MHz, see Mod/clock.h)
+ * 				- APB1 = 50 MHz (timers 100 MHz), APB2 = 100 MHz
  *		- Inputs:
- * 				- ADC Analog @ PA1 (Channel 1)
+ * 				- ADC Analog @ PA1 (Channel 1), triggered by TIM5 CC1
  * 				- USART Input @ PA10 (USART1_RX)
  * 				- USART Input @ PA3 (USART2_RX)
  * 		- Outputs:
@@ -33,6 +33,7 @@
  *					- PASS
  *					- WRITE_API
  *					- READ_API
+ *					- CHANNEL_ID
  *				- ./main.c
  *					- THRESHOLD
  *					- FIELD_NUM
@@ -50,120 +51,268 @@
 #include "stm32f4xx.h" 			// Header for the specific device family
 #include <stm32f411xe.h>
 
+#include <Mod/clock.h>
 #include <Mod/timing.h>
 #include <Mod/usart1.h>
+#include <Mod/esp_at.h>
 #include <Mod/usart2.h>
 #include <Mod/i2c1.h>
 #include <Mod/lcd1602.h>
 #include <Mod/adc1.h>
+#include <Mod/flashlog.h>
+#include <Mod/sched.h>
+#include <Mod/prof.h>
+#include <Mod/monitor.h>
+#include <Mod/sampler.h>
 
 #include <stdio.h>				// For sprintf()
 
 #define SEND_INTERVAL 	100000 	// 100 seconds interval for sending to cloud
-#define THRESHOLD 		350		// (ADC) System will trigger alarm if this value is reached
+#define SAMPLE_PERIOD	100		// (ms) TIM3 sampling, SAMPLER_PERIOD_MIN..SAMPLER_PERIOD_MAX
+#define SAMPLE_INTERVAL	1000	// (ms) Buffering the average for the bulk upload
+#define ADC_RATE		10000	// (Hz) ADC conversions; a 256-conversion block every 25.6 ms
+#define DISPLAY_INTERVAL 1000	// (ms) LCD refresh
+#define WATCHDOG_INTERVAL 1000	// (ms) IWDG kick, if every job has checked in
+#define JOB_SLACK		2000	// (ms) Lateness a job may have before the monitor holds the IWDG kick
+#define IDLE_MAX		1000	// (ms) Longest sleep between jobs
+#define IDLE_BUSY		10		// (ms) Longest sleep while the ESP8266 is busy
+#define IDLE_STEP		1		// (ms) Longest sleep while the LCD is being brought up
+#define THRESHOLD 		1000	// (ppm smoke) System will trigger alarm if this value is reached
 #define FIELD_NUM 		1		// ThingSpeak Field number for the specific sensor
-#define WIFI_DELAY		1000	// (ms)
-#define INITIAL_DELAY	25		// (s)
+#define INITIAL_DELAY	25		// (s) From reset to the first buffered sample (sensor warm-up)
+#define BOOT_STAGES		6		// Boot timeline entries
 
 /************************** Function Prototypes *******************************/
 
 void Buzzer_Init(void);
-void TIM3_Init(void);
-void TIM3_IRQHandler(void);
-volatile uint32_t seconds_count = 0;
+void Boot_Mark(const char* stage);
+void Boot_Report(void);
+void Boot_Step(void);
+void Sample_Tick(uint64_t t_us);
+void Sample_Drain(void);
+void Alarm_Check(const sample_t* s, uint64_t data_us);
+void Watchdog_Job(void* ctx);
+void Display_Job(void* ctx);
+void Sample_Job(void* ctx);
+void Upload_Job(void* ctx);
+
+volatile uint32_t alarm_worst_us = 0;	// Worst time from a TIM3 update to its buzzer write
+volatile uint32_t alarm_age_us = 0;		// Worst age of the ADC data judged, at the buzzer write
+int32_t latest = 0;						// (ppm smoke) Newest sample, from Sample_Drain()
+int64_t sample_sum = 0;					// Samples drained since the last Sample_Job()
+uint32_t sample_count = 0;
+
+sched_timer_t watchdog_job, display_job, sample_job, upload_job;
+int display_mon, sample_mon, upload_mon;	// Deadline monitor ids
+uint32_t uploads_seen = 0;				// ThingSpeak_Completed() at the last upload check-in
+
+pt_t lcd_pt, wifi_pt;					// Start-up, run from the loop
+bool lcd_ready = false;
+bool wifi_ready = false;
+struct {
+	const char* stage;
+	uint32_t us;						// now_us() when it was reached
+} boot_log[BOOT_STAGES];
+int boot_count = 0;
 
 /************************* Main Function **************************************/
 
 int main(void) {
-	IWDG_Refresh();
-
+	Clock_Init();						// 100 MHz before any peripheral is set up
+	bool wdog_reset = Monitor_Init();	// Reads the reset flags
 	IWDG_Init();
 	TIM2_Init();
-	TIM3_Init();
-	I2C_Init();
-	LCD_Init();
-
-	LCD_SendString("Initializing", 0, 2, true);
-	LCD_SendString("System", 1, 5, true);
-	delaymS(1000);
+	Boot_Mark("clock");
 
+	// Sensing first: the alarm needs none of the slow parts below
 	Buzzer_Init();
-	ADC_Init();
-	SysTick_Init();
+	ADC_Init(ADC_RATE);
+	Sampler_Init(SAMPLE_PERIOD, Sample_Tick);	// Alarm is live from here on
+	Boot_Mark("alarm live");
+
 	usart1_Init();
 	usart2_Init();
+	if (wdog_reset) {
+		Monitor_Report();				// What starved the loop last time
+	}
+	FlashLog_Init();					// Samples not uploaded before a reset
+	I2C_Init();
 
-	delaymS(WIFI_DELAY);
-	LCD_SendString("Connecting", 0, 3, true);
-	LCD_SendString("WIFI", 1, 6, true);
-	WiFi_Init();
-	IWDG_Refresh();
-
-	LCD_ClearRow(1);
-	LCD_SendString("Success!", 0, 4, true);
-	delaymS(1500);
-
-	LCD_ClearRow(0);
+	// The LCD and the WiFi join come up from the loop, in Boot_Step()
+	PT_INIT(&lcd_pt);
+	PT_INIT(&wifi_pt);
 
-	char smokebuff[50];
+	// Each job runs at its own rate; buffering starts after the initial delay
+	Sched_Init(&watchdog_job, Watchdog_Job, NULL);
+	Sched_Init(&display_job, Display_Job, NULL);
+	Sched_Init(&sample_job, Sample_Job, NULL);
+	Sched_Init(&upload_job, Upload_Job, NULL);
 
-	int delayed = 0;
-	int interval_start = 1;
+	Sched_Start(&watchdog_job, 0, WATCHDOG_INTERVAL);
+	Sched_Start(&display_job, 0, DISPLAY_INTERVAL);
+	Sched_Start(&sample_job, INITIAL_DELAY * 1000, SAMPLE_INTERVAL);
+	Sched_Start(&upload_job, INITIAL_DELAY * 1000 + SEND_INTERVAL, SEND_INTERVAL);
 
-//	char timebuff[100];
-	seconds_count = 0;
+	// Each job must check in within its period plus some slack
+	display_mon = Monitor_Register("display", 0, DISPLAY_INTERVAL + JOB_SLACK);
+	sample_mon = Monitor_Register("sample", INITIAL_DELAY * 1000, SAMPLE_INTERVAL + JOB_SLACK);
+	upload_mon = Monitor_Register("upload", INITIAL_DELAY * 1000 + SEND_INTERVAL,
+			SEND_INTERVAL + JOB_SLACK);
 
 	/* Loop forever */
 	while (1) {
-		IWDG_Refresh();
-//		sprintf(timebuff, "%u\r\n", seconds_count);
-//		serialPrint(timebuff);
-
-		/******************************** Sense and Display to LCD ********************************/
-		// Sense data
-		int smoke_adc = MQ2_GetVal();
-
-		// Monitor the temperature
-		if (smoke_adc >= THRESHOLD) {
-			// Temperature sensed exceeds threshold -> trigger alarm
-			GPIOB->ODR |= (1 << 1);				// Alarm ON
-		} else {
-			GPIOB->ODR &= ~(1 << 1);			// Alarm OFF
+		bool busy;
+		{
+			PROF_ZONE(PROF_LOOP);
+			Sample_Drain();
+			Boot_Step();
+			Sched_Run();
+			ThingSpeak_Poll();			// Service the ESP8266 between jobs
+			busy = ThingSpeak_Busy() || AT_Busy() || !wifi_ready;
 		}
+		Prof_Poll();					// Debug builds: profile table on request
+
+		// Sleep until the next job; ESP8266 data and each sample wake it early
+		Sched_Idle(!lcd_ready ? IDLE_STEP : (busy ? IDLE_BUSY : IDLE_MAX), false);
+	}
+}
+
+/******************************* Boot Sequence ********************************/
+
+void Boot_Mark(const char* stage) {
+	// Timestamp a start-up stage for Boot_Report()
+	if (boot_count < BOOT_STAGES) {
+		boot_log[boot_count].stage = stage;
+		boot_log[boot_count].us = (uint32_t)now_us();
+		boot_count++;
+	}
+}
 
-		// Display the data to LCD
-		LCD_SendString("Smoke ADC Val:", 0, 0, false);
-		sprintf(smokebuff, "%d", smoke_adc);
-		LCD_SendString(smokebuff, 1, 0, true);
-		IWDG_Refresh();
-		/******************************************************************************************/
-
-		if ((seconds_count >= (INITIAL_DELAY - WIFI_DELAY/1000)) || delayed) {
-			if (interval_start) {
-				serialPrint("initial delay done\r\n");
-				interval_start = 0;
-				delayed = 1;
-				seconds_count = 0;
-			}
-
-			if (seconds_count >= 100) {
-				// transmit to Thingspeak
-				LCD_ClearRow(1);
-				LCD_SendString("Sending data", 0, 0, true);
-
-				sendThingSpeak(smoke_adc, FIELD_NUM);
-
-				LCD_SendString("Success!", 1, 0, true);
-				seconds_count = 0;
-			}
+void Boot_Report(void) {
+	char line[60];
+
+	serialPrint("boot timeline (from TIM2 start):\r\n");
+	for (int i = 0; i < boot_count; i++) {
+		sprintf(line, "  %10lu us  %s\r\n", boot_log[i].us, boot_log[i].stage);
+		serialPrint(line);
+	}
+}
+
+void Boot_Step(void) {
+	// Carry the LCD bring-up and the WiFi join on side by side
+	if (!lcd_ready && !PT_SCHEDULE(LCD_InitPT(&lcd_pt))) {
+		lcd_ready = true;
+		Boot_Mark("LCD ready");
+		if (!wifi_ready) {
+			LCD_SendString("Connecting", 0, 3, true);
+			LCD_SendString("WIFI", 1, 6, true);
 		}
+	}
 
-		// Loop every 1s
-		delaymS(1000);
-		LCD_Clear();
+	if (!wifi_ready && !PT_SCHEDULE(WiFi_InitPT(&wifi_pt))) {
+		wifi_ready = true;
+		Boot_Mark("WiFi ready");
+		if (lcd_ready) {
+			LCD_ClearRow(1);
+			LCD_SendString("Success!", 0, 4, true);
+		}
+		Boot_Report();
 	}
 }
 
+/****************************** Scheduled Jobs ********************************/
+
+void Watchdog_Job(void* ctx) {
+	Monitor_Kick();
+}
+
+void Display_Job(void* ctx) {
+	char smokebuff[50];
+
+	Monitor_CheckIn(display_mon);
+
+	if (!lcd_ready || !wifi_ready) {
+		return;							// Start-up messages still showing
+	}
+
+	// Sensing and the alarm run in the TIM3 interrupt; show the newest sample
+	int smoke_ppm = latest;
+
+	LCD_Clear();
+	LCD_SendString("Smoke ppm:", 0, 0, false);
+	sprintf(smokebuff, "%d", smoke_ppm);
+	LCD_SendString(smokebuff, 1, 0, true);
+}
+
+void Sample_Job(void* ctx) {
+	static bool first = true;
+
+	Monitor_CheckIn(sample_mon);
+	MQ2_Track(THRESHOLD);				// Baseline from the end of warm-up, then clean air
+
+	if (first) {
+		serialPrint("initial delay done\r\n");
+		first = false;
+		sample_sum = 0;					// Drop what came in during the initial delay
+		sample_count = 0;
+		return;
+	}
+	if (sample_count == 0) {
+		return;							// Nothing new since the last run
+	}
+
+	// Buffer the average since the last run; they go up together in one bulk update
+	int32_t value = (int32_t)(sample_sum / sample_count);
+	sample_sum = 0;
+	sample_count = 0;
+	ThingSpeak_AddSample(value, FIELD_NUM);
+}
+
+void Upload_Job(void* ctx) {
+	char report[100];
+	uint32_t run_ms, sleep_ms, blocks, overruns;
+
+	// Only once the previous upload has completed, so a stuck one starves the monitor
+	if (!ThingSpeak_Busy() || (ThingSpeak_Completed() != uploads_seen)) {
+		uploads_seen = ThingSpeak_Completed();
+		Monitor_CheckIn(upload_mon);
+	}
+
+	if (!wifi_ready || ThingSpeak_Busy()) {
+		return;							// Not joined yet, or last upload still running; samples stay buffered
+	}
+
+	// transmit to Thingspeak; the upload runs in the background
+	if (lcd_ready) {
+		LCD_ClearRow(1);
+		LCD_SendString("Sending data", 0, 0, true);
+	}
+	ThingSpeak_BulkUpload();
+
+	sprintf(report, "alarm latency (worst): %lu us from the data, %lu us from the tick\r\n",
+			alarm_age_us, alarm_worst_us);
+	serialPrint(report);
+	sprintf(report, "samples: every %u ms, %lu dropped\r\n", SAMPLE_PERIOD, Sampler_Dropped());
+	serialPrint(report);
+	sprintf(report, "mq2: Rs/R0 %lu/1024, LPG %lu ppm, CO %lu ppm\r\n", MQ2_Ratio(),
+			MQ2_GetPPM(MQ2_LPG), MQ2_GetPPM(MQ2_CO));
+	serialPrint(report);
+	ADC_Stats(&blocks, &overruns);
+	sprintf(report, "adc: %u Hz, %lu blocks, %lu overruns, VDDA %lu mV, chip %ld C\r\n", ADC_RATE,
+			blocks, overruns, ADC_VddaMV(), ADC_ChipTemp() / 100);
+	serialPrint(report);
+	sprintf(report, "job jitter (worst): sample %lu us, display %lu us, upload %lu us\r\n",
+			Sched_Jitter(&sample_job), Sched_Jitter(&display_job), Sched_Jitter(&upload_job));
+	serialPrint(report);
+
+	Duty_Read(&run_ms, &sleep_ms);
+	sprintf(report, "duty cycle: run %lu ms, sleep %lu ms (%lu%% awake)\r\n", run_ms, sleep_ms,
+			(uint32_t)((uint64_t)run_ms * 100 / ((run_ms + sleep_ms) ? (run_ms + sleep_ms) : 1)));
+	serialPrint(report);
+
+	Monitor_Report();
+}
+
 /************************** Buzzer Initialization *****************************/
 
 void Buzzer_Init(void) {
@@ -176,28 +325,55 @@ void Buzzer_Init(void) {
 	GPIOB->OTYPER &= ~(1 << 1);			// Push-pull output
 }
 
-void TIM3_Init(void) {
-    // Enable TIM3 clock
-    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+/************************** Sampling (from TIM3) ******************************/
 
-    // Configure TIM3: count up, prescaler for 1 ms tick, update on overflow
-    TIM3->PSC = 16000 - 1;  // Prescaler to divide the clock by 16000 (1 kHz timer clock)
-    TIM3->ARR = 1000 - 1;   // Auto-reload value to generate 1-second tick
-    TIM3->CNT = 0;          // Clear counter
+RAMFUNC void Sample_Tick(uint64_t t_us) {
+	// Runs in the TIM3 interrupt every SAMPLE_PERIOD: read, act on the alarm
+	// at once, and queue the sample for the main loop
+	sample_t s = { .t_us = t_us };
+	uint64_t data_us = ADC_BlockTime();			// Before the value: a newer block only makes it older
 
-    // Enable the update interrupt
-    TIM3->DIER |= TIM_DIER_UIE;
+	s.value[0] = MQ2_GetPPM(MQ2_SMOKE);			// (ppm) Default baseline until warm-up is over
+	Alarm_Check(&s, data_us);
+	Sampler_Push(&s);
+}
 
-    // Enable the TIM3 interrupt in the NVIC
-    NVIC_EnableIRQ(TIM3_IRQn);
+void Sample_Drain(void) {
+	// Take the queued samples: the newest for the display, all for the average
+	static bool first = true;
+	sample_t s;
 
-    // Enable the timer
-    TIM3->CR1 |= TIM_CR1_CEN;
+	while (Sampler_Pop(&s)) {
+		if (first) {
+			Boot_Mark("first sample");
+			first = false;
+		}
+		latest = s.value[0];
+		sample_sum += s.value[0];
+		sample_count++;
+	}
 }
 
-void TIM3_IRQHandler(void) {
-    if (TIM3->SR & TIM_SR_UIF) {  // Check for update interrupt flag
-        TIM3->SR &= ~TIM_SR_UIF;  // Clear update interrupt flag
-        seconds_count++;
-    }
+RAMFUNC void Alarm_Check(const sample_t* s, uint64_t data_us) {
+	// Runs in the TIM3 interrupt, so the alarm keeps up even while the main
+	// loop is busy with the LCD or the ESP8266
+	// Monitor the smoke level
+	if (s->value[0] >= THRESHOLD) {
+		// Value sensed exceeds threshold -> trigger alarm
+		GPIOB->ODR |= (1 << 1);				// Alarm ON
+	} else {
+		GPIOB->ODR &= ~(1 << 1);			// Alarm OFF
+	}
+
+	// Record the worst response latency: from the TIM3 update, and from the
+	// first conversion of the ADC block judged (data_us), to the buzzer write
+	uint64_t now = now_us();
+	uint32_t latency_us = (uint32_t)(now - s->t_us);
+	uint32_t age_us = (uint32_t)(now - data_us);
+	if (latency_us > alarm_worst_us) {
+		alarm_worst_us = latency_us;
+	}
+	if ((data_us != 0) && (age_us > alarm_age_us)) {
+		alarm_age_us = age_us;
+	}
 }
@@ -0,0 +1,97 @@
+/**
+ * @file	cmsis_host.h
+ * @brief	Host build: CMSIS compiler definitions and core intrinsics
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Takes the place of cmsis_compiler.h. The intrinsics that touch the core's
+ * state go to the simulator: PRIMASK is its interrupt mask and __WFI()
+ * moves virtual time on to the next interrupt.
+ */
+
+#ifndef CMSIS_HOST_H
+#define CMSIS_HOST_H
+
+#define __CMSIS_COMPILER_H			// Keeps the Arm cmsis_compiler.h out
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "sim.h"
+
+#define __ASM						__asm
+#define __INLINE					inline
+#define __STATIC_INLINE				static inline
+#define __STATIC_FORCEINLINE		__attribute__((always_inline)) static inline
+#define __NO_RETURN					__attribute__((__noreturn__))
+#define __USED						__attribute__((used))
+#define __WEAK						__attribute__((weak))
+#define __PACKED					__attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT				struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION				union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)				__attribute__((aligned(x)))
+#define __RESTRICT					__restrict
+#define __COMPILER_BARRIER()		__asm volatile("" ::: "memory")
+
+__STATIC_FORCEINLINE void __enable_irq(void) {
+	sim_primask_set(0);
+}
+
+__STATIC_FORCEINLINE void __disable_irq(void) {
+	sim_primask_set(1);
+}
+
+__STATIC_FORCEINLINE uint32_t __get_PRIMASK(void) {
+	return sim_primask_get();
+}
+
+__STATIC_FORCEINLINE void __set_PRIMASK(uint32_t primask) {
+	sim_primask_set(primask & 1);
+}
+
+__STATIC_FORCEINLINE void __WFI(void) {
+	sim_wfi();
+}
+
+__STATIC_FORCEINLINE void __WFE(void) {
+	sim_wfi();
+}
+
+__STATIC_FORCEINLINE void __NOP(void) {
+	sim_spin();						// Only ever found in loops waiting on something
+}
+
+__STATIC_FORCEINLINE void __DSB(void) {
+	__sync_synchronize();
+}
+
+__STATIC_FORCEINLINE void __DMB(void) {
+	__sync_synchronize();
+}
+
+__STATIC_FORCEINLINE void __ISB(void) {
+	__sync_synchronize();
+}
+
+__STATIC_FORCEINLINE uint8_t __CLZ(uint32_t value) {
+	return (value == 0) ? 32 : (uint8_t)__builtin_clz(value);
+}
+
+__STATIC_FORCEINLINE uint32_t __RBIT(uint32_t value) {
+	uint32_t result = 0;
+
+	for (int i = 0; i < 32; i++) {
+		result = (result << 1) | ((value >> i) & 1);
+	}
+	return result;
+}
+
+__STATIC_FORCEINLINE uint32_t __REV(uint32_t value) {
+	return __builtin_bswap32(value);
+}
+
+#define __BKPT(value)				abort()
+
+#endif // CMSIS_HOST_H
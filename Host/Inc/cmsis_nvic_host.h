@@ -0,0 +1,25 @@
+/**
+ * @file	cmsis_nvic_host.h
+ * @brief	Host build: NVIC functions routed to the simulator
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef CMSIS_NVIC_HOST_H
+#define CMSIS_NVIC_HOST_H
+
+#define NVIC_SetPriorityGrouping	__NVIC_SetPriorityGrouping
+#define NVIC_GetPriorityGrouping	__NVIC_GetPriorityGrouping
+#define NVIC_EnableIRQ				sim_nvic_enable
+#define NVIC_GetEnableIRQ			__NVIC_GetEnableIRQ
+#define NVIC_DisableIRQ				sim_nvic_disable
+#define NVIC_GetPendingIRQ			__NVIC_GetPendingIRQ
+#define NVIC_SetPendingIRQ			sim_nvic_set_pending
+#define NVIC_ClearPendingIRQ		__NVIC_ClearPendingIRQ
+#define NVIC_GetActive				__NVIC_GetActive
+#define NVIC_SetPriority			sim_nvic_set_priority
+#define NVIC_GetPriority			sim_nvic_get_priority
+#define NVIC_SystemReset			__NVIC_SystemReset
+
+#endif // CMSIS_NVIC_HOST_H
@@ -0,0 +1,25 @@
+/**
+ * @file	core_cm4.h
+ * @brief	Host build: Cortex-M4 core header over the host intrinsics
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The real core_cm4.h is used for the core peripherals (SCB, NVIC, DWT...),
+ * but its cmsis_compiler.h is for an Arm target. cmsis_host.h stands in for
+ * it, and the NVIC functions are routed to the simulator.
+ */
+
+#ifndef HOST_CORE_CM4_H
+#define HOST_CORE_CM4_H
+
+#include "cmsis_host.h"
+
+#define CMSIS_NVIC_VIRTUAL
+#define CMSIS_NVIC_VIRTUAL_HEADER_FILE	"cmsis_nvic_host.h"
+
+#include_next <core_cm4.h>
+
+#endif // HOST_CORE_CM4_H
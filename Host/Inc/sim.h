@@ -0,0 +1,226 @@
+/**
+ * @file	sim.h
+ * @brief	Host simulator: virtual clock, register file and peripheral models
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The firmware is built for the host unchanged: the CMSIS device header
+ * is the real one, and its peripherals are mapped at their real addresses
+ * (see sim.c), so every register access is an ordinary memory access. What
+ * the firmware writes is picked up by the models at the next sync point:
+ * SPIN_HOOK(), __WFI() and the PRIMASK intrinsics. Virtual time only moves
+ * at those points, so the firmware's code runs in zero time and everything
+ * it reads between two sync points is consistent.
+ *
+ * Interrupts are dispatched at sync points, through the vector table SCB->VTOR
+ * points at, when PRIMASK allows. All the firmware's handlers run at one
+ * priority (as on the target), so they never nest.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SIM_US(x)		((uint64_t)(x) * 1000ULL)			// Virtual time is in ns
+#define SIM_MS(x)		((uint64_t)(x) * 1000000ULL)
+#define SIM_S(x)		((uint64_t)(x) * 1000000000ULL)
+#define SIM_NEVER		UINT64_MAX
+
+/******************************** Core ****************************************/
+
+typedef void (*sim_entry_t)(void);
+typedef void (*sim_event_t)(void* ctx);
+
+typedef enum {
+	SIM_RETURNED,						// The entry function returned
+	SIM_TIME_UP,						// sim_run()'s time ran out
+	SIM_STOPPED,						// sim_stop() from an event
+} sim_result_t;
+
+typedef enum {
+	SIM_RESET_POWER,					// Power cycle: RAM and the backup domain are lost
+	SIM_RESET_IWDG,						// Watchdog: RAM (.noinit) and the backup domain survive
+} sim_reset_t;
+
+// What the core saw the firmware do; cleared by sim_init() only
+typedef struct {
+	uint32_t resets[2];					// By sim_reset_t
+	uint32_t irqs;						// Handlers dispatched
+	uint32_t stalls;					// Flash busy while code had to be fetched from it
+	uint64_t stall_ns;					// Their total length
+	uint64_t stall_max_ns;
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+void sim_init(void);
+uint64_t sim_now(void);
+sim_result_t sim_run(sim_entry_t entry, uint64_t duration);
+void sim_stop(void);
+void sim_at(uint64_t when, sim_event_t fn, void* ctx);
+void sim_reset(sim_reset_t kind);
+bool sim_verbose(void);
+
+// Firmware side: SPIN_SYNC(), SPIN_HOOK(), the CMSIS intrinsics and NVIC functions
+void sim_sync(void);
+void sim_spin(void);
+void sim_wfi(void);
+uint32_t sim_primask_get(void);
+void sim_primask_set(uint32_t primask);
+void sim_nvic_enable(int irqn);
+void sim_nvic_disable(int irqn);
+void sim_nvic_set_priority(int irqn, uint32_t priority);
+uint32_t sim_nvic_get_priority(int irqn);
+void sim_nvic_set_pending(int irqn);
+
+// Model side
+typedef struct {
+	const char* name;
+	void (*reset)(sim_reset_t kind);	// Registers to their reset values
+	void (*sync)(void);					// Take up what the firmware wrote
+	void (*update)(uint64_t now);		// Run what is due by now, refresh derived registers
+	uint64_t (*next)(void);				// When update() next has something to do
+} sim_model_t;
+
+void sim_add_model(const sim_model_t* model);
+void sim_irq_source(int irqn, bool (*level)(void), void (*taken)(void));
+uint64_t sim_stall_until(void);			// While the flash is busy (see sim_flash.c)
+
+/***************************** Register file **********************************/
+
+uint32_t sim_hclk(void);				// Clocks, as RCC is configured
+uint32_t sim_pclk1(void);
+uint32_t sim_pclk2(void);
+uint32_t sim_timclk1(void);
+uint32_t sim_lsi_hz(void);
+
+// GPIO pins: what drives an input, and who watches an output
+typedef void (*sim_pin_watch_t)(int port, int pin, bool level, uint64_t now);
+void sim_gpio_input(int port, int pin, bool (*level)(uint64_t now));
+void sim_gpio_watch(int port, int pin, sim_pin_watch_t fn);
+bool sim_gpio_driven_low(int port, int pin);
+bool sim_gpio_output(int port, int pin);
+
+/******************************** Flash ***************************************/
+
+typedef enum {
+	SIM_CUT_NONE,
+	SIM_CUT_WORD,						// Power lost while the n-th word is programmed
+	SIM_CUT_ERASE,						// Power lost partway through the n-th erase
+} sim_cut_t;
+
+void sim_flash_cut(sim_cut_t kind, uint32_t n);
+uint32_t sim_flash_words(void);			// Words programmed so far
+uint32_t sim_flash_erases(void);
+void sim_flash_erase_time(uint64_t ns);	// Per 16 KB sector (default 400 ms)
+
+/******************************* USARTs ***************************************/
+
+// USART1 faces the ESP8266 model; USART2 is the debug console
+void sim_usart1_to_mcu(const void* data, size_t len, uint32_t baud, uint64_t delay);
+uint32_t sim_usart1_baud(void);
+uint64_t sim_usart1_idle_at(void);		// When the bytes queued for the MCU are all out
+uint32_t sim_usart1_overruns(void);
+uint32_t sim_usart1_tx_overwritten(void);	// DMA buffers changed before they were sent
+const char* sim_console(void);			// Everything printed on USART2
+void sim_console_clear(void);
+
+/******************************** ADC *****************************************/
+
+// Millivolts on an ADC channel at a time; channels 17/18 default to VREFINT/the die sensor
+typedef double (*sim_analog_t)(uint64_t now);
+void sim_adc_source(int channel, sim_analog_t mv);
+void sim_adc_vdda(double mv);
+uint32_t sim_adc_conversions(void);
+
+/****************************** Devices ***************************************/
+
+// HD44780 on a PCF8574 at I2C address 0x27
+const char* sim_lcd_row(int row);
+uint32_t sim_lcd_writes(void);
+uint32_t sim_lcd_violations(void);		// Writes made before the LCD was ready for them
+
+// DHT22 on PA8
+typedef struct {
+	double temp;						// (Celsius)
+	double rh;							// (%)
+} sim_dht_t;
+void sim_dht_source(sim_dht_t (*read)(uint64_t now));
+void sim_dht_fail(bool silent);			// Stop answering
+uint32_t sim_dht_reads(void);
+uint32_t sim_dht_too_soon(void);		// Starts less than 2 s after the last one
+
+// ESP8266 AT firmware (sim_esp.c)
+typedef struct {
+	const char* channel;				// Channel taking bulk updates and MQTT publishes; NULL: "1234567"
+	const char* write_key;				// Key taken by GET /update; NULL: any
+	uint32_t status;					// HTTP status; 200 by default
+	bool entry_zero;					// GET /update answers "0" (rate limited)
+	uint32_t idle_close_ms;				// Server closes an idle keep-alive link; 0: never
+	bool silent_close;					// ... without the ESP reporting "CLOSED"
+	uint32_t max_requests;				// Server closes after this many on a link; 0: no limit
+	uint32_t rtt_ms;					// Round trip to the server
+	uint32_t connect_ms;				// CIPSTART's TCP handshake; 0: one round trip
+	bool unreachable;					// CIPSTART fails
+} sim_http_t;
+
+typedef struct {
+	bool refuse;						// CONNACK with return code 5
+	bool drop_publish;					// Close the link on a PUBLISH instead of taking it
+	bool silent;						// Stop answering (PINGREQ/PUBLISH go unanswered)
+} sim_broker_t;
+
+typedef struct {
+	uint32_t field;
+	double value;
+	double time;						// (s) Entry time on the server, from delta_t where given
+	uint64_t at;						// When the request was taken
+} sim_entry_rec_t;
+
+typedef struct {
+	uint32_t cipstarts;
+	uint32_t cipsends;
+	uint32_t cipcloses;
+	uint32_t already_connected;
+	uint32_t requests;					// HTTP requests answered
+	uint32_t rejected;					// ... with a non-2xx status or entry "0"
+	uint32_t publishes;					// MQTT PUBLISH packets taken
+	uint32_t pingreqs;
+	uint32_t garbled;					// Bytes lost to a baud mismatch
+	uint32_t corrupt;					// Requests that did not parse
+	uint64_t uart_bytes;				// MCU to ESP, AT commands included
+	uint64_t payload_bytes;				// Sent on TCP links
+	uint64_t link_in_bytes;				// Received on TCP links ("+IPD" payloads)
+} sim_esp_stats_t;
+
+void sim_esp_ap(bool up);				// Access point in range
+void sim_esp_http(const sim_http_t* cfg);
+void sim_esp_broker(const sim_broker_t* cfg);
+void sim_esp_server_close(void);		// Server drops the link now
+const sim_esp_stats_t* sim_esp_stats(void);
+size_t sim_esp_entries(const sim_entry_rec_t** out);
+void sim_esp_clear_entries(void);
+const char* sim_esp_log(void);			// Lines the ESP received, one per command
+
+/******************************** Tests ***************************************/
+
+extern int sim_failures;
+
+#define SIM_CHECK(cond, ...)	do { \
+		if (!(cond)) { \
+			sim_failures++; \
+			printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+		} \
+	} while (0)
+
+int sim_report(const char* name);
+
+#endif // SIM_H
@@ -0,0 +1,34 @@
+/**
+ * @file	stm32f4xx.h
+ * @brief	Host build: the device header, with the simulator's hooks
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Found ahead of Drivers/CMSIS/Device/ST/STM32F4xx/Include, so the firmware's
+ * #include "stm32f4xx.h" gets the real header and, through it, the real
+ * register definitions; only core_cm4.h is swapped (see Host/Inc/core_cm4.h).
+ */
+
+#ifndef HOST_STM32F4XX_H
+#define HOST_STM32F4XX_H
+
+#ifndef STM32F411xE
+#define STM32F411xE
+#endif
+
+#include_next <stm32f4xx.h>
+#include "sim.h"
+
+// Busy-waits advance the peripheral models (see Mod/timing.h)
+#define SPIN_SYNC()			sim_sync()
+#define SPIN_HOOK()			sim_spin()
+
+// Linked apart from the rest, so the simulator can tell RAM code from flash code
+#ifndef RAMFUNC
+#define RAMFUNC				__attribute__((section("ramfunc"), noinline))
+#endif
+
+#endif // HOST_STM32F4XX_H
@@ -0,0 +1,719 @@
+/**
+ * @file	sim.c
+ * @brief	Host simulator: register file, virtual clock and interrupts
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Memory map:
+ * 	- The peripheral, core peripheral, system memory and flash regions are
+ * 	  anonymous mappings at their target addresses, so the CMSIS pointers
+ * 	  (RCC, TIM2, SCB...) work as they are.
+ * 	- The executable is linked without PIE (see Host/CMakeLists.txt), so the
+ * 	  firmware's RAM sits below 4 GB and survives the (uint32_t) casts it
+ * 	  makes for DMA addresses and the vector table.
+ * 	- The firmware's .data/.bss are gathered into .fwdata by host.ld. A copy
+ * 	  taken before the first boot is put back at every reset, as the startup
+ * 	  code would; .noinit (.fwnoinit) is only lost to a power cycle.
+ *
+ * Virtual time moves at the sync points only: by one SIM_SPIN_NS step in
+ * SPIN_HOOK(), to the next pending interrupt in __WFI(), and by SIM_CODE_NS
+ * at the others, for the code run since the last one (without it, a loop
+ * that polls the clock between critical sections would never see it move).
+ * Models report when
+ * they next have something to do (a flag to set, a byte to deliver) and
+ * the clock goes from one such point to the next.
+ *
+ * Flash: while the flash is busy (an erase or a program), the CPU cannot
+ * fetch from it. Code linked as RAMFUNC runs on; anything else (a sync
+ * point or function entry in flash code, a vector table or handler in
+ * flash) stalls until the flash is done, with interrupts held pending.
+ * Function entries and returns are seen through -finstrument-functions.
+ */
+
+#define _GNU_SOURCE
+#include "sim_internal.h"
+#include "stm32f4xx.h"
+#include <sys/mman.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_SPIN_NS		1000				// Virtual time per SPIN_HOOK()
+#define SIM_CODE_NS		100					// ... and per other sync point
+#define SIM_IRQS		96
+#define SIM_MODELS_MAX	24
+#define SIM_EVENTS_MAX	1024
+#define SIM_LOOP_MAX	1000000				// Updates at one instant before a model is taken as stuck
+
+#define SIM_JMP_RESET	1
+#define SIM_JMP_END		2
+
+typedef struct {
+	uint64_t when;
+	uint64_t seq;							// Same-time events run in the order scheduled
+	sim_event_t fn;
+	void* ctx;
+} sim_ev_t;
+
+static const struct {
+	uintptr_t base;
+	size_t size;
+} sim_regions[] = {
+	{ 0x40000000, 0x80000 },				// APB1, APB2, AHB1 (RCC, FLASH interface, DMA)
+	{ 0xE0000000, 0x100000 },				// Private peripheral bus (DWT, NVIC, SCB)
+	{ 0x1FFF0000, 0x10000 },				// System memory, OTP, factory calibration
+	{ FLASH_BASE, 0x80000 },				// Main flash, 512 KB
+};
+
+sim_stats_t sim_stats;
+int sim_failures = 0;
+
+uint32_t SystemCoreClock = 16000000;		// system_stm32f4xx.c is target only
+uint32_t g_pfnVectors[16 + SIM_IRQS];		// The flash vector table
+
+// The firmware's RAM image (host.ld), and its RAM-resident code
+extern char __fw_data_start[], __fw_data_end[];
+extern char __fw_noinit_start[], __fw_noinit_end[];
+extern char __start_ramfunc[] __attribute__((weak));
+extern char __stop_ramfunc[] __attribute__((weak));
+
+static char* fw_image = NULL;				// .fwdata as linked
+static bool mapped = false;
+
+static uint64_t now = 0;
+static uint64_t run_until = SIM_NEVER;
+static jmp_buf run_jmp;
+static bool running = false;
+static bool stop_requested = false;
+static sim_result_t end_reason;
+
+static uint32_t primask = 0;
+static int active_irq = -1;					// Handler running, if any
+static void (*active_handler)(void);		// ... and its entry point
+static bool irq_enabled[SIM_IRQS];
+static uint8_t irq_list[SIM_IRQS];			// The enabled ones, in order
+static int irq_count = 0;
+static bool irq_soft[SIM_IRQS];				// NVIC_SetPendingIRQ()
+static uint8_t irq_prio[SIM_IRQS];
+static struct {
+	bool (*level)(void);
+	void (*taken)(void);
+} irq_src[SIM_IRQS];
+
+static const sim_model_t* models[SIM_MODELS_MAX];
+static int model_count = 0;
+
+static sim_ev_t events[SIM_EVENTS_MAX];
+static int event_count = 0;
+static uint64_t event_seq = 0;
+
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+// Handlers the firmware may define; the others stay NULL
+#define SIM_HANDLERS(X) \
+	X(WWDG) X(PVD) X(TAMP_STAMP) X(RTC_WKUP) X(FLASH) X(RCC) X(EXTI0) X(EXTI1) \
+	X(EXTI2) X(EXTI3) X(EXTI4) X(DMA1_Stream0) X(DMA1_Stream1) X(DMA1_Stream2) \
+	X(DMA1_Stream3) X(DMA1_Stream4) X(DMA1_Stream5) X(DMA1_Stream6) X(ADC) \
+	X(EXTI9_5) X(TIM1_BRK_TIM9) X(TIM1_UP_TIM10) X(TIM1_TRG_COM_TIM11) X(TIM1_CC) \
+	X(TIM2) X(TIM3) X(TIM4) X(I2C1_EV) X(I2C1_ER) X(I2C2_EV) X(I2C2_ER) X(SPI1) \
+	X(SPI2) X(USART1) X(USART2) X(EXTI15_10) X(RTC_Alarm) X(OTG_FS_WKUP) \
+	X(DMA1_Stream7) X(SDIO) X(TIM5) X(SPI3) X(DMA2_Stream0) X(DMA2_Stream1) \
+	X(DMA2_Stream2) X(DMA2_Stream3) X(DMA2_Stream4) X(OTG_FS) X(DMA2_Stream5) \
+	X(DMA2_Stream6) X(DMA2_Stream7) X(USART6) X(I2C3_EV) X(I2C3_ER) X(FPU) \
+	X(SPI4) X(SPI5)
+
+#define SIM_DECLARE(name)	extern void name##_IRQHandler(void) __attribute__((weak));
+SIM_HANDLERS(SIM_DECLARE)
+
+static void sim_sync_all(void);
+static void sim_dispatch(void);
+
+
+/******************************** Helpers *************************************/
+
+uint64_t sim_random(void) {
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return rng;
+}
+
+
+static bool sim_in_ram(const void* pc) {
+	const char* p = (const char*)pc;
+	return (__start_ramfunc != NULL) && (p >= __start_ramfunc) && (p < __stop_ramfunc);
+}
+
+
+bool sim_verbose(void) {
+	static int verbose = -1;
+
+	if (verbose < 0) {
+		const char* v = getenv("SIM_VERBOSE");
+		verbose = (v != NULL) && (v[0] != '\0') && (v[0] != '0');
+	}
+	return verbose;
+}
+
+
+/******************************** Events **************************************/
+
+static bool sim_ev_before(const sim_ev_t* a, const sim_ev_t* b) {
+	return (a->when < b->when) || ((a->when == b->when) && (a->seq < b->seq));
+}
+
+
+void sim_at(uint64_t when, sim_event_t fn, void* ctx) {
+	if (event_count >= SIM_EVENTS_MAX) {
+		fprintf(stderr, "sim: event queue full\n");
+		abort();
+	}
+
+	int i = event_count++;
+	events[i] = (sim_ev_t){ when, event_seq++, fn, ctx };
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!sim_ev_before(&events[i], &events[parent])) {
+			break;
+		}
+		sim_ev_t t = events[i];
+		events[i] = events[parent];
+		events[parent] = t;
+		i = parent;
+	}
+}
+
+
+static sim_ev_t sim_ev_pop(void) {
+	sim_ev_t top = events[0];
+	int i = 0;
+
+	events[0] = events[--event_count];
+	for (;;) {
+		int l = 2 * i + 1, r = l + 1, m = i;
+		if ((l < event_count) && sim_ev_before(&events[l], &events[m])) {
+			m = l;
+		}
+		if ((r < event_count) && sim_ev_before(&events[r], &events[m])) {
+			m = r;
+		}
+		if (m == i) {
+			break;
+		}
+		sim_ev_t t = events[i];
+		events[i] = events[m];
+		events[m] = t;
+		i = m;
+	}
+	return top;
+}
+
+
+/******************************** Models **************************************/
+
+void sim_add_model(const sim_model_t* model) {
+	for (int i = 0; i < model_count; i++) {
+		if (models[i] == model) {
+			return;
+		}
+	}
+	if (model_count >= SIM_MODELS_MAX) {
+		fprintf(stderr, "sim: too many models\n");
+		abort();
+	}
+	models[model_count++] = model;
+}
+
+
+void sim_irq_source(int irqn, bool (*level)(void), void (*taken)(void)) {
+	irq_src[irqn].level = level;
+	irq_src[irqn].taken = taken;
+}
+
+
+static void sim_sync_all(void) {
+	for (int i = 0; i < model_count; i++) {
+		if (models[i]->sync) {
+			models[i]->sync();
+		}
+	}
+}
+
+
+static uint64_t sim_next_due(void) {
+	uint64_t t = (event_count > 0) ? events[0].when : SIM_NEVER;
+
+	for (int i = 0; i < model_count; i++) {
+		if (models[i]->next) {
+			uint64_t m = models[i]->next();
+			if (m < t) {
+				t = m;
+			}
+		}
+	}
+	return t;
+}
+
+
+static void sim_update_all(uint64_t t) {
+	now = t;
+	for (int i = 0; i < model_count; i++) {
+		if (models[i]->update) {
+			models[i]->update(t);
+		}
+	}
+	while ((event_count > 0) && (events[0].when <= t)) {
+		sim_ev_t ev = sim_ev_pop();
+		ev.fn(ev.ctx);
+	}
+}
+
+
+/****************************** Interrupts ************************************/
+
+static bool sim_irq_active(int n) {
+	if (!irq_enabled[n]) {
+		return false;
+	}
+	return irq_soft[n] || ((irq_src[n].level != NULL) && irq_src[n].level());
+}
+
+
+static int sim_irq_next(void) {
+	// Highest priority (lowest value) first, then the lowest number
+	int best = -1;
+
+	for (int i = 0; i < irq_count; i++) {
+		int n = irq_list[i];
+		if (sim_irq_active(n) && ((best < 0) || (irq_prio[n] < irq_prio[best]))) {
+			best = n;
+		}
+	}
+	return best;
+}
+
+
+static void sim_irq_relist(void) {
+	irq_count = 0;
+	for (int n = 0; n < SIM_IRQS; n++) {
+		if (irq_enabled[n]) {
+			irq_list[irq_count++] = (uint8_t)n;
+		}
+	}
+}
+
+
+static bool sim_irq_takeable(void) {
+	return (primask == 0) && (active_irq < 0) && (sim_irq_next() >= 0);
+}
+
+
+void sim_nvic_enable(int irqn) {
+	if ((irqn >= 0) && (irqn < SIM_IRQS)) {
+		irq_enabled[irqn] = true;
+		sim_irq_relist();
+	}
+}
+
+
+void sim_nvic_disable(int irqn) {
+	if ((irqn >= 0) && (irqn < SIM_IRQS)) {
+		irq_enabled[irqn] = false;
+		sim_irq_relist();
+	}
+}
+
+
+void sim_nvic_set_priority(int irqn, uint32_t priority) {
+	if ((irqn >= 0) && (irqn < SIM_IRQS)) {
+		irq_prio[irqn] = priority & 0x0F;
+	}
+}
+
+
+uint32_t sim_nvic_get_priority(int irqn) {
+	return ((irqn >= 0) && (irqn < SIM_IRQS)) ? irq_prio[irqn] : 0;
+}
+
+
+void sim_nvic_set_pending(int irqn) {
+	if ((irqn >= 0) && (irqn < SIM_IRQS)) {
+		irq_soft[irqn] = true;
+	}
+}
+
+
+/********************************* Time ***************************************/
+
+uint64_t sim_now(void) {
+	return now;
+}
+
+
+static void sim_check_end(void) {
+	if (!running) {
+		return;
+	}
+	if (stop_requested) {
+		stop_requested = false;
+		end_reason = SIM_STOPPED;
+		longjmp(run_jmp, SIM_JMP_END);
+	}
+	if (now >= run_until) {
+		end_reason = SIM_TIME_UP;
+		longjmp(run_jmp, SIM_JMP_END);
+	}
+}
+
+
+typedef enum {
+	SIM_ADVANCE_PLAIN,						// To the target, interrupts held
+	SIM_ADVANCE_SPIN,						// Until an interrupt can be taken
+	SIM_ADVANCE_WFI,						// Until an interrupt is pending
+	SIM_ADVANCE_STALL,						// Until one can be taken from RAM alone
+} sim_advance_t;
+
+static bool sim_irq_from_ram(void);
+
+static void sim_advance(uint64_t target, sim_advance_t mode) {
+	uint32_t same = 0;
+
+	if (target > run_until) {
+		target = run_until;
+	}
+	for (;;) {
+		uint64_t t = sim_next_due();
+		if (t > target) {
+			t = target;
+		}
+		if (t < now) {
+			t = now;
+		}
+		same = (t == now) ? (same + 1) : 0;
+		if (same > SIM_LOOP_MAX) {
+			fprintf(stderr, "sim: stuck at %llu ns\n", (unsigned long long)now);
+			abort();
+		}
+
+		sim_update_all(t);
+		sim_check_end();
+		if (t >= target) {
+			return;
+		}
+		if ((mode == SIM_ADVANCE_SPIN) && sim_irq_takeable()) {
+			return;
+		}
+		if ((mode == SIM_ADVANCE_WFI) && (sim_irq_next() >= 0)) {
+			return;
+		}
+		if ((mode == SIM_ADVANCE_STALL) && sim_irq_takeable() && sim_irq_from_ram()) {
+			return;
+		}
+	}
+}
+
+
+static void sim_stall(void) {
+	/*
+	 * Wait the flash out. Nothing in flash runs meanwhile; an interrupt
+	 * whose vector and handler are both in RAM is still taken.
+	 */
+	uint64_t from = now;
+
+	sim_sync_all();
+	if (sim_stall_until() <= now) {
+		return;
+	}
+	while (sim_stall_until() > now) {
+		sim_advance(sim_stall_until(), SIM_ADVANCE_STALL);
+		if (sim_stall_until() > now) {
+			sim_dispatch();
+		}
+	}
+	sim_stats.stalls++;
+	sim_stats.stall_ns += now - from;
+	if ((now - from) > sim_stats.stall_max_ns) {
+		sim_stats.stall_max_ns = now - from;
+	}
+	if (sim_verbose()) {
+		printf("[%10.6f] sim: CPU stalled %.3f ms on a busy flash\n", now / 1e9, (now - from) / 1e6);
+	}
+}
+
+
+static void sim_fetch(const void* pc) {
+	// Code at pc is about to run
+	if ((sim_stall_until() > now) && !sim_in_ram(pc)) {
+		sim_stall();
+	}
+}
+
+
+/******************************** Dispatch ************************************/
+
+static void (*sim_vector(int irqn, bool* in_flash))(void) {
+	uint32_t vtor = SCB->VTOR;
+
+	if ((vtor == 0) || ((vtor >= FLASH_BASE) && (vtor <= FLASH_END))) {
+		*in_flash = true;
+		return (void (*)(void))(uintptr_t)g_pfnVectors[16 + irqn];
+	}
+	*in_flash = false;
+	return (void (*)(void))(uintptr_t)((const uint32_t*)(uintptr_t)vtor)[16 + irqn];
+}
+
+
+static bool sim_irq_from_ram(void) {
+	// The next interrupt's vector and handler can both be fetched from RAM
+	bool vec_flash;
+	int n = sim_irq_next();
+	void (*handler)(void) = (n >= 0) ? sim_vector(n, &vec_flash) : NULL;
+
+	return (handler != NULL) && !vec_flash && sim_in_ram((const void*)handler);
+}
+
+
+static void sim_dispatch(void) {
+	while ((primask == 0) && (active_irq < 0)) {
+		int n = sim_irq_next();
+		if (n < 0) {
+			return;
+		}
+
+		bool vec_flash;
+		void (*handler)(void) = sim_vector(n, &vec_flash);
+		if (vec_flash || !sim_in_ram((const void*)handler)) {
+			sim_stall();					// Vector or handler fetched from a busy flash
+		}
+		if (handler == NULL) {
+			fprintf(stderr, "sim: IRQ %d enabled and pending, but no handler\n", n);
+			abort();
+		}
+
+		irq_soft[n] = false;
+		active_irq = n;
+		active_handler = handler;
+		SCB->ICSR = (SCB->ICSR & ~SCB_ICSR_VECTACTIVE_Msk) | (uint32_t)(n + 16);
+		sim_stats.irqs++;
+
+		handler();
+
+		SCB->ICSR &= ~SCB_ICSR_VECTACTIVE_Msk;
+		active_irq = -1;
+		if (irq_src[n].taken) {
+			irq_src[n].taken();
+		}
+		sim_sync_all();
+	}
+}
+
+
+/****************************** Sync points ***********************************/
+
+void sim_sync(void) {
+	const void* pc = __builtin_return_address(0);
+
+	sim_sync_all();
+	sim_fetch(pc);
+	sim_advance(now + SIM_CODE_NS, SIM_ADVANCE_PLAIN);
+	sim_dispatch();
+}
+
+
+void sim_spin(void) {
+	const void* pc = __builtin_return_address(0);
+
+	sim_sync_all();
+	sim_fetch(pc);
+	sim_dispatch();
+	sim_advance(now + SIM_SPIN_NS, SIM_ADVANCE_SPIN);
+	sim_fetch(pc);
+	sim_dispatch();
+}
+
+
+void sim_wfi(void) {
+	const void* pc = __builtin_return_address(0);
+
+	sim_sync_all();
+	sim_fetch(pc);
+	if (sim_irq_next() < 0) {
+		sim_advance(SIM_NEVER, SIM_ADVANCE_WFI);
+	}
+	sim_dispatch();
+}
+
+
+uint32_t sim_primask_get(void) {
+	const void* pc = __builtin_return_address(0);
+
+	sim_sync_all();
+	sim_fetch(pc);
+	sim_advance(now + SIM_CODE_NS, SIM_ADVANCE_PLAIN);
+	sim_dispatch();
+	return primask;
+}
+
+
+void sim_primask_set(uint32_t mask) {
+	const void* pc = __builtin_return_address(0);
+
+	sim_sync_all();
+	sim_fetch(pc);
+	sim_advance(now + SIM_CODE_NS, SIM_ADVANCE_PLAIN);
+	primask = mask;
+	sim_dispatch();
+}
+
+
+// -finstrument-functions: every firmware function entered or returned to
+void __cyg_profile_func_enter(void* fn, void* site) __attribute__((no_instrument_function));
+void __cyg_profile_func_exit(void* fn, void* site) __attribute__((no_instrument_function));
+
+void __cyg_profile_func_enter(void* fn, void* site) {
+	(void)site;
+	sim_fetch(fn);
+}
+
+
+void __cyg_profile_func_exit(void* fn, void* site) {
+	// A handler returns to sim_dispatch(); the code it interrupted is
+	// fetched again when that resumes
+	if ((active_irq >= 0) && (fn == (void*)active_handler)) {
+		return;
+	}
+	sim_fetch(site);
+}
+
+
+/****************************** Reset / run ***********************************/
+
+static void sim_map(void) {
+	for (size_t i = 0; i < sizeof(sim_regions) / sizeof(sim_regions[0]); i++) {
+		void* p = mmap((void*)sim_regions[i].base, sim_regions[i].size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+		if (p != (void*)sim_regions[i].base) {
+			fprintf(stderr, "sim: cannot map 0x%08lx\n", (unsigned long)sim_regions[i].base);
+			exit(2);
+		}
+	}
+	memset((void*)FLASH_BASE, 0xFF, 0x80000);	// A new part: erased
+
+	// Factory calibration (typical values), taken at VDDA = 3.3 V
+	*(volatile uint16_t*)0x1FFF7A2A = 1500;		// VREFINT_CAL: 1.21 V
+	*(volatile uint16_t*)0x1FFF7A2C = 943;		// TS_CAL1: 0.76 V at 30 Celsius
+	*(volatile uint16_t*)0x1FFF7A2E = 1191;		// TS_CAL2: 0.96 V at 110 Celsius
+}
+
+
+static void sim_vectors(void) {
+	#define SIM_VECTOR(name)	g_pfnVectors[16 + name##_IRQn] = (uint32_t)(uintptr_t)name##_IRQHandler;
+	SIM_HANDLERS(SIM_VECTOR)
+	#undef SIM_VECTOR
+}
+
+
+void sim_init(void) {
+	if (!mapped) {
+		sim_map();
+		sim_vectors();
+		fw_image = malloc(__fw_data_end - __fw_data_start + 1);
+		memcpy(fw_image, __fw_data_start, __fw_data_end - __fw_data_start);
+		mapped = true;
+	}
+
+	memset(&sim_stats, 0, sizeof(sim_stats));
+	event_count = 0;
+	now = 0;
+
+	// Models in sync order: the clocks and pins first, the devices behind them last
+	sim_periph_init();
+	sim_flash_init();
+	sim_lcd_init();
+	sim_dht_init();
+	sim_esp_init();
+	sim_reset(SIM_RESET_POWER);
+	sim_stats.resets[SIM_RESET_POWER] = 0;
+}
+
+
+void sim_reset(sim_reset_t kind) {
+	// Reset the MCU; from inside sim_run(), the entry function starts over
+	sim_stats.resets[kind]++;
+
+	memcpy(__fw_data_start, fw_image, __fw_data_end - __fw_data_start);
+	if (kind == SIM_RESET_POWER) {
+		for (char* p = __fw_noinit_start; p < __fw_noinit_end; p++) {
+			*p = (char)sim_random();			// SRAM powers up random
+		}
+	}
+
+	primask = 0;
+	active_irq = -1;
+	memset(irq_enabled, 0, sizeof(irq_enabled));
+	irq_count = 0;
+	memset(irq_soft, 0, sizeof(irq_soft));
+	memset(irq_prio, 0, sizeof(irq_prio));
+	memset((void*)0xE0000000, 0, 0x100000);
+	*(volatile uint32_t*)&SCB->CPUID = 0x410FC241;	// Cortex-M4 r0p1
+	SystemCoreClock = 16000000;
+
+	for (int i = 0; i < model_count; i++) {
+		if (models[i]->reset) {
+			models[i]->reset(kind);
+		}
+	}
+
+	if (running) {
+		if (sim_verbose()) {
+			printf("[%10.6f] sim: %s reset\n", now / 1e9,
+					(kind == SIM_RESET_POWER) ? "power-on" : "watchdog");
+		}
+		longjmp(run_jmp, SIM_JMP_RESET);
+	}
+}
+
+
+sim_result_t sim_run(sim_entry_t entry, uint64_t duration) {
+	/*
+	 * Run entry (the firmware's main(), or a test) for up to duration of
+	 * virtual time. A reset in the meantime starts it over.
+	 */
+	volatile uint64_t until = (duration == SIM_NEVER) ? SIM_NEVER : now + duration;
+
+	switch (setjmp(run_jmp)) {
+	case SIM_JMP_END:
+		running = false;
+		return end_reason;
+	default:
+		break;
+	}
+
+	run_until = until;
+	stop_requested = false;
+	running = true;
+	entry();
+	running = false;
+	run_until = SIM_NEVER;
+	return SIM_RETURNED;
+}
+
+
+void sim_stop(void) {
+	// From an event: end sim_run() at once
+	stop_requested = true;
+}
+
+
+int sim_report(const char* name) {
+	if (sim_failures == 0) {
+		printf("PASS %s\n", name);
+		return 0;
+	}
+	printf("FAIL %s: %d check(s) failed\n", name, sim_failures);
+	return 1;
+}
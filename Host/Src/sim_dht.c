@@ -0,0 +1,173 @@
+/**
+ * @file	sim_dht.c
+ * @brief	Host simulator: DHT22 temperature and humidity sensor on PA8
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The data line is pulled up and driven low by either side. When the MCU
+ * has held it low for at least 1 ms and lets go, the sensor answers 30 us
+ * later: 80 us low, 80 us high, then 40 bits, each 50 us low followed by
+ * 26 us (0) or 70 us (1) high, and a final 50 us low. The bits are the
+ * humidity and temperature in tenths (the temperature's top bit is its
+ * sign) and a checksum.
+ *
+ * The level is worked out from the reply's start time whenever the pin is
+ * read, so the model needs no events of its own.
+ */
+
+#include "sim_internal.h"
+#include <math.h>
+#include <stdio.h>
+
+#define DHT_PORT		0					// PA8
+#define DHT_PIN			8
+
+#define DHT_START_NS	SIM_MS(1)			// Shortest start signal the sensor takes
+#define DHT_REPLY_NS	SIM_US(30)			// From the release to the reply
+#define DHT_MIN_GAP_NS	SIM_S(2)			// Between readings, per the datasheet
+
+static struct {
+	sim_dht_t (*source)(uint64_t now);
+	bool silent;
+
+	bool held;								// MCU driving the line low
+	uint64_t held_from;
+	bool replying;
+	uint64_t reply_at;
+	uint8_t data[5];
+	bool started;
+	uint64_t last_start;
+
+	uint32_t reads;
+	uint32_t too_soon;
+} dht;
+
+static sim_dht_t dht_default(uint64_t now) {
+	(void)now;
+	return (sim_dht_t){ 25.0, 60.0 };
+}
+
+
+void sim_dht_source(sim_dht_t (*read)(uint64_t now)) {
+	dht.source = (read != NULL) ? read : dht_default;
+}
+
+
+void sim_dht_fail(bool silent) {
+	dht.silent = silent;
+}
+
+
+uint32_t sim_dht_reads(void) {
+	return dht.reads;
+}
+
+
+uint32_t sim_dht_too_soon(void) {
+	return dht.too_soon;
+}
+
+
+static void dht_sample(uint64_t now) {
+	sim_dht_t v = dht.source(now);
+	long rh = lround(v.rh * 10);
+	long t = lround(fabs(v.temp) * 10);
+
+	rh = (rh < 0) ? 0 : ((rh > 1000) ? 1000 : rh);
+	t = (t > 0x7FFF) ? 0x7FFF : t;
+	if (v.temp < 0) {
+		t |= 0x8000;
+	}
+	dht.data[0] = (uint8_t)(rh >> 8);
+	dht.data[1] = (uint8_t)rh;
+	dht.data[2] = (uint8_t)(t >> 8);
+	dht.data[3] = (uint8_t)t;
+	dht.data[4] = (uint8_t)(dht.data[0] + dht.data[1] + dht.data[2] + dht.data[3]);
+}
+
+
+static bool dht_level(uint64_t now) {
+	// What the sensor does to the line; the pull-up makes it high when idle
+	if (!dht.replying || (now < dht.reply_at)) {
+		return true;
+	}
+
+	uint64_t t = (now - dht.reply_at) / 1000;		// (us)
+	if (t < 80) {
+		return false;
+	}
+	if (t < 160) {
+		return true;
+	}
+	t -= 160;
+	for (int bit = 0; bit < 40; bit++) {
+		uint64_t high = ((dht.data[bit / 8] >> (7 - (bit % 8))) & 1) ? 70 : 26;
+		if (t < 50) {
+			return false;
+		}
+		if (t < 50 + high) {
+			return true;
+		}
+		t -= 50 + high;
+	}
+	if (t < 50) {
+		return false;
+	}
+	dht.replying = false;
+	return true;
+}
+
+
+static void dht_watch(int port, int pin, bool level, uint64_t now) {
+	bool held = sim_gpio_driven_low(port, pin);
+
+	(void)level;
+	if (held && !dht.held) {
+		dht.held_from = now;
+		dht.replying = false;
+	} else if (!held && dht.held && ((now - dht.held_from) >= DHT_START_NS)) {
+		if (dht.started && ((now - dht.last_start) < DHT_MIN_GAP_NS)) {
+			dht.too_soon++;
+			if (sim_verbose()) {
+				printf("[%10.6f] sim: DHT22 started %.3f s after the last start\n", now / 1e9,
+						(now - dht.last_start) / 1e9);
+			}
+		}
+		dht.started = true;
+		dht.last_start = now;
+		if (!dht.silent) {
+			dht_sample(now);
+			dht.replying = true;
+			dht.reply_at = now + DHT_REPLY_NS;
+			dht.reads++;
+		}
+	}
+	dht.held = held;
+}
+
+
+static void dht_reset(sim_reset_t kind) {
+	// Powered from the same rail: only a power cycle restarts the sensor
+	if (kind == SIM_RESET_POWER) {
+		dht.held = false;
+		dht.replying = false;
+		dht.started = false;
+	}
+}
+
+
+static const sim_model_t dht_model = { "dht22", dht_reset, NULL, NULL, NULL };
+
+
+void sim_dht_init(void) {
+	dht.source = dht_default;
+	dht.silent = false;
+	dht.reads = 0;
+	dht.too_soon = 0;
+	sim_gpio_input(DHT_PORT, DHT_PIN, dht_level);
+	sim_gpio_watch(DHT_PORT, DHT_PIN, dht_watch);
+	sim_add_model(&dht_model);
+}
@@ -0,0 +1,863 @@
+/**
+ * @file	sim_esp.c
+ * @brief	Host simulator: ESP8266 AT firmware, access point, ThingSpeak
+ * 			HTTP server and MQTT broker
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Enough of the ESP8266 AT command set (1.x, CIPMUX=1) for the firmware:
+ * commands are echoed and answered as the real module does, including
+ * "busy p..." while it is joining an access point, "ALREADY CONNECTED" on a
+ * second CIPSTART and "SEND FAIL" on a link the server has dropped. Bytes
+ * sent at a baud rate other than the module's are garbled.
+ *
+ * Behind it, the server answers on link 0 either as ThingSpeak's HTTP API
+ * (GET /update and the bulk_update.json POST; responses come back as
+ * "+IPD,0,<len>:") or, for a link opened to port 1883, as an MQTT broker.
+ * Either answers half a round trip after "SEND OK".
+ * What the server accepts is recorded as entries (sim_esp_entries()).
+ *
+ * The module is powered with the MCU: a power cycle restarts it (it says
+ * "ready" 300 ms later, and rejoins the AP on its own once CWAUTOCONN was
+ * set), while a watchdog reset of the MCU leaves it, its baud rate and its
+ * links as they were.
+ */
+
+#include "sim_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ESP_BOOT_BAUD		115200
+#define ESP_READY_NS		SIM_MS(300)
+#define ESP_JOIN_NS			SIM_S(3)
+#define ESP_REJOIN_NS		SIM_MS(1500)
+#define ESP_CMD_NS			SIM_US(500)		// From a command's end to its answer
+
+#define ESP_LINKS			5
+#define ESP_LINE_MAX		256
+#define ESP_LINK_BUF		8192
+#define ESP_LOG_MAX			(1 << 20)
+#define ESP_DEFAULT_CHANNEL	"1234567"
+
+typedef enum {
+	ACT_READY,
+	ACT_JOINED,								// AP joined (CWJAP or auto-connect)
+	ACT_JOIN_FAILED,
+	ACT_CONNECT,							// TCP handshake done
+	ACT_SEND_DONE,							// CIPSEND data out and acked
+	ACT_REPLY,								// Server answer arrives
+	ACT_IDLE,								// Server's keep-alive timer
+} esp_act_t;
+
+typedef struct {
+	bool open;								// As far as the ESP knows
+	bool dead;								// Server side gone, unknown to the ESP
+	bool mqtt;
+	uint32_t requests;
+	uint64_t last_active;
+	uint8_t in[ESP_LINK_BUF];				// Server side: request bytes so far
+	size_t in_len;
+	char reply[2048];
+	size_t reply_len;
+	bool close_after;						// Server closes once the reply is out
+} esp_link_t;
+
+static struct {
+	uint32_t gen;							// Bumped by a power cycle: stale events are dropped
+	bool booted;
+	uint32_t baud;
+	uint32_t baud_old;
+	uint64_t baud_at;						// When baud took over from baud_old
+
+	bool ap_up;
+	bool joined;
+	bool has_ap;							// Credentials given (CWJAP) or stored
+	bool autoconn;
+	bool joining;
+
+	char line[ESP_LINE_MAX];
+	size_t line_len;
+	int send_link;							// Taking CIPSEND data; -1 otherwise
+	size_t send_left;
+	size_t send_total;
+
+	esp_link_t links[ESP_LINKS];
+	uint32_t entry_id;
+
+	sim_http_t http;
+	sim_broker_t broker;
+	sim_esp_stats_t stats;
+	sim_entry_rec_t* entries;
+	size_t entry_count;
+	size_t entry_cap;
+	char* log;
+	size_t log_len;
+} esp;
+
+static void esp_line(const char* line);
+
+/******************************** Output **************************************/
+
+static uint32_t esp_baud(void) {
+	return (sim_now() >= esp.baud_at) ? esp.baud : esp.baud_old;
+}
+
+
+static void esp_out(const void* data, size_t len) {
+	sim_usart1_to_mcu(data, len, esp_baud(), 0);
+}
+
+
+static void esp_puts(const char* s) {
+	esp_out(s, strlen(s));
+}
+
+
+static void esp_later(uint64_t delay, esp_act_t act, int link);
+
+
+/******************************** Config **************************************/
+
+void sim_esp_ap(bool up) {
+	// The access point comes into range or goes away
+	esp.ap_up = up;
+	if (!up && esp.joined) {
+		esp.joined = false;
+		for (int i = 0; i < ESP_LINKS; i++) {
+			if (esp.links[i].open) {
+				char msg[16];
+				esp.links[i].open = false;
+				snprintf(msg, sizeof(msg), "%d,CLOSED\r\n", i);
+				esp_puts(msg);
+			}
+		}
+		esp_puts("WIFI DISCONNECT\r\n");
+	} else if (up && !esp.joined && esp.has_ap && esp.booted && !esp.joining) {
+		esp_later(ESP_REJOIN_NS, ACT_JOINED, 0);
+	}
+}
+
+
+void sim_esp_http(const sim_http_t* cfg) {
+	esp.http = *cfg;
+}
+
+
+void sim_esp_broker(const sim_broker_t* cfg) {
+	esp.broker = *cfg;
+}
+
+
+const sim_esp_stats_t* sim_esp_stats(void) {
+	return &esp.stats;
+}
+
+
+size_t sim_esp_entries(const sim_entry_rec_t** out) {
+	*out = esp.entries;
+	return esp.entry_count;
+}
+
+
+void sim_esp_clear_entries(void) {
+	esp.entry_count = 0;
+}
+
+
+const char* sim_esp_log(void) {
+	return (esp.log != NULL) ? esp.log : "";
+}
+
+
+static const char* esp_channel(void) {
+	return (esp.http.channel != NULL) ? esp.http.channel : ESP_DEFAULT_CHANNEL;
+}
+
+
+static uint64_t esp_rtt(void) {
+	return SIM_MS(esp.http.rtt_ms ? esp.http.rtt_ms : 1);
+}
+
+
+static void esp_entry(uint32_t field, double value, double time) {
+	if (esp.entry_count == esp.entry_cap) {
+		esp.entry_cap = esp.entry_cap ? (2 * esp.entry_cap) : 256;
+		esp.entries = realloc(esp.entries, esp.entry_cap * sizeof(*esp.entries));
+	}
+	esp.entries[esp.entry_count++] = (sim_entry_rec_t){ field, value, time, sim_now() };
+}
+
+
+static void esp_log(const char* line) {
+	size_t n = strlen(line);
+
+	if (esp.log == NULL) {
+		esp.log = calloc(ESP_LOG_MAX, 1);
+	}
+	if ((esp.log_len + n + 2) < ESP_LOG_MAX) {
+		memcpy(esp.log + esp.log_len, line, n);
+		esp.log_len += n;
+		esp.log[esp.log_len++] = '\n';
+		esp.log[esp.log_len] = '\0';
+	}
+}
+
+
+/********************************* Links **************************************/
+
+static void esp_close(int link, bool report) {
+	esp_link_t* l = &esp.links[link];
+
+	l->open = false;
+	l->dead = false;
+	l->in_len = 0;
+	l->reply_len = 0;
+	if (report) {
+		char msg[16];
+		snprintf(msg, sizeof(msg), "%d,CLOSED\r\n", link);
+		esp_puts(msg);
+	}
+}
+
+
+void sim_esp_server_close(void) {
+	// The server drops link 0
+	esp_link_t* l = &esp.links[0];
+
+	if (!l->open || l->dead) {
+		return;
+	}
+	if (esp.http.silent_close) {
+		l->dead = true;						// The ESP only finds out on the next send
+	} else {
+		esp_close(0, true);
+	}
+}
+
+
+static void esp_ipd(int link, const void* data, size_t len) {
+	char head[32];
+	int n = snprintf(head, sizeof(head), "\r\n+IPD,%d,%u:", link, (unsigned)len);
+
+	esp_out(head, n);
+	esp_out(data, len);
+	esp.stats.link_in_bytes += len;
+}
+
+
+/********************************** HTTP **************************************/
+
+static void http_reply(esp_link_t* l, uint32_t status, const char* body) {
+	static const struct {
+		uint32_t code;
+		const char* text;
+	} reasons[] = {
+		{ 200, "OK" }, { 202, "Accepted" }, { 400, "Bad Request" }, { 401, "Unauthorized" },
+		{ 404, "Not Found" }, { 429, "Too Many Requests" }, { 500, "Internal Server Error" },
+	};
+	const char* reason = "Error";
+
+	for (size_t i = 0; i < sizeof(reasons) / sizeof(reasons[0]); i++) {
+		if (reasons[i].code == status) {
+			reason = reasons[i].text;
+		}
+	}
+	l->reply_len = snprintf(l->reply, sizeof(l->reply),
+			"HTTP/1.1 %u %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n"
+			"Connection: keep-alive\r\n\r\n%s", status, reason,
+			(body[0] == '{') ? "application/json" : "text/plain", (unsigned)strlen(body), body);
+	esp.stats.requests++;
+	if ((status < 200) || (status > 299) || (strcmp(body, "0") == 0)) {
+		esp.stats.rejected++;
+	}
+}
+
+
+static bool http_query(const char* q, const char* key, char* val, size_t cap) {
+	// Value of key in a query string (up to a space)
+	size_t n = strlen(key);
+
+	for (const char* p = q; p != NULL && *p && *p != ' '; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+		if ((strncmp(p, key, n) == 0) && (p[n] == '=')) {
+			size_t i = 0;
+			for (p += n + 1; *p && (*p != '&') && (*p != ' ') && (i + 1 < cap); p++) {
+				val[i++] = *p;
+			}
+			val[i] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
+
+
+static void http_update(esp_link_t* l, const char* target) {
+	// GET /update?api_key=...&fieldN=v...
+	const char* q = strchr(target, '?');
+	char key[64], val[32];
+	bool any = false;
+	double t = sim_now() / 1e9;
+
+	if ((q == NULL) || !http_query(q + 1, "api_key", key, sizeof(key))
+			|| ((esp.http.write_key != NULL) && (strcmp(key, esp.http.write_key) != 0))) {
+		http_reply(l, 401, "0");			// ThingSpeak answers 200 "0" to a bad key at best
+		return;
+	}
+	if (esp.http.entry_zero) {
+		http_reply(l, 200, "0");
+		return;
+	}
+	for (int f = 1; f <= 8; f++) {
+		char name[8];
+		snprintf(name, sizeof(name), "field%d", f);
+		if (http_query(q + 1, name, val, sizeof(val))) {
+			esp_entry(f, atof(val), t);
+			any = true;
+		}
+	}
+	if (!any) {
+		http_reply(l, 200, "0");
+		return;
+	}
+
+	char id[16];
+	snprintf(id, sizeof(id), "%u", ++esp.entry_id);
+	http_reply(l, 200, id);
+}
+
+
+static void http_bulk(esp_link_t* l, const char* target, const char* body) {
+	// POST /channels/<id>/bulk_update.json: {"write_api_key":..,"updates":[{"delta_t":n,"fieldN":v,..},...]}
+	char channel[32];
+	const char* p = target + strlen("/channels/");
+	size_t n = strcspn(p, "/");
+
+	snprintf(channel, sizeof(channel), "%.*s", (int)((n < sizeof(channel)) ? n : sizeof(channel) - 1), p);
+	if ((strcmp(channel, esp_channel()) != 0) || (strcmp(p + n, "/bulk_update.json") != 0)) {
+		http_reply(l, 404, "{\"status\":\"404\",\"error\":{\"error_code\":\"error_resource_not_found\"}}");
+		return;
+	}
+
+	const char* u = strstr(body, "\"updates\":[");
+	if ((u == NULL) || (strstr(body, "\"write_api_key\":\"") == NULL)) {
+		esp.stats.corrupt++;
+		http_reply(l, 400, "{\"status\":\"400\"}");
+		return;
+	}
+
+	// Entries first, with their offsets; times are then laid back from now
+	size_t first = esp.entry_count;
+	double* deltas = NULL;
+	size_t count = 0;
+	for (u = strchr(u, '{'); u != NULL; u = strchr(u + 1, '{')) {
+		const char* d = strstr(u, "\"delta_t\":");
+		const char* f = strstr(u, "\"field");
+		const char* end = strchr(u, '}');
+		if ((d == NULL) || (f == NULL) || (end == NULL) || (d > end) || (f > end)) {
+			esp.stats.corrupt++;
+			esp.entry_count = first;
+			free(deltas);
+			http_reply(l, 400, "{\"status\":\"400\"}");
+			return;
+		}
+		// One record per field; the update's later fields share its time
+		for (double delta = atof(d + 10); (f != NULL) && (f < end); f = strstr(f + 1, "\"field"), delta = 0) {
+			deltas = realloc(deltas, (count + 1) * sizeof(double));
+			deltas[count++] = delta;
+			esp_entry(atoi(f + 6), atof(strchr(f, ':') + 1), 0);
+		}
+	}
+
+	double t = sim_now() / 1e9;
+	for (size_t i = count; i > 0; i--) {
+		esp.entries[first + i - 1].time = t;
+		t -= deltas[i - 1];
+	}
+	free(deltas);
+	http_reply(l, 202, "{\"success\":true}");
+}
+
+
+static void http_take(int link) {
+	// A whole request is in; answer it
+	esp_link_t* l = &esp.links[link];
+	char* req = (char*)l->in;
+	char* body = strstr(req, "\r\n\r\n");
+	char method[8], target[256];
+
+	body += 4;
+	if (sscanf(req, "%7s %255s HTTP/1.1", method, target) != 2) {
+		esp.stats.corrupt++;
+		http_reply(l, 400, "{\"status\":\"400\"}");
+	} else if ((esp.http.status != 0) && (esp.http.status != 200)) {
+		http_reply(l, esp.http.status, (esp.http.status == 429) ? "0" : "{\"status\":\"error\"}");
+	} else if ((strcmp(method, "GET") == 0) && (strncmp(target, "/update", 7) == 0)) {
+		http_update(l, target);
+	} else if ((strcmp(method, "POST") == 0) && (strncmp(target, "/channels/", 10) == 0)) {
+		http_bulk(l, target, body);
+	} else {
+		esp.stats.corrupt++;
+		http_reply(l, 400, "{\"status\":\"400\"}");
+	}
+
+	l->requests++;
+	l->close_after = (esp.http.max_requests != 0) && (l->requests >= esp.http.max_requests);
+	esp_later(esp_rtt() / 2, ACT_REPLY, link);
+}
+
+
+static void http_data(int link) {
+	// See whether the bytes so far make a whole request
+	esp_link_t* l = &esp.links[link];
+	char* end;
+	long body = 0;
+
+	l->in[(l->in_len < ESP_LINK_BUF) ? l->in_len : (ESP_LINK_BUF - 1)] = '\0';
+	end = strstr((char*)l->in, "\r\n\r\n");
+	if (end == NULL) {
+		return;
+	}
+	char* cl = strstr((char*)l->in, "Content-Length: ");
+	if ((cl != NULL) && (cl < end)) {
+		body = atol(cl + 16);
+	}
+	size_t total = (end + 4 - (char*)l->in) + body;
+	if (l->in_len < total) {
+		return;
+	}
+
+	char c = l->in[total];
+	l->in[total] = '\0';
+	http_take(link);
+	l->in[total] = c;
+	memmove(l->in, l->in + total, l->in_len - total);
+	l->in_len -= total;
+}
+
+
+/********************************** MQTT **************************************/
+
+static void mqtt_reply(esp_link_t* l, const uint8_t* p, size_t len) {
+	// Sent back with the other answers to the same send (ACT_REPLY)
+	if (l->reply_len + len <= sizeof(l->reply)) {
+		memcpy(l->reply + l->reply_len, p, len);
+		l->reply_len += len;
+	}
+}
+
+
+static void mqtt_packet(int link, const uint8_t* p, size_t len) {
+	esp_link_t* l = &esp.links[link];
+	uint8_t type = p[0] & 0xF0;
+	size_t i = 1;
+
+	while ((i < len) && (p[i] & 0x80)) {
+		i++;
+	}
+	i++;									// Past the remaining length
+
+	if (esp.broker.silent) {
+		return;
+	}
+	switch (type) {
+	case 0x10: {							// CONNECT
+		uint8_t connack[] = { 0x20, 0x02, 0x00, esp.broker.refuse ? 5 : 0 };
+		mqtt_reply(l, connack, sizeof(connack));
+		l->close_after = esp.broker.refuse;
+		break;
+	}
+	case 0x30: {							// PUBLISH
+		uint8_t qos = (p[0] >> 1) & 3;
+		size_t tlen = ((size_t)p[i] << 8) | p[i + 1];
+		char topic[128], want[128], payload[256];
+
+		if (esp.broker.drop_publish) {
+			esp_close(link, true);
+			return;
+		}
+		snprintf(topic, sizeof(topic), "%.*s", (int)tlen, (const char*)&p[i + 2]);
+		snprintf(want, sizeof(want), "channels/%s/publish", esp_channel());
+		i += 2 + tlen;
+		uint16_t id = 0;
+		if (qos > 0) {
+			id = ((uint16_t)p[i] << 8) | p[i + 1];
+			i += 2;
+		}
+		if (strcmp(topic, want) != 0) {
+			esp_close(link, true);			// ThingSpeak drops a client on a bad topic
+			return;
+		}
+		snprintf(payload, sizeof(payload), "%.*s", (int)(len - i), (const char*)&p[i]);
+		esp.stats.publishes++;
+		for (int f = 1; f <= 8; f++) {
+			char name[8], val[32];
+			snprintf(name, sizeof(name), "field%d", f);
+			if (http_query(payload, name, val, sizeof(val))) {
+				esp_entry(f, atof(val), sim_now() / 1e9);
+			}
+		}
+		if (qos == 1) {
+			uint8_t puback[] = { 0x40, 0x02, (uint8_t)(id >> 8), (uint8_t)id };
+			mqtt_reply(l, puback, sizeof(puback));
+		}
+		break;
+	}
+	case 0xC0: {							// PINGREQ
+		static const uint8_t pingresp[] = { 0xD0, 0x00 };
+		esp.stats.pingreqs++;
+		mqtt_reply(l, pingresp, sizeof(pingresp));
+		break;
+	}
+	case 0xE0:								// DISCONNECT
+		esp_close(link, true);
+		break;
+	default:
+		break;
+	}
+}
+
+
+static void mqtt_data(int link) {
+	// Take every whole packet received so far
+	esp_link_t* l = &esp.links[link];
+
+	while (l->open && (l->in_len >= 2)) {
+		size_t len = 0, i = 1;
+		int shift = 0;
+		do {
+			if (i >= l->in_len) {
+				return;
+			}
+			len |= (size_t)(l->in[i] & 0x7F) << shift;
+			shift += 7;
+		} while (l->in[i++] & 0x80);
+		if (l->in_len < i + len) {
+			return;
+		}
+		size_t total = i + len;
+		uint8_t packet[ESP_LINK_BUF];
+		memcpy(packet, l->in, total);
+		memmove(l->in, l->in + total, l->in_len - total);
+		l->in_len -= total;
+		mqtt_packet(link, packet, total);
+	}
+	if (l->open && (l->reply_len > 0)) {
+		esp_later(esp_rtt() / 2, ACT_REPLY, link);
+	}
+}
+
+
+/********************************* Events *************************************/
+
+static void esp_act(void* ctx) {
+	uintptr_t v = (uintptr_t)ctx;
+	esp_act_t act = v & 0xFF;
+	int link = (v >> 8) & 0xFF;
+	esp_link_t* l = &esp.links[link];
+
+	if ((uint32_t)(v >> 16) != (esp.gen & 0xFFFF)) {
+		return;								// From before a power cycle
+	}
+	switch (act) {
+	case ACT_READY:
+		esp.booted = true;
+		esp_puts("\r\nready\r\n");
+		if (esp.autoconn && esp.has_ap && esp.ap_up) {
+			esp_later(ESP_REJOIN_NS, ACT_JOINED, 0);
+		}
+		break;
+	case ACT_JOINED:
+		if (!esp.ap_up) {
+			if (esp.joining) {
+				esp_later(0, ACT_JOIN_FAILED, 0);
+			}
+			break;
+		}
+		if (!esp.joined) {
+			esp.joined = true;
+			esp_puts("WIFI CONNECTED\r\nWIFI GOT IP\r\n");
+		}
+		if (esp.joining) {
+			esp.joining = false;
+			esp_puts("\r\nOK\r\n");
+		}
+		break;
+	case ACT_JOIN_FAILED:
+		esp.joining = false;
+		esp_puts("+CWJAP:3\r\n\r\nFAIL\r\n");
+		break;
+	case ACT_CONNECT: {
+		char msg[40];
+		if (!esp.joined || esp.http.unreachable) {
+			snprintf(msg, sizeof(msg), "%d,CONNECT FAIL\r\n\r\nERROR\r\n", link);
+		} else {
+			l->open = true;
+			l->dead = false;
+			l->requests = 0;
+			l->in_len = 0;
+			l->last_active = sim_now();
+			snprintf(msg, sizeof(msg), "%d,CONNECT\r\n\r\nOK\r\n", link);
+			if (esp.http.idle_close_ms) {
+				esp_later(SIM_MS(esp.http.idle_close_ms), ACT_IDLE, link);
+			}
+		}
+		esp_puts(msg);
+		break;
+	}
+	case ACT_SEND_DONE:
+		if (!l->open) {
+			break;
+		}
+		if (l->dead || !esp.joined) {
+			esp_puts("\r\nSEND FAIL\r\n");
+			esp_close(link, true);
+			break;
+		}
+		esp_puts("\r\nSEND OK\r\n");
+		l->last_active = sim_now();
+		if (l->mqtt) {
+			mqtt_data(link);
+		} else {
+			http_data(link);
+		}
+		break;
+	case ACT_REPLY:
+		if (!l->open || l->dead || (l->reply_len == 0)) {
+			break;
+		}
+		esp_ipd(link, l->reply, l->reply_len);
+		l->reply_len = 0;
+		l->last_active = sim_now();
+		if (l->close_after) {
+			esp_close(link, true);
+		}
+		break;
+	case ACT_IDLE:
+		if (!l->open || l->dead || (esp.http.idle_close_ms == 0)) {
+			break;
+		}
+		if ((sim_now() - l->last_active) >= SIM_MS(esp.http.idle_close_ms)) {
+			sim_esp_server_close();
+		} else {
+			esp_later(l->last_active + SIM_MS(esp.http.idle_close_ms) - sim_now(), ACT_IDLE, link);
+		}
+		break;
+	}
+}
+
+
+static void esp_later(uint64_t delay, esp_act_t act, int link) {
+	uintptr_t v = ((uintptr_t)(esp.gen & 0xFFFF) << 16) | ((uintptr_t)link << 8) | act;
+	sim_at(sim_now() + delay, esp_act, (void*)v);
+}
+
+
+/******************************** Commands ************************************/
+
+static void esp_reply(const char* s) {
+	// Answer a command, after the time the module takes over it
+	sim_usart1_to_mcu(s, strlen(s), esp_baud(), ESP_CMD_NS);
+}
+
+
+static void esp_cipstart(const char* args) {
+	int link;
+	char type[8], host[64];
+	unsigned port;
+
+	esp.stats.cipstarts++;
+	if (sscanf(args, "%d,\"%7[^\"]\",\"%63[^\"]\",%u", &link, type, host, &port) != 4
+			|| (link < 0) || (link >= ESP_LINKS)) {
+		esp_reply("ERROR\r\n");
+		return;
+	}
+	if (esp.links[link].open) {
+		esp.stats.already_connected++;
+		esp_reply("ALREADY CONNECTED\r\n\r\nERROR\r\n");
+		return;
+	}
+	if (!esp.joined) {
+		esp_reply("no ip\r\n\r\nERROR\r\n");
+		return;
+	}
+	esp.links[link].mqtt = (port == 1883);
+	esp_later(esp.http.connect_ms ? SIM_MS(esp.http.connect_ms) : esp_rtt(), ACT_CONNECT, link);
+}
+
+
+static void esp_cipsend(const char* args) {
+	int link;
+	unsigned len;
+
+	esp.stats.cipsends++;
+	if ((sscanf(args, "%d,%u", &link, &len) != 2) || (link < 0) || (link >= ESP_LINKS)
+			|| (len == 0) || (len > 2048)) {
+		esp_reply("ERROR\r\n");
+		return;
+	}
+	if (!esp.links[link].open) {
+		esp_reply("link is not valid\r\n\r\nERROR\r\n");
+		return;
+	}
+	esp.send_link = link;
+	esp.send_left = esp.send_total = len;
+	esp_reply("\r\nOK\r\n> ");
+}
+
+
+static void esp_line(const char* line) {
+	// A command line from the MCU
+	char echo[ESP_LINE_MAX + 4];
+
+	esp_log(line);
+	snprintf(echo, sizeof(echo), "%s\r\r\n", line);
+	esp_puts(echo);
+
+	if (esp.joining) {
+		esp_reply("busy p...\r\n");
+		return;
+	}
+
+	if (strcmp(line, "AT") == 0) {
+		esp_reply("\r\nOK\r\n");
+	} else if (strcmp(line, "AT+GMR") == 0) {
+		esp_reply("AT version:1.2.0.0(Jul  1 2016 20:04:45)\r\n"
+				"SDK version:1.5.4.1(39cb9a32)\r\n"
+				"Ai-Thinker Technology Co. Ltd.\r\n"
+				"Dec  2 2016 14:21:16\r\n\r\nOK\r\n");
+	} else if (strncmp(line, "AT+UART_CUR=", 12) == 0) {
+		uint32_t rate = strtoul(line + 12, NULL, 10);
+		esp_reply("\r\nOK\r\n");
+		esp.baud_old = esp_baud();
+		esp.baud_at = sim_usart1_idle_at();	// Once the OK is out
+		esp.baud = rate;
+	} else if (strncmp(line, "AT+CWMODE=", 10) == 0) {
+		esp_reply("\r\nOK\r\n");
+	} else if (strcmp(line, "AT+CWJAP?") == 0) {
+		esp_reply(esp.joined ? "+CWJAP:\"AP\",\"de:ad:be:ef:00:01\",6,-58\r\n\r\nOK\r\n"
+				: "No AP\r\n\r\nOK\r\n");
+	} else if (strncmp(line, "AT+CWJAP=", 9) == 0) {
+		esp.has_ap = true;
+		esp.joining = true;
+		esp.joined = false;
+		esp_later(ESP_JOIN_NS, esp.ap_up ? ACT_JOINED : ACT_JOIN_FAILED, 0);
+	} else if (strncmp(line, "AT+CWAUTOCONN=", 14) == 0) {
+		esp.autoconn = (line[14] == '1');
+		esp_reply("\r\nOK\r\n");
+	} else if (strncmp(line, "AT+CIPMUX=", 10) == 0) {
+		esp_reply("\r\nOK\r\n");
+	} else if (strncmp(line, "AT+CIPSTART=", 12) == 0) {
+		esp_cipstart(line + 12);
+	} else if (strncmp(line, "AT+CIPSEND=", 11) == 0) {
+		esp_cipsend(line + 11);
+	} else if (strncmp(line, "AT+CIPCLOSE=", 12) == 0) {
+		int link = atoi(line + 12);
+		esp.stats.cipcloses++;
+		if ((link >= 0) && (link < ESP_LINKS) && esp.links[link].open) {
+			char msg[32];
+			esp_close(link, false);
+			snprintf(msg, sizeof(msg), "%d,CLOSED\r\n\r\nOK\r\n", link);
+			esp_reply(msg);
+		} else {
+			esp_reply("UNLINK\r\n\r\nERROR\r\n");
+		}
+	} else {
+		esp_reply("\r\nERROR\r\n");
+	}
+}
+
+
+void sim_esp_from_mcu(const uint8_t* data, size_t len, uint32_t baud) {
+	// Bytes from USART1, as they finish arriving
+	uint32_t mine = esp_baud();
+	uint32_t diff = (baud > mine) ? (baud - mine) : (mine - baud);
+	bool garbled = (uint64_t)diff * 100 > (uint64_t)mine * 3;
+
+	esp.stats.uart_bytes += len;
+	if (!esp.booted) {
+		return;
+	}
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+
+		if (garbled) {
+			c = (uint8_t)(sim_random() | 0x80);
+			esp.stats.garbled++;
+		}
+
+		if (esp.send_link >= 0) {
+			esp_link_t* l = &esp.links[esp.send_link];
+			if (l->in_len < ESP_LINK_BUF - 1) {
+				l->in[l->in_len++] = c;
+			}
+			esp.stats.payload_bytes++;
+			if (--esp.send_left == 0) {
+				char msg[32];
+				snprintf(msg, sizeof(msg), "\r\nRecv %u bytes\r\n", (unsigned)esp.send_total);
+				esp_puts(msg);
+				esp_later(esp_rtt() / 2, ACT_SEND_DONE, esp.send_link);
+				esp.send_link = -1;
+			}
+			continue;
+		}
+
+		if (c == '\n') {
+			if ((esp.line_len > 0) && (esp.line[esp.line_len - 1] == '\r')) {
+				esp.line[--esp.line_len] = '\0';
+				if (esp.line_len > 0) {
+					esp_line(esp.line);
+				}
+			}
+			esp.line_len = 0;
+		} else if (esp.line_len < ESP_LINE_MAX - 1) {
+			esp.line[esp.line_len++] = (char)c;
+			esp.line[esp.line_len] = '\0';
+		}
+	}
+}
+
+
+/********************************* Set-up *************************************/
+
+static void esp_reset(sim_reset_t kind) {
+	// Powered with the MCU: only a power cycle restarts it
+	if (kind != SIM_RESET_POWER) {
+		return;
+	}
+	esp.gen++;
+	esp.booted = false;
+	esp.baud = esp.baud_old = ESP_BOOT_BAUD;
+	esp.baud_at = 0;
+	esp.joined = false;
+	esp.joining = false;
+	esp.line_len = 0;
+	esp.send_link = -1;
+	for (int i = 0; i < ESP_LINKS; i++) {
+		esp.links[i].open = false;
+		esp.links[i].dead = false;
+		esp.links[i].in_len = 0;
+		esp.links[i].reply_len = 0;
+	}
+	esp_later(ESP_READY_NS, ACT_READY, 0);
+}
+
+
+static const sim_model_t esp_model = { "esp8266", esp_reset, NULL, NULL, NULL };
+
+
+void sim_esp_init(void) {
+	// A module fresh from the factory, next to a working access point
+	free(esp.entries);
+	free(esp.log);
+	uint32_t gen = esp.gen;
+	memset(&esp, 0, sizeof(esp));
+	esp.gen = gen + 1;
+	esp.ap_up = true;
+	esp.send_link = -1;
+	esp.http.rtt_ms = 200;
+	sim_add_model(&esp_model);
+}
@@ -0,0 +1,313 @@
+/**
+ * @file	sim_flash.c
+ * @brief	Host simulator: flash interface (program, sector erase, power loss)
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The flash array is the mapped region at FLASH_BASE. Programming is only
+ * modelled in the LOG region (sectors 1-3, where the firmware writes), and
+ * only looked for while the interface is unlocked, which keeps the sync
+ * points cheap: a stray write made while it is locked is only seen once it
+ * is unlocked again.
+ *
+ * Programming can only clear bits, so a word becomes what it held AND what
+ * was written. A word takes 16 us and a 16 KB sector erase 400 ms (set with
+ * sim_flash_erase_time(); the 64 KB and 128 KB sectors take 2.25 and 4
+ * times that). While either runs, SR.BSY is set and code outside RAM
+ * stalls (see sim.c).
+ *
+ * Power loss, from sim_flash_cut() or any reset while busy, leaves the word
+ * partly programmed or the sector partly erased.
+ */
+
+#include "sim_internal.h"
+#include "stm32f4xx.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LOG_START		0x08004000U
+#define LOG_END			0x08010000U
+#define LOG_WORDS		((LOG_END - LOG_START) / 4)
+
+#define KEY1			0x45670123U
+#define KEY2			0xCDEF89ABU
+#define SENTINEL		0x80000000U			// FLASH->SR bit 31 is reserved; cleared by a write
+#define SR_ERRORS		(FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR | FLASH_SR_WRPERR)
+
+#define WORD_NS			SIM_US(16)
+
+static struct {
+	uint32_t shadow[LOG_WORDS];				// The LOG region as programmed
+	uint32_t sh_cr;
+	uint32_t sh_sr;
+	bool locked;
+	bool key1;								// KEY1 written, KEY2 expected
+
+	bool busy;
+	uint64_t busy_from;
+	uint64_t busy_until;
+	int sector;								// Being erased; -1 while programming or idle
+
+	uint64_t erase_ns;
+	uint32_t words;
+	uint32_t erases;
+	sim_cut_t cut;
+	uint32_t cut_n;
+} fl;
+
+static volatile uint32_t* flash_log(void) {
+	return (volatile uint32_t*)(uintptr_t)LOG_START;
+}
+
+
+static uint32_t sector_base(int sector) {
+	static const uint32_t base[8] = {
+		0x08000000, 0x08004000, 0x08008000, 0x0800C000,
+		0x08010000, 0x08020000, 0x08040000, 0x08060000,
+	};
+	return base[sector];
+}
+
+
+static uint32_t sector_size(int sector) {
+	return (sector < 4) ? 0x4000 : ((sector == 4) ? 0x10000 : 0x20000);
+}
+
+
+void sim_flash_cut(sim_cut_t kind, uint32_t n) {
+	// Lose power during the n-th word programmed or erase started from now on
+	fl.cut = kind;
+	fl.cut_n = n + ((kind == SIM_CUT_WORD) ? fl.words : fl.erases);
+}
+
+
+uint32_t sim_flash_words(void) {
+	return fl.words;
+}
+
+
+uint32_t sim_flash_erases(void) {
+	return fl.erases;
+}
+
+
+void sim_flash_erase_time(uint64_t ns) {
+	fl.erase_ns = ns;
+}
+
+
+static void flash_shadow_sector(int sector) {
+	// Keep the shadow in step with an erase overlapping the LOG region
+	uint32_t from = sector_base(sector), to = from + sector_size(sector);
+
+	for (uint32_t a = from; a < to; a += 4) {
+		if ((a >= LOG_START) && (a < LOG_END)) {
+			fl.shadow[(a - LOG_START) / 4] = *(volatile uint32_t*)(uintptr_t)a;
+		}
+	}
+}
+
+
+static void flash_partial_erase(void) {
+	// Cut short: each word is erased, untouched, or somewhere in between
+	uint32_t base = sector_base(fl.sector), size = sector_size(fl.sector);
+	uint64_t span = fl.busy_until - fl.busy_from;
+	uint64_t done = (sim_now() - fl.busy_from) * 1024 / (span ? span : 1);
+
+	for (uint32_t a = base; a < base + size; a += 4) {
+		volatile uint32_t* w = (volatile uint32_t*)(uintptr_t)a;
+		uint64_t r = sim_random();
+		if ((r % 1024) < done) {
+			*w = 0xFFFFFFFF;
+		} else if (((r >> 10) & 3) == 0) {
+			*w |= (uint32_t)(r >> 16);
+		}
+	}
+	flash_shadow_sector(fl.sector);
+	fl.erases++;
+}
+
+
+static void flash_reset(sim_reset_t kind) {
+	(void)kind;
+	if (fl.busy && (fl.sector >= 0)) {
+		flash_partial_erase();
+	}
+	fl.busy = false;
+	fl.sector = -1;
+	fl.locked = true;
+	fl.key1 = false;
+	FLASH->CR = fl.sh_cr = FLASH_CR_LOCK;
+	FLASH->SR = SENTINEL;
+	fl.sh_sr = 0;
+}
+
+
+static void flash_program(uint32_t i, uint32_t written) {
+	volatile uint32_t* mem = flash_log();
+	uint64_t now = sim_now();
+
+	if (fl.locked || !(fl.sh_cr & FLASH_CR_PG) || fl.busy) {
+		mem[i] = fl.shadow[i];				// Not taken; the array is unchanged
+		fl.sh_sr |= fl.locked ? FLASH_SR_WRPERR : FLASH_SR_PGSERR;
+		return;
+	}
+
+	uint32_t word = fl.shadow[i] & written;
+	fl.words++;
+	if ((fl.cut == SIM_CUT_WORD) && (fl.words == fl.cut_n)) {
+		// Only some of the bits being cleared got there
+		fl.cut = SIM_CUT_NONE;
+		mem[i] = fl.shadow[i] = fl.shadow[i] & (written | (uint32_t)sim_random());
+		if (sim_verbose()) {
+			printf("[%10.6f] sim: power lost programming 0x%08x\n", now / 1e9, LOG_START + 4 * i);
+		}
+		sim_reset(SIM_RESET_POWER);
+		return;
+	}
+	mem[i] = fl.shadow[i] = word;
+	fl.busy = true;
+	fl.busy_from = now;
+	fl.busy_until = now + WORD_NS;
+}
+
+
+static void flash_cut_event(void* ctx) {
+	(void)ctx;
+	if (sim_verbose()) {
+		printf("[%10.6f] sim: power lost erasing sector %d\n", sim_now() / 1e9, fl.sector);
+	}
+	sim_reset(SIM_RESET_POWER);				// flash_reset() leaves the sector half erased
+}
+
+
+static void flash_erase(int sector) {
+	uint64_t now = sim_now();
+	uint64_t t = fl.erase_ns;
+
+	if (fl.locked || fl.busy || (sector > 7)) {
+		fl.sh_sr |= FLASH_SR_WRPERR;
+		return;
+	}
+	t = (sector < 4) ? t : ((sector == 4) ? (t * 9 / 4) : (t * 4));
+	fl.busy = true;
+	fl.sector = sector;
+	fl.busy_from = now;
+	fl.busy_until = now + t;
+	if ((fl.cut == SIM_CUT_ERASE) && ((fl.erases + 1) == fl.cut_n)) {
+		fl.cut = SIM_CUT_NONE;
+		sim_at(now + 1 + (sim_random() % t), flash_cut_event, NULL);
+	}
+}
+
+
+static void flash_sync(void) {
+	uint32_t key = FLASH->KEYR;
+	bool unlocked = false;
+
+	/*
+	 * KEYR and CR are only read here, so what was written since the last
+	 * sync point comes in one go: KEY1 then KEY2 leave KEY2 alone, which is
+	 * taken as the whole sequence, and a LOCK bit still in CR alongside it
+	 * is from before the unlock (on the part, CR reads it back cleared).
+	 */
+	if (key != 0) {
+		FLASH->KEYR = 0;
+		if (key == KEY1) {
+			fl.key1 = true;
+		} else if (key == KEY2) {
+			fl.locked = false;
+			fl.key1 = false;
+			fl.sh_cr &= ~FLASH_CR_LOCK;
+			unlocked = true;
+		} else {
+			fl.key1 = false;				// A wrong key locks it until reset
+		}
+	}
+
+	uint32_t cr = FLASH->CR;
+	if (fl.locked) {
+		cr = fl.sh_cr;						// CR cannot be written while locked
+	} else if (unlocked) {
+		cr &= ~FLASH_CR_LOCK;
+	} else if (cr & FLASH_CR_LOCK) {
+		fl.locked = true;
+	}
+	if (fl.busy) {
+		cr = (cr & ~FLASH_CR_STRT) | (fl.sh_cr & FLASH_CR_STRT);
+	}
+	FLASH->CR = fl.sh_cr = cr;
+
+	if (!(FLASH->SR & SENTINEL)) {
+		fl.sh_sr &= ~(FLASH->SR & SR_ERRORS);
+	}
+
+	if ((cr & FLASH_CR_STRT) && !fl.busy && (fl.sector < 0)) {
+		if (cr & FLASH_CR_SER) {
+			flash_erase((cr & FLASH_CR_SNB) >> FLASH_CR_SNB_Pos);
+		}
+		if (!fl.busy) {
+			FLASH->CR = fl.sh_cr &= ~FLASH_CR_STRT;
+		}
+	}
+
+	if (!fl.locked) {
+		volatile uint32_t* mem = flash_log();
+		for (uint32_t i = 0; i < LOG_WORDS; i++) {
+			if (mem[i] != fl.shadow[i]) {
+				flash_program(i, mem[i]);
+			}
+		}
+	}
+
+	FLASH->SR = SENTINEL | fl.sh_sr | (fl.busy ? FLASH_SR_BSY : 0);
+}
+
+
+static void flash_update(uint64_t now) {
+	if (!fl.busy || (now < fl.busy_until)) {
+		return;
+	}
+	fl.busy = false;
+	if (fl.sector >= 0) {
+		uint32_t base = sector_base(fl.sector);
+		memset((void*)(uintptr_t)base, 0xFF, sector_size(fl.sector));
+		flash_shadow_sector(fl.sector);
+		fl.erases++;
+		fl.sector = -1;
+		fl.sh_cr &= ~FLASH_CR_STRT;
+		FLASH->CR &= ~FLASH_CR_STRT;
+	}
+	FLASH->SR = SENTINEL | fl.sh_sr;
+}
+
+
+static uint64_t flash_next(void) {
+	return fl.busy ? fl.busy_until : SIM_NEVER;
+}
+
+
+uint64_t sim_stall_until(void) {
+	// Checked at every function entry: an erase started since the last sync counts
+	if (!fl.busy && (FLASH->CR & FLASH_CR_STRT)) {
+		flash_sync();
+	}
+	return fl.busy ? fl.busy_until : 0;
+}
+
+
+static const sim_model_t flash_model = { "flash", flash_reset, flash_sync, flash_update, flash_next };
+
+
+void sim_flash_init(void) {
+	// A new part: erased
+	memset((void*)(uintptr_t)FLASH_BASE, 0xFF, 0x80000);
+	memset(&fl, 0, sizeof(fl));
+	memset(fl.shadow, 0xFF, sizeof(fl.shadow));
+	fl.sector = -1;
+	fl.erase_ns = SIM_MS(400);
+	sim_add_model(&flash_model);
+}
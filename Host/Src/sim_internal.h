@@ -0,0 +1,31 @@
+/**
+ * @file	sim_internal.h
+ * @brief	Host simulator: interfaces between the models
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+#ifndef SIM_INTERNAL_H
+#define SIM_INTERNAL_H
+
+#include "sim.h"
+
+// Registration and defaults, from sim_init()
+void sim_periph_init(void);
+void sim_flash_init(void);
+void sim_lcd_init(void);
+void sim_dht_init(void);
+void sim_esp_init(void);
+
+// I2C1 to the PCF8574 behind the LCD (sim_lcd.c)
+bool sim_lcd_present(uint8_t addr);
+void sim_lcd_expander(uint8_t byte, uint64_t now);
+
+// USART1 to the ESP8266 (sim_esp.c): bytes as the ESP receives them, at baud
+void sim_esp_from_mcu(const uint8_t* data, size_t len, uint32_t baud);
+
+// Deterministic noise for the models
+uint64_t sim_random(void);
+
+#endif // SIM_INTERNAL_H
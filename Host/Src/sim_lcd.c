@@ -0,0 +1,184 @@
+/**
+ * @file	sim_lcd.c
+ * @brief	Host simulator: 16x2 HD44780 LCD behind a PCF8574 I2C expander
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The PCF8574 at 0x27 drives the HD44780 with P0 = RS, P1 = RW, P2 = EN,
+ * P3 = backlight and P4-P7 = D4-D7. The controller latches on the falling
+ * edge of EN; it starts in 8-bit mode, where each latch is a whole
+ * instruction, until a function set with DL = 0 puts it in 4-bit mode.
+ *
+ * The controller is not polled for busy, so the firmware must wait each
+ * instruction out: 1.52 ms for clear and home, 37 us for the rest, and
+ * 4.1 ms then 100 us after the first two 8-bit function sets of the reset
+ * sequence. Anything latched sooner, or within 40 ms of power-up, counts
+ * as a violation: on the real part it would be lost.
+ */
+
+#include "sim_internal.h"
+#include <stdio.h>
+#include <string.h>
+
+#define LCD_ADDR		0x27
+#define LCD_RS			0x01
+#define LCD_EN			0x04
+
+#define LCD_POWER_NS	SIM_MS(40)
+#define LCD_LONG_NS		SIM_US(1520)
+#define LCD_SHORT_NS	SIM_US(37)
+
+static struct {
+	uint8_t port;							// Expander outputs
+	bool four_bit;
+	bool high_done;							// 4-bit mode: high nibble latched
+	uint8_t high;
+	uint8_t resets;							// 8-bit function sets seen so far
+	bool increment;
+	bool cgram;								// Data goes to CGRAM, not the display
+	uint8_t ac;								// Address counter
+	char ddram[0x80];
+	char rows[2][17];
+	uint64_t powered;
+	uint64_t ready;							// Busy until
+	uint32_t writes;
+	uint32_t violations;
+} lcd;
+
+bool sim_lcd_present(uint8_t addr) {
+	return addr == LCD_ADDR;
+}
+
+
+const char* sim_lcd_row(int row) {
+	memcpy(lcd.rows[row], &lcd.ddram[row ? 0x40 : 0x00], 16);
+	lcd.rows[row][16] = '\0';
+	return lcd.rows[row];
+}
+
+
+uint32_t sim_lcd_writes(void) {
+	return lcd.writes;
+}
+
+
+uint32_t sim_lcd_violations(void) {
+	return lcd.violations;
+}
+
+
+static void lcd_advance(void) {
+	// Two lines of 40: 0x00-0x27 and 0x40-0x67
+	if (lcd.increment) {
+		lcd.ac = (lcd.ac == 0x27) ? 0x40 : ((lcd.ac == 0x67) ? 0x00 : (lcd.ac + 1));
+	} else {
+		lcd.ac = (lcd.ac == 0x00) ? 0x67 : ((lcd.ac == 0x40) ? 0x27 : (lcd.ac - 1));
+	}
+}
+
+
+static uint64_t lcd_instruction(uint8_t cmd) {
+	// Carry out an instruction; returns how long it keeps the controller busy
+	if (cmd & 0x80) {
+		lcd.ac = cmd & 0x7F;
+		lcd.cgram = false;
+	} else if (cmd & 0x40) {
+		lcd.cgram = true;
+	} else if (cmd & 0x20) {
+		if (!lcd.four_bit && (cmd & 0x10)) {
+			lcd.resets++;
+			return (lcd.resets == 1) ? SIM_US(4100) : ((lcd.resets == 2) ? SIM_US(100) : LCD_SHORT_NS);
+		}
+		lcd.four_bit = !(cmd & 0x10);
+	} else if (cmd & 0x10) {
+		// Cursor/display shift: not used by the firmware
+	} else if (cmd & 0x08) {
+		// Display on/off control
+	} else if (cmd & 0x04) {
+		lcd.increment = (cmd & 0x02) != 0;
+	} else if (cmd & 0x02) {
+		lcd.ac = 0;
+		lcd.cgram = false;
+		return LCD_LONG_NS;
+	} else if (cmd & 0x01) {
+		memset(lcd.ddram, ' ', sizeof(lcd.ddram));
+		lcd.ac = 0;
+		lcd.increment = true;
+		lcd.cgram = false;
+		return LCD_LONG_NS;
+	}
+	return LCD_SHORT_NS;
+}
+
+
+static void lcd_latch(bool rs, uint8_t value, uint64_t now) {
+	uint64_t busy;
+
+	if ((now < lcd.powered + LCD_POWER_NS) || (now < lcd.ready)) {
+		lcd.violations++;
+		if (sim_verbose()) {
+			printf("[%10.6f] sim: LCD %s 0x%02x while busy\n", now / 1e9, rs ? "data" : "command", value);
+		}
+		return;
+	}
+	if (rs) {
+		if (!lcd.cgram) {
+			lcd.ddram[lcd.ac & 0x7F] = (char)value;
+			lcd.writes++;
+		}
+		lcd_advance();
+		busy = LCD_SHORT_NS;
+	} else {
+		busy = lcd_instruction(value);
+	}
+	lcd.ready = now + busy;
+}
+
+
+void sim_lcd_expander(uint8_t byte, uint64_t now) {
+	bool fall = (lcd.port & LCD_EN) && !(byte & LCD_EN);
+	uint8_t nibble = byte & 0xF0;
+
+	lcd.port = byte;
+	if (!fall) {
+		return;
+	}
+	if (!lcd.four_bit) {
+		lcd_latch(byte & LCD_RS, nibble, now);
+	} else if (!lcd.high_done) {
+		lcd.high = nibble;
+		lcd.high_done = true;
+	} else {
+		lcd.high_done = false;
+		lcd_latch(byte & LCD_RS, lcd.high | (nibble >> 4), now);
+	}
+}
+
+
+static void lcd_reset(sim_reset_t kind) {
+	// Only a power cycle reaches the LCD; a watchdog reset leaves it as it was
+	uint32_t writes = lcd.writes, violations = lcd.violations;
+
+	if (kind != SIM_RESET_POWER) {
+		return;
+	}
+	memset(&lcd, 0, sizeof(lcd));
+	lcd.writes = writes;
+	lcd.violations = violations;
+	memset(lcd.ddram, ' ', sizeof(lcd.ddram));
+	lcd.increment = true;
+	lcd.powered = sim_now();
+}
+
+
+static const sim_model_t lcd_model = { "lcd", lcd_reset, NULL, NULL, NULL };
+
+
+void sim_lcd_init(void) {
+	lcd.writes = 0;
+	lcd.violations = 0;
+	sim_add_model(&lcd_model);
+}
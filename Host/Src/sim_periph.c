@@ -0,0 +1,1361 @@
+/**
+ * @file	sim_periph.c
+ * @brief	Host simulator: on-chip peripherals (RCC, GPIO, timers, ADC, DMA,
+ * 			USARTs, I2C, IWDG, RTC wakeup, DWT)
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Each peripheral's registers live in the mapped peripheral region, and the
+ * firmware reads and writes them directly. A model keeps a shadow of what
+ * it last left in a register, so at a sync point it can tell what the
+ * firmware wrote:
+ * 	- Plain registers (CR1, BRR, PSC...) are simply read.
+ * 	- rc_w0 status flags (TIMx->SR, USARTx->SR, RTC->ISR) can only be
+ * 	  cleared: the new value is the shadow AND what is in memory.
+ * 	- Write-only registers (GPIO BSRR, DMA LIFCR/HIFCR, IWDG KR, TIMx EGR)
+ * 	  are acted on and zeroed, as they read on the target.
+ * 	- Data registers the firmware writes (USARTx->DR, I2C1->DR) and the w1c
+ * 	  EXTI->PR keep bit 31, which reads as 0 on the target, set: a write
+ * 	  clears it. The firmware only ever looks at the low bits.
+ *
+ * Not modelled: Stop mode is taken as Sleep (the clocks stay up), and DMA
+ * only serves ADC1 (stream 0) and USART1 TX (stream 7).
+ */
+
+#include "sim_internal.h"
+#include "stm32f4xx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HSI_HZ			16000000ULL
+#define LSI_HZ			32000
+#define SENTINEL		0x80000000U			// Reads 0 on the target; cleared by a write
+
+#define TIM_SR_FLAGS	(TIM_SR_UIF | TIM_SR_CC1IF)
+#define USART_SR_FLAGS	(USART_SR_RXNE | USART_SR_TC | USART_SR_ORE)
+
+#define ADC_CHANNELS	19
+#define ADC_VREFINT_MV	(1500.0 * 3300.0 / 4096.0)	// What VREFINT_CAL was taken from
+#define ADC_TS_MV_30	(943.0 * 3300.0 / 4096.0)	// TS_CAL1 at 30 Celsius
+#define ADC_TS_SLOPE	((1191.0 - 943.0) * 3300.0 / 4096.0 / 80.0)	// (mV/Celsius)
+
+#define RX_QUEUE		65536				// Bytes in flight to the MCU on USART1
+#define CONSOLE_MAX		(1 << 20)
+
+#define I2C_START_NS	SIM_US(5)
+
+static uint64_t sim_ticks(uint64_t ns, uint64_t hz, uint64_t div) {
+	// Whole ticks of hz / div in ns
+	return (uint64_t)(((unsigned __int128)ns * hz) / ((unsigned __int128)1000000000ULL * div));
+}
+
+
+static uint64_t sim_ticks_ns(uint64_t ticks, uint64_t hz, uint64_t div) {
+	// Time to the tick: the first ns by which that many ticks have passed
+	unsigned __int128 num = (unsigned __int128)ticks * 1000000000ULL * div;
+	return (uint64_t)((num + hz - 1) / hz);
+}
+
+
+/********************************* Clocks *************************************/
+
+static uint32_t rtc_backup[0x400 / 4];		// RTC registers across a watchdog reset
+
+uint32_t sim_hclk(void) {
+	static const uint16_t hpre[8] = { 2, 4, 8, 16, 64, 128, 256, 512 };
+	uint32_t cfgr = RCC->CFGR;
+	uint64_t sys = HSI_HZ;
+
+	if (((cfgr & RCC_CFGR_SWS) >> RCC_CFGR_SWS_Pos) == 2) {
+		uint32_t pll = RCC->PLLCFGR;
+		uint64_t m = pll & RCC_PLLCFGR_PLLM;
+		uint64_t n = (pll & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+		uint64_t p = (((pll & RCC_PLLCFGR_PLLP) >> RCC_PLLCFGR_PLLP_Pos) + 1) * 2;
+		sys = (m == 0) ? HSI_HZ : (HSI_HZ * n) / (m * p);
+	}
+
+	uint32_t div = (cfgr & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos;
+	return (uint32_t)((div < 8) ? sys : (sys / hpre[div - 8]));
+}
+
+
+static uint32_t sim_apb_div(uint32_t bits) {
+	return (bits < 4) ? 1 : (2U << (bits - 4));
+}
+
+
+uint32_t sim_pclk1(void) {
+	return sim_hclk() / sim_apb_div((RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos);
+}
+
+
+uint32_t sim_pclk2(void) {
+	return sim_hclk() / sim_apb_div((RCC->CFGR & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos);
+}
+
+
+uint32_t sim_timclk1(void) {
+	uint32_t div = sim_apb_div((RCC->CFGR & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos);
+	return (div == 1) ? sim_pclk1() : (2 * sim_pclk1());
+}
+
+
+uint32_t sim_lsi_hz(void) {
+	return LSI_HZ;
+}
+
+
+static void clock_backup_reset(void) {
+	// RTC registers to their backup domain reset values
+	memset((void*)RTC, 0, 0x400);
+	RTC->ISR = RTC_ISR_ALRAWF | RTC_ISR_ALRBWF | RTC_ISR_WUTWF;
+	RTC->WUTR = 0xFFFF;
+	RTC->PRER = 0x007F00FF;
+	RCC->BDCR = 0;
+}
+
+
+static void clock_reset(sim_reset_t kind) {
+	uint32_t flags = RCC->CSR & 0xFF000000;
+	uint32_t bdcr = RCC->BDCR;
+
+	memcpy(rtc_backup, (const void*)RTC, sizeof(rtc_backup));
+	memset((void*)PERIPH_BASE, 0, 0x80000);
+
+	RCC->CR = RCC_CR_HSION | RCC_CR_HSIRDY | (0x10 << RCC_CR_HSITRIM_Pos);
+	RCC->PLLCFGR = 0x24003010;
+	if (kind == SIM_RESET_POWER) {
+		RCC->CSR = RCC_CSR_PORRSTF | RCC_CSR_PINRSTF;
+		clock_backup_reset();
+	} else {
+		RCC->CSR = flags | RCC_CSR_IWDGRSTF | RCC_CSR_PINRSTF;
+		RCC->BDCR = bdcr;
+		memcpy((void*)RTC, rtc_backup, sizeof(rtc_backup));
+	}
+	PWR->CSR = PWR_CSR_VOSRDY;
+}
+
+
+static void clock_sync(void) {
+	// Oscillators and the PLL lock at once; SWS follows SW
+	uint32_t cr = RCC->CR & ~(RCC_CR_HSIRDY | RCC_CR_PLLRDY);
+	cr |= (cr & RCC_CR_HSION) ? RCC_CR_HSIRDY : 0;
+	cr |= (cr & RCC_CR_PLLON) ? RCC_CR_PLLRDY : 0;
+	RCC->CR = cr;
+
+	uint32_t cfgr = RCC->CFGR;
+	uint32_t sw = cfgr & RCC_CFGR_SW;
+	if ((sw == RCC_CFGR_SW_PLL) && !(cr & RCC_CR_PLLRDY)) {
+		sw = RCC_CFGR_SW_HSI;				// The switch waits for the PLL
+	}
+	RCC->CFGR = (cfgr & ~RCC_CFGR_SWS) | (sw << RCC_CFGR_SWS_Pos);
+
+	uint32_t csr = RCC->CSR & ~RCC_CSR_LSIRDY;
+	csr |= (csr & RCC_CSR_LSION) ? RCC_CSR_LSIRDY : 0;
+	if (csr & RCC_CSR_RMVF) {
+		csr &= 0x00FFFFFF;
+	}
+	RCC->CSR = csr;
+
+	if (RCC->BDCR & RCC_BDCR_BDRST) {
+		uint32_t bdcr = RCC->BDCR;
+		clock_backup_reset();
+		RCC->BDCR = bdcr & RCC_BDCR_BDRST;
+	}
+	PWR->CSR |= PWR_CSR_VOSRDY;
+}
+
+
+static const sim_model_t clock_model = { "rcc", clock_reset, clock_sync, NULL, NULL };
+
+
+/********************************** GPIO **************************************/
+
+#define GPIO_PORTS		5					// A..E
+
+typedef struct {
+	bool (*input[16])(uint64_t now);
+	sim_pin_watch_t watch[16];
+	uint32_t moder;							// As last seen, for the watchers
+	uint32_t odr;
+	uint32_t inputs;						// Pins with an input[] driver
+	uint32_t watched;						// ... and with a watch[]
+	uint32_t key[4];						// MODER, OTYPER, PUPDR, ODR behind idr_fixed
+	uint32_t idr_fixed;						// IDR of the other pins
+} gpio_t;
+
+static gpio_t gpio[GPIO_PORTS];
+
+static GPIO_TypeDef* gpio_regs(int port) {
+	return (GPIO_TypeDef*)(GPIOA_BASE + 0x400 * port);
+}
+
+
+void sim_gpio_input(int port, int pin, bool (*level)(uint64_t now)) {
+	gpio[port].input[pin] = level;
+	gpio[port].inputs = (gpio[port].inputs & ~(1U << pin)) | ((level != NULL) << pin);
+	gpio[port].key[0] = ~gpio_regs(port)->MODER;	// Work idr_fixed out again
+}
+
+
+void sim_gpio_watch(int port, int pin, sim_pin_watch_t fn) {
+	gpio[port].watch[pin] = fn;
+	gpio[port].watched = (gpio[port].watched & ~(1U << pin)) | ((fn != NULL) << pin);
+}
+
+
+static bool gpio_is_output(const GPIO_TypeDef* g, int pin) {
+	return ((g->MODER >> (2 * pin)) & 3) == 1;
+}
+
+
+bool sim_gpio_driven_low(int port, int pin) {
+	GPIO_TypeDef* g = gpio_regs(port);
+	return gpio_is_output(g, pin) && !(g->ODR & (1U << pin));
+}
+
+
+bool sim_gpio_output(int port, int pin) {
+	GPIO_TypeDef* g = gpio_regs(port);
+	return gpio_is_output(g, pin) && (g->ODR & (1U << pin));
+}
+
+
+static bool gpio_level(const GPIO_TypeDef* g, const gpio_t* p, int pin, uint64_t now) {
+	// A pin's level from the MCU and whatever is wired to it
+	bool level;
+
+	if (p->input[pin] != NULL) {
+		level = p->input[pin](now);
+	} else {
+		level = (((g->PUPDR >> (2 * pin)) & 3) == 1);
+	}
+	if (gpio_is_output(g, pin)) {
+		bool out = (g->ODR >> pin) & 1;
+		level = (g->OTYPER & (1U << pin)) ? (level && out) : out;
+	}
+	return level;
+}
+
+
+static void gpio_refresh(uint64_t now) {
+	// IDR from the pins' drivers; only pins with an input[] driver change by themselves
+	for (int port = 0; port < GPIO_PORTS; port++) {
+		GPIO_TypeDef* g = gpio_regs(port);
+		gpio_t* p = &gpio[port];
+		uint32_t idr;
+
+		if ((g->MODER != p->key[0]) || (g->OTYPER != p->key[1]) || (g->PUPDR != p->key[2])
+				|| (g->ODR != p->key[3])) {
+			p->key[0] = g->MODER;
+			p->key[1] = g->OTYPER;
+			p->key[2] = g->PUPDR;
+			p->key[3] = g->ODR;
+			p->idr_fixed = 0;
+			for (int pin = 0; pin < 16; pin++) {
+				if (!(p->inputs & (1U << pin))) {
+					p->idr_fixed |= (uint32_t)gpio_level(g, p, pin, now) << pin;
+				}
+			}
+		}
+		idr = p->idr_fixed;
+		for (uint32_t in = p->inputs; in != 0; in &= in - 1) {
+			int pin = __builtin_ctz(in);
+			idr |= (uint32_t)gpio_level(g, p, pin, now) << pin;
+		}
+		g->IDR = idr;
+	}
+}
+
+
+static void gpio_reset(sim_reset_t kind) {
+	(void)kind;
+	GPIOA->MODER = 0xA8000000;				// Debug pins
+	GPIOA->PUPDR = 0x64000000;
+	GPIOA->OSPEEDR = 0x0C000000;
+	GPIOB->MODER = 0x00000280;
+	GPIOB->PUPDR = 0x00000100;
+	GPIOB->OSPEEDR = 0x000000C0;
+	for (int port = 0; port < GPIO_PORTS; port++) {
+		gpio[port].moder = gpio_regs(port)->MODER;
+		gpio[port].odr = 0;
+	}
+	gpio_refresh(sim_now());
+}
+
+
+static void gpio_sync(void) {
+	uint64_t now = sim_now();
+
+	for (int port = 0; port < GPIO_PORTS; port++) {
+		GPIO_TypeDef* g = gpio_regs(port);
+		uint32_t bsrr = g->BSRR;
+
+		if (bsrr != 0) {
+			g->ODR = ((g->ODR & ~(bsrr >> 16)) | bsrr) & 0xFFFF;
+			g->BSRR = 0;
+		}
+
+		// Watchers see every change of a pin's mode or output level
+		uint32_t moder = g->MODER, odr = g->ODR;
+		for (uint32_t w = gpio[port].watched; w != 0; w &= w - 1) {
+			int pin = __builtin_ctz(w);
+			bool changed = (((moder ^ gpio[port].moder) >> (2 * pin)) & 3)
+					|| (((odr ^ gpio[port].odr) >> pin) & 1);
+			if (changed) {
+				gpio[port].moder = (gpio[port].moder & ~(3U << (2 * pin))) | (moder & (3U << (2 * pin)));
+				gpio[port].odr = (gpio[port].odr & ~(1U << pin)) | (odr & (1U << pin));
+				gpio[port].watch[pin](port, pin, sim_gpio_output(port, pin), now);
+			}
+		}
+	}
+	gpio_refresh(now);
+}
+
+
+static const sim_model_t gpio_model = { "gpio", gpio_reset, gpio_sync, gpio_refresh, NULL };
+
+
+/********************************* Timers *************************************/
+
+/*
+ * The counter runs from a base: pos0 at t0, one tick per (PSC + 1) timer
+ * clocks after that. Positions are not wrapped, so the update events up to
+ * a time are the multiples of ARR + 1 passed, and the CC1 matches the
+ * positions congruent to CCR1. Register changes move the base to now.
+ */
+typedef struct {
+	TIM_TypeDef* regs;
+	int irqn;
+	bool running;
+	uint64_t t0;
+	uint64_t pos0;
+	uint32_t clk;
+	uint32_t psc;							// Active prescaler (PSC is preloaded)
+	uint64_t period;						// ARR + 1
+	uint32_t ccr1;
+	uint64_t cc1_from;						// Position from which CC1 matches are counted
+	uint64_t cc1_acc;						// Matches before that
+	uint64_t wraps_acc;						// Update events before t0
+	uint64_t wraps_seen;					// Flagged in SR so far
+	uint64_t cc1_seen;
+	uint32_t sh_sr, sh_cnt, sh_arr, sh_ccr1, sh_cr1;
+} tim_t;
+
+static tim_t tims[3] = {
+	{ .regs = TIM2, .irqn = TIM2_IRQn },
+	{ .regs = TIM3, .irqn = TIM3_IRQn },
+	{ .regs = TIM5, .irqn = TIM5_IRQn },
+};
+
+#define TIM_ADC		(&tims[2])				// TIM5 CC1 triggers ADC1
+
+static uint64_t tim_pos(const tim_t* t, uint64_t now) {
+	if (!t->running || (now <= t->t0)) {
+		return t->pos0;
+	}
+	return t->pos0 + sim_ticks(now - t->t0, t->clk, (uint64_t)t->psc + 1);
+}
+
+
+static uint64_t tim_pos_time(const tim_t* t, uint64_t pos) {
+	// When the counter reaches pos; SIM_NEVER if it is stopped
+	if (!t->running || (t->clk == 0)) {
+		return SIM_NEVER;
+	}
+	if (pos <= t->pos0) {
+		return t->t0;
+	}
+	return t->t0 + sim_ticks_ns(pos - t->pos0, t->clk, (uint64_t)t->psc + 1);
+}
+
+
+static uint64_t tim_matches(const tim_t* t, uint64_t pos) {
+	// CC1 matches at positions up to pos, since cc1_from
+	uint64_t c = t->ccr1;
+
+	if (c >= t->period) {
+		return 0;
+	}
+	return ((pos + t->period - c) / t->period) - ((t->cc1_from + t->period - c) / t->period);
+}
+
+
+static uint64_t tim_cc1_total(const tim_t* t, uint64_t now) {
+	return t->cc1_acc + tim_matches(t, tim_pos(t, now));
+}
+
+
+static uint64_t tim_cc1_time(const tim_t* t, uint64_t k) {
+	// When the k-th CC1 match (1-based, counted like tim_cc1_total()) happens
+	uint64_t c = t->ccr1;
+
+	if ((c >= t->period) || (k <= t->cc1_acc)) {
+		return (k <= t->cc1_acc) ? t->t0 : SIM_NEVER;
+	}
+	uint64_t before = (t->cc1_from + t->period - c) / t->period;	// Matches at or before cc1_from
+	uint64_t pos = c + (before + (k - t->cc1_acc) - 1) * t->period;
+	return tim_pos_time(t, pos);
+}
+
+
+static uint64_t tim_wraps(const tim_t* t, uint64_t now) {
+	return t->wraps_acc + (tim_pos(t, now) / t->period) - (t->pos0 / t->period);
+}
+
+
+static void tim_rebase(tim_t* t, uint64_t now, uint64_t cnt) {
+	// Counter to cnt at now, keeping the events counted so far
+	uint64_t pos = tim_pos(t, now);
+
+	t->wraps_acc = tim_wraps(t, now);
+	t->cc1_acc += tim_matches(t, pos);
+	t->t0 = now;
+	t->pos0 = cnt;
+	t->cc1_from = cnt;
+}
+
+
+static void tim_store(tim_t* t, uint64_t now) {
+	// Flags and CNT as of now
+	uint64_t w = tim_wraps(t, now);
+	uint64_t m = tim_cc1_total(t, now);
+	uint32_t sr = t->sh_sr;
+
+	if (w > t->wraps_seen) {
+		sr |= TIM_SR_UIF;
+		t->wraps_seen = w;
+	}
+	if (m > t->cc1_seen) {
+		sr |= TIM_SR_CC1IF;
+		t->cc1_seen = m;
+	}
+	t->regs->SR = t->sh_sr = sr;
+	t->regs->CNT = t->sh_cnt = (uint32_t)(tim_pos(t, now) % t->period);
+}
+
+
+static void tim_reset_one(tim_t* t) {
+	memset(&t->running, 0, sizeof(*t) - offsetof(tim_t, running));
+	t->period = (t->regs == TIM3) ? 0x10000 : 0x100000000ULL;
+	t->regs->ARR = t->sh_arr = (uint32_t)(t->period - 1);
+	t->clk = sim_timclk1();
+}
+
+
+static void tim_sync_one(tim_t* t) {
+	TIM_TypeDef* r = t->regs;
+	uint64_t now = sim_now();
+	uint64_t cnt = tim_pos(t, now) % t->period;
+
+	// Status flags are rc_w0
+	t->sh_sr &= r->SR;
+
+	if (r->CNT != t->sh_cnt) {
+		cnt = r->CNT;
+		tim_rebase(t, now, cnt);
+	}
+	if (r->EGR & TIM_EGR_UG) {
+		// Update event: PSC loaded, counter cleared. UIF is not raised, as the
+		// firmware clears it straight after forcing one, before any sync point.
+		r->EGR = 0;
+		cnt = 0;
+		tim_rebase(t, now, cnt);
+		t->psc = r->PSC;
+	}
+	if ((r->ARR != t->sh_arr) || (t->clk != sim_timclk1())) {
+		tim_rebase(t, now, cnt);
+		t->period = (uint64_t)r->ARR + 1;
+		t->sh_arr = r->ARR;
+		t->clk = sim_timclk1();
+		t->pos0 %= t->period;
+		t->cc1_from = t->pos0;
+	}
+	if (r->CCR1 != t->sh_ccr1) {
+		uint64_t pos = tim_pos(t, now);
+		t->cc1_acc += tim_matches(t, pos);
+		t->cc1_from = pos;
+		t->ccr1 = t->sh_ccr1 = r->CCR1;
+	}
+	if ((r->CR1 ^ t->sh_cr1) & TIM_CR1_CEN) {
+		tim_rebase(t, now, cnt);
+		t->running = (r->CR1 & TIM_CR1_CEN) != 0;
+	}
+	t->sh_cr1 = r->CR1;
+	tim_store(t, now);
+}
+
+
+static bool tim_level(const tim_t* t) {
+	return (t->regs->SR & t->regs->DIER & TIM_SR_FLAGS) != 0;
+}
+
+
+static bool tim2_level(void) { return tim_level(&tims[0]); }
+static bool tim3_level(void) { return tim_level(&tims[1]); }
+static bool tim5_level(void) { return tim_level(&tims[2]); }
+
+
+static void tim_reset(sim_reset_t kind) {
+	(void)kind;
+	for (int i = 0; i < 3; i++) {
+		tim_reset_one(&tims[i]);
+	}
+}
+
+
+static void tim_sync(void) {
+	for (int i = 0; i < 3; i++) {
+		tim_sync_one(&tims[i]);
+	}
+}
+
+
+static void tim_update(uint64_t now) {
+	for (int i = 0; i < 3; i++) {
+		tim_store(&tims[i], now);
+	}
+}
+
+
+static uint64_t tim_next(void) {
+	// Only flags someone waits on need an exact time; the rest are found on the way
+	uint64_t next = SIM_NEVER;
+
+	for (int i = 0; i < 3; i++) {
+		tim_t* t = &tims[i];
+		uint64_t now = sim_now();
+		uint64_t pos = tim_pos(t, now);
+
+		if (!t->running) {
+			continue;
+		}
+		if (t->regs->DIER & TIM_DIER_UIE) {
+			uint64_t at = tim_pos_time(t, (pos / t->period + 1) * t->period);
+			next = (at < next) ? at : next;
+		}
+		if (t->regs->DIER & TIM_DIER_CC1IE) {
+			uint64_t at = tim_cc1_time(t, tim_cc1_total(t, now) + 1);
+			next = (at < next) ? at : next;
+		}
+	}
+	return next;
+}
+
+
+static const sim_model_t tim_model = { "tim", tim_reset, tim_sync, tim_update, tim_next };
+
+
+/*********************************** DWT **************************************/
+
+static struct {
+	uint32_t base;
+	uint64_t t0;
+	uint32_t hclk;
+	bool on;
+	uint32_t shadow;
+} dwt;
+
+static bool dwt_counting(void) {
+	return (CoreDebug->DEMCR & CoreDebug_DEMCR_TRCENA_Msk) && (DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk);
+}
+
+
+static uint32_t dwt_value(uint64_t now) {
+	if (!dwt.on) {
+		return dwt.base;
+	}
+	return dwt.base + (uint32_t)sim_ticks(now - dwt.t0, dwt.hclk, 1);
+}
+
+
+static void dwt_reset(sim_reset_t kind) {
+	(void)kind;
+	memset(&dwt, 0, sizeof(dwt));
+}
+
+
+static void dwt_sync(void) {
+	uint64_t now = sim_now();
+	uint32_t cyc = (DWT->CYCCNT != dwt.shadow) ? DWT->CYCCNT : dwt_value(now);
+
+	if ((DWT->CYCCNT != dwt.shadow) || (dwt.on != dwt_counting()) || (dwt.hclk != sim_hclk())) {
+		dwt.base = cyc;
+		dwt.t0 = now;
+		dwt.on = dwt_counting();
+		dwt.hclk = sim_hclk();
+	}
+	DWT->CYCCNT = dwt.shadow = dwt_value(now);
+}
+
+
+static void dwt_update(uint64_t now) {
+	DWT->CYCCNT = dwt.shadow = dwt_value(now);
+}
+
+
+static const sim_model_t dwt_model = { "dwt", dwt_reset, dwt_sync, dwt_update, NULL };
+
+
+/*********************************** IWDG *************************************/
+
+static struct {
+	bool running;
+	uint64_t expires;
+} iwdg;
+
+static void iwdg_reload(void) {
+	uint64_t div = 4ULL << (IWDG->PR & 7);
+	uint64_t ticks = (uint64_t)(IWDG->RLR & 0xFFF) + 1;
+	iwdg.expires = sim_now() + sim_ticks_ns(ticks, LSI_HZ, div);
+}
+
+
+static void iwdg_reset(sim_reset_t kind) {
+	(void)kind;
+	iwdg.running = false;
+	IWDG->RLR = 0xFFF;
+}
+
+
+static void iwdg_sync(void) {
+	uint32_t key = IWDG->KR;
+
+	if (key == 0) {
+		return;
+	}
+	IWDG->KR = 0;
+	if (key == 0xCCCC) {
+		iwdg.running = true;
+		RCC->CSR |= RCC_CSR_LSION | RCC_CSR_LSIRDY;
+		iwdg_reload();
+	} else if ((key == 0xAAAA) && iwdg.running) {
+		iwdg_reload();
+	}
+}
+
+
+static void iwdg_update(uint64_t now) {
+	if (iwdg.running && (now >= iwdg.expires)) {
+		iwdg.running = false;
+		sim_reset(SIM_RESET_IWDG);
+	}
+}
+
+
+static uint64_t iwdg_next(void) {
+	return iwdg.running ? iwdg.expires : SIM_NEVER;
+}
+
+
+static const sim_model_t iwdg_model = { "iwdg", iwdg_reset, iwdg_sync, iwdg_update, iwdg_next };
+
+
+/**************************** RTC wakeup, EXTI ********************************/
+
+static struct {
+	bool running;
+	uint64_t period;
+	uint64_t next;
+	uint32_t sh_isr;
+	uint32_t sh_pr;
+} rtc;
+
+static void rtc_reset(sim_reset_t kind) {
+	(void)kind;
+	rtc.running = false;
+	rtc.sh_isr = RTC->ISR;
+	EXTI->PR = rtc.sh_pr = SENTINEL;
+}
+
+
+static void rtc_sync(void) {
+	// WUTF is rc_w0, INIT the only other bit used; EXTI PR is w1c
+	uint32_t isr = RTC->ISR;
+	uint32_t wutf = rtc.sh_isr & isr & RTC_ISR_WUTF;
+	uint32_t init = isr & RTC_ISR_INIT;
+	bool wute = (RTC->CR & RTC_CR_WUTE) != 0;
+
+	if (wute && !rtc.running) {
+		static const uint8_t div[4] = { 16, 8, 4, 2 };
+		uint32_t sel = RTC->CR & RTC_CR_WUCKSEL;
+		uint64_t ticks = (uint64_t)(RTC->WUTR & 0xFFFF) + 1;
+		rtc.period = sim_ticks_ns(ticks, LSI_HZ, (sel < 4) ? div[sel] : LSI_HZ);
+		rtc.next = sim_now() + rtc.period;
+	}
+	rtc.running = wute;
+
+	isr = rtc.sh_isr & ~(RTC_ISR_WUTF | RTC_ISR_WUTWF | RTC_ISR_INIT | RTC_ISR_INITF);
+	isr |= wutf | init | (init ? RTC_ISR_INITF : 0) | (wute ? 0 : RTC_ISR_WUTWF);
+	RTC->ISR = rtc.sh_isr = isr;
+
+	if (!(EXTI->PR & SENTINEL)) {
+		rtc.sh_pr &= ~EXTI->PR;
+	}
+	EXTI->PR = rtc.sh_pr |= SENTINEL;
+}
+
+
+static void rtc_update(uint64_t now) {
+	while (rtc.running && (now >= rtc.next)) {
+		RTC->ISR = rtc.sh_isr |= RTC_ISR_WUTF;
+		if ((EXTI->IMR & EXTI_IMR_MR22) && (EXTI->RTSR & EXTI_RTSR_TR22)) {
+			EXTI->PR = rtc.sh_pr |= EXTI_PR_PR22;
+		}
+		rtc.next += rtc.period;
+	}
+}
+
+
+static uint64_t rtc_next(void) {
+	return rtc.running ? rtc.next : SIM_NEVER;
+}
+
+
+static bool rtc_level(void) {
+	return (EXTI->PR & EXTI->IMR & EXTI_PR_PR22) != 0;
+}
+
+
+static const sim_model_t rtc_model = { "rtc", rtc_reset, rtc_sync, rtc_update, rtc_next };
+
+
+/******************************* ADC1, DMA2 ***********************************/
+
+/*
+ * Conversions are carried out lazily: on each update, every conversion
+ * finished by then is written to the buffer DMA2 stream 0 points at, with
+ * the flags it raises. Each TIM5 CC1 event starts one scan of the regular
+ * sequence; a conversion takes the channel's sampling time plus 12 cycles.
+ */
+static struct {
+	sim_analog_t source[ADC_CHANNELS];
+	double vdda;
+	uint32_t total;
+
+	bool armed;
+	uint64_t trig_base;						// TIM5 CC1 matches before the ADC was armed
+	uint64_t done;							// Conversions since
+	uint32_t n;								// DMA buffer length (transfers)
+	uint32_t ndtr;
+	uint32_t sh_cr0;
+} adc;
+
+static double adc_vrefint(uint64_t now) {
+	(void)now;
+	return ADC_VREFINT_MV;
+}
+
+
+static double adc_die(uint64_t now) {
+	(void)now;
+	return ADC_TS_MV_30 - 5 * ADC_TS_SLOPE;		// 25 Celsius
+}
+
+
+void sim_adc_source(int channel, sim_analog_t mv) {
+	adc.source[channel] = mv;
+}
+
+
+void sim_adc_vdda(double mv) {
+	adc.vdda = mv;
+}
+
+
+uint32_t sim_adc_conversions(void) {
+	return adc.total;
+}
+
+
+static uint32_t adc_scan(void) {
+	return ((ADC1->SQR1 & ADC_SQR1_L) >> ADC_SQR1_L_Pos) + 1;
+}
+
+
+static int adc_channel(uint32_t rank) {
+	// SQ1..SQ6 in SQR3, SQ7..SQ12 in SQR2
+	uint32_t reg = (rank < 6) ? ADC1->SQR3 : ADC1->SQR2;
+	return (reg >> (5 * (rank % 6))) & 0x1F;
+}
+
+
+static uint64_t adc_conv_ns(int ch) {
+	static const uint16_t smp[8] = { 3, 15, 28, 56, 84, 112, 144, 480 };
+	uint32_t code = (ch < 10) ? (ADC1->SMPR2 >> (3 * ch)) : (ADC1->SMPR1 >> (3 * (ch - 10)));
+	uint32_t adcclk = sim_pclk2() / (2 * (((ADC->CCR & ADC_CCR_ADCPRE) >> ADC_CCR_ADCPRE_Pos) + 1));
+	return sim_ticks_ns(smp[code & 7] + 12, adcclk, 1);
+}
+
+
+static bool adc_triggered(void) {
+	// ADC on, triggered by TIM5 CC1 with the channel output enabled, into DMA
+	return (ADC1->CR2 & ADC_CR2_ADON) && (ADC1->CR2 & ADC_CR2_EXTEN)
+			&& (((ADC1->CR2 & ADC_CR2_EXTSEL) >> ADC_CR2_EXTSEL_Pos) == 10)
+			&& (ADC1->CR2 & ADC_CR2_DMA) && (DMA2_Stream0->CR & DMA_SxCR_EN)
+			&& (TIM5->CCER & TIM_CCER_CC1E);
+}
+
+
+static uint64_t adc_conv_time(uint64_t c) {
+	// When conversion c (counted from arming) completes
+	uint32_t scan = adc_scan();
+	uint64_t trig = tim_cc1_time(TIM_ADC, adc.trig_base + (c / scan) + 1);
+	uint64_t t = trig;
+
+	if (trig == SIM_NEVER) {
+		return SIM_NEVER;
+	}
+	for (uint32_t p = 0; p <= (c % scan); p++) {
+		t += adc_conv_ns(adc_channel(p));
+	}
+	return t;
+}
+
+
+static void adc_convert(uint64_t c, uint64_t at) {
+	int ch = adc_channel(c % adc_scan());
+	double mv = (adc.source[ch] != NULL) ? adc.source[ch](at) : 0;
+	double u = (double)(sim_random() >> 11) / 9007199254740992.0;	// Dither, [0, 1)
+	double code = (mv * 4096.0 / adc.vdda) + u;
+	uint16_t value = (code < 0) ? 0 : ((code >= 4095) ? 4095 : (uint16_t)code);
+
+	uint16_t* buf = (uint16_t*)(uintptr_t)DMA2_Stream0->M0AR;
+	buf[adc.n - adc.ndtr] = value;
+	ADC1->DR = value;
+	adc.total++;
+
+	adc.ndtr--;
+	if (adc.ndtr == adc.n / 2) {
+		DMA2->LISR |= DMA_LISR_HTIF0;
+	}
+	if (adc.ndtr == 0) {
+		DMA2->LISR |= DMA_LISR_TCIF0;
+		adc.ndtr = adc.n;					// Circular
+	}
+	DMA2_Stream0->NDTR = adc.ndtr;
+}
+
+
+static void adc_reset(sim_reset_t kind) {
+	(void)kind;
+	adc.armed = false;
+	adc.sh_cr0 = 0;
+}
+
+
+static void adc_update(uint64_t now) {
+	if (!adc.armed) {
+		return;
+	}
+	uint64_t trigs = tim_cc1_total(TIM_ADC, now) - adc.trig_base;
+	uint32_t scan = adc_scan();
+
+	while ((adc.done / scan) < trigs) {
+		uint64_t at = adc_conv_time(adc.done);
+		if (at > now) {
+			break;
+		}
+		adc_convert(adc.done, at);
+		adc.done++;
+	}
+}
+
+
+static void adc_sync(void) {
+	uint32_t cr0 = DMA2_Stream0->CR;
+
+	if (DMA2->LIFCR != 0) {
+		DMA2->LISR &= ~DMA2->LIFCR;
+		DMA2->LIFCR = 0;
+	}
+	if ((cr0 & DMA_SxCR_EN) && !(adc.sh_cr0 & DMA_SxCR_EN)) {
+		adc.n = adc.ndtr = DMA2_Stream0->NDTR;
+	}
+	adc.sh_cr0 = cr0;
+
+	bool armed = adc_triggered() && (adc.n > 0);
+	if (armed && !adc.armed) {
+		adc.trig_base = tim_cc1_total(TIM_ADC, sim_now());
+		adc.done = 0;
+	} else if (!armed && adc.armed) {
+		adc_update(sim_now());
+	}
+	adc.armed = armed;
+}
+
+
+static uint64_t adc_next(void) {
+	// The conversion that raises the next half/full transfer flag
+	if (!adc.armed || !(DMA2_Stream0->CR & (DMA_SxCR_HTIE | DMA_SxCR_TCIE))) {
+		return SIM_NEVER;
+	}
+	uint32_t left = (adc.ndtr > adc.n / 2) ? (adc.ndtr - adc.n / 2) : adc.ndtr;
+	return adc_conv_time(adc.done + left - 1);
+}
+
+
+static bool dma0_level(void) {
+	uint32_t cr = DMA2_Stream0->CR, lisr = DMA2->LISR;
+	return ((lisr & DMA_LISR_HTIF0) && (cr & DMA_SxCR_HTIE))
+			|| ((lisr & DMA_LISR_TCIF0) && (cr & DMA_SxCR_TCIE))
+			|| ((lisr & DMA_LISR_TEIF0) && (cr & DMA_SxCR_TEIE));
+}
+
+
+static const sim_model_t adc_model = { "adc", adc_reset, adc_sync, adc_update, adc_next };
+
+
+/********************************* USART1 *************************************/
+
+typedef struct {
+	uint8_t byte;
+	uint32_t baud;
+	uint64_t at;
+} rx_byte_t;
+
+static struct {
+	// MCU to ESP
+	bool tx_active;
+	uint64_t tx_end;
+	uint8_t tx_copy[65536];					// What the DMA was given, to spot later changes
+	uint16_t tx_len;
+	const uint8_t* tx_src;
+	uint32_t tx_overwritten;
+	uint32_t sh_cr7;
+
+	// ESP to MCU
+	rx_byte_t rx[RX_QUEUE];
+	uint32_t rx_head, rx_tail;
+	uint64_t rx_free_at;
+	uint32_t overruns;
+
+	uint32_t sh_sr;
+	uint32_t sh_dr;
+	uint8_t dr_byte;
+	bool dr_tx;								// A byte written to DR is on the line
+	uint64_t dr_end;
+} u1;
+
+static uint32_t usart_baud(const USART_TypeDef* u, uint32_t clk) {
+	uint32_t brr = u->BRR;
+	uint32_t div = (u->CR1 & USART_CR1_OVER8) ? (((brr >> 4) << 3) | (brr & 7)) : brr;
+
+	// Oversampling by 16: BRR = clk / baud; by 8: BRR's mantissa and 3-bit fraction are clk / (8 × baud)
+	return (div == 0) ? 0 : (clk / div);
+}
+
+
+uint32_t sim_usart1_baud(void) {
+	return usart_baud(USART1, sim_pclk2());
+}
+
+
+static uint64_t usart_byte_ns(uint32_t baud) {
+	// 8N1; an unconfigured USART is taken as infinitely fast rather than stuck
+	return (baud == 0) ? 0 : sim_ticks_ns(10, baud, 1);
+}
+
+
+void sim_usart1_to_mcu(const void* data, size_t len, uint32_t baud, uint64_t delay) {
+	// Bytes from the ESP, back to back at its baud rate after delay
+	const uint8_t* p = data;
+	uint64_t t = sim_now() + delay;
+
+	if (t < u1.rx_free_at) {
+		t = u1.rx_free_at;
+	}
+	for (size_t i = 0; i < len; i++) {
+		if ((u1.rx_head - u1.rx_tail) >= RX_QUEUE) {
+			break;
+		}
+		t += usart_byte_ns(baud);
+		u1.rx[u1.rx_head++ % RX_QUEUE] = (rx_byte_t){ p[i], baud, t };
+	}
+	u1.rx_free_at = t;
+}
+
+
+uint64_t sim_usart1_idle_at(void) {
+	return u1.rx_free_at;
+}
+
+
+uint32_t sim_usart1_overruns(void) {
+	return u1.overruns;
+}
+
+
+uint32_t sim_usart1_tx_overwritten(void) {
+	return u1.tx_overwritten;
+}
+
+
+static bool usart_baud_close(uint32_t a, uint32_t b) {
+	// A receiver tolerates a few percent of mismatch
+	uint32_t diff = (a > b) ? (a - b) : (b - a);
+	return (uint64_t)diff * 100 <= (uint64_t)b * 3;
+}
+
+
+static void u1_reset(sim_reset_t kind) {
+	(void)kind;
+	u1.tx_active = false;
+	u1.dr_tx = false;
+	u1.sh_cr7 = 0;
+	u1.rx_tail = u1.rx_head;
+	u1.rx_free_at = 0;
+	USART1->SR = u1.sh_sr = USART_SR_TXE | USART_SR_TC;
+	USART1->DR = u1.sh_dr = SENTINEL;
+}
+
+
+static void u1_sync(void) {
+	uint64_t now = sim_now();
+
+	u1.sh_sr &= USART1->SR | ~USART_SR_FLAGS;
+
+	if (!(USART1->DR & SENTINEL)) {
+		// Written by the firmware: one byte out, polled
+		u1.dr_byte = (uint8_t)USART1->DR;
+		u1.dr_tx = true;
+		u1.dr_end = now + usart_byte_ns(sim_usart1_baud());
+		u1.sh_sr &= ~(USART_SR_TXE | USART_SR_TC);
+		USART1->DR = u1.sh_dr;
+	}
+
+	if (DMA2->HIFCR != 0) {
+		DMA2->HISR &= ~DMA2->HIFCR;
+		DMA2->HIFCR = 0;
+	}
+
+	uint32_t cr7 = DMA2_Stream7->CR;
+	if ((cr7 & DMA_SxCR_EN) && !(u1.sh_cr7 & DMA_SxCR_EN)) {
+		u1.tx_len = DMA2_Stream7->NDTR;
+		u1.tx_src = (const uint8_t*)(uintptr_t)DMA2_Stream7->M0AR;
+		memcpy(u1.tx_copy, u1.tx_src, u1.tx_len);
+		u1.tx_active = true;
+		u1.tx_end = now + u1.tx_len * usart_byte_ns(sim_usart1_baud());
+		u1.sh_sr &= ~USART_SR_TC;
+	}
+	u1.sh_cr7 = cr7;
+	USART1->SR = u1.sh_sr;
+}
+
+
+static void u1_update(uint64_t now) {
+	if (u1.tx_active && (now >= u1.tx_end)) {
+		// The DMA read the buffer as the bytes went out; later changes show
+		if (memcmp(u1.tx_copy, u1.tx_src, u1.tx_len) != 0) {
+			u1.tx_overwritten++;
+		}
+		u1.tx_active = false;
+		DMA2_Stream7->NDTR = 0;
+		DMA2_Stream7->CR = u1.sh_cr7 = DMA2_Stream7->CR & ~DMA_SxCR_EN;
+		DMA2->HISR |= DMA_HISR_TCIF7;
+		u1.sh_sr |= USART_SR_TC;
+		sim_esp_from_mcu(u1.tx_src, u1.tx_len, sim_usart1_baud());
+	}
+	if (u1.dr_tx && (now >= u1.dr_end)) {
+		u1.dr_tx = false;
+		u1.sh_sr |= USART_SR_TXE | USART_SR_TC;
+		sim_esp_from_mcu(&u1.dr_byte, 1, sim_usart1_baud());
+	}
+
+	while ((u1.rx_tail != u1.rx_head) && (u1.rx[u1.rx_tail % RX_QUEUE].at <= now)) {
+		rx_byte_t* b = &u1.rx[u1.rx_tail++ % RX_QUEUE];
+		uint32_t cr1 = USART1->CR1;
+
+		if (!(cr1 & USART_CR1_UE) || !(cr1 & USART_CR1_RE)) {
+			continue;
+		}
+		uint8_t c = b->byte;
+		if (!usart_baud_close(sim_usart1_baud(), b->baud)) {
+			c = (uint8_t)(sim_random() | 0x80);	// Framing at the wrong rate
+		}
+		if (u1.sh_sr & USART_SR_RXNE) {
+			u1.sh_sr |= USART_SR_ORE;
+			u1.overruns++;
+			continue;
+		}
+		u1.sh_sr |= USART_SR_RXNE;
+		USART1->DR = u1.sh_dr = SENTINEL | c;
+	}
+	USART1->SR = u1.sh_sr;
+}
+
+
+static uint64_t u1_next(void) {
+	uint64_t next = SIM_NEVER;
+
+	if (u1.tx_active) {
+		next = u1.tx_end;
+	}
+	if (u1.dr_tx && (u1.dr_end < next)) {
+		next = u1.dr_end;
+	}
+	if ((u1.rx_tail != u1.rx_head) && (u1.rx[u1.rx_tail % RX_QUEUE].at < next)) {
+		next = u1.rx[u1.rx_tail % RX_QUEUE].at;
+	}
+	return next;
+}
+
+
+static bool u1_level(void) {
+	uint32_t cr1 = USART1->CR1, sr = USART1->SR;
+	return ((cr1 & USART_CR1_RXNEIE) && (sr & (USART_SR_RXNE | USART_SR_ORE)))
+			|| ((cr1 & USART_CR1_TCIE) && (sr & USART_SR_TC))
+			|| ((cr1 & USART_CR1_TXEIE) && (sr & USART_SR_TXE));
+}
+
+
+static void u1_taken(void) {
+	// The handler read SR then DR, which clears RXNE and ORE
+	u1.sh_sr &= ~(USART_SR_RXNE | USART_SR_ORE);
+	USART1->SR = u1.sh_sr;
+}
+
+
+static bool dma7_level(void) {
+	uint32_t cr = DMA2_Stream7->CR, hisr = DMA2->HISR;
+	return ((hisr & DMA_HISR_TCIF7) && (cr & DMA_SxCR_TCIE))
+			|| ((hisr & DMA_HISR_TEIF7) && (cr & DMA_SxCR_TEIE));
+}
+
+
+static const sim_model_t u1_model = { "usart1", u1_reset, u1_sync, u1_update, u1_next };
+
+
+/********************************* USART2 *************************************/
+
+static struct {
+	char* text;
+	size_t len;
+	bool busy;
+	uint64_t end;
+	uint32_t sh_sr;
+} u2;
+
+const char* sim_console(void) {
+	return (u2.text != NULL) ? u2.text : "";
+}
+
+
+void sim_console_clear(void) {
+	u2.len = 0;
+	if (u2.text != NULL) {
+		u2.text[0] = '\0';
+	}
+}
+
+
+static void u2_reset(sim_reset_t kind) {
+	(void)kind;
+	u2.busy = false;
+	USART2->SR = u2.sh_sr = USART_SR_TXE | USART_SR_TC;
+	USART2->DR = SENTINEL;
+}
+
+
+static void u2_sync(void) {
+	u2.sh_sr &= USART2->SR | ~USART_SR_FLAGS;
+	if (!(USART2->DR & SENTINEL)) {
+		char c = (char)USART2->DR;
+
+		if (u2.text == NULL) {
+			u2.text = calloc(CONSOLE_MAX, 1);
+		}
+		if (u2.len < (CONSOLE_MAX - 1)) {
+			u2.text[u2.len++] = c;
+			u2.text[u2.len] = '\0';
+		}
+		if (sim_verbose()) {
+			putchar(c);
+		}
+		u2.busy = true;
+		u2.end = sim_now() + usart_byte_ns(usart_baud(USART2, sim_pclk1()));
+		u2.sh_sr &= ~(USART_SR_TXE | USART_SR_TC);
+		USART2->DR = SENTINEL;
+	}
+	USART2->SR = u2.sh_sr;
+}
+
+
+static void u2_update(uint64_t now) {
+	if (u2.busy && (now >= u2.end)) {
+		u2.busy = false;
+		USART2->SR = u2.sh_sr |= USART_SR_TXE | USART_SR_TC;
+	}
+}
+
+
+static uint64_t u2_next(void) {
+	return u2.busy ? u2.end : SIM_NEVER;
+}
+
+
+static const sim_model_t u2_model = { "usart2", u2_reset, u2_sync, u2_update, u2_next };
+
+
+/*********************************** I2C1 *************************************/
+
+typedef enum {
+	I2C_IDLE,
+	I2C_START,								// START on the bus
+	I2C_SB,									// Waiting for the address
+	I2C_ADDR,								// Address going out
+	I2C_READY,								// Waiting for data (TXE)
+	I2C_DATA,								// Data byte going out
+	I2C_NACK,								// Nobody answered the address
+	I2C_STOP,
+} i2c_state_t;
+
+static struct {
+	i2c_state_t state;
+	uint64_t until;
+	uint8_t addr;
+	uint8_t byte;
+} i2c;
+
+static uint64_t i2c_byte_ns(void) {
+	// Standard mode: SCL period = 2 × CCR PCLK1 cycles, 9 clocks a byte
+	uint32_t ccr = I2C1->CCR & I2C_CCR_CCR;
+	return sim_ticks_ns(18ULL * (ccr ? ccr : 1), sim_pclk1(), 1);
+}
+
+
+static void i2c_reset(sim_reset_t kind) {
+	(void)kind;
+	i2c.state = I2C_IDLE;
+	I2C1->DR = SENTINEL;
+}
+
+
+static void i2c_sync(void) {
+	uint64_t now = sim_now();
+	uint32_t cr1 = I2C1->CR1;
+
+	if ((cr1 & I2C_CR1_SWRST) || !(cr1 & I2C_CR1_PE)) {
+		i2c.state = I2C_IDLE;
+		I2C1->SR1 = 0;
+		I2C1->SR2 = 0;
+		I2C1->CR1 = cr1 & ~(I2C_CR1_START | I2C_CR1_STOP);
+		I2C1->DR = SENTINEL;
+		return;
+	}
+
+	if (cr1 & I2C_CR1_START) {
+		I2C1->CR1 = cr1 &= ~I2C_CR1_START;
+		i2c.state = I2C_START;
+		i2c.until = now + I2C_START_NS;
+		I2C1->SR2 = I2C_SR2_BUSY | I2C_SR2_MSL;
+	}
+	if (!(I2C1->DR & SENTINEL)) {
+		uint8_t v = (uint8_t)I2C1->DR;
+		I2C1->DR = SENTINEL;
+
+		if (i2c.state == I2C_SB) {
+			i2c.addr = v >> 1;
+			i2c.state = I2C_ADDR;
+			i2c.until = now + i2c_byte_ns();
+			I2C1->SR1 &= ~I2C_SR1_SB;
+		} else if (i2c.state == I2C_READY) {
+			i2c.byte = v;
+			i2c.state = I2C_DATA;
+			i2c.until = now + i2c_byte_ns();
+			I2C1->SR1 &= ~(I2C_SR1_TXE | I2C_SR1_BTF | I2C_SR1_ADDR);
+		}
+	}
+	if (cr1 & I2C_CR1_STOP) {
+		I2C1->CR1 = cr1 & ~I2C_CR1_STOP;
+		i2c.state = I2C_STOP;
+		i2c.until = now + I2C_START_NS;
+		I2C1->SR1 &= ~(I2C_SR1_TXE | I2C_SR1_BTF | I2C_SR1_ADDR);
+	}
+}
+
+
+static void i2c_update(uint64_t now) {
+	if ((i2c.state == I2C_IDLE) || (now < i2c.until)) {
+		return;
+	}
+	switch (i2c.state) {
+	case I2C_START:
+		I2C1->SR1 |= I2C_SR1_SB;
+		i2c.state = I2C_SB;
+		break;
+	case I2C_ADDR:
+		if (sim_lcd_present(i2c.addr)) {
+			I2C1->SR1 |= I2C_SR1_ADDR | I2C_SR1_TXE;
+			i2c.state = I2C_READY;
+		} else {
+			I2C1->SR1 |= I2C_SR1_AF;
+			i2c.state = I2C_NACK;
+		}
+		break;
+	case I2C_DATA:
+		sim_lcd_expander(i2c.byte, now);
+		I2C1->SR1 |= I2C_SR1_TXE | I2C_SR1_BTF;
+		i2c.state = I2C_READY;
+		break;
+	case I2C_STOP:
+		I2C1->SR2 = 0;
+		i2c.state = I2C_IDLE;
+		break;
+	default:
+		break;
+	}
+}
+
+
+static uint64_t i2c_next(void) {
+	switch (i2c.state) {
+	case I2C_START:
+	case I2C_ADDR:
+	case I2C_DATA:
+	case I2C_STOP:
+		return i2c.until;
+	default:
+		return SIM_NEVER;
+	}
+}
+
+
+static const sim_model_t i2c_model = { "i2c1", i2c_reset, i2c_sync, i2c_update, i2c_next };
+
+
+/********************************* Set-up *************************************/
+
+void sim_periph_init(void) {
+	memset(gpio, 0, sizeof(gpio));
+	memset(&u1, 0, sizeof(u1));
+	memset(&adc, 0, sizeof(adc));
+	sim_console_clear();
+
+	adc.vdda = 3300;
+	adc.source[17] = adc_vrefint;
+	adc.source[18] = adc_die;
+
+	sim_add_model(&clock_model);
+	sim_add_model(&gpio_model);
+	sim_add_model(&tim_model);
+	sim_add_model(&dwt_model);
+	sim_add_model(&iwdg_model);
+	sim_add_model(&rtc_model);
+	sim_add_model(&adc_model);
+	sim_add_model(&u1_model);
+	sim_add_model(&u2_model);
+	sim_add_model(&i2c_model);
+
+	sim_irq_source(TIM2_IRQn, tim2_level, NULL);
+	sim_irq_source(TIM3_IRQn, tim3_level, NULL);
+	sim_irq_source(TIM5_IRQn, tim5_level, NULL);
+	sim_irq_source(RTC_WKUP_IRQn, rtc_level, NULL);
+	sim_irq_source(DMA2_Stream0_IRQn, dma0_level, NULL);
+	sim_irq_source(USART1_IRQn, u1_level, u1_taken);
+	sim_irq_source(DMA2_Stream7_IRQn, dma7_level, NULL);
+}
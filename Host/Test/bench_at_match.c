@@ -0,0 +1,176 @@
+/**
+ * @file	bench_at_match.c
+ * @brief	Host microbenchmark: the AT engine's streaming matcher against a
+ * 			strstr() over the response after every byte
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * esp_at.c is compiled into this file, so its matcher (AT_Match()) and
+ * pattern table are reached directly, with the USART and clock stubbed
+ * out; no simulator is involved. Each transcript is what the ESP8266 sends
+ * back for one command, echo included, as the AT engine sees it.
+ *
+ * The reference works as the engine did before the matcher, over the same
+ * terminators: the byte is appended to the response and each terminator is
+ * looked for with strstr() from the start, so n bytes cost O(n^2). Both
+ * must complete on the same byte with the same outcome; the figures are
+ * printed, not checked, as wall time depends on the machine.
+ */
+
+#include "Mod/esp_at.c"
+#include "sim.h"
+#include <stdio.h>
+#include <time.h>
+
+#define REPS			2000
+
+typedef struct {
+	const char* name;
+	at_expect_t expect;
+	const char* text;
+} transcript_t;
+
+static const transcript_t transcripts[] = {
+	{ "AT", AT_EXPECT_OK, "AT\r\r\n\r\nOK\r\n" },
+	{ "AT+GMR", AT_EXPECT_OK, "AT+GMR\r\r\n"
+		"AT version:1.2.0.0(Jul  1 2016 20:04:45)\r\n"
+		"SDK version:1.5.4.1(39cb9a32)\r\n"
+		"Ai-Thinker Technology Co. Ltd.\r\n"
+		"Dec  2 2016 14:21:16\r\n\r\nOK\r\n" },
+	{ "AT+CWJAP", AT_EXPECT_OK, "AT+CWJAP=\"DOMINGO WIFI\",\"Nathanie!0801\"\r\r\n"
+		"WIFI DISCONNECT\r\nWIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n" },
+	{ "AT+CWLAP", AT_EXPECT_OK, "AT+CWLAP\r\r\n"
+		"+CWLAP:(3,\"DOMINGO WIFI\",-58,\"de:ad:be:ef:00:01\",6,-12,0)\r\n"
+		"+CWLAP:(4,\"PLDTHOMEFIBR8a2c0\",-71,\"9c:a2:f4:8a:2c:01\",1,-20,0)\r\n"
+		"+CWLAP:(3,\"Globe_LTE_MIFI_3F1A\",-77,\"00:1e:10:3f:1a:22\",11,7,0)\r\n"
+		"+CWLAP:(0,\"UP Campus Guest\",-80,\"70:4c:a5:12:9e:40\",1,-8,0)\r\n"
+		"+CWLAP:(4,\"EEEI-LAB-2G\",-63,\"f0:9f:c2:71:0a:5d\",6,3,0)\r\n"
+		"+CWLAP:(3,\"HUAWEI-B315-7C3E\",-84,\"48:db:50:7c:3e:11\",9,-31,0)\r\n"
+		"+CWLAP:(4,\"Converge_2.4G_x9Qd\",-69,\"c8:3a:35:0b:88:f0\",3,12,0)\r\n"
+		"\r\nOK\r\n" },
+	{ "AT+CIPSTART", AT_EXPECT_OK, "AT+CIPSTART=0,\"TCP\",\"api.thingspeak.com\",80\r\r\n"
+		"0,CONNECT\r\n\r\nOK\r\n" },
+	{ "AT+CIPSTART (fail)", AT_EXPECT_OK, "AT+CIPSTART=0,\"TCP\",\"api.thingspeak.com\",80\r\r\n"
+		"0,CONNECT FAIL\r\n\r\nERROR\r\n" },
+	{ "AT+CIPSTART (open)", AT_EXPECT_OK, "AT+CIPSTART=0,\"TCP\",\"api.thingspeak.com\",80\r\r\n"
+		"ALREADY CONNECTED\r\n\r\nERROR\r\n" },
+	{ "AT+CIPSEND", AT_EXPECT_PROMPT, "AT+CIPSEND=0,512\r\r\n\r\nOK\r\n> " },
+	{ "data", AT_EXPECT_SEND_OK, "\r\nRecv 512 bytes\r\n\r\nSEND OK\r\n" },
+	{ "data (dropped)", AT_EXPECT_SEND_OK, "\r\nRecv 512 bytes\r\n\r\nSEND FAIL\r\n" },
+	{ "AT+CIPMUX (busy)", AT_EXPECT_OK, "AT+CIPMUX=1\r\r\nbusy p...\r\n" },
+};
+
+#define NUM_TRANSCRIPTS		(sizeof(transcripts) / sizeof(transcripts[0]))
+
+// The USART and the clock, as far as esp_at.c needs them
+bool usart1_tx_busy(void) { return false; }
+bool usart1_tx_start(const void* buf, uint16_t len) { (void)buf; (void)len; return true; }
+bool usart1_rx_read(uint8_t* c) { (void)c; return false; }
+uint64_t now_us(void) { return 0; }
+uint32_t now_ms(void) { return 0; }
+void idle_until(uint64_t deadline_us) { (void)deadline_us; }
+
+
+static size_t run_matcher(const transcript_t* t, at_status_t* status) {
+	// As AT_Receive() does for the active command: keep the response, match the byte
+	size_t n = strlen(t->text);
+
+	resp_len = 0;
+	memset(match_pos, 0, sizeof(match_pos));
+	for (size_t i = 0; i < n; i++) {
+		if (resp_len < (AT_RESP_MAX - 1)) {
+			resp[resp_len++] = t->text[i];
+			resp[resp_len] = '\0';
+		}
+		*status = AT_Match(t->text[i], t->expect);
+		if (*status != AT_PENDING) {
+			return i + 1;
+		}
+	}
+	return n;
+}
+
+
+static size_t run_strstr(const transcript_t* t, at_status_t* status) {
+	// Every terminator looked for over the whole response, after every byte
+	size_t n = strlen(t->text);
+
+	resp_len = 0;
+	*status = AT_PENDING;
+	for (size_t i = 0; i < n; i++) {
+		if (resp_len < (AT_RESP_MAX - 1)) {
+			resp[resp_len++] = t->text[i];
+			resp[resp_len] = '\0';
+		}
+		for (unsigned int k = 0; k < AT_NUM_PATTERNS; k++) {
+			const at_pattern_t* p = &at_patterns[k];
+			if (((p->expect < 0) || (p->expect == (int8_t)t->expect)) && (strstr(resp, p->text) != NULL)) {
+				*status = p->status;
+			}
+		}
+		if (*status != AT_PENDING) {
+			return i + 1;
+		}
+	}
+	return n;
+}
+
+
+static double ns_per_byte(size_t (*run)(const transcript_t*, at_status_t*), const transcript_t* t) {
+	struct timespec a, b;
+	at_status_t status;
+	size_t bytes = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	for (int r = 0; r < REPS; r++) {
+		bytes += run(t, &status);
+		__asm__ volatile("" ::: "memory");	// Keep the repetitions
+	}
+	clock_gettime(CLOCK_MONOTONIC, &b);
+	return ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec)) / bytes;
+}
+
+
+int main(void) {
+	// The failure tables are written out by hand; check them against the text
+	for (unsigned int k = 0; k < AT_NUM_PATTERNS; k++) {
+		const at_pattern_t* p = &at_patterns[k];
+		uint8_t want = 0;
+
+		SIM_CHECK(p->fail[0] == 0, "\"%s\" fail[0] = %u", p->text, p->fail[0]);
+		for (uint8_t i = 1; i < p->len; i++) {
+			while ((want > 0) && (p->text[i] != p->text[want])) {
+				want = p->fail[want - 1];
+			}
+			if (p->text[i] == p->text[want]) {
+				want++;
+			}
+			SIM_CHECK(p->fail[i] == want, "\"%s\" fail[%u] = %u, should be %u", p->text, i, p->fail[i], want);
+		}
+	}
+
+	double total_kmp = 0, total_strstr = 0;
+	printf("%-20s %6s %12s %12s\n", "transcript", "bytes", "matcher", "strstr");
+	for (unsigned int i = 0; i < NUM_TRANSCRIPTS; i++) {
+		const transcript_t* t = &transcripts[i];
+		at_status_t s_kmp, s_strstr;
+		size_t n_kmp = run_matcher(t, &s_kmp);
+		size_t n_strstr = run_strstr(t, &s_strstr);
+
+		SIM_CHECK((n_kmp == n_strstr) && (s_kmp == s_strstr), "%s: matcher %d at byte %zu, strstr %d at byte %zu",
+				t->name, s_kmp, n_kmp, s_strstr, n_strstr);
+		SIM_CHECK(s_kmp != AT_PENDING, "%s: no outcome", t->name);
+
+		double kmp = ns_per_byte(run_matcher, t);
+		double ref = ns_per_byte(run_strstr, t);
+		total_kmp += kmp * n_kmp;
+		total_strstr += ref * n_strstr;
+		printf("%-20s %6zu %9.1f ns %9.1f ns  per byte\n", t->name, n_kmp, kmp, ref);
+	}
+	printf("at_match: all transcripts %.2f us with the matcher, %.2f us with strstr\n",
+			total_kmp / 1000, total_strstr / 1000);
+	return sim_report("bench_at_match");
+}
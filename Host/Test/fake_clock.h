@@ -0,0 +1,55 @@
+/**
+ * @file	fake_clock.h
+ * @brief	Host test harness: a clock the test moves, for stepping coroutines
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * For unit tests that compile firmware code into themselves (fuv1_unit()
+ * in CMakeLists.txt) instead of running it on the simulator. The TIM2
+ * clock functions are defined here over fake_us, which only moves when
+ * the test moves it or the code idles, so every step of a coroutine
+ * happens at a time the test chose.
+ *
+ * fake_wait() moves the clock on as a caller sleeping through a wait
+ * would: to the deadline of the delay the coroutine is in, or by a tick if
+ * it waits on a condition. FAKE_RUN() steps a protothread to its end that
+ * way, so a wait of seconds costs one step.
+ *
+ * Include it in one file only.
+ */
+
+#ifndef FAKE_CLOCK_H
+#define FAKE_CLOCK_H
+
+#include <stdint.h>
+
+#define FAKE_TICK_US	1000				// A condition wait's poll, as PT_POLL_US
+
+static uint64_t fake_us;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t now_us(void) { return fake_us; }
+uint32_t now_ms(void) { return (uint32_t)(fake_us / 1000); }
+void idle_until(uint64_t deadline_us) { fake_us = (deadline_us > fake_us) ? deadline_us : fake_us; }
+void delay_until(uint64_t deadline_us) { idle_until(deadline_us); }
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline void fake_wait(uint64_t until_us) {
+	fake_us = (until_us > fake_us) ? until_us : (fake_us + FAKE_TICK_US);
+}
+
+// Step a protothread to its end, counting the calls it took
+#define FAKE_RUN(pt, thread, steps)	do { PT_INIT((pt)); (steps) = 1; \
+									while (PT_SCHEDULE(thread)) { fake_wait((pt)->until); (steps)++; } \
+								} while (0)
+
+#endif // FAKE_CLOCK_H
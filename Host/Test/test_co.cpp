@@ -0,0 +1,205 @@
+/**
+ * @file	test_co.cpp
+ * @brief	Host unit test: Mod/co.hpp's C++20 coroutines, stepped on a fake
+ * 			clock
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * co::task coroutines stepped by hand on fake_clock.h's clock, as
+ * test_pt.c steps protothreads: delays wake on their deadlines, locals
+ * survive waits (inside a switch too), a condition is picked up on the
+ * first step after it holds, a parent follows its child's deadlines, and a
+ * protothread runs under co_await. Tasks and protothreads share one loop.
+ * The frame pool hands out CO_FRAMES frames, fails the next one cleanly,
+ * and takes them back.
+ */
+
+#include "Mod/co.hpp"
+#include "fake_clock.h"
+
+extern "C" {
+#include "sim.h"
+}
+
+#include <stdio.h>
+
+#define PERIOD_MS		10
+
+static uint64_t woke[8];
+static int wakes;
+static bool flag;
+
+
+static co::task ticker(int n) {
+	for (int i = 0; i < n; i++) {
+		co_await co::delay_ms(PERIOD_MS);
+		woke[wakes++] = now_us();
+	}
+}
+
+
+static co::task states(int* out) {
+	// A local across waits, and waits inside a switch: neither works in a protothread
+	int total = 0;
+
+	for (int state = 0; state < 3; state++) {
+		switch (state) {
+		case 0:
+			co_await co::yield();
+			total += 1;
+			break;
+		case 1:
+			co_await co::delay_ms(1);
+			total += 10;
+			break;
+		default:
+			co_await co::until([] { return flag; });
+			total += 100;
+			break;
+		}
+	}
+	*out = total;
+}
+
+
+static co::task parent(uint64_t* done_at) {
+	co_await ticker(2);
+	*done_at = now_us();
+}
+
+
+static int pt_delay(pt_t* pt, uint32_t ms) {
+	PT_BEGIN(pt);
+	PT_DELAY_MS(pt, ms);
+	PT_END(pt);
+}
+
+
+static co::task via_pt(uint64_t* done_at) {
+	co_await co::protothread([](pt_t* pt) { return pt_delay(pt, 7); });
+	*done_at = now_us();
+}
+
+
+static uint32_t run(co::task& t) {
+	// Step to its end, sleeping to its deadlines; the steps it took
+	uint32_t steps = 0;
+
+	while (PT_SCHEDULE(t.step())) {
+		fake_wait(t.until());
+		steps++;
+	}
+	return steps + 1;
+}
+
+
+static void test_delays(void) {
+	fake_us = 0;
+	wakes = 0;
+	co::task t = ticker(3);
+	uint32_t steps = run(t);
+
+	for (int i = 0; i < 3; i++) {
+		SIM_CHECK(woke[i] == (uint64_t)(i + 1) * PERIOD_MS * 1000, "woke at %.3f ms, wake %d", woke[i] / 1e3, i);
+	}
+	SIM_CHECK(steps == 4, "%u steps for three delays", steps);
+}
+
+
+static void test_states(void) {
+	int total = 0;
+
+	fake_us = 0;
+	flag = false;
+	co::task t = states(&total);
+	SIM_CHECK(t.step() == PT_YIELDED, "no yield");
+	SIM_CHECK(t.step() == PT_WAITING, "no delay");
+	SIM_CHECK(t.until() == 1000, "delay until %.3f ms", t.until() / 1e3);
+	SIM_CHECK(t.step() == PT_WAITING, "resumed before its delay");
+	fake_wait(t.until());
+	SIM_CHECK(t.step() == PT_WAITING, "did not wait on the flag");
+	fake_us += 5000;
+	SIM_CHECK(t.step() == PT_WAITING, "resumed without the flag");
+	flag = true;
+	SIM_CHECK(t.step() == PT_ENDED, "not ended with the flag");
+	SIM_CHECK(total == 111, "total %d", total);
+}
+
+
+static void test_nesting(void) {
+	uint64_t child_done = 0, pt_done = 0;
+
+	fake_us = 0;
+	wakes = 0;
+	co::task t = parent(&child_done);
+	uint32_t steps = run(t);
+	SIM_CHECK(child_done == 2 * PERIOD_MS * 1000, "parent resumed at %.3f ms", child_done / 1e3);
+	SIM_CHECK(steps == 3, "%u steps through the child's two delays", steps);
+
+	fake_us = 0;
+	co::task p = via_pt(&pt_done);
+	steps = run(p);
+	SIM_CHECK(pt_done == 7000, "resumed after the protothread at %.3f ms", pt_done / 1e3);
+	SIM_CHECK(steps == 2, "%u steps through the protothread's delay", steps);
+}
+
+
+static void test_mixed(void) {
+	// A task and a protothread in one loop, sleeping to the nearer deadline
+	pt_t pt;
+	uint64_t pt_done = 0;
+	int rt, rp;
+
+	fake_us = 0;
+	wakes = 0;
+	PT_INIT(&pt);
+	co::task t = ticker(3);
+	do {
+		rt = t.step();
+		rp = pt_delay(&pt, 25);
+		if ((rp == PT_ENDED) && (pt_done == 0)) {
+			pt_done = now_us();
+		}
+		uint64_t next = PT_SCHEDULE(rp) ? pt.until : UINT64_MAX;
+		if (PT_SCHEDULE(rt) && (t.until() < next)) {
+			next = t.until();
+		}
+		if (next != UINT64_MAX) {
+			fake_wait(next);
+		}
+	} while (PT_SCHEDULE(rt) || PT_SCHEDULE(rp));
+	SIM_CHECK((wakes == 3) && (woke[2] == 3 * PERIOD_MS * 1000), "%d wakes, the last at %.3f ms", wakes,
+			woke[2] / 1e3);
+	SIM_CHECK(pt_done == 25000, "protothread ended at %.3f ms", pt_done / 1e3);
+}
+
+
+static void test_pool(void) {
+	co::task t[CO_FRAMES];
+
+	for (int i = 0; i < CO_FRAMES; i++) {
+		t[i] = ticker(1);
+		SIM_CHECK(t[i].valid(), "frame %d of %d not given", i, CO_FRAMES);
+	}
+	co::task extra = ticker(1);
+	SIM_CHECK(!extra.valid() && extra.done(), "a frame past CO_FRAMES");
+	SIM_CHECK(extra.step() == PT_ENDED, "a task without a frame still runs");
+
+	t[0] = co::task();						// Frees its frame
+	co::task again = ticker(1);
+	SIM_CHECK(again.valid(), "a freed frame not given again");
+}
+
+
+int main(void) {
+	test_delays();
+	test_states();
+	test_nesting();
+	test_mixed();
+	test_pool();
+	printf("co: tasks of up to %u bytes, %u frames\n", (unsigned)CO_FRAME_BYTES, (unsigned)CO_FRAMES);
+	return sim_report("test_co");
+}
@@ -0,0 +1,123 @@
+/**
+ * @file	test_dht22.c
+ * @brief	Host scenario: the DHT22 node from power-up through an alarm and an upload
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The room sits at 25 C and 60 % RH, a fire takes it to 60 C from 40 s to
+ * 50 s, and the node runs for 210 s: long enough to join, read every 2 s
+ * (never sooner, which the sensor would not answer), sound and clear the
+ * alarm, and buffer both fields every 50 s. The server cannot be reached
+ * from 60 s to 160 s, so the readings at 100 s and 150 s must wait for the
+ * upload at 200 s; each reading is one entry, its two fields at one time,
+ * and the entries of one bulk update 50 s apart.
+ */
+
+#include "sim.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FIRE_FROM		SIM_S(40)
+#define FIRE_TO			SIM_S(50)
+#define OUTAGE_FROM		SIM_S(60)
+#define OUTAGE_TO		SIM_S(160)
+#define READINGS		4				// Buffered at 50, 100, 150 and 200 s
+
+int firmware_main(void);
+
+static bool alarm_in_fire, alarm_after_fire;
+static char row0[17], row1[17];
+
+static sim_dht_t room(uint64_t now) {
+	return (sim_dht_t){ ((now >= FIRE_FROM) && (now < FIRE_TO)) ? 60.0 : 25.0, 60.0 };
+}
+
+
+static void look_in_fire(void* ctx) {
+	(void)ctx;
+	alarm_in_fire = sim_gpio_output(1, 1);
+}
+
+
+static void look_after_fire(void* ctx) {
+	(void)ctx;
+	alarm_after_fire = sim_gpio_output(1, 1);
+	strcpy(row0, sim_lcd_row(0));
+	strcpy(row1, sim_lcd_row(1));
+}
+
+
+static void outage(void* ctx) {
+	(void)ctx;
+	sim_esp_http(&(sim_http_t){ .channel = "0000000", .unreachable = true });
+	sim_esp_server_close();
+}
+
+
+static void restore(void* ctx) {
+	(void)ctx;
+	sim_esp_http(&(sim_http_t){ .channel = "0000000" });
+}
+
+
+static void boot(void) {
+	firmware_main();
+}
+
+
+int main(void) {
+	const sim_entry_rec_t* entries;
+	size_t n, spaced = 0;
+
+	sim_init();
+	sim_dht_source(room);
+	sim_esp_http(&(sim_http_t){ .channel = "0000000" });
+	sim_at(FIRE_FROM + SIM_S(1), look_in_fire, NULL);
+	sim_at(FIRE_TO + SIM_S(5), look_after_fire, NULL);
+	sim_at(OUTAGE_FROM, outage, NULL);
+	sim_at(OUTAGE_TO, restore, NULL);
+
+	SIM_CHECK(sim_run(boot, SIM_S(210)) == SIM_TIME_UP, "firmware_main() returned");
+
+	SIM_CHECK(strstr(sim_console(), "WiFi Initialization Success!") != NULL, "no WiFi join");
+	SIM_CHECK(sim_stats.resets[SIM_RESET_IWDG] == 0, "%u watchdog resets", sim_stats.resets[SIM_RESET_IWDG]);
+	SIM_CHECK(sim_lcd_violations() == 0, "%u LCD writes lost", sim_lcd_violations());
+	SIM_CHECK(strncmp(row0, "R. Temp: 25.", 12) == 0, "LCD row 0 \"%s\"", row0);
+	SIM_CHECK(strncmp(row1, "    Hum: 60.00", 14) == 0, "LCD row 1 \"%s\"", row1);
+	SIM_CHECK(sim_dht_reads() >= 50, "%u DHT22 readings", sim_dht_reads());
+	SIM_CHECK(sim_dht_too_soon() == 0, "%u DHT22 readings started too soon", sim_dht_too_soon());
+	SIM_CHECK(alarm_in_fire, "no alarm at 60 C");
+	SIM_CHECK(!alarm_after_fire, "alarm still on at 25 C");
+	SIM_CHECK(sim_usart1_overruns() == 0, "%u USART1 overruns", sim_usart1_overruns());
+
+	// One record per field: temperature, then humidity, for each reading
+	n = sim_esp_entries(&entries);
+	SIM_CHECK(n == 2 * READINGS, "%zu fields uploaded", n);
+	for (size_t i = 0; i < n; i++) {
+		// The first reading is the last one of the fire
+		unsigned int field = (i % 2) ? 2 : 3;
+		double want = ((field == 3) && (i < 2)) ? 60.0 : ((field == 3) ? 25.0 : 60.0);
+		SIM_CHECK(entries[i].field == field, "entry %zu in field %u", i, entries[i].field);
+		SIM_CHECK(fabs(entries[i].value - want) < 0.01, "entry %zu: %.2f", i, entries[i].value);
+	}
+	for (size_t i = 1; (n == 2 * READINGS) && (i < n); i += 2) {
+		SIM_CHECK(entries[i].time == entries[i - 1].time, "reading %zu: fields %.0f s apart",
+				i / 2, entries[i].time - entries[i - 1].time);
+		if ((i > 1) && (entries[i].at == entries[i - 2].at)) {
+			// delta_t only spaces the entries of one bulk update
+			spaced++;
+			SIM_CHECK(fabs(entries[i].time - entries[i - 2].time - 50) <= 1, "readings %zu and %zu %.0f s apart",
+					i / 2 - 1, i / 2, entries[i].time - entries[i - 2].time);
+		}
+	}
+	SIM_CHECK(spaced > 0, "no two readings in one bulk update");
+	SIM_CHECK((n == 2 * READINGS) && (entries[2].at > OUTAGE_TO) && (entries[4].at > OUTAGE_TO),
+			"readings from the outage not held back for after it");
+
+	printf("dht22: %zu entries, %u IRQs, LCD \"%s\" / \"%s\"\n", n, sim_stats.irqs, row0, row1);
+	return sim_report("test_dht22");
+}
@@ -0,0 +1,215 @@
+/**
+ * @file	test_esp_link.c
+ * @brief	Host scenario: ThingSpeak uploads over the kept-alive link, against
+ * 			the original open/send/close sequence
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The LM35 node's USART1 and AT engine, driven directly: after the WiFi
+ * join, one minute of uploads made the way sendThingSpeak() first did
+ * (CIPMUX, CIPSTART, CIPSEND, the request and CIPCLOSE, with the fixed
+ * delays it had between them), then one minute of the background uploads
+ * over one kept-alive link. The server is 200 ms away and takes every
+ * request, so the figures only measure the protocol.
+ *
+ * Then the link's failure paths: a server that drops the link without the
+ * ESP noticing (the upload must close it before opening a new one), a
+ * server that takes SLOW_CONNECT_MS to accept the new link and SLOW_RTT_MS
+ * to answer (the reply timeout runs from SEND OK, so the setup must not
+ * count against it), and a server that cannot be reached ("0,CONNECT FAIL"
+ * must not pass for an open link).
+ *
+ * Last, a watchdog reset of the MCU alone: the ESP is still at the faster
+ * baud rate it was moved to, and the node must find it there and rejoin.
+ */
+
+#include "sim.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include "Mod/usart1.h"
+#include "Mod/usart2.h"
+#include "Mod/esp_at.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PHASE_MS		60000
+#define RTT_MS			200
+#define SLOW_CONNECT_MS	9500				// Within CIPSTART's 10 s
+#define SLOW_RTT_MS		1000
+
+static uint64_t before_from, before_to, after_from, after_to;
+static size_t stale_mark, stale_entries, unreachable_mark;
+static size_t slow_entries;
+static bool stale_done, slow_done, slow_no_answer, unreachable_done;
+static bool joined, rebooted, rejoined;
+
+static size_t entries_now(void) {
+	const sim_entry_rec_t* e;
+	return sim_esp_entries(&e);
+}
+
+
+static void baseline_upload(int val) {
+	// sendThingSpeak() as it was before the link was kept alive; data is
+	// static, as the TX DMA only takes 32-bit addresses
+	static char data[200];
+	char cmd[40];
+	int len = snprintf(data, sizeof(data), "GET /update?api_key=KEY&field1=%d HTTP/1.1\r\n"
+			"Host: api.thingspeak.com\r\n\r\n", val);
+
+	snprintf(cmd, sizeof(cmd), "AT+CIPSEND=0,%d\r\n", len);
+	if (AT_Command("AT+CIPMUX=1\r\n", AT_EXPECT_OK, 1000) != AT_OK) {
+		ThingSpeak_PollFor(5000);
+		return;
+	}
+	ThingSpeak_PollFor(1000);
+	if (AT_Command("AT+CIPSTART=0,\"TCP\",\"api.thingspeak.com\",80\r\n", AT_EXPECT_OK, 10000) != AT_OK) {
+		ThingSpeak_PollFor(5000);
+		return;
+	}
+	ThingSpeak_PollFor(1000);
+	if (AT_Command(cmd, AT_EXPECT_PROMPT, 1000) != AT_OK) {
+		ThingSpeak_PollFor(5000);
+		return;
+	}
+	ThingSpeak_PollFor(1000);
+	usart1_tx_start(data, len);			// No response awaited
+	ThingSpeak_PollFor(3000);
+	AT_Command("AT+CIPCLOSE=0\r\n", AT_EXPECT_OK, 1000);
+}
+
+
+static void wait_upload(uint32_t timeout_ms) {
+	uint32_t done = ThingSpeak_Completed();
+	uint32_t start = now_ms();
+
+	while ((ThingSpeak_Completed() == done) && ((uint32_t)(now_ms() - start) < timeout_ms)) {
+		ThingSpeak_Poll();
+		idle_until(now_us() + 1000);
+	}
+}
+
+
+static void session(void) {
+	int val = 0;
+
+	Clock_Init();
+	TIM2_Init();
+	usart1_Init();
+	usart2_Init();
+	WiFi_Init();
+	if (rebooted) {
+		rejoined = (strstr(sim_console(), "ESP8266 found at") != NULL);	// WiFi_Init() is back, so joined
+		return;
+	}
+	joined = (strstr(sim_console(), "WiFi Initialization Success!") != NULL);
+
+	before_from = sim_now();
+	while (sim_now() - before_from < SIM_MS(PHASE_MS)) {
+		baseline_upload(++val);
+	}
+	before_to = sim_now();
+
+	after_from = sim_now();
+	while (sim_now() - after_from < SIM_MS(PHASE_MS)) {
+		if (!ThingSpeak_Busy()) {
+			sendThingSpeak(++val, 1);
+		}
+		ThingSpeak_Poll();
+		idle_until(now_us() + 1000);
+	}
+	after_to = sim_now();
+	wait_upload(10000);
+
+	// The server drops the link; the ESP only finds out on the next send
+	sim_esp_http(&(sim_http_t){ .rtt_ms = RTT_MS, .silent_close = true });
+	sim_esp_server_close();
+	stale_mark = strlen(sim_esp_log());
+	stale_entries = entries_now();
+	sendThingSpeak(++val, 1);
+	wait_upload(20000);
+	stale_entries = entries_now() - stale_entries;
+	stale_done = !ThingSpeak_Busy();
+
+	// The link goes, and the server is slow to take a new one and to answer
+	sim_esp_http(&(sim_http_t){ .rtt_ms = SLOW_RTT_MS, .connect_ms = SLOW_CONNECT_MS });
+	sim_esp_server_close();
+	ThingSpeak_PollFor(100);
+	sim_console_clear();
+	slow_entries = entries_now();
+	sendThingSpeak(++val, 1);
+	wait_upload(30000);
+	slow_entries = entries_now() - slow_entries;
+	slow_done = !ThingSpeak_Busy();
+	slow_no_answer = (strstr(sim_console(), "No answer from ThingSpeak") != NULL);
+
+	// The link goes, and the server cannot be reached again
+	sim_esp_http(&(sim_http_t){ .rtt_ms = RTT_MS, .unreachable = true });
+	sim_esp_server_close();
+	ThingSpeak_PollFor(100);
+	unreachable_mark = strlen(sim_esp_log());
+	sendThingSpeak(++val, 1);
+	ThingSpeak_PollFor(3000);				// The first attempt, short of the retry
+	unreachable_done = true;
+
+	rebooted = true;
+	sim_console_clear();
+	sim_reset(SIM_RESET_IWDG);
+}
+
+
+static double per_minute(uint64_t from, uint64_t to) {
+	const sim_entry_rec_t* e;
+	size_t n = sim_esp_entries(&e), count = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if ((e[i].at >= from) && (e[i].at < to)) {
+			count++;
+		}
+	}
+	return count * 60.0 / ((to - from) / 1e9);
+}
+
+
+int main(void) {
+	sim_init();
+	sim_esp_http(&(sim_http_t){ .rtt_ms = RTT_MS });
+
+	SIM_CHECK(sim_run(session, SIM_S(300)) == SIM_RETURNED, "session did not finish");
+	SIM_CHECK(joined, "no WiFi join");
+
+	double before = per_minute(before_from, before_to);
+	double after = per_minute(after_from, after_to);
+	SIM_CHECK(before > 0, "no uploads the original way");
+	SIM_CHECK(after > 4 * before, "%.1f uploads/min over the kept-alive link, %.1f before", after, before);
+
+	// CIPCLOSE for the dead link before the new CIPSTART, and the upload still made it
+	const char* log = sim_esp_log();
+	const char* stale = log + stale_mark;
+	const char* close = strstr(stale, "AT+CIPCLOSE=0");
+	const char* start = strstr(stale, "AT+CIPSTART=0");
+	SIM_CHECK(stale_done, "upload over the dropped link never completed");
+	SIM_CHECK((close != NULL) && (start != NULL) && (close < start), "no CIPCLOSE before reconnecting");
+	SIM_CHECK(stale_entries == 1, "%zu entries over the dropped link", stale_entries);
+
+	// A slow CIPSTART is not taken for a server that does not answer
+	SIM_CHECK(slow_done, "upload over the slow connect never completed");
+	SIM_CHECK(!slow_no_answer, "reply timed out while the link was still being opened");
+	SIM_CHECK(slow_entries == 1, "%zu entries after the slow connect", slow_entries);
+
+	// CONNECT FAIL leaves the link closed: no CIPSEND on it
+	const char* unreachable = log + unreachable_mark;
+	SIM_CHECK(unreachable_done, "unreachable server scenario did not run");
+	SIM_CHECK(strstr(unreachable, "AT+CIPSTART=0") != NULL, "no CIPSTART to the unreachable server");
+	SIM_CHECK(strstr(unreachable, "AT+CIPSEND") == NULL, "CIPSEND after \"0,CONNECT FAIL\"");
+
+	// The ESP kept its baud rate through the MCU's reset
+	SIM_CHECK(rebooted && rejoined, "no WiFi join after a watchdog reset");
+
+	printf("esp_link: %.1f uploads/min open/send/close, %.1f uploads/min kept alive (RTT %u ms)\n",
+			before, after, RTT_MS);
+	return sim_report("test_esp_link");
+}
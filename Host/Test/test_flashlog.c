@@ -0,0 +1,315 @@
+/**
+ * @file	test_flashlog.c
+ * @brief	Host scenario: the flash log's sector erases against the sampling
+ * 			interrupt and the alarm
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Erases: the LM35 node's sampling (TIM3, the ADC and the buzzer) runs as
+ * main() sets it up, while the flash log is filled as fast as it takes
+ * samples, so it erases all three sectors in turn. The room is only on
+ * fire while the flash is busy. Each erase stalls the code in flash for
+ * 400 ms; the sampling interrupt runs from RAM, so no tick may come late
+ * or be dropped, and the alarm must sound while the erase is still running.
+ *
+ * Resets: the upload path, driven directly, logs samples while the server
+ * cannot be reached, across a watchdog reset and then a power cut, and
+ * uploads them all in one bulk update once it can. The delta_t between two
+ * entries must be the time between the samples, to the second, across the
+ * watchdog reset; across the power cut it may only leave out the time from
+ * the last sample logged to the cut.
+ *
+ * Power loss: samples numbered in order are appended as fast as the log
+ * takes them, and acked every ACK_EVERY, while power is cut partway through
+ * programming a word, then through an erase, then through a word again.
+ * After each cut the log must hold exactly the samples appended and not
+ * acked, in order: at most the one being appended may be added, and at
+ * most the ack being written may be undone.
+ */
+
+#include "sim.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include "Mod/adc1.h"
+#include "Mod/sampler.h"
+#include "Mod/flashlog.h"
+#include "Mod/usart1.h"
+#include "Mod/usart2.h"
+#include <stdio.h>
+
+#define SAMPLE_PERIOD	100					// As in main.c
+#define ADC_RATE		10000
+#define ERASES			3
+#define TICK_SLACK_US	1000				// Past SAMPLE_PERIOD, for a tick that is late
+#define LOG_EVERY		SIM_S(10)			// Between the samples of the reset scenario
+#define PER_BOOT		3
+#define BOOTS			3					// Watchdog reset, then a power cut
+#define CUT_AFTER		SIM_S(4)			// From the last sample logged to the reset
+#define BOOT_SLACK		SIM_MS(10)			// From a reset to TIM2_Init(), not counted
+#define POWER_APPENDS	3000				// Per boot, through at least two erases
+#define ACK_EVERY		20
+#define READ_MAX		64
+
+void Buzzer_Init(void);
+void Sample_Tick(uint64_t t_us);
+
+static uint32_t ticks, appended, dropped;
+static uint64_t worst_gap_us;
+static bool alarm_in_erase;
+static uint64_t stall_max_ns;
+
+static int boot;
+static uint64_t taken[BOOTS * PER_BOOT];	// When each sample was added
+static int taken_count;
+static uint64_t cut_at[BOOTS];
+static bool drained;
+
+static const struct {
+	sim_cut_t kind;
+	uint32_t n;								// Words programmed or erases started, from the boot
+} cuts[] = {
+	{ SIM_CUT_WORD, 200 },
+	{ SIM_CUT_ERASE, 1 },
+	{ SIM_CUT_WORD, 2401 },
+};
+
+#define NUM_CUTS		(sizeof(cuts) / sizeof(cuts[0]))
+
+static int power_boot;
+static int16_t logged;						// Last sample FlashLog_Append() took
+static int16_t appending;					// Sample being appended, 0 if none
+static int16_t acked, acking;				// Last ack FlashLog_Ack() returned from, ack being written
+static uint32_t power_erases;
+static bool power_done;
+
+static double lm35_mv(uint64_t now) {
+	return (sim_stall_until() > now) ? 600.0 : 250.0;	// 60 C while the flash is busy, else 25 C
+}
+
+
+static void buzzer(int port, int pin, bool level, uint64_t now) {
+	(void)port;
+	(void)pin;
+	if (level && (sim_stall_until() > now)) {
+		alarm_in_erase = true;
+	}
+}
+
+
+static void session(void) {
+	uint64_t last_us = 0;
+	sample_t s;
+
+	Clock_Init();
+	TIM2_Init();
+	Buzzer_Init();
+	ADC_Init(ADC_RATE);
+	Sampler_Init(SAMPLE_PERIOD, Sample_Tick);
+	FlashLog_Init();
+
+	while (sim_flash_erases() < ERASES) {
+		FlashLog_Poll();
+		while (Sampler_Pop(&s)) {
+			if ((ticks > 0) && ((s.t_us - last_us) > worst_gap_us)) {
+				worst_gap_us = s.t_us - last_us;
+			}
+			last_us = s.t_us;
+			ticks++;
+		}
+		if (FlashLog_Append(now_ms(), 2500, 4)) {
+			appended++;
+		}
+		idle_until(now_us() + 500);
+	}
+	dropped = Sampler_Dropped();
+	stall_max_ns = sim_stats.stall_max_ns;
+}
+
+
+static void run_until(uint64_t t) {
+	while (sim_now() < t) {
+		ThingSpeak_Poll();
+		idle_until(now_us() + 1000);
+	}
+}
+
+
+static void upload_all(void) {
+	uint64_t from = sim_now();
+
+	while ((ThingSpeak_Pending() > 0) && (sim_now() - from < SIM_S(120))) {
+		ThingSpeak_BulkUpload();
+		run_until(sim_now() + SIM_MS(10));
+		while (ThingSpeak_Busy()) {
+			run_until(sim_now() + SIM_MS(10));
+		}
+	}
+}
+
+
+static void reset_session(void) {
+	// Entered again after each reset; boot and the samples' times live on here
+	boot++;
+	Clock_Init();
+	TIM2_Init();
+	usart1_Init();
+	usart2_Init();
+	FlashLog_Init();
+	WiFi_Init();
+
+	// Samples on LOG_EVERY marks, to the flash log once the upload fails
+	for (int i = 0; i < PER_BOOT; i++) {
+		run_until(((sim_now() / LOG_EVERY) + 1) * LOG_EVERY);
+		taken[taken_count++] = sim_now();
+		ThingSpeak_AddSample(2500 + taken_count, 4 | TS_FIELD_CENTI);
+	}
+	ThingSpeak_BulkUpload();
+	while (ThingSpeak_Busy()) {
+		run_until(sim_now() + SIM_MS(10));
+	}
+
+	if (boot < BOOTS) {
+		run_until(taken[taken_count - 1] + CUT_AFTER);
+		cut_at[boot - 1] = sim_now();
+		sim_reset((boot == 1) ? SIM_RESET_IWDG : SIM_RESET_POWER);
+	}
+
+	sim_esp_http(&(sim_http_t){ .channel = "0000000" });
+	upload_all();
+	drained = (ThingSpeak_Pending() == 0);
+}
+
+
+static void power_check(void) {
+	// The log against what was appended and acked before the cut
+	static flashlog_rec_t r[READ_MAX];
+	uint16_t n = FlashLog_Read(r, READ_MAX);
+
+	SIM_CHECK(FlashLog_Pending() == n, "boot %d: %u pending, %u read", power_boot, FlashLog_Pending(), n);
+	if (n == 0) {
+		SIM_CHECK((logged == acked) || (logged == acking), "boot %d: nothing pending, %d logged, %d acked",
+				power_boot, logged, acked);
+		return;
+	}
+	int16_t first = r[0].value, last = r[n - 1].value;
+	SIM_CHECK((first - 1 >= acked) && (first - 1 <= acking), "boot %d: pending from %d, %d acked",
+			power_boot, first, acked);
+	SIM_CHECK((last == logged) || ((appending != 0) && (last == appending)),
+			"boot %d: pending up to %d, %d logged", power_boot, last, logged);
+	for (uint16_t i = 1; i < n; i++) {
+		SIM_CHECK(r[i].value == r[i - 1].value + 1, "boot %d: %d after %d", power_boot, r[i].value,
+				r[i - 1].value);
+	}
+	logged = last;							// A torn append that still checks out
+}
+
+
+static void power_ack(void) {
+	static flashlog_rec_t r[READ_MAX];
+	uint16_t n = FlashLog_Read(r, READ_MAX);
+
+	if (n > 0) {
+		acking = r[n - 1].value;
+		FlashLog_Ack(r[n - 1].seq);
+		acked = acking;
+	}
+}
+
+
+static void power_session(void) {
+	// Entered again after each cut
+	uint32_t erases = sim_flash_erases();
+
+	power_boot++;
+	Clock_Init();
+	TIM2_Init();
+	FlashLog_Init();
+	if (power_boot > 1) {
+		power_check();
+	}
+	acked = acking;
+	appending = 0;
+	if (power_boot <= (int)NUM_CUTS) {
+		sim_flash_cut(cuts[power_boot - 1].kind, cuts[power_boot - 1].n);
+	}
+
+	for (int i = 0; i < POWER_APPENDS; ) {
+		FlashLog_Poll();
+		appending = logged + 1;
+		if (FlashLog_Append(FlashLog_Now(), appending, 4)) {
+			logged = appending;
+			i++;
+			if (logged % ACK_EVERY == 0) {
+				power_ack();
+			}
+		}
+		appending = 0;
+		idle_until(now_us() + 500);
+	}
+	power_check();
+	power_erases = sim_flash_erases() - erases;
+	power_done = true;
+}
+
+
+int main(void) {
+	sim_init();
+	sim_adc_source(1, lm35_mv);
+	sim_gpio_watch(1, 1, buzzer);
+
+	SIM_CHECK(sim_run(session, SIM_S(60)) == SIM_RETURNED, "session did not finish");
+	SIM_CHECK(appended > 0, "nothing appended");
+	SIM_CHECK(stall_max_ns >= SIM_MS(300), "longest stall %.1f ms; no erase held the main loop",
+			stall_max_ns / 1e6);
+	SIM_CHECK(ticks > 0, "no samples");
+	SIM_CHECK(dropped == 0, "%u samples dropped", dropped);
+	SIM_CHECK(worst_gap_us <= (SAMPLE_PERIOD * 1000 + TICK_SLACK_US), "samples %.1f ms apart",
+			worst_gap_us / 1e3);
+	SIM_CHECK(alarm_in_erase, "no alarm while the flash was erased");
+
+	printf("flashlog: %u erases, %u appends, longest stall %.1f ms, %u ticks %.1f ms apart at worst\n",
+			sim_flash_erases(), appended, stall_max_ns / 1e6, ticks, worst_gap_us / 1e3);
+
+	// Resets: every sample uploaded, each entry its sample's time after the last
+	const sim_entry_rec_t* e;
+	size_t n;
+
+	sim_init();
+	sim_esp_http(&(sim_http_t){ .channel = "0000000", .unreachable = true });
+	SIM_CHECK(sim_run(reset_session, SIM_S(600)) == SIM_RETURNED, "reset session did not finish");
+	SIM_CHECK(boot == BOOTS, "%d boots", boot);
+	SIM_CHECK(drained, "samples left after the upload");
+	n = sim_esp_entries(&e);
+	SIM_CHECK(n == (size_t)taken_count, "%zu entries for %d samples", n, taken_count);
+	for (size_t i = 1; (i < n) && (n == (size_t)taken_count); i++) {
+		double sent = e[i].time - e[i - 1].time;
+		double real = (taken[i] - taken[i - 1]) / 1e9;
+		double lost = 0;					// Left out across a reset
+
+		if ((int)i % PER_BOOT == 0) {
+			lost = BOOT_SLACK / 1e9;
+		}
+		if ((int)i == 2 * PER_BOOT) {
+			lost += (cut_at[1] - taken[i - 1]) / 1e9;
+		}
+		SIM_CHECK((sent >= real - lost - 1) && (sent <= real + 1), "entry %zu: %.0f s after the last, taken %.1f s after",
+				i, sent, real);
+		if ((int)i % PER_BOOT == 0) {
+			printf("flashlog: delta_t %.0f s across the %s (%.1f s between the samples)\n", sent,
+					(i == PER_BOOT) ? "watchdog reset" : "power cut", real);
+		}
+	}
+
+	// Power loss: every cut recovered from, and the log intact after each
+	sim_init();
+	SIM_CHECK(sim_run(power_session, SIM_S(600)) == SIM_RETURNED, "power loss session did not finish");
+	SIM_CHECK(power_boot == NUM_CUTS + 1, "%d boots for %zu cuts", power_boot, NUM_CUTS);
+	SIM_CHECK(power_done, "no appends after the last cut");
+	SIM_CHECK(power_erases >= 2, "%u erases after the last cut", power_erases);
+	printf("flashlog: %d samples logged through %zu power cuts, %u acked\n", logged, NUM_CUTS, acked);
+
+	return sim_report("test_flashlog");
+}
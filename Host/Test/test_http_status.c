@@ -0,0 +1,150 @@
+/**
+ * @file	test_http_status.c
+ * @brief	Host scenario: ThingSpeak uploads against the server's HTTP answers
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The LM35 node's upload path, driven directly, against a server that
+ * accepts, rejects (401 for a wrong key, 400, 429, entry id "0") or does
+ * not know the channel (the firmware's placeholder CHANNEL_ID). Only an
+ * accepted upload may count as delivered and release its samples; every
+ * other one is retried RETRY_DELAY apart and given up on after
+ * TS_MAX_ATTEMPTS, with its samples kept.
+ */
+
+#include "sim.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include "Mod/usart1.h"
+#include "Mod/usart2.h"
+#include "Mod/flashlog.h"
+#include <stdio.h>
+#include <string.h>
+
+#define RETRY_DELAY		5000				// As in usart1.c
+#define TS_MAX_ATTEMPTS	5
+#define SAMPLES			10
+#define PLACEHOLDER		"0000000"			// CHANNEL_ID as shipped
+
+typedef struct {
+	const char* name;
+	sim_http_t http;
+	bool bulk;
+	bool accepted;							// The server takes it
+	uint32_t requests;						// It takes to get there
+} case_t;
+
+static const case_t cases[] = {
+	{ "GET 200", { .channel = PLACEHOLDER }, false, true, 1 },
+	{ "GET entry 0", { .channel = PLACEHOLDER, .entry_zero = true }, false, false, TS_MAX_ATTEMPTS },
+	{ "GET 401", { .channel = PLACEHOLDER, .write_key = "NOT-OUR-KEY" }, false, false, TS_MAX_ATTEMPTS },
+	{ "GET 429", { .channel = PLACEHOLDER, .status = 429 }, false, false, TS_MAX_ATTEMPTS },
+	{ "bulk 400", { .channel = PLACEHOLDER, .status = 400 }, true, false, TS_MAX_ATTEMPTS },
+	{ "bulk placeholder", { .channel = "1234567" }, true, false, TS_MAX_ATTEMPTS },
+	// Offline since the refusals, so the new samples join the refused ones in the flash log
+	{ "bulk 202", { .channel = PLACEHOLDER }, true, true, 1 },
+};
+
+#define NUM_CASES		(sizeof(cases) / sizeof(cases[0]))
+
+typedef struct {
+	bool finished;
+	bool success;							// "Data Transmission Success!"
+	uint32_t requests;
+	uint64_t ns;							// From the first request to the outcome
+	uint16_t pending_before, pending_after;
+} result_t;
+
+static result_t results[NUM_CASES];
+static bool joined, warned;
+
+static void session(void) {
+	Clock_Init();
+	TIM2_Init();
+	usart1_Init();
+	usart2_Init();
+	FlashLog_Init();
+	WiFi_Init();
+	joined = (strstr(sim_console(), "WiFi Initialization Success!") != NULL);
+	warned = (strstr(sim_console(), "CHANNEL_ID is not set") != NULL);
+
+	for (unsigned int i = 0; i < NUM_CASES; i++) {
+		const case_t* c = &cases[i];
+		result_t* r = &results[i];
+		uint32_t done = ThingSpeak_Completed();
+		uint32_t requests = sim_esp_stats()->requests;
+		uint64_t from = sim_now();
+
+		sim_http_t http = c->http;
+		http.rtt_ms = 200;
+		sim_esp_http(&http);
+		sim_console_clear();
+
+		if (c->bulk) {
+			for (int s = 0; s < SAMPLES; s++) {
+				ThingSpeak_AddSample(2500 + s, 4 | TS_FIELD_CENTI);
+			}
+			r->pending_before = ThingSpeak_Pending();
+			ThingSpeak_BulkUpload();
+		} else {
+			sendThingSpeak(25, 4);
+		}
+
+		// Until it is given up on, or (when taken) the backlog has drained too
+		while (((ThingSpeak_Completed() == done) || (c->accepted && ThingSpeak_Busy()))
+				&& (sim_now() - from < SIM_S(60))) {
+			ThingSpeak_Poll();
+			idle_until(now_us() + 1000);
+		}
+		r->finished = (ThingSpeak_Completed() != done);
+		r->success = (strstr(sim_console(), "Data Transmission Success!") != NULL);
+		r->requests = sim_esp_stats()->requests - requests;
+		r->ns = sim_now() - from;
+		r->pending_after = ThingSpeak_Pending();
+	}
+}
+
+
+int main(void) {
+	sim_init();
+
+	SIM_CHECK(sim_run(session, SIM_S(600)) == SIM_RETURNED, "session did not finish");
+	SIM_CHECK(joined, "no WiFi join");
+	SIM_CHECK(warned, "no warning about the placeholder CHANNEL_ID");
+
+	for (unsigned int i = 0; i < NUM_CASES; i++) {
+		const case_t* c = &cases[i];
+		const result_t* r = &results[i];
+
+		SIM_CHECK(r->finished, "%s: upload never completed", c->name);
+		if (c->accepted) {
+			SIM_CHECK(r->success, "%s: not reported delivered", c->name);
+			SIM_CHECK(r->requests == c->requests, "%s: %u requests", c->name, r->requests);
+			if (c->bulk) {
+				SIM_CHECK(r->pending_after == 0, "%s: %u samples left", c->name, r->pending_after);
+			}
+		} else {
+			// Refused: retried after backing off, then given up on with the samples kept
+			SIM_CHECK(!r->success, "%s: reported delivered", c->name);
+			SIM_CHECK(r->requests == c->requests, "%s: %u requests", c->name, r->requests);
+			SIM_CHECK(r->ns >= SIM_MS((TS_MAX_ATTEMPTS - 1) * RETRY_DELAY), "%s: gave up after %.1f s",
+					c->name, r->ns / 1e9);
+			if (c->bulk) {
+				SIM_CHECK(r->pending_after == r->pending_before, "%s: %u samples left of %u",
+						c->name, r->pending_after, r->pending_before);
+			}
+		}
+		printf("%-18s %s after %u request(s), %.1f s\n", c->name, r->success ? "delivered" : "refused",
+				r->requests, r->ns / 1e9);
+	}
+
+	// Everything refused earlier went up with the last bulk update
+	const sim_entry_rec_t* entries;
+	size_t n = sim_esp_entries(&entries);
+	SIM_CHECK(n == 1 + 3 * SAMPLES, "%zu entries on the server", n);
+
+	return sim_report("test_http_status");
+}
@@ -0,0 +1,108 @@
+/**
+ * @file	test_lm35.c
+ * @brief	Host scenario: the LM35 node from power-up through an alarm and an upload
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The room sits at 25 C, a fire takes it to 60 C from 40 s to 50 s, and
+ * the node runs for 130 s: long enough to join, show the reading, sound
+ * and clear the alarm, and make its first bulk upload at 100 s.
+ */
+
+#include "sim.h"
+#include <stdio.h>
+#include <string.h>
+
+#define FIRE_FROM		SIM_S(40)
+#define FIRE_TO			SIM_S(50)
+#define LATENCY_MAX_US	1000				// TIM3 update to buzzer write, all in the TIM3 interrupt
+#define BLOCK_US		25600				// An ADC block: 256 conversions at 10 kHz
+
+int firmware_main(void);
+
+static bool alarm_in_fire, alarm_after_fire;
+static char row0[17], row1[17];
+
+static double room(uint64_t now) {
+	return ((now >= FIRE_FROM) && (now < FIRE_TO)) ? 60.0 : 25.0;
+}
+
+
+static double lm35_mv(uint64_t now) {
+	return room(now) * 10.0;				// 10 mV per Celsius
+}
+
+
+static void look_in_fire(void* ctx) {
+	(void)ctx;
+	alarm_in_fire = sim_gpio_output(1, 1);
+}
+
+
+static void look_after_fire(void* ctx) {
+	(void)ctx;
+	alarm_after_fire = sim_gpio_output(1, 1);
+	strcpy(row0, sim_lcd_row(0));
+	strcpy(row1, sim_lcd_row(1));
+}
+
+
+static bool alarm_latency_us(long* data_us, long* tick_us) {
+	// The worst alarm latencies in the last report
+	const char* line = NULL;
+
+	for (const char* p = sim_console(); (p = strstr(p, "alarm latency (worst): ")) != NULL; p++) {
+		line = p;
+	}
+	return (line != NULL)
+			&& (sscanf(line, "alarm latency (worst): %ld us from the data, %ld us from the tick", data_us, tick_us) == 2);
+}
+
+
+static void boot(void) {
+	firmware_main();
+}
+
+
+int main(void) {
+	const sim_entry_rec_t* entries;
+	size_t n;
+	long data_us = -1, latency_us = -1;
+
+	sim_init();
+	sim_adc_source(1, lm35_mv);
+	sim_esp_http(&(sim_http_t){ .channel = "0000000" });
+	sim_at(FIRE_FROM + SIM_S(1), look_in_fire, NULL);
+	sim_at(FIRE_TO + SIM_S(5), look_after_fire, NULL);
+
+	SIM_CHECK(sim_run(boot, SIM_S(130)) == SIM_TIME_UP, "firmware_main() returned");
+
+	SIM_CHECK(strstr(sim_console(), "WiFi Initialization Success!") != NULL, "no WiFi join");
+	SIM_CHECK(sim_stats.resets[SIM_RESET_IWDG] == 0, "%u watchdog resets", sim_stats.resets[SIM_RESET_IWDG]);
+	SIM_CHECK(sim_lcd_violations() == 0, "%u LCD writes lost", sim_lcd_violations());
+	SIM_CHECK(strncmp(row0, "E. Temp:", 8) == 0, "LCD row 0 \"%s\"", row0);
+	SIM_CHECK(strncmp(row1, "25.", 3) == 0, "LCD row 1 \"%s\"", row1);
+	SIM_CHECK(alarm_in_fire, "no alarm at 60 C");
+	SIM_CHECK(!alarm_after_fire, "alarm still on at 25 C");
+	SIM_CHECK(sim_usart1_overruns() == 0, "%u USART1 overruns", sim_usart1_overruns());
+	SIM_CHECK(alarm_latency_us(&data_us, &latency_us), "no alarm latency report");
+	SIM_CHECK((latency_us >= 0) && (latency_us <= LATENCY_MAX_US), "alarm latency %ld us", latency_us);
+	// The block judged is complete, and no older than the one before the newest
+	SIM_CHECK((data_us >= BLOCK_US - 100) && (data_us <= 2 * BLOCK_US + LATENCY_MAX_US),
+			"alarm data %ld us old", data_us);
+
+	n = sim_esp_entries(&entries);
+	SIM_CHECK(n >= 90, "%zu entries uploaded", n);
+	for (size_t i = 0; i < n; i++) {
+		SIM_CHECK(entries[i].field == 4, "entry %zu in field %u", i, entries[i].field);
+		SIM_CHECK((entries[i].value > 24.5) && (entries[i].value < 60.5),
+				"entry %zu: %.2f C", i, entries[i].value);
+	}
+
+	printf("lm35: %zu entries, %u IRQs, alarm latency %ld us (data %ld us old), LCD \"%s\" / \"%s\"\n", n,
+			sim_stats.irqs, latency_us, data_us, row0, row1);
+	return sim_report("test_lm35");
+}
@@ -0,0 +1,85 @@
+/**
+ * @file	test_lm35_fixed.c
+ * @brief	Host unit test: LM35_GetVal()'s fixed-point conversion against
+ * 			the float formula it replaced
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * adc1.c is compiled into this file, so the last block's results
+ * (adc_value[], adc_vdda_mv) are set directly and LM35_GetVal() is called
+ * on them; the ADC itself is never started. Every ADC_BITS code is tried
+ * at VDDA from the part's 1.7 V to 3.6 V in 10 mV steps.
+ *
+ * The reference is the float build's: (adc × VDDA / 2^n) × 100 in double,
+ * returned as a float and taken to 0.01 Celsius with TS_CENTI(). Every
+ * reading must be within 0.01 Celsius of it; the ones that are not
+ * bit-identical are counted and printed. The fixed-point product must not
+ * wrap at the largest code and VDDA.
+ */
+
+#include "Mod/adc1.c"
+#include "Mod/usart1.h"						// TS_CENTI()
+#include "sim.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VDDA_MIN_MV		1700
+#define VDDA_MAX_MV		3600
+#define VDDA_STEP_MV	10
+
+// The clock, as far as adc1.c needs it; ADC_Init() is not called
+void delaymS(uint32_t ms) { (void)ms; }
+uint64_t now_us(void) { return 0; }
+
+
+static int32_t reference(uint32_t adc, uint32_t vdda_mv) {
+	// LM35_GetVal() as it was, with VDDA for 3.3
+	float temperature = ((adc * (vdda_mv / 1000.0)) / pow(2, ADC_BITS)) * 100;
+	return TS_CENTI(temperature);
+}
+
+
+int main(void) {
+	uint32_t readings = 0, differ = 0, worst = 0;
+	uint32_t at_3300 = 0;
+
+	_Static_assert((((1ULL << ADC_BITS) - 1) * VDDA_MAX_MV * 10 + (1ULL << (ADC_BITS - 1))) <= UINT32_MAX,
+			"LM35_GetVal()'s product wraps at 32 bits");
+
+	for (uint32_t vdda = VDDA_MIN_MV; vdda <= VDDA_MAX_MV; vdda += VDDA_STEP_MV) {
+		adc_vdda_mv = vdda;
+		for (uint32_t adc = 0; adc < (1UL << ADC_BITS); adc++) {
+			adc_value[LM35_SLOT] = (uint16_t)adc;
+			int32_t got = LM35_GetVal();
+			int32_t want = reference(adc, vdda);
+			uint32_t off = (uint32_t)abs(got - want);
+
+			if (off > worst) {
+				worst = off;
+			}
+			if (off != 0) {
+				differ++;
+				at_3300 += (vdda == ADC_VREF_MV) ? 1 : 0;
+			}
+			if (off > 1) {
+				SIM_CHECK(false, "code %u at %u mV: %d.%02d C, the float formula %d.%02d C", adc, vdda,
+						got / 100, got % 100, want / 100, want % 100);
+				return sim_report("test_lm35_fixed");
+			}
+			readings++;
+		}
+	}
+
+	adc_vdda_mv = VDDA_MAX_MV;
+	adc_value[LM35_SLOT] = (uint16_t)((1UL << ADC_BITS) - 1);
+	SIM_CHECK(LM35_GetVal() == reference((1UL << ADC_BITS) - 1, VDDA_MAX_MV), "full scale at %u mV: %d",
+			VDDA_MAX_MV, LM35_GetVal());
+
+	printf("lm35: %u readings, %u (%u at %u mV) off the float formula by %u.%02u C at most, the rest identical\n",
+			readings, differ, at_3300, ADC_VREF_MV, worst / 100, worst % 100);
+	return sim_report("test_lm35_fixed");
+}
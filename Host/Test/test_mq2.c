@@ -0,0 +1,90 @@
+/**
+ * @file	test_mq2.c
+ * @brief	Host scenario: the MQ2 node from power-up through an alarm and an upload
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The module (5 V, RL = 1 kOhm, R0 = 10 kOhm) sits in clean air, smoke
+ * takes Rs down to 0.8 R0 (thousands of ppm) from 40 s to 50 s, and the
+ * node runs for 140 s: through its 25 s warm-up, which seeds the clean-air
+ * baseline, an alarm, and its first bulk upload at 125 s.
+ */
+
+#include "sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FIRE_FROM		SIM_S(40)
+#define FIRE_TO			SIM_S(50)
+#define RL				1.0					// (kOhm)
+#define R0				10.0
+#define THRESHOLD		1000				// (ppm) As in main.c
+
+int firmware_main(void);
+
+static bool alarm_in_fire, alarm_after_fire;
+static char row0[17], row1[17];
+
+static double mq2_mv(uint64_t now) {
+	// AO = Vc x RL / (Rs + RL)
+	double rs = ((now >= FIRE_FROM) && (now < FIRE_TO)) ? (0.8 * R0) : (9.83 * R0);
+	return 5000.0 * RL / (rs + RL);
+}
+
+
+static void look_in_fire(void* ctx) {
+	(void)ctx;
+	alarm_in_fire = sim_gpio_output(1, 1);
+}
+
+
+static void look_after_fire(void* ctx) {
+	(void)ctx;
+	alarm_after_fire = sim_gpio_output(1, 1);
+	strcpy(row0, sim_lcd_row(0));
+	strcpy(row1, sim_lcd_row(1));
+}
+
+
+static void boot(void) {
+	firmware_main();
+}
+
+
+int main(void) {
+	const sim_entry_rec_t* entries;
+	size_t n;
+
+	sim_init();
+	sim_adc_source(1, mq2_mv);
+	sim_esp_http(&(sim_http_t){ .channel = "0000000" });
+	sim_at(FIRE_FROM + SIM_S(1), look_in_fire, NULL);
+	sim_at(FIRE_TO + SIM_S(5), look_after_fire, NULL);
+
+	SIM_CHECK(sim_run(boot, SIM_S(140)) == SIM_TIME_UP, "firmware_main() returned");
+
+	SIM_CHECK(strstr(sim_console(), "WiFi Initialization Success!") != NULL, "no WiFi join");
+	SIM_CHECK(sim_stats.resets[SIM_RESET_IWDG] == 0, "%u watchdog resets", sim_stats.resets[SIM_RESET_IWDG]);
+	SIM_CHECK(sim_lcd_violations() == 0, "%u LCD writes lost", sim_lcd_violations());
+	SIM_CHECK(strncmp(row0, "Smoke ppm:", 10) == 0, "LCD row 0 \"%s\"", row0);
+	SIM_CHECK(atoi(row1) < THRESHOLD, "LCD row 1 \"%s\"", row1);
+	SIM_CHECK(alarm_in_fire, "no alarm in smoke");
+	SIM_CHECK(!alarm_after_fire, "alarm still on in clean air");
+	SIM_CHECK(sim_usart1_overruns() == 0, "%u USART1 overruns", sim_usart1_overruns());
+
+	n = sim_esp_entries(&entries);
+	SIM_CHECK(n >= 90, "%zu entries uploaded", n);
+	size_t smoky = 0;
+	for (size_t i = 0; i < n; i++) {
+		SIM_CHECK(entries[i].field == 1, "entry %zu in field %u", i, entries[i].field);
+		smoky += (entries[i].value >= THRESHOLD);
+	}
+	SIM_CHECK((smoky >= 9) && (smoky <= 11), "%zu of %zu entries in smoke", smoky, n);
+
+	printf("mq2: %zu entries, %u IRQs, LCD \"%s\" / \"%s\"\n", n, sim_stats.irqs, row0, row1);
+	return sim_report("test_mq2");
+}
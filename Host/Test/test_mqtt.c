@@ -0,0 +1,196 @@
+/**
+ * @file	test_mqtt.c
+ * @brief	Host scenario: ThingSpeak uploads over MQTT against the broker,
+ * 			and against HTTP GETs
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * The LM35 node's upload path built with TS_USE_MQTT, driven directly.
+ * Samples are published one after the other for PHASE_MS, at QoS 0 as
+ * shipped. Then the same values go up as the default build sends them:
+ * HTTP GETs on a kept-alive link, written out here as usart1.c formats
+ * them, on a link of their own. Each way reports messages per second and
+ * bytes per sample on the TCP link (out and back) and on the UART to the
+ * ESP (AT commands included).
+ *
+ * Last, the broker stops answering. "SEND OK" only means the ESP took the
+ * PUBLISH; without the PINGRESP that follows it, a QoS 0 publish must not
+ * count as delivered.
+ */
+
+#include "sim.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include "Mod/usart1.h"
+#include "Mod/usart2.h"
+#include "Mod/esp_at.h"
+#include "Mod/mqtt.h"
+#include <stdio.h>
+#include <string.h>
+
+#define PHASE_MS		60000
+#define RTT_MS			200
+#define HTTP_LINK		1					// TS_LINK_ID is the MQTT session's
+#define HTTP_KEY		"XXXXXXXXXXXXXXXX"	// As long as WRITE_API
+
+typedef struct {
+	uint64_t from, to;
+	size_t entries;
+	uint64_t link_out, link_in, uart;		// (bytes)
+} tally_t;
+
+static tally_t mqtt, http;
+static bool joined, http_open;
+static bool silent_done, silent_success;
+static uint64_t http_in;					// Bytes the AT engine handed over on HTTP_LINK
+
+static size_t entries_now(void) {
+	const sim_entry_rec_t* e;
+	return sim_esp_entries(&e);
+}
+
+
+static void tally_start(tally_t* t) {
+	const sim_esp_stats_t* s = sim_esp_stats();
+
+	t->from = sim_now();
+	t->entries = entries_now();
+	t->link_out = s->payload_bytes;
+	t->link_in = s->link_in_bytes;
+	t->uart = s->uart_bytes;
+}
+
+
+static void tally_end(tally_t* t) {
+	const sim_esp_stats_t* s = sim_esp_stats();
+
+	t->to = sim_now();
+	t->entries = entries_now() - t->entries;
+	t->link_out = s->payload_bytes - t->link_out;
+	t->link_in = s->link_in_bytes - t->link_in;
+	t->uart = s->uart_bytes - t->uart;
+}
+
+
+static void on_data(uint8_t link, uint8_t c) {
+	// The MQTT session keeps its link; the HTTP answers are only counted
+	if (link == HTTP_LINK) {
+		http_in++;
+	} else {
+		MQTT_OnData(link, c);
+	}
+}
+
+
+static void http_upload(int val) {
+	// sendThingSpeak() in the default build; data is static, as the TX DMA only takes 32-bit addresses
+	static char data[200];
+	char cmd[40];
+	int len = snprintf(data, sizeof(data), "GET /update?api_key=%s&field%d=%d HTTP/1.1\r\n"
+			"Host: api.thingspeak.com\r\n"
+			"Connection: keep-alive\r\n\r\n", HTTP_KEY, 1, val);
+	uint64_t in = sim_esp_stats()->link_in_bytes;
+	uint64_t from = sim_now();
+
+	snprintf(cmd, sizeof(cmd), "AT+CIPSEND=%d,%d\r\n", HTTP_LINK, len);
+	if ((AT_Command(cmd, AT_EXPECT_PROMPT, 1000) != AT_OK)
+			|| !AT_SubmitData(data, len, AT_EXPECT_SEND_OK, 5000, NULL, NULL)) {
+		ThingSpeak_PollFor(1000);
+		return;
+	}
+
+	// Until the whole answer has reached the AT engine
+	while (((sim_esp_stats()->link_in_bytes == in) || (http_in < sim_esp_stats()->link_in_bytes - in))
+			&& (sim_now() - from < SIM_S(10))) {
+		ThingSpeak_Poll();
+		idle_until(now_us() + 1000);
+	}
+	http_in = 0;
+}
+
+
+static void session(void) {
+	int val = 0;
+
+	Clock_Init();
+	TIM2_Init();
+	usart1_Init();
+	usart2_Init();
+	WiFi_Init();
+	joined = (strstr(sim_console(), "WiFi Initialization Success!") != NULL);
+
+	// MQTT, as the node uploads with TS_USE_MQTT
+	tally_start(&mqtt);
+	while (sim_now() - mqtt.from < SIM_MS(PHASE_MS)) {
+		if (!ThingSpeak_Busy()) {
+			sendThingSpeak(++val, 1);
+		}
+		ThingSpeak_Poll();
+		idle_until(now_us() + 1000);
+	}
+	while (ThingSpeak_Busy()) {
+		ThingSpeak_PollFor(10);
+	}
+	tally_end(&mqtt);
+
+	// HTTP GETs, as the node uploads by default
+	AT_SetDataHandler(on_data);
+	http_open = (AT_Command("AT+CIPSTART=1,\"TCP\",\"api.thingspeak.com\",80\r\n", AT_EXPECT_OK, 10000)
+			== AT_OK);
+	tally_start(&http);
+	while (http_open && (sim_now() - http.from < SIM_MS(PHASE_MS))) {
+		http_upload(++val);
+	}
+	tally_end(&http);
+
+	// The broker goes quiet; the publish still gets its "SEND OK"
+	uint32_t done = ThingSpeak_Completed();
+	uint64_t from = sim_now();
+
+	sim_esp_broker(&(sim_broker_t){ .silent = true });
+	sim_console_clear();
+	sendThingSpeak(++val, 1);
+	while ((ThingSpeak_Completed() == done) && (sim_now() - from < SIM_S(300))) {
+		ThingSpeak_PollFor(10);
+	}
+	silent_done = (ThingSpeak_Completed() != done);
+	silent_success = (strstr(sim_console(), "Data Transmission Success!") != NULL);
+}
+
+
+static void report(const char* name, const tally_t* t) {
+	double s = (t->to - t->from) / 1e9;
+	size_t n = (t->entries > 0) ? t->entries : 1;
+
+	printf("mqtt: %-4s %5.2f msgs/s, per sample %5.1f B out + %5.1f B back on the link, %5.1f B on the UART\n",
+			name, t->entries / s, (double)t->link_out / n, (double)t->link_in / n, (double)t->uart / n);
+}
+
+
+int main(void) {
+	sim_init();
+	sim_esp_http(&(sim_http_t){ .channel = "0000000", .rtt_ms = RTT_MS });	// CHANNEL_ID as shipped
+
+	SIM_CHECK(sim_run(session, SIM_S(600)) == SIM_RETURNED, "session did not finish");
+	SIM_CHECK(joined, "no WiFi join");
+
+	SIM_CHECK(mqtt.entries > 0, "nothing published");
+	SIM_CHECK(sim_esp_stats()->publishes >= mqtt.entries, "%u publishes for %zu entries",
+			sim_esp_stats()->publishes, mqtt.entries);
+	SIM_CHECK(http_open, "no HTTP link");
+	SIM_CHECK(http.entries > 0, "no HTTP GETs taken");
+	if ((mqtt.entries > 0) && (http.entries > 0)) {
+		SIM_CHECK((mqtt.link_out + mqtt.link_in) * http.entries < (http.link_out + http.link_in) * mqtt.entries,
+				"MQTT takes no fewer bytes per sample than HTTP");
+	}
+
+	SIM_CHECK(silent_done, "publish to the silent broker never completed");
+	SIM_CHECK(!silent_success, "publish to the silent broker reported delivered");
+
+	report("MQTT", &mqtt);
+	report("HTTP", &http);
+	return sim_report("test_mqtt");
+}
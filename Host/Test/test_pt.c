@@ -0,0 +1,199 @@
+/**
+ * @file	test_pt.c
+ * @brief	Host unit test: protothreads and a driver's resumable operation,
+ * 			stepped on a fake clock
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * Mod/pt.h's threads are stepped by hand on fake_clock.h's clock, with no
+ * simulator: two delay loops interleaved in one loop must each wake on
+ * their own deadlines and at no other time, PT_YIELD() must hand back once,
+ * and a parent must wait out a PT_SPAWN()ed child.
+ *
+ * esp_at.c is compiled into this file, with the USART stubbed out by a
+ * script of timed bytes from the ESP, so AT_CommandPT() is stepped too: it
+ * must time out at its timeout when nothing comes back, and complete on
+ * the step after the answer's last byte when it does.
+ */
+
+#include "Mod/esp_at.c"
+#include "sim.h"
+#include "fake_clock.h"
+#include <stdio.h>
+
+#define WAKES			12
+
+typedef struct {
+	pt_t pt;
+	uint32_t period_ms;
+	uint64_t woke[WAKES];
+	int wakes;
+} blink_t;
+
+typedef struct {
+	uint64_t at_us;							// Available to usart1_rx_read() from then on
+	const char* text;
+} rx_chunk_t;
+
+static const rx_chunk_t* rx_script;
+static size_t rx_chunk, rx_pos;
+static char tx_sent[AT_RESP_MAX];
+
+// The USART, as far as esp_at.c needs it
+bool usart1_tx_busy(void) { return false; }
+
+
+bool usart1_tx_start(const void* buf, uint16_t len) {
+	snprintf(tx_sent, sizeof(tx_sent), "%.*s", (int)len, (const char*)buf);
+	return true;
+}
+
+
+bool usart1_rx_read(uint8_t* c) {
+	while ((rx_script != NULL) && (rx_script[rx_chunk].text != NULL) && (rx_script[rx_chunk].at_us <= fake_us)) {
+		const rx_chunk_t* k = &rx_script[rx_chunk];
+		if (k->text[rx_pos] != '\0') {
+			*c = k->text[rx_pos++];
+			return true;
+		}
+		rx_chunk++;
+		rx_pos = 0;
+	}
+	return false;
+}
+
+
+static int blink(blink_t* b) {
+	PT_BEGIN(&b->pt);
+	while (b->wakes < WAKES) {
+		PT_DELAY_MS(&b->pt, b->period_ms);
+		b->woke[b->wakes++] = now_us();
+	}
+	PT_END(&b->pt);
+}
+
+
+static int yielder(pt_t* pt, int* count) {
+	PT_BEGIN(pt);
+	(*count)++;
+	PT_YIELD(pt);
+	(*count)++;
+	PT_END(pt);
+}
+
+
+static int child(pt_t* pt) {
+	PT_BEGIN(pt);
+	PT_DELAY_MS(pt, 10);
+	PT_DELAY_MS(pt, 10);
+	PT_END(pt);
+}
+
+
+static int parent(pt_t* pt, pt_t* sub, uint64_t* done_at) {
+	PT_BEGIN(pt);
+	PT_SPAWN(pt, sub, child(sub));
+	*done_at = now_us();
+	PT_END(pt);
+}
+
+
+static void test_interleave(void) {
+	// Two delay loops stepped in one loop, sleeping to the nearer deadline
+	blink_t a = { .period_ms = 3 }, b = { .period_ms = 5 };
+	uint32_t steps = 0;
+	int ra, rb;
+
+	fake_us = 0;
+	PT_INIT(&a.pt);
+	PT_INIT(&b.pt);
+	do {
+		ra = blink(&a);
+		rb = blink(&b);
+		steps++;
+		uint64_t next = UINT64_MAX;
+		if (PT_SCHEDULE(ra)) {
+			next = a.pt.until;
+		}
+		if (PT_SCHEDULE(rb) && (b.pt.until < next)) {
+			next = b.pt.until;
+		}
+		if (next != UINT64_MAX) {
+			fake_wait(next);
+		}
+	} while (PT_SCHEDULE(ra) || PT_SCHEDULE(rb));
+
+	for (int i = 0; i < WAKES; i++) {
+		SIM_CHECK(a.woke[i] == (uint64_t)(i + 1) * 3000, "a woke at %.3f ms, wake %d", a.woke[i] / 1e3, i);
+		SIM_CHECK(b.woke[i] == (uint64_t)(i + 1) * 5000, "b woke at %.3f ms, wake %d", b.woke[i] / 1e3, i);
+	}
+	// Once at the start, then once per distinct deadline: 3, 5, 6, 9, 10, 12, 15...
+	uint32_t deadlines = 0;
+	for (uint32_t t = 1; t <= WAKES * 5; t++) {
+		deadlines += (((t % 3 == 0) && (t <= WAKES * 3)) || (t % 5 == 0)) ? 1 : 0;
+	}
+	SIM_CHECK(steps == deadlines + 1, "%u steps for %u deadlines", steps, deadlines);
+	printf("pt: two threads, %d wakes each, in %u steps\n", WAKES, steps);
+}
+
+
+static void test_yield_spawn(void) {
+	pt_t pt, sub;
+	int count = 0;
+	uint64_t done_at = 0;
+	uint32_t steps;
+
+	fake_us = 0;
+	PT_INIT(&pt);
+	SIM_CHECK(yielder(&pt, &count) == PT_YIELDED, "no PT_YIELDED");
+	SIM_CHECK(count == 1, "%d before the yield", count);
+	SIM_CHECK(yielder(&pt, &count) == PT_ENDED, "not ended after the yield");
+	SIM_CHECK(count == 2, "%d after the yield", count);
+
+	// The parent's pt_t does not carry its child's deadline: its caller polls by the tick
+	FAKE_RUN(&pt, parent(&pt, &sub, &done_at), steps);
+	SIM_CHECK(done_at == 20000, "parent resumed at %.3f ms", done_at / 1e3);
+	SIM_CHECK(steps == 20000 / FAKE_TICK_US + 1, "%u steps through two child delays", steps);
+}
+
+
+static void test_at_command(void) {
+	// AT_CommandPT(): a timeout with nothing back, then an answer in two parts
+	static const rx_chunk_t answer[] = {
+		{ 2000, "AT\r\r\n" },
+		{ 5000, "\r\nOK\r\n" },
+		{ 0, NULL },
+	};
+	volatile at_status_t status;
+	pt_t pt;
+	uint32_t steps;
+
+	AT_Init(NULL);
+	fake_us = 0;
+	rx_script = NULL;
+	FAKE_RUN(&pt, AT_CommandPT(&pt, "AT\r\n", AT_EXPECT_OK, 1000, &status), steps);
+	SIM_CHECK(status == AT_TIMEOUT, "status %d with no answer", status);
+	SIM_CHECK((fake_us >= 1000000) && (fake_us <= 1000000 + FAKE_TICK_US), "timed out at %.3f ms",
+			fake_us / 1e3);
+	SIM_CHECK(strcmp(tx_sent, "AT\r\n") == 0, "sent \"%s\"", tx_sent);
+
+	fake_us = 0;
+	rx_script = answer;
+	rx_chunk = rx_pos = 0;
+	FAKE_RUN(&pt, AT_CommandPT(&pt, "AT\r\n", AT_EXPECT_OK, 1000, &status), steps);
+	SIM_CHECK(status == AT_OK, "status %d with an answer", status);
+	SIM_CHECK(fake_us == 5000, "completed at %.3f ms", fake_us / 1e3);
+	SIM_CHECK(steps == 6, "%u steps to the answer", steps);
+	printf("pt: AT_CommandPT() answered at %.3f ms after %u steps\n", fake_us / 1e3, steps);
+}
+
+
+int main(void) {
+	test_interleave();
+	test_yield_spawn();
+	test_at_command();
+	return sim_report("test_pt");
+}
@@ -0,0 +1,59 @@
+/**
+ * @file	test_timing.c
+ * @brief	Host scenario: the TIM2 microsecond clock against virtual time
+ *
+ * @author	FUV1 project contributors (see the git history)
+ * @date	16 October 2026
+ */
+
+/*
+ * delaymS() sleeps through TIM2 compare interrupts, so a 100 s delay
+ * takes a handful of sync points rather than 100 s; short delays spin and
+ * must still land on the microsecond.
+ */
+
+#include "sim.h"
+#include "Mod/clock.h"
+#include "Mod/timing.h"
+#include <stdio.h>
+#include <time.h>
+
+static uint64_t t_long, t_short, clock_long, clock_short;
+
+static void delays(void) {
+	Clock_Init();
+	TIM2_Init();
+
+	uint64_t from = sim_now(), us = now_us();
+	delaymS(100000);
+	t_long = sim_now() - from;
+	clock_long = now_us() - us;
+
+	from = sim_now();
+	us = now_us();
+	delayuS(20);
+	t_short = sim_now() - from;
+	clock_short = now_us() - us;
+}
+
+
+int main(void) {
+	struct timespec a, b;
+
+	sim_init();
+	clock_gettime(CLOCK_MONOTONIC, &a);
+	SIM_CHECK(sim_run(delays, SIM_S(200)) == SIM_RETURNED, "delays did not finish");
+	clock_gettime(CLOCK_MONOTONIC, &b);
+
+	double wall = (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+	SIM_CHECK((t_long >= SIM_S(100)) && (t_long < SIM_S(100) + SIM_US(50)), "delaymS(100000) took %llu ns",
+			(unsigned long long)t_long);
+	SIM_CHECK(clock_long >= 100000000, "now_us() moved %llu us", (unsigned long long)clock_long);
+	SIM_CHECK((t_short >= SIM_US(20)) && (t_short <= SIM_US(22)), "delayuS(20) took %llu ns",
+			(unsigned long long)t_short);
+	SIM_CHECK(clock_short >= 20, "now_us() moved %llu us", (unsigned long long)clock_short);
+	SIM_CHECK(wall < 0.5, "%.3f s of wall time", wall);
+
+	printf("timing: delaymS(100000) in %.6f s of wall time, %u IRQs\n", wall, sim_stats.irqs);
+	return sim_report("test_timing");
+}